@@ -6,9 +6,9 @@
 #include <sstream>
 #include <stdexcept>
 #include <unordered_map>
-#include <map>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cassert>
 #include <iostream>
 #include <algorithm>
@@ -290,7 +290,7 @@ public:
                         auto& ii = identifier_info(l);
                         if (ii.has_value)
                             ASSEMBLER_ERROR("Redefinition of " << ii.id);
-                        else if (!ii.fixups.empty())
+                        else if (ii.referenced)
                             ASSEMBLER_ERROR("Invalid definition for " << ii.id << " (previously referenced)");
                         ii.has_value = true;
                         auto val = process_number();
@@ -304,7 +304,7 @@ public:
                         auto& ii = identifier_info(l);
                         if (ii.has_value)
                             ASSEMBLER_ERROR("Redefinition of " << ii.id);
-                        else if (!ii.fixups.empty())
+                        else if (ii.referenced)
                             ASSEMBLER_ERROR("Invalid definition for " << ii.id << " (previously referenced)");
                         ii.has_value = true;
                         ii.value = process_rs();
@@ -323,15 +323,6 @@ public:
                     last_global_ = ii.id;
                 ii.has_value = true;
                 ii.value = pc_;
-                for (const auto& f : ii.fixups) {
-                    auto it = pending_fixups_.find(f.offset);
-                    if (it == pending_fixups_.end())
-                        ASSEMBLER_ERROR("Invalid fixup for " << ii.id);
-                    if (it->second.size != f.size)
-                        ASSEMBLER_ERROR("Size mismatch for " << ii.id << " expected size " << opsize_bytes(it->second.size) << " got " << opsize_bytes(f.size));
-                    it->second.value += f.negate ? -static_cast<int32_t>(ii.value) : ii.value;
-                }
-                ii.fixups.clear();
             } else if (is_instruction(token_type_)) {
                 // Strictly legal, but 99.99% of the time not what's wanted
                 if (pc_ & 1)
@@ -404,13 +395,19 @@ public:
         } while (token_type_ != token_type::eof);
 
         for (const auto& i : identifier_info_) {
-            if (!i->has_value || !i->fixups.empty()) {
+            if (!i->has_value) {
                 ASSEMBLER_ERROR(i->id << " referenced but not defined");
             }
         }
 
-        // Apply fixups. Delayed until here to allow full 32-bit intermediate values.
-        for (const auto& [offset, f] : pending_fixups_) {
+        // Apply fixups in one pass now that all identifiers have values.
+        // Delayed until here to allow full 32-bit intermediate values.
+        for (auto& f : pending_fixups_) {
+            const auto offset = f.offset;
+            for (uint32_t i = 0; i < f.num_terms; ++i) {
+                const auto& [ii, negate] = fixup_terms_[f.first_term + i];
+                f.value += negate ? -static_cast<int32_t>(ii->value) : ii->value;
+            }
             //std::cout << "Applying fixup offset=$" << hexfmt(offset) << " " << token_type_string(f.inst) << " line " << f.line << " value $" << hexfmt(f.value) << "\n";
             switch (f.size) {
             case opsize::none:
@@ -442,35 +439,48 @@ public:
     }
 
 private:
-    std::unordered_map<std::string, token_type> id_map_ = {
-        #define INST_ID_INIT(n, m, d, no) { #n, token_type::n },
-        INSTRUCTIONS(INST_ID_INIT)
-        #undef INST_ID_INIT
-        #define TOKEN_ID_INIT(n, t) { t, token_type::n },
-        TOKENS(TOKEN_ID_INIT)
-        #undef TOKEN_ID_INIT
-        // Synonyms
-        { "SP", token_type::a7 },
+    static const std::unordered_map<std::string_view, token_type>& keywords()
+    {
+        static const std::unordered_map<std::string_view, token_type> keywords = {
+            #define INST_ID_INIT(n, m, d, no) { #n, token_type::n },
+            INSTRUCTIONS(INST_ID_INIT)
+            #undef INST_ID_INIT
+            #define TOKEN_ID_INIT(n, t) { t, token_type::n },
+            TOKENS(TOKEN_ID_INIT)
+            #undef TOKEN_ID_INIT
+            // Synonyms
+            { "SP", token_type::a7 },
+        };
+        return keywords;
+    }
+
+    // Transparent hashing so symbols can be looked up without constructing a std::string
+    struct string_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const
+        {
+            return std::hash<std::string_view> {}(s);
+        }
     };
 
-    struct fixup_type {
-        opsize size;
-        bool negate;
-        uint32_t offset;
+    struct identifier_info_type {
+        std::string id;
+        bool has_value;
+        bool referenced; // Used before being defined
+        uint32_t value;
     };
 
+    // Identifier and whether it's subtracted
+    using fixup_term = std::pair<identifier_info_type*, bool>;
+
     struct pending_fixup {
+        uint32_t offset;
         token_type inst;
         uint32_t line;
         opsize size;
         uint32_t value;
-    };
-
-    struct identifier_info_type {
-        std::string id;
-        bool has_value;
-        uint32_t value;
-        std::vector<fixup_type> fixups;
+        uint32_t first_term; // Index into fixup_terms_
+        uint32_t num_terms;
     };
 
     struct cond_state {
@@ -482,8 +492,11 @@ private:
         uint8_t state;
     };
 
+    std::unordered_map<std::string, token_type, string_hash, std::equal_to<>> symbols_;
     std::vector<std::unique_ptr<identifier_info_type>> identifier_info_;
-    std::map<uint32_t, pending_fixup> pending_fixups_;
+    std::vector<pending_fixup> pending_fixups_;
+    std::vector<fixup_term> fixup_terms_;
+    std::vector<bool> has_fixup_; // Indexed by result offset
 
     std::vector<uint8_t> result_;
     uint32_t pc_;
@@ -495,6 +508,7 @@ private:
     token_type token_type_ = token_type::eof;
     std::string token_text_;
     uint32_t token_number_ = 0;
+    std::string id_buf_; // Scratch buffer for make_identifier
 
     uint32_t rs_value_ = 0; // TODO: In vasm this value can be referenced as __RS
 
@@ -573,30 +587,34 @@ private:
         }
     }
 
-    token_type make_identifier(const char* text)
+    token_type make_identifier(std::string_view text)
     {
-        std::string uc = toupper_str(text);
+        id_buf_.clear();
+        for (const char c : text)
+            id_buf_.push_back(c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c);
 
-        if (auto it = id_map_.find(uc); it != id_map_.end())
+        if (auto it = keywords().find(id_buf_); it != keywords().end())
+            return it->second;
+        if (auto it = symbols_.find(id_buf_); it != symbols_.end())
             return it->second;
 
         // Don't define new identifiers in disabled block
         if (in_disabled_block())
             return token_type::whitespace; // Hmm...
 
-        if (uc[0] == '.') {
+        if (id_buf_[0] == '.') {
             if (last_global_.empty())
                 ASSEMBLER_ERROR("Local label outside function");
-            uc = last_global_ + uc;
+            id_buf_.insert(0, last_global_);
             // Lookup again
-            if (auto it = id_map_.find(uc); it != id_map_.end())
+            if (auto it = symbols_.find(id_buf_); it != symbols_.end())
                 return it->second;
         }
 
         const uint32_t id = static_cast<uint32_t>(identifier_info_.size()) + static_cast<uint32_t>(token_type::identifier_start);
-        id_map_[uc] = static_cast<token_type>(id);
+        symbols_.emplace(id_buf_, static_cast<token_type>(id));
         auto ii = std::make_unique<identifier_info_type>();
-        ii->id = std::move(uc);
+        ii->id = id_buf_;
         identifier_info_.push_back(std::move(ii));
         return static_cast<token_type>(id);
     }
@@ -751,7 +769,7 @@ private:
                 ++col_;
             }
 
-            token_type_ = make_identifier(token_text_.c_str());
+            token_type_ = make_identifier(token_text_);
             return;
         }
 
@@ -801,7 +819,7 @@ private:
         uint8_t type;
         uint32_t val = 0;
         uint32_t saved_val = 0;
-        std::vector<std::pair<identifier_info_type*,bool>> fixups;
+        std::vector<fixup_term> fixups;
 
         bool has_fixups() const
         {
@@ -814,12 +832,17 @@ private:
         if (r.fixups.empty())
             return;
 
-        if (!pending_fixups_.insert({ offset, pending_fixup { inst, line_, osize, r.saved_val } }).second)
+        if (offset >= has_fixup_.size())
+            has_fixup_.resize(std::max<size_t>(offset + 1, has_fixup_.size() * 2));
+        if (has_fixup_[offset])
             ASSEMBLER_ERROR("Fixups already exist");
-
+        has_fixup_[offset] = true;
         assert(!!(offset & 1) == (osize == opsize::b));
-        for (auto [ii, negate] : r.fixups)
-            ii->fixups.push_back(fixup_type { osize, negate, offset });
+        pending_fixups_.push_back(pending_fixup { offset, inst, line_, osize, r.saved_val, static_cast<uint32_t>(fixup_terms_.size()), static_cast<uint32_t>(r.fixups.size()) });
+        for (const auto& t : r.fixups) {
+            t.first->referenced = true;
+            fixup_terms_.push_back(t);
+        }
     }
 
     void convert_string_to_number()
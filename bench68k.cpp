@@ -0,0 +1,305 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+
+#include "ioutil.h"
+#include "cpu.h"
+#include "memory.h"
+#include "asm.h"
+
+namespace {
+
+constexpr uint32_t ram_size    = 1 << 20;
+constexpr uint32_t code_pos    = 0x1000;
+constexpr uint32_t rts_pos     = 0x0f00;  // A4
+constexpr uint32_t data_pos    = 0x20000; // A2 (fixed), $2000.w is used for absolute word addressing
+constexpr uint32_t postinc_pos = 0x40000; // A0
+constexpr uint32_t predec_pos  = 0xc0000; // A1
+constexpr uint32_t stack_pos   = 0xff000;
+constexpr uint32_t iterations  = 4096; // Loop count for one run (A0/A1 move at most 32 bytes per iteration)
+constexpr int body_repeat      = 8;    // Copies of the body in the loop to amortize the DBF
+
+// The body is repeated in the loop, '@' is replaced by the copy number to allow local labels.
+// D1=1, D2=3, D3=$12345678, D6=0 and A2 points to a zeroed data area.
+struct bench_case {
+    const char* name;
+    const char* body;
+};
+
+const bench_case bench_cases[] = {
+    // Data movement
+    { "moveq",              "moveq #1,d0" },
+    { "move.l Dn,Dn",       "move.l d1,d0" },
+    { "move.w #imm,Dn",     "move.w #$1234,d0" },
+    { "move.w (An),Dn",     "move.w (a2),d0" },
+    { "move.w Dn,(An)",     "move.w d0,(a2)" },
+    { "move.l (An)+,Dn",    "move.l (a0)+,d0" },
+    { "move.l Dn,-(An)",    "move.l d0,-(a1)" },
+    { "move.w d16(An),Dn",  "move.w 8(a2),d0" },
+    { "move.w d8(An,Xn),Dn","move.w 4(a2,d6.w),d0" },
+    { "move.w abs.w,Dn",    "move.w $2000.w,d0" },
+    { "move.l abs.l,Dn",    "move.l $20000,d0" },
+    { "move.l (An),(An)",   "move.l (a2),4(a2)" },
+    { "movem.l regs,(An)",  "movem.l d0-d3,(a2)" },
+    { "movem.l (An),regs",  "movem.l (a2),d0/d2-d4" },
+    { "lea d16(An),An",     "lea 4(a2),a3" },
+    { "pea/addq",           "pea (a2)\naddq.l #4,sp" },
+    { "clr.l Dn",           "clr.l d0" },
+    { "swap",               "swap d0" },
+    { "exg",                "exg d0,d4" },
+    { "ext.l",              "ext.l d0" },
+    // Arithmetic
+    { "add.l Dn,Dn",        "add.l d1,d0" },
+    { "add.w (An),Dn",      "add.w (a2),d0" },
+    { "add.w Dn,(An)",      "add.w d1,(a2)" },
+    { "addi.l #imm,Dn",     "add.l #$12345678,d0" },
+    { "addq.w #imm,Dn",     "addq.w #1,d0" },
+    { "adda.l Dn,An",       "add.l d1,a3" },
+    { "addx.l",             "addx.l d1,d0" },
+    { "sub.w Dn,Dn",        "sub.w d1,d0" },
+    { "neg.l",              "neg.l d0" },
+    { "cmp.w Dn,Dn",        "cmp.w d1,d0" },
+    { "cmpi.w #imm,(An)",   "cmp.w #5,(a2)" },
+    { "tst.w (An)",         "tst.w (a2)" },
+    { "mulu.w",             "mulu.w d3,d0" },
+    { "muls.w",             "muls.w d3,d0" },
+    { "divu.w",             "move.l d3,d0\ndivu.w #$4000,d0" },
+    { "divs.w",             "move.l d3,d0\ndivs.w #$4000,d0" },
+    { "abcd",               "abcd d1,d0" },
+    // Logical
+    { "and.l Dn,Dn",        "and.l d3,d0" },
+    { "or.w (An),Dn",       "or.w (a2),d0" },
+    { "eor.l Dn,Dn",        "eor.l d3,d0" },
+    { "not.l",              "not.l d0" },
+    // Shifts and bit operations
+    { "lsl.l #imm,Dn",      "lsl.l #2,d0" },
+    { "asr.w Dn,Dn",        "asr.w d2,d0" },
+    { "rol.l #imm,Dn",      "rol.l #8,d0" },
+    { "roxr.w #imm,Dn",     "roxr.w #1,d0" },
+    { "lsl.w (An)",         "lsl.w (a2)" },
+    { "btst #imm,Dn",       "btst #3,d0" },
+    { "bset Dn,(An)",       "bset d1,(a2)" },
+    { "bclr #imm,Dn",       "bclr #3,d0" },
+    // Program control
+    { "nop",                "nop" },
+    { "bra.s",              "bra.s l@\nnop\nl@:" },
+    { "bne.s taken",        "bne.s l@\nnop\nl@:" },
+    { "beq.s not taken",    "beq.s l@\nnop\nl@:" },
+    { "scc",                "sne d0" },
+    { "jsr/rts",            "jsr (a4)" },
+};
+
+struct bench_result {
+    uint64_t instructions;
+    uint64_t cycles;
+    double ns;
+
+    double ns_per_instruction() const
+    {
+        return ns / static_cast<double>(instructions);
+    }
+
+    double ns_per_cycle() const
+    {
+        return ns / static_cast<double>(cycles);
+    }
+};
+
+cpu_state initial_state()
+{
+    cpu_state st {};
+    st.d[1] = 1;
+    st.d[2] = 3;
+    st.d[3] = 0x12345678;
+    st.d[7] = iterations - 1;
+    st.a[0] = postinc_pos;
+    st.a[1] = predec_pos;
+    st.a[2] = data_pos;
+    st.a[4] = rts_pos;
+    st.ssp = stack_pos;
+    st.sr = srm_s | srm_ipl;
+    st.pc = code_pos;
+    st.prefetch_address = invalid_prefetch_address;
+    return st;
+}
+
+// Run the loop once, returns number of instructions executed
+uint64_t run_loop(memory_handler& mem, uint32_t end_pc, const m68000::cycle_handler& cycle_handler)
+{
+    memset(&mem.ram()[data_pos], 0, 0x100);
+    m68000 cpu { mem, initial_state() };
+    cpu.set_cycle_handler(cycle_handler);
+    while (cpu.state().pc != end_pc)
+        cpu.step();
+    return cpu.state().instruction_count;
+}
+
+bench_result run_case(const bench_case& bc, double min_ns)
+{
+    std::string code = "loop:\n";
+    for (int i = 0; i < body_repeat; ++i) {
+        std::string body = bc.body;
+        for (size_t pos; (pos = body.find('@')) != std::string::npos;)
+            body.replace(pos, 1, std::to_string(i));
+        code += body + "\n";
+    }
+    code += "dbf d7,loop\n";
+
+    const auto bytes = assemble(code_pos, code.c_str());
+    const uint32_t end_pc = code_pos + static_cast<uint32_t>(bytes.size());
+    auto setup_memory = [&](memory_handler& mem) {
+        auto& ram = mem.ram();
+        memcpy(&ram[code_pos], bytes.data(), bytes.size());
+        put_u16(&ram[rts_pos], 0x4e75); // RTS
+    };
+
+    // The CPU only reports internal cycles, count the memory accesses in a separate
+    // (untimed) run so the interceptor doesn't affect the measurement.
+    uint64_t cycles_per_run = 0;
+    {
+        memory_handler mem { ram_size };
+        setup_memory(mem);
+        mem.set_memory_interceptor([&cycles_per_run](uint32_t, uint32_t, uint8_t size, bool) { cycles_per_run += size > 2 ? 8 : 4; });
+        run_loop(mem, end_pc, [&cycles_per_run](uint8_t c) { cycles_per_run += c; });
+    }
+
+    memory_handler mem { ram_size };
+    setup_memory(mem);
+    bench_result res {};
+    uint64_t internal_cycles = 0; // Keep the cycle handler as it's always installed in the emulator
+    uint64_t runs = 0;
+    do {
+        const auto start = std::chrono::steady_clock::now();
+        res.instructions += run_loop(mem, end_pc, [&internal_cycles](uint8_t c) { internal_cycles += c; });
+        res.ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        ++runs;
+    } while (res.ns < min_ns);
+    res.cycles = cycles_per_run * runs;
+    return res;
+}
+
+// Write results as a JSON array with one object per line (that's also what read_baseline expects)
+void write_json(std::ostream& os, const std::vector<std::pair<const bench_case*, bench_result>>& results)
+{
+    os << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& [bc, r] = results[i];
+        os << "  { \"name\": \"" << bc->name << "\", \"instructions\": " << r.instructions << ", \"cycles\": " << r.cycles;
+        os << ", \"ns_per_instruction\": " << r.ns_per_instruction() << ", \"ns_per_cycle\": " << r.ns_per_cycle() << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "]\n";
+}
+
+// Only handles files produced by write_json: name -> ns per instruction
+std::map<std::string, double> read_baseline(const std::string& filename)
+{
+    std::ifstream in { filename };
+    if (!in)
+        throw std::runtime_error { "Error opening " + filename };
+    std::map<std::string, double> res;
+    const std::string name_key = "\"name\": \"";
+    const std::string ns_key = "\"ns_per_instruction\": ";
+    for (std::string line; std::getline(in, line);) {
+        const auto name_pos = line.find(name_key);
+        const auto ns_pos = line.find(ns_key);
+        if (name_pos == std::string::npos || ns_pos == std::string::npos)
+            continue;
+        const auto name_start = name_pos + name_key.size();
+        const auto name_end = line.find('"', name_start);
+        if (name_end == std::string::npos)
+            throw std::runtime_error { "Invalid line in " + filename + ": " + line };
+        res[line.substr(name_start, name_end - name_start)] = std::strtod(line.c_str() + ns_pos + ns_key.size(), nullptr);
+    }
+    return res;
+}
+
+void usage()
+{
+    std::cerr << "Usage: bench68k [options]\n";
+    std::cerr << "   -filter text     only run benchmarks whose name contains text\n";
+    std::cerr << "   -time ms         minimum run time per benchmark in milliseconds (default 200)\n";
+    std::cerr << "   -json file       write results as JSON to file\n";
+    std::cerr << "   -baseline file   compare against results previously written with -json\n";
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[])
+{
+    try {
+        std::string filter, json_file, baseline_file;
+        double min_ms = 200;
+        while (argc >= 2 && argv[1][0] == '-') {
+            if (!strcmp(argv[1], "-filter") && argc > 2) {
+                filter = argv[2];
+            } else if (!strcmp(argv[1], "-time") && argc > 2) {
+                min_ms = std::strtod(argv[2], nullptr);
+            } else if (!strcmp(argv[1], "-json") && argc > 2) {
+                json_file = argv[2];
+            } else if (!strcmp(argv[1], "-baseline") && argc > 2) {
+                baseline_file = argv[2];
+            } else {
+                usage();
+                return 1;
+            }
+            argv += 2;
+            argc -= 2;
+        }
+        if (argc != 1) {
+            usage();
+            return 1;
+        }
+
+        std::map<std::string, double> baseline;
+        if (!baseline_file.empty())
+            baseline = read_baseline(baseline_file);
+
+        std::vector<std::pair<const bench_case*, bench_result>> results;
+        double total_ns = 0, total_baseline_ns = 0;
+
+        std::cout << "Benchmark              ns/inst   ns/cycle   Minst/s";
+        if (!baseline.empty())
+            std::cout << "   baseline    change";
+        std::cout << "\n";
+
+        for (const auto& bc : bench_cases) {
+            if (!filter.empty() && !strstr(bc.name, filter.c_str()))
+                continue;
+            const auto r = run_case(bc, min_ms * 1e6);
+            results.push_back({ &bc, r });
+
+            char line[128];
+            snprintf(line, sizeof(line), "%-20s %10.2f %10.3f %9.1f", bc.name, r.ns_per_instruction(), r.ns_per_cycle(), 1e3 / r.ns_per_instruction());
+            std::cout << line;
+            if (auto it = baseline.find(bc.name); it != baseline.end() && it->second > 0) {
+                snprintf(line, sizeof(line), " %10.2f %+8.1f%%", it->second, (r.ns_per_instruction() / it->second - 1) * 100);
+                std::cout << line;
+                total_ns += r.ns;
+                total_baseline_ns += it->second * r.instructions;
+            }
+            std::cout << std::endl;
+        }
+
+        if (total_baseline_ns > 0) {
+            char line[128];
+            snprintf(line, sizeof(line), "Total change (weighted by instructions executed): %+.1f%%", (total_ns / total_baseline_ns - 1) * 100);
+            std::cout << line << "\n";
+        }
+
+        if (!json_file.empty()) {
+            std::ofstream out { json_file };
+            if (!out)
+                throw std::runtime_error { "Error creating " + json_file };
+            write_json(out, results);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
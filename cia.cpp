@@ -4,6 +4,7 @@
 #include "state_file.h"
 #include "debug.h"
 #include <cassert>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 
@@ -122,7 +123,7 @@ constexpr uint8_t CIACRBF_ALARM   = 1 << CIACRBB_ALARM;
 constexpr uint8_t CIAB_GAMEPORT0 = 6; // gameport 0, pin 6 (fire button*)
 //constexpr uint8_t CIAB_DSKRDY    = 5; // disk ready*
 //constexpr uint8_t CIAB_DSKTRACK0 = 4; // disk on track 00*
-//constexpr uint8_t CIAB_DSKPROT   = 3; // disk write protect*
+constexpr uint8_t CIAB_DSKPROT   = 3; // disk write protect*
 constexpr uint8_t CIAB_DSKCHANGE = 2; // disk change*
 constexpr uint8_t CIAB_LED       = 1; // led light control (0==>bright)
 constexpr uint8_t CIAB_OVERLAY   = 0; // memory overlay bit
@@ -158,6 +159,11 @@ constexpr uint8_t CIAF_DSKSTEP  = 1 << CIAB_DSKSTEP;
 // Two clocks after bit 0 in the CRA has been set to 1, the timer will start counting from its current value back to zero
 constexpr uint8_t cia_start_delay = 2;
 
+// Floppy turbo mode: CIA-B one-shot timers started from ROM within this many ticks of a step/motor on from ROM
+// (i.e. trackdisk.device step, settle and spin-up delays) are shortened to turbo_timer_count ticks
+constexpr uint32_t turbo_wait_window = 709379 / 20; // ~50ms
+constexpr uint16_t turbo_timer_count = 10;
+
 #if 0
 
 /* control register B INMODE masks */
@@ -214,23 +220,38 @@ public:
         assert(s_[0].port_value(0) & CIAF_OVERLAY);
     }
 
-    void step()
+    void step(uint32_t eclocks)
     {
+        assert(eclocks);
+        turbo_wait_cnt_ -= std::min(turbo_wait_cnt_, eclocks);
+
         for (int i = 0; i < 2; ++i) {
             auto& s = s_[i];
             for (int t = 0; t < 2; ++t) {
-                if (s.cr[t] & CIACRAF_START) {
-                    if (s.start_delay[t]) {
-                        --s.start_delay[t];
-                        continue;
-                    }
-
-                    if (--s.timer_val[t] == 0) {
-                        s.timer_val[t] = s.timer_latch[t];
-                        if (s.cr[t] & CIACRAF_RUNMODE)
-                            s.cr[t] &= ~CIACRAF_START;
-                        s.trigger_int(t ? CIAICRB_TB : CIAICRB_TA);
-                    }
+                if (!(s.cr[t] & CIACRAF_START))
+                    continue;
+
+                uint32_t ticks = eclocks;
+                const uint32_t delay = std::min<uint32_t>(s.start_delay[t], ticks);
+                s.start_delay[t] = static_cast<uint8_t>(s.start_delay[t] - delay);
+                ticks -= delay;
+
+                const uint32_t val = s.timer_val[t] ? s.timer_val[t] : 0x10000;
+                if (ticks < val) {
+                    s.timer_val[t] = static_cast<uint16_t>(val - ticks);
+                    continue;
+                }
+
+                // Underflow
+                ticks -= val;
+                s.trigger_int(t ? CIAICRB_TB : CIAICRB_TA);
+                if (s.cr[t] & CIACRAF_RUNMODE) {
+                    s.timer_val[t] = s.timer_latch[t];
+                    s.cr[t] &= ~CIACRAF_START;
+                } else {
+                    // Continuous mode: Reloaded from the latch on each underflow
+                    const uint32_t period = s.timer_latch[t] ? s.timer_latch[t] : 0x10000;
+                    s.timer_val[t] = static_cast<uint16_t>(s.timer_latch[t] - ticks % period);
                 }
             }
         }
@@ -238,7 +259,7 @@ public:
         for (auto d : drives_) {
             if (!d)
                 continue;
-            if (!d->step())
+            if (!d->step(eclocks))
                 continue;
             // TODO: Only from selected drive(s)??
             if (DEBUG_CIA)
@@ -256,8 +277,38 @@ public:
         }
     }
 
+    uint32_t eclocks_until_event() const
+    {
+        if (kbd_.buffer_head_ != kbd_.buffer_tail_ && kbd_.ack_ && !(s_[0].cr[0] & CIACRAF_SPMODE))
+            return 1;
+
+        uint32_t res = UINT32_MAX;
+        for (const auto& s : s_) {
+            for (int t = 0; t < 2; ++t) {
+                if (s.cr[t] & CIACRAF_START)
+                    res = std::min(res, s.start_delay[t] + (s.timer_val[t] ? s.timer_val[t] : 0x10000U));
+            }
+        }
+        for (auto d : drives_) {
+            if (d && d->eclocks_until_index())
+                res = std::min(res, d->eclocks_until_index());
+        }
+        return res;
+    }
+
+    void set_sync_handler(const sync_handler& handler)
+    {
+        sync_handler_ = handler;
+    }
+
+    void set_pc_handler(const pc_handler& handler)
+    {
+        pc_handler_ = handler;
+    }
+
     uint8_t read_u8(uint32_t addr, uint32_t) override
     {
+        sync();
         // CIA-A is selected when A12=0, CIA-B is selcted when A13=0
         const uint8_t reg = (addr >> 8) & 0xf;
         switch ((addr >> 12) & 3) {
@@ -286,6 +337,7 @@ public:
 
     void write_u8(uint32_t addr, uint32_t, uint8_t val) override
     {
+        sync();
         // CIA-A is selected when A12=0, CIA-B is selcted when A13=0
         const uint8_t reg = (addr >> 8) & 0xf;
         const auto chip_select = (addr >> 12) & 3;
@@ -320,6 +372,7 @@ public:
     void keyboard_event(bool pressed, uint8_t raw)
     {
         assert(raw <= 0x7f);
+        sync();
         // Bit0: 1=down/0=up, Bit1..7: ~scancore (i.e. bitwise not)
         if (static_cast<uint8_t>(kbd_.buffer_head_ - kbd_.buffer_tail_) >= sizeof(kbd_.buffer_)) {
             std::cerr << "Keyboard buffer overrun\n";
@@ -364,6 +417,7 @@ public:
 
     void show_debug_state(std::ostream& os)
     {
+        sync();
         for (int idx = 0; idx < 2; ++idx) {
             auto& s = s_[idx];
             os << (char)('A' + idx) << ": CRA " << hexfmt(s.cr[0]) << " CRB " << hexfmt(s.cr[1]) << " ICR " << hexfmt(s.icrdata) << " IM " << hexfmt(s.icrmask);
@@ -382,6 +436,7 @@ public:
 
     void handle_state(state_file& sf)
     {
+        sync();
         const state_file::scope scope { sf, "CIA", 1 };
         sf.handle_blob(&s_[0], sizeof(state));
         sf.handle_blob(&s_[1], sizeof(state));
@@ -463,6 +518,9 @@ private:
         uint8_t buffer_tail_;
         bool ack_;
     } kbd_;
+    uint32_t turbo_wait_cnt_ = 0; // Not saved, only affects turbo mode
+    sync_handler sync_handler_;
+    pc_handler pc_handler_;
 
     static constexpr uint32_t latch_active_mask = 0x8000'0000;
 
@@ -488,6 +546,7 @@ private:
             if (idx == 0) {
                 auto& pi = s_[0].port_input[0];
                 static_assert(DSKF_ALL == 0xF << CIAB_DSKCHANGE);
+                static_assert(DSKF_PROT == 1 << CIAB_DSKPROT);
                 uint8_t disk_state = DSKF_ALL;
                 const uint8_t ciab_prb_output = s_[1].port_value(1);
                 for (uint8_t dsk = 0; dsk < max_drives; ++dsk) {
@@ -548,6 +607,7 @@ private:
         auto& s = s_[idx];
         const uint8_t port_a_before = s.port_value(0);
         const uint8_t port_b_before = s.port_value(1);
+        const uint8_t cr_before[2] = { s.cr[0], s.cr[1] };
 
         if (DEBUG_CIA)
             *debug_stream << "CIA write to CIA" << static_cast<char>('A' + idx) << " " << regnames[reg] << " val $" << hexfmt(val) << "\n";
@@ -646,6 +706,9 @@ cr_common:
             return;
         }
 
+        if (idx == 1 && turbo_wait_cnt_ && access_from_rom())
+            shorten_turbo_wait(cr_before);
+
         if (idx == 0) {
             const uint8_t port_a_after = s.port_value(0);
             const uint8_t port_a_diff = port_a_before ^ port_a_after;
@@ -656,6 +719,29 @@ cr_common:
     }
 
 private:
+    void sync()
+    {
+        if (sync_handler_)
+            sync_handler_();
+    }
+
+    bool access_from_rom() const
+    {
+        return pc_handler_ && is_kickstart_pc(pc_handler_());
+    }
+
+    void shorten_turbo_wait(const uint8_t cr_before[2])
+    {
+        auto& s = s_[1];
+        for (int t = 0; t < 2; ++t) {
+            if ((cr_before[t] & CIACRAF_START) || (s.cr[t] & (CIACRAF_START | CIACRAF_RUNMODE)) != (CIACRAF_START | CIACRAF_RUNMODE) || s.timer_val[t] <= turbo_timer_count)
+                continue;
+            if (DEBUG_CIA || DEBUG_DISK)
+                *debug_stream << "CIAB timer " << static_cast<char>('A' + t) << " started during turbo disk wait, shortening $" << hexfmt(s.timer_val[t]) << " -> $" << hexfmt(turbo_timer_count) << "\n";
+            s.timer_val[t] = turbo_timer_count;
+        }
+    }
+
     void recalc_disk(uint8_t before) {
         const uint8_t after = s_[1].port_value(1);
         const uint8_t diff = after ^ before;
@@ -698,6 +784,8 @@ private:
                 continue;
             if (before & selmask) {
                 d.set_motor(!(after & CIAF_DSKMOTOR));
+                if (!(after & CIAF_DSKMOTOR) && d.turbo_active() && access_from_rom())
+                    turbo_wait_cnt_ = turbo_wait_window;
             }
             /*if (diff & (CIAF_DSKSIDE | CIAF_DSKDIREC)) */{
                 // seekdir out -> towards 0
@@ -706,6 +794,8 @@ private:
             if (!(before & CIAF_DSKSTEP) && (after & CIAF_DSKSTEP)) {
                 // TODO: Maybe check if it actually goes high again?
                 d.dir_step();
+                if (d.turbo_active() && access_from_rom())
+                    turbo_wait_cnt_ = turbo_wait_window;
             }
 
         }
@@ -719,9 +809,24 @@ cia_handler::cia_handler(memory_handler& mem_handler, rom_area_handler& rom_hand
 
 cia_handler::~cia_handler() = default;
 
-void cia_handler::step()
+void cia_handler::step(uint32_t eclocks)
+{
+    impl_->step(eclocks);
+}
+
+uint32_t cia_handler::eclocks_until_event() const
+{
+    return impl_->eclocks_until_event();
+}
+
+void cia_handler::set_sync_handler(const sync_handler& handler)
+{
+    impl_->set_sync_handler(handler);
+}
+
+void cia_handler::set_pc_handler(const pc_handler& handler)
 {
-    impl_->step();
+    impl_->set_pc_handler(handler);
 }
 
 uint8_t cia_handler::active_irq_mask() const
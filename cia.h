@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <iosfwd>
+#include <functional>
 #include "memory.h"
 #include "disk_drive.h"
 
@@ -11,8 +12,21 @@ public:
     explicit cia_handler(memory_handler& mem_handler, rom_area_handler& rom_handler, disk_drive* dfs[max_drives]);
     ~cia_handler();
 
-    // Call with frequency equal to timer tick rate (.715909 Mhz NTSC; .709379 Mhz PAL) == Base CPU freq / 10
-    void step();
+    // Advance by a number of timer ticks (.715909 Mhz NTSC; .709379 Mhz PAL) == Base CPU freq / 10
+    void step(uint32_t eclocks = 1);
+
+    // Number of ticks until the next event (timer underflow, index pulse, keyboard data) that can change active_irq_mask(),
+    // i.e. step() can be called less often as long as it's called at least that often
+    uint32_t eclocks_until_event() const;
+
+    // The sync handler is called before the state is accessed or changed from the outside (register access, keyboard events etc.),
+    // so a user that batches step() calls can apply the pending ticks first. eclocks_until_event() must be rechecked afterwards.
+    using sync_handler = std::function<void ()>;
+    void set_sync_handler(const sync_handler& handler);
+
+    // Returns the PC of the instruction accessing the CIA (floppy turbo mode only applies to trackdisk.device in ROM)
+    using pc_handler = std::function<uint32_t ()>;
+    void set_pc_handler(const pc_handler& handler);
 
     uint8_t active_irq_mask() const;
     void increment_tod_counter(uint8_t cia);
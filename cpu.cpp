@@ -24,25 +24,35 @@ std::string ccr_string(uint16_t sr)
     return s;
 }
 
-void print_cpu_state(std::ostream& os, const cpu_state& s)
+void print_cpu_state(format_buffer& fb, const cpu_state& s)
 {
     for (int i = 0; i < 8; ++i) {
         if (i)
-            os << " ";
-        os << "D" << i << "=" << hexfmt(s.d[i]);
+            fb << ' ';
+        fb << 'D' << static_cast<char>('0' + i) << '=' << hexfmt(s.d[i]);
     }
-    os << "\n";
+    fb << '\n';
     for (int i = 0; i < 8; ++i) {
         if (i)
-            os << " ";
-        os << "A" << i << "=" << hexfmt(s.A(i));
+            fb << ' ';
+        fb << 'A' << static_cast<char>('0' + i) << '=' << hexfmt(s.A(i));
     }
-    os << "\n";
-    os << "PC=" << hexfmt(s.pc) << " SR=" << hexfmt(s.sr) << " SSP=" << hexfmt(s.ssp) << " USP=" << hexfmt(s.usp) << " CCR: " << ccr_string(s.sr) << " Prefetch: $" << hexfmt(s.prefecth_val) << " ($" << hexfmt(s.prefetch_address) << ")";
+    fb << '\n';
+    fb << "PC=" << hexfmt(s.pc) << " SR=" << hexfmt(s.sr) << " SSP=" << hexfmt(s.ssp) << " USP=" << hexfmt(s.usp) << " CCR: ";
+    for (unsigned i = 5; i--;)
+        fb << ((s.sr & (1 << i)) ? "CVZNX"[i] : '-');
+    fb << " Prefetch: $" << hexfmt(s.prefecth_val) << " ($" << hexfmt(s.prefetch_address) << ")";
 
     if (s.stopped)
-        os << " (stopped)";
-    os << '\n';
+        fb << " (stopped)";
+    fb << '\n';
+}
+
+void print_cpu_state(std::ostream& os, const cpu_state& s)
+{
+    format_buffer fb;
+    print_cpu_state(fb, s);
+    os << fb;
 }
 
 constexpr uint8_t num_bits_set(uint16_t n)
@@ -362,8 +372,10 @@ found:
 
     out:
         if (trace_) {
-            disasm(*trace_, start_pc_, iwords_, inst_->ilen);
-            *trace_ << "\n";
+            format_buffer fb;
+            disasm(fb, start_pc_, iwords_, inst_->ilen);
+            fb << '\n';
+            *trace_ << fb;
         }
 
         step_res.current_pc = state_.pc;
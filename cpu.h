@@ -159,7 +159,10 @@ struct cpu_state {
     }
 };
 
+class format_buffer;
+
 std::string ccr_string(uint16_t sr);
+void print_cpu_state(format_buffer& fb, const cpu_state& s);
 void print_cpu_state(std::ostream& os, const cpu_state& s);
 
 class memory_handler;
@@ -0,0 +1,368 @@
+#include "cpu_trace.h"
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace {
+
+constexpr char trace_magic[8] = { 'A', 'M', 'I', 'T', 'R', 'A', 'C', 'E' };
+constexpr uint8_t trace_version = 1;
+
+constexpr uint8_t tag_inst = 0x01;
+constexpr uint8_t tag_inst_full = 0x02; // Instruction record with full state (keyframe)
+constexpr uint8_t tag_mem = 0x10; // Low bits: size
+constexpr uint8_t tag_mem_write_flag = 0x08;
+constexpr uint8_t tag_mem_size_mask = 0x07;
+
+constexpr size_t buffer_size = 1 << 20;
+constexpr size_t max_queued_buffers = 16;
+
+uint32_t& reg(cpu_state& s, uint32_t idx)
+{
+    assert(idx < cpu_trace_num_regs);
+    if (idx < 8)
+        return s.d[idx];
+    else if (idx < 15)
+        return s.a[idx - 8];
+    else if (idx == cpu_trace_reg_ssp)
+        return s.ssp;
+    return s.usp;
+}
+
+uint32_t reg(const cpu_state& s, uint32_t idx)
+{
+    return reg(const_cast<cpu_state&>(s), idx);
+}
+
+constexpr uint32_t zigzag(int32_t n)
+{
+    return (static_cast<uint32_t>(n) << 1) ^ static_cast<uint32_t>(n >> 31);
+}
+
+constexpr int32_t unzigzag(uint32_t n)
+{
+    return static_cast<int32_t>((n >> 1) ^ (~(n & 1) + 1));
+}
+
+} // unnamed namespace
+
+class cpu_trace_writer::impl {
+public:
+    explicit impl(const std::string& filename)
+        : f_ { filename, std::ofstream::binary }
+    {
+        if (!f_ || !f_.is_open())
+            throw std::runtime_error { "Error creating " + filename };
+        buf_.reserve(buffer_size + 256);
+        buf_.insert(buf_.end(), std::begin(trace_magic), std::end(trace_magic));
+        buf_.push_back(trace_version);
+        thread_ = std::thread { [this]() { writer_thread(); } };
+    }
+
+    ~impl()
+    {
+        flush_buffer();
+        {
+            std::unique_lock<std::mutex> lock { mutex_ };
+            done_ = true;
+        }
+        queued_cv_.notify_one();
+        thread_.join();
+    }
+
+    void memory_access(uint32_t addr, uint32_t data, uint8_t size, bool write)
+    {
+        assert(size <= tag_mem_size_mask);
+        put_u8(tag_mem | (write ? tag_mem_write_flag : 0) | size);
+        put_svarint(static_cast<int32_t>(addr - last_mem_addr_));
+        last_mem_addr_ = addr;
+        if (write)
+            put_varint(data);
+    }
+
+    void instruction(uint32_t pc, const uint16_t* iwords, uint8_t ilen, const cpu_state& state, uint8_t exception, uint16_t vpos, uint16_t hpos)
+    {
+        assert(ilen <= max_instruction_words);
+        const uint32_t beam = vpos << 9 | hpos;
+        const bool full = !have_state_ || state.instruction_count != last_.instruction_count + 1 || !(state.instruction_count % cpu_trace_keyframe_interval);
+
+        uint32_t changed = 0;
+        for (uint32_t r = 0; r < cpu_trace_num_regs; ++r) {
+            if (reg(state, r) != reg(last_, r))
+                changed |= 1 << r;
+        }
+        if (state.sr != last_.sr)
+            changed |= cpu_trace_sr_changed;
+        if (exception)
+            changed |= cpu_trace_exception;
+
+        put_u8(full ? tag_inst_full : tag_inst);
+        put_varint(changed);
+        if (full) {
+            put_varint(static_cast<uint32_t>(state.instruction_count >> 32));
+            put_varint(static_cast<uint32_t>(state.instruction_count));
+            put_varint(pc);
+            put_varint(beam);
+            for (uint32_t r = 0; r < cpu_trace_num_regs; ++r)
+                put_varint(reg(state, r));
+            put_varint(state.sr);
+        } else {
+            put_svarint(static_cast<int32_t>(pc - last_.pc));
+            put_svarint(static_cast<int32_t>(beam - last_beam_));
+            for (uint32_t r = 0; r < cpu_trace_num_regs; ++r) {
+                if (changed & (1 << r))
+                    put_svarint(static_cast<int32_t>(reg(state, r) - reg(last_, r)));
+            }
+            if (changed & cpu_trace_sr_changed)
+                put_varint(state.sr);
+        }
+        put_u8(ilen);
+        for (uint8_t i = 0; i < ilen; ++i) {
+            put_u8(static_cast<uint8_t>(iwords[i] >> 8));
+            put_u8(static_cast<uint8_t>(iwords[i]));
+        }
+        // PC after the instruction (non-zero for taken branches and exceptions)
+        put_svarint(static_cast<int32_t>(state.pc - (pc + ilen * 2)));
+        if (exception)
+            put_u8(exception);
+
+        last_ = state;
+        last_beam_ = beam;
+        have_state_ = true;
+
+        if (buf_.size() >= buffer_size)
+            flush_buffer();
+    }
+
+    uint64_t bytes_written() const
+    {
+        return bytes_total_ + buf_.size();
+    }
+
+private:
+    std::ofstream f_;
+    std::vector<uint8_t> buf_;
+    uint64_t bytes_total_ = 0;
+    cpu_state last_ {};
+    uint32_t last_beam_ = 0;
+    uint32_t last_mem_addr_ = 0;
+    bool have_state_ = false;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable queued_cv_;
+    std::condition_variable written_cv_;
+    std::deque<std::vector<uint8_t>> queue_;
+    bool done_ = false;
+
+    void put_u8(uint8_t b)
+    {
+        buf_.push_back(b);
+    }
+
+    void put_varint(uint32_t n)
+    {
+        while (n >= 0x80) {
+            buf_.push_back(static_cast<uint8_t>(n | 0x80));
+            n >>= 7;
+        }
+        buf_.push_back(static_cast<uint8_t>(n));
+    }
+
+    void put_svarint(int32_t n)
+    {
+        put_varint(zigzag(n));
+    }
+
+    void flush_buffer()
+    {
+        if (buf_.empty())
+            return;
+        bytes_total_ += buf_.size();
+        {
+            std::unique_lock<std::mutex> lock { mutex_ };
+            // Don't let the queue grow without bounds if the disk can't keep up
+            written_cv_.wait(lock, [this]() { return queue_.size() < max_queued_buffers; });
+            queue_.push_back(std::move(buf_));
+        }
+        queued_cv_.notify_one();
+        buf_ = std::vector<uint8_t> {};
+        buf_.reserve(buffer_size + 256);
+    }
+
+    void writer_thread()
+    {
+        for (;;) {
+            std::vector<uint8_t> data;
+            {
+                std::unique_lock<std::mutex> lock { mutex_ };
+                queued_cv_.wait(lock, [this]() { return done_ || !queue_.empty(); });
+                if (queue_.empty())
+                    return;
+                data = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            written_cv_.notify_one();
+            f_.write(reinterpret_cast<const char*>(data.data()), data.size());
+        }
+    }
+};
+
+cpu_trace_writer::cpu_trace_writer(const std::string& filename)
+    : impl_ { std::make_unique<impl>(filename) }
+{
+}
+
+cpu_trace_writer::~cpu_trace_writer() = default;
+
+void cpu_trace_writer::memory_access(uint32_t addr, uint32_t data, uint8_t size, bool write)
+{
+    impl_->memory_access(addr, data, size, write);
+}
+
+void cpu_trace_writer::instruction(uint32_t pc, const uint16_t* iwords, uint8_t ilen, const cpu_state& state, uint8_t exception, uint16_t vpos, uint16_t hpos)
+{
+    impl_->instruction(pc, iwords, ilen, state, exception, vpos, hpos);
+}
+
+uint64_t cpu_trace_writer::bytes_written() const
+{
+    return impl_->bytes_written();
+}
+
+class cpu_trace_reader::impl {
+public:
+    explicit impl(const std::string& filename)
+        : filename_ { filename }
+        , f_ { filename, std::ifstream::binary }
+    {
+        if (!f_ || !f_.is_open())
+            throw std::runtime_error { "Error opening " + filename };
+        char magic[sizeof(trace_magic)];
+        for (auto& c : magic) {
+            if (!more())
+                throw std::runtime_error { filename + " is not a trace file" };
+            c = static_cast<char>(get_u8());
+        }
+        if (std::memcmp(magic, trace_magic, sizeof(magic)) || !more() || get_u8() != trace_version)
+            throw std::runtime_error { filename + " is not a trace file (or has an unsupported version)" };
+    }
+
+    bool next(cpu_trace_entry& e)
+    {
+        e.mem_accesses.clear();
+        while (more()) {
+            const uint8_t tag = get_u8();
+            if ((tag & ~(tag_mem_write_flag | tag_mem_size_mask)) == tag_mem) {
+                cpu_trace_mem_access ma {};
+                ma.write = !!(tag & tag_mem_write_flag);
+                ma.size = tag & tag_mem_size_mask;
+                last_mem_addr_ += unzigzag(get_varint());
+                ma.addr = last_mem_addr_;
+                if (ma.write)
+                    ma.data = get_varint();
+                e.mem_accesses.push_back(ma);
+                continue;
+            } else if (tag != tag_inst && tag != tag_inst_full) {
+                throw std::runtime_error { filename_ + ": Invalid record in trace file" };
+            }
+            if (tag == tag_inst && !have_state_)
+                throw std::runtime_error { filename_ + ": Trace doesn't start with a keyframe" };
+
+            e.changed = get_varint();
+            if (tag == tag_inst_full) {
+                state_.instruction_count = static_cast<uint64_t>(get_varint()) << 32;
+                state_.instruction_count |= get_varint();
+                state_.pc = get_varint();
+                beam_ = get_varint();
+                for (uint32_t r = 0; r < cpu_trace_num_regs; ++r)
+                    reg(state_, r) = get_varint();
+                state_.sr = static_cast<uint16_t>(get_varint());
+                have_state_ = true;
+            } else {
+                ++state_.instruction_count;
+                state_.pc += unzigzag(get_varint());
+                beam_ += unzigzag(get_varint());
+                for (uint32_t r = 0; r < cpu_trace_num_regs; ++r) {
+                    if (e.changed & (1 << r))
+                        reg(state_, r) += unzigzag(get_varint());
+                }
+                if (e.changed & cpu_trace_sr_changed)
+                    state_.sr = static_cast<uint16_t>(get_varint());
+            }
+            e.ilen = get_u8();
+            if (e.ilen > max_instruction_words)
+                throw std::runtime_error { filename_ + ": Invalid instruction length in trace file" };
+            for (uint8_t i = 0; i < e.ilen; ++i) {
+                const uint8_t hi = get_u8();
+                e.iwords[i] = static_cast<uint16_t>(hi << 8 | get_u8());
+            }
+            e.pc = state_.pc;
+            state_.pc = e.pc + e.ilen * 2 + unzigzag(get_varint());
+            e.exception = e.changed & cpu_trace_exception ? get_u8() : 0;
+            e.instruction_count = state_.instruction_count;
+            e.vpos = static_cast<uint16_t>(beam_ >> 9);
+            e.hpos = static_cast<uint16_t>(beam_ & 0x1ff);
+            e.state = state_;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::string filename_;
+    std::ifstream f_;
+    std::vector<uint8_t> buf_ = std::vector<uint8_t>(1 << 20);
+    size_t buf_pos_ = 0;
+    size_t buf_len_ = 0;
+    cpu_state state_ {};
+    uint32_t beam_ = 0;
+    uint32_t last_mem_addr_ = 0;
+    bool have_state_ = false;
+
+    bool more()
+    {
+        if (buf_pos_ < buf_len_)
+            return true;
+        f_.read(reinterpret_cast<char*>(buf_.data()), buf_.size());
+        buf_len_ = static_cast<size_t>(f_.gcount());
+        buf_pos_ = 0;
+        return buf_len_ != 0;
+    }
+
+    uint8_t get_u8()
+    {
+        if (!more())
+            throw std::runtime_error { filename_ + ": Unexpected end of trace file" };
+        return buf_[buf_pos_++];
+    }
+
+    uint32_t get_varint()
+    {
+        uint32_t n = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            const uint8_t b = get_u8();
+            n |= static_cast<uint32_t>(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return n;
+        }
+        throw std::runtime_error { filename_ + ": Invalid number in trace file" };
+    }
+};
+
+cpu_trace_reader::cpu_trace_reader(const std::string& filename)
+    : impl_ { std::make_unique<impl>(filename) }
+{
+}
+
+cpu_trace_reader::~cpu_trace_reader() = default;
+
+bool cpu_trace_reader::next(cpu_trace_entry& entry)
+{
+    return impl_->next(entry);
+}
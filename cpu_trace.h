@@ -0,0 +1,88 @@
+#ifndef CPU_TRACE_H_INCLUDED
+#define CPU_TRACE_H_INCLUDED
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu.h"
+#include "instruction.h"
+
+// Compact binary CPU trace
+//
+// The file starts with the magic "AMITRACE" followed by a version byte. The rest is a stream of records,
+// each starting with a tag byte. Numbers are LEB128 varints, signed numbers are zigzag encoded first.
+//
+// Memory access record (precedes the instruction record it belongs to):
+//   tag (+write flag and size), address delta from previous access, [data if write]
+// Instruction record:
+//   tag, changed register mask, PC delta from predicted (PC after previous instruction), beam position delta,
+//   register deltas, [SR], instruction length, instruction words (raw big endian), PC after instruction
+//   (delta from PC + instruction length), [exception]
+// Keyframe instruction record (written first and every cpu_trace_keyframe_interval instructions):
+//   Same as above, but with instruction count, PC, beam position, D0-D7, A0-A6, SSP, USP and SR given in full
+// Register values are those after the instruction has executed.
+
+constexpr uint32_t cpu_trace_keyframe_interval = 1 << 16;
+
+constexpr uint32_t cpu_trace_reg_d0 = 0; // D0-D7 = 0-7, A0-A6 = 8-14
+constexpr uint32_t cpu_trace_reg_ssp = 15;
+constexpr uint32_t cpu_trace_reg_usp = 16;
+constexpr uint32_t cpu_trace_num_regs = 17;
+constexpr uint32_t cpu_trace_sr_changed = 1 << 17;
+constexpr uint32_t cpu_trace_exception = 1 << 18;
+
+struct cpu_trace_mem_access {
+    uint32_t addr;
+    uint32_t data; // Only valid for writes
+    uint8_t size;
+    bool write;
+};
+
+struct cpu_trace_entry {
+    uint64_t instruction_count;
+    uint32_t pc;
+    uint16_t iwords[max_instruction_words];
+    uint8_t ilen; // 0 if no instruction was executed (interrupt)
+    uint16_t vpos;
+    uint16_t hpos;
+    uint8_t exception;
+    uint32_t changed; // Mask of changed registers (cpu_trace_reg_* bits, cpu_trace_sr_changed)
+    cpu_state state; // After the instruction
+    std::vector<cpu_trace_mem_access> mem_accesses;
+};
+
+// Buffers trace data and writes it to the file from a background thread
+class cpu_trace_writer {
+public:
+    explicit cpu_trace_writer(const std::string& filename);
+    ~cpu_trace_writer();
+
+    cpu_trace_writer(const cpu_trace_writer&) = delete;
+    cpu_trace_writer& operator=(const cpu_trace_writer&) = delete;
+
+    void memory_access(uint32_t addr, uint32_t data, uint8_t size, bool write);
+    // Register state is after the instruction has executed
+    void instruction(uint32_t pc, const uint16_t* iwords, uint8_t ilen, const cpu_state& state, uint8_t exception, uint16_t vpos, uint16_t hpos);
+
+    uint64_t bytes_written() const;
+
+private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+};
+
+class cpu_trace_reader {
+public:
+    explicit cpu_trace_reader(const std::string& filename);
+    ~cpu_trace_reader();
+
+    // Returns false at end of file
+    bool next(cpu_trace_entry& entry);
+
+private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+};
+
+#endif
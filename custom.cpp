@@ -11,6 +11,9 @@
 #include <climits>
 #include <iostream>
 #include <array>
+#include <chrono>
+#include <algorithm>
+#include <vector>
 
 #define TODO_ASSERT(expr) do { if (!(expr)) throw std::runtime_error{("TODO: " #expr " in ") + std::string{__FILE__} + " line " + std::to_string(__LINE__) }; } while (0)
 
@@ -1083,6 +1086,25 @@ constexpr auto make_one_pixel_func_array(std::index_sequence<I...>)
 
 constexpr auto one_pixel_funcs = make_one_pixel_func_array(std::make_index_sequence<32> {});
 
+// Only every 61st step is timed to keep the overhead down (prime to avoid aliasing with CCKs, E-clock and lines)
+constexpr uint32_t timing_sample_interval = 61;
+
+template <typename F>
+auto timed_call(bool timed, double& total, F&& f)
+{
+    if (!timed)
+        return f();
+    struct section_timer {
+        double& total;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ~section_timer()
+        {
+            total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    } t { total };
+    return f();
+}
+
 
 } // unnamed namespace
 
@@ -1100,6 +1122,8 @@ public:
             // Mirror custom registers (due to partial decoding), this is necessary for e.g. KS1.2
             mem_.register_handler(*this, addr + (256 << 10) - 0x1000, 0x1000);
         }
+        cia_.set_sync_handler([this]() { sync_cia(); });
+        cia_.set_pc_handler([this]() { return current_pc_; });
         reset();
     }
 
@@ -1108,6 +1132,11 @@ public:
         std::memset(gfx_buf_, 0, sizeof(gfx_buf_));
         std::memset(audio_buf_, 0, sizeof(audio_buf_));
         std::memset(&s_, 0, sizeof(s_));
+        sync_index_valid_ = false;
+        turbo_transfer_ = false;
+        dsklen_from_rom_ = false;
+        cia_pending_ = 0;
+        cia_next_event_ = 1;
         std::memset(col32_, 0, sizeof(col32_));
         s_.long_frame = true;
         s_.copstate = copper_state::halted;
@@ -1119,6 +1148,9 @@ public:
         const state_file::scope scope { sf, "Custom", 1 };
         sf.handle_blob(&s_, sizeof(s_));
         if (sf.loading()) {
+            sync_index_valid_ = false;
+            cia_pending_ = 0;
+            cia_next_event_ = 1;
             for (int i = 0; i < 32; ++i)
                 col32_[i] = rgb4_to_8(s_.color[i]);
             for (int spr = 0; spr < 8; ++spr)
@@ -1133,6 +1165,11 @@ public:
         serial_data_handler_ = handler;
     }
 
+    void set_external_irq_handler(const external_irq_handler& handler)
+    {
+        external_irq_handler_ = handler;
+    }
+
     void set_rbutton_state(bool pressed)
     {
         s_.rmb_pressed[0] = pressed;
@@ -1150,6 +1187,27 @@ public:
         s_.rmb_pressed[1] = button_state;
     }
 
+    void set_rendering(bool enabled)
+    {
+        render_ = enabled;
+    }
+
+    bool rendering() const
+    {
+        return render_;
+    }
+
+    void set_timing(bool enabled)
+    {
+        timing_enabled_ = enabled;
+        timing_ = {};
+    }
+
+    const timing_info& timing() const
+    {
+        return timing_;
+    }
+
     void show_debug_state(std::ostream& os)
     {
         cia_.show_debug_state(os);
@@ -1765,6 +1823,50 @@ public:
             DBGOUT << "Copper jump to COP" << (idx + 1) << "LC: $" << hexfmt(s_.coplc[idx]) << "\n";
     }
 
+    // Record all bit positions in the current MFM track where the sync word starts
+    void build_sync_index()
+    {
+        constexpr uint32_t track_size = MFM_TRACK_SIZE_WORDS * 2;
+        sync_index_.clear();
+        for (uint32_t b = 0; b < track_size; ++b) {
+            const uint32_t dat = s_.mfm_track[b] << 16 | s_.mfm_track[(b + 1) % track_size] << 8 | s_.mfm_track[(b + 2) % track_size];
+            for (uint32_t shift = 0; shift < 8; ++shift) {
+                if (static_cast<uint16_t>(dat >> (8 - shift)) == s_.dsksync)
+                    sync_index_.push_back(b * 8 + shift);
+            }
+        }
+        sync_index_word_ = s_.dsksync;
+        sync_index_valid_ = true;
+    }
+
+    // trackdisk.device starts transfers from ROM, always transfers (at least) a full track, and reads using word sync with the standard sync word
+    bool is_trackdisk_transfer(uint16_t nwords, bool write) const
+    {
+        if (!dsklen_from_rom_ || nwords < MFM_TRACK_SIZE_WORDS - MFM_GAP_SIZE_WORDS)
+            return false;
+        return write || ((s_.adkcon & 0x400) && s_.dsksync == 0x4489);
+    }
+
+    void start_disk_transfer(uint16_t nwords, bool write)
+    {
+        auto& drive = cia_.active_drive();
+        turbo_transfer_ = false;
+        if (!drive.turbo())
+            return;
+        drive.set_trackdisk_access(is_trackdisk_transfer(nwords, write));
+        turbo_transfer_ = drive.turbo_active();
+    }
+
+    // Apply pending E-clocks before the CIA/drive state is accessed or changed, and recheck for the next event on the next E-clock
+    void sync_cia()
+    {
+        if (cia_pending_) {
+            cia_.step(cia_pending_);
+            cia_pending_ = 0;
+        }
+        cia_next_event_ = 1;
+    }
+
     bool do_disk_dma()
     {
         if (s_.dskwait) {
@@ -1778,6 +1880,11 @@ public:
         const bool write = !!(s_.dsklen_act & 0x4000);
         TODO_ASSERT(nwords > 0);
 
+        if (s_.dskpos == 0 && (write || !s_.dskread))
+            start_disk_transfer(nwords, write);
+        // In turbo mode trackdisk.device transfers are completed in one go
+        const uint32_t words_per_slot = turbo_transfer_ ? nwords : floppy_speed_;
+
         if (write) {
             // Pretty hacky...
             if (s_.dskpos == 0) {
@@ -1786,14 +1893,16 @@ public:
                 if (nwords * 2 < sizeof(s_.mfm_track))
                     std::cerr << "[DISK] WARNING writing less than full track nwords=$" << hexfmt(nwords) << "\n";
             }
-            for (uint32_t i = 0; i < floppy_speed_ && s_.dskpos < nwords; ++i) {
+            for (uint32_t i = 0; i < words_per_slot && s_.dskpos < nwords; ++i) {
                 const auto data = chip_read(s_.dskpt);
                 s_.dskpt += 2;
                 put_u16(&s_.mfm_track[(s_.dskpos % MFM_TRACK_SIZE_WORDS) * 2], data);
                 ++s_.dskpos;
+                sync_index_valid_ = false;
             }
             if (s_.dskpos < nwords)
                 return true;
+            sync_cia();
             cia_.active_drive().write_mfm_track(s_.mfm_track);
         } else {
             // Read
@@ -1801,7 +1910,9 @@ public:
                 if (DEBUG_DISK)
                     DBGOUT << "Reading track\n";
                 assert(s_.dskpos == 0);
+                sync_cia();
                 cia_.active_drive().read_mfm_track(s_.mfm_track);
+                sync_index_valid_ = false;
                 s_.dskread = true;
                 s_.dskwait = 0;
 
@@ -1817,32 +1928,41 @@ public:
                     s_.mfm_pos = 0; // If the loader is able to handle a full track (minus the gap) then give it a clean fit to work around any issues
                 else
                     s_.mfm_pos %= MFM_TRACK_SIZE_WORDS * 16; // Otherwise let it think that it's processing data as fast as possible (no gaps)
-                return false;
+                if (!turbo_transfer_)
+                    return false;
             }
 
             if (!s_.dsksync_passed && (s_.adkcon & 0x400)) {
-                for (uint32_t i = 0; i < MFM_TRACK_SIZE_WORDS * 16 + 16; ++i) {
-                    if (s_.get_mfm_word() == s_.dsksync) {
-                        if (DEBUG_DISK)
-                            DBGOUT << "Disk sync word ($" << hexfmt(s_.dsksync) << ") matches at word pos $" << hexfmt(s_.mfm_pos) << "\n";
-                        s_.mfm_pos += 16;
-                        // XXX: FIXME: Shouldn't be done here
-                        s_.intreq |= INTF_DSKSYNC;
-                        s_.dsksync_passed = true;
-                        s_.dskbyt = 1 << 15 | 1 << 12 | (s_.dsksync & 0xff); // XXX
+                if (!sync_index_valid_ || sync_index_word_ != s_.dsksync)
+                    build_sync_index();
+                if (!sync_index_.empty()) {
+                    // Find the first sync position at or after the current bit position (wrapping around)
+                    constexpr uint32_t track_bits = MFM_TRACK_SIZE_WORDS * 16;
+                    const uint32_t pos = s_.mfm_pos % track_bits;
+                    auto it = std::lower_bound(sync_index_.begin(), sync_index_.end(), pos);
+                    s_.mfm_pos += it != sync_index_.end() ? *it - pos : sync_index_[0] + track_bits - pos;
+                    assert(s_.get_mfm_word() == s_.dsksync);
+                    if (DEBUG_DISK)
+                        DBGOUT << "Disk sync word ($" << hexfmt(s_.dsksync) << ") matches at word pos $" << hexfmt(s_.mfm_pos) << "\n";
+                    s_.mfm_pos += 16;
+                    // XXX: FIXME: Shouldn't be done here
+                    s_.intreq |= INTF_DSKSYNC;
+                    s_.dsksync_passed = true;
+                    s_.dskbyt = 1 << 15 | 1 << 12 | (s_.dsksync & 0xff); // XXX
+                    if (!turbo_transfer_) {
                         s_.dskwait = 10; // HACK: Some demos (e.g. desert dream clear intreq after starting the read, so delay a bit)
                         return false;
                     }
-                    ++s_.mfm_pos;
+                } else {
+                    TODO_ASSERT(!"Sync word not found?");
                 }
-                TODO_ASSERT(!"Sync word not found?");
             }
 
             if (DEBUG_DISK && !s_.dskpos)
                 DBGOUT << "Disk reading $" << hexfmt(nwords) << " words to $" << hexfmt(s_.dskpt) << " mfm pos=$" << hexfmt(s_.mfm_pos) << " dsksync_passed=" << s_.dsksync_passed << "\n";
 
             // 400% floppy speed corrupts display at start of "flower"/Anarchy Germany (https://www.pouet.net/prod.php?which=3037)
-            for (uint32_t i = 0; i < floppy_speed_ && s_.dskpos < nwords; ++i) {
+            for (uint32_t i = 0; i < words_per_slot && s_.dskpos < nwords; ++i) {
                 const auto data = s_.get_mfm_word();
                 chip_write(s_.dskpt, data);
                 s_.dskbyt = 1 << 15 | (data == s_.dsksync ? 1 << 12 : 0) | (data & 0xff); // XXX
@@ -2110,6 +2230,20 @@ public:
     }
 
     step_result step(bool cpu_wants_access, uint32_t current_pc)
+    {
+        if (timing_enabled_) {
+            // Time whole steps and their parts in different samples, so the timing overhead of the parts doesn't skew the total
+            const auto phase = ++timing_.steps % timing_sample_interval;
+            if (phase == 0) {
+                ++timing_.sampled_steps;
+                return timed_call(true, timing_.step, [&]() { return do_step(cpu_wants_access, current_pc, false); });
+            }
+            return do_step(cpu_wants_access, current_pc, phase == timing_sample_interval / 2);
+        }
+        return do_step(cpu_wants_access, current_pc, false);
+    }
+
+    step_result do_step(bool cpu_wants_access, uint32_t current_pc, bool timed)
     {
         // Step frequency: Base CPU frequency (7.09 for PAL) => 1 lores virtual pixel / 2 hires pixels
 
@@ -2230,7 +2364,7 @@ public:
 
                 // Disk
                 if ((colclock == 7 || colclock == 9 || colclock == 11) && (s_.dmacon & DMAF_DISK) && (s_.dsklen & 0x8000) && s_.dsklen_act) {
-                    if (do_disk_dma()) {
+                    if (timed_call(timed, timing_.disk, [this]() { return do_disk_dma(); })) {
                         res.bus = bus_use::disk;
                         break;
                     }
@@ -2256,13 +2390,12 @@ public:
 
                 // Display
                 const bool bpl_dma_active = (s_.dmacon & DMAF_RASTER) && vert_disp && (s_.bplcon0 & BPLCON0F_BPU);
-                static int num_bpl1_writes = 0;
 
                 if (bpl_dma_active) {
                     if (s_.ddfst == ddfstate::before_ddfstrt && colclock == std::max<uint16_t>(0x18, s_.ddfstrt)) {
                         if (DEBUG_BPL) {
                             DBGOUT << "DDFSTRT=$" << hexfmt(s_.ddfstrt) << " passed\n";
-                            num_bpl1_writes = 0;
+                            num_bpl1_writes_ = 0;
                         }
                         s_.ddfst = ddfstate::active;
                         s_.ddfcycle = 0;
@@ -2274,7 +2407,7 @@ public:
                         s_.ddfst = ddfstate::ddfstop_passed;
                     } else if (s_.ddfst == ddfstate::ddfstop_passed && s_.ddfcycle == s_.ddfend) {
                         if (DEBUG_BPL)
-                            DBGOUT << "BPL DMA done (fetch cycle $" << hexfmt(s_.ddfcycle) << ", bpl1 writes: " << num_bpl1_writes << ")\n";
+                            DBGOUT << "BPL DMA done (fetch cycle $" << hexfmt(s_.ddfcycle) << ", bpl1 writes: " << num_bpl1_writes_ << ")\n";
                         s_.ddfst = ddfstate::stopped;
                     }
                 }
@@ -2285,7 +2418,7 @@ public:
                     const int bpl = (s_.bplcon0 & BPLCON0F_HIRES ? hires_bpl_sched : lores_bpl_sched)[s_.ddfcycle & 7] - 1;
                     if (s_.ddfst == ddfstate::ddfstop_passed && !s_.ddfend && (s_.ddfcycle & 7) == 0) {
                         if (DEBUG_BPL)
-                            DBGOUT << "Doing final DMA cycles (fetch cycle $" << hexfmt(s_.ddfcycle) << ", bpl1 writes: " << num_bpl1_writes << ")\n";
+                            DBGOUT << "Doing final DMA cycles (fetch cycle $" << hexfmt(s_.ddfcycle) << ", bpl1 writes: " << num_bpl1_writes_ << ")\n";
                         s_.ddfend = s_.ddfcycle + 8;
                     }
                     ++s_.ddfcycle;
@@ -2302,7 +2435,7 @@ public:
                         if (bpl == 0) {
                             if (DEBUG_BPL) {
                                 DBGOUT << "Data available -- bpldat1_written = " << s_.bpl1dat_written << " bpldata_avail = " << hexfmt(s_.bpldata_avail) << (s_.bpl1dat_written ? " Warning!" : "") << "\n";
-                                ++num_bpl1_writes;
+                                ++num_bpl1_writes_;
                             }
 
                             s_.bpl1dat_written = true;
@@ -2345,7 +2478,7 @@ public:
                     // http://eab.abime.net/showpost.php?p=600609&postcount=47
                     // But seems like it gets allocated anyway?
                     if ((!(colclock & 1) && colclock != 0xe0) || colclock == 0xe1) {
-                        if (do_copper()) {
+                        if (timed_call(timed, timing_.copper_blitter, [this]() { return do_copper(); })) {
                             res.bus = bus_use::copper;
                             break;
                         }
@@ -2354,7 +2487,7 @@ public:
                 
                 // Blitter
                 blitter_had_chance_to_run = true;
-                if (do_blitter()) {
+                if (timed_call(timed, timing_.copper_blitter, [this]() { return do_blitter(); })) {
                     res.bus = bus_use::blitter;
                     break;
                 }
@@ -2373,8 +2506,8 @@ public:
         }
 
         // Output pixels after copper had a chance to update color registers
-        if (display_vpos >= vblank_end_vpos && display_vpos != vpos_per_field-1)
-            do_pixels(vert_disp, display_vpos, display_hpos, pixel_temp);
+        if (render_ && display_vpos >= vblank_end_vpos && display_vpos != vpos_per_field-1)
+            timed_call(timed, timing_.render, [&]() { do_pixels(vert_disp, display_vpos, display_hpos, pixel_temp); });
 
         if (cck_tick && (s_.bplmod1_countdown | s_.bplmod2_countdown)) {
             if (s_.bplmod1_countdown && --s_.bplmod1_countdown == 0) {
@@ -2399,7 +2532,7 @@ public:
 
         // Check for blitter delays/idle cycles that don't need the bus
         if (!blitter_had_chance_to_run) {
-            check_blit_idle_any_cycle();
+            timed_call(timed, timing_.copper_blitter, [this]() { check_blit_idle_any_cycle(); });
         }
 
         // Delayed interrupts
@@ -2428,9 +2561,18 @@ public:
         res.eclock_cycle = s_.eclock_cycle;
 
         // CIA tick rate (EClock) is 1/10th of (base) CPU speed = 1/5th of CCK (to keep in sync with DMA)
+        // The CIAs are only stepped when something can happen (or their state is accessed, see sync_cia)
         if (++s_.eclock_cycle == 10) {
-            cia_.step();
-            const auto irq_mask = cia_.active_irq_mask();
+            if (++cia_pending_ >= cia_next_event_) {
+                timed_call(timed, timing_.cia, [this]() {
+                    cia_.step(cia_pending_);
+                    cia_pending_ = 0;
+                    cia_next_event_ = cia_.eclocks_until_event();
+                });
+            }
+            auto irq_mask = cia_.active_irq_mask();
+            if (external_irq_handler_)
+                irq_mask |= external_irq_handler_();
             constexpr uint8_t cia_int_delay = 16; // XXX: FIXME: Need correct number
             if ((irq_mask & 1) && !(s_.intreq & INTF_PORTS))
                 interrupt_with_delay(INTB_PORTS, cia_int_delay);
@@ -2452,8 +2594,8 @@ public:
                 s_.vpos = 0;
                 if (s_.bplcon0 & BPLCON0F_LACE)
                     s_.long_frame = !s_.long_frame;
-                else if (s_.last_long_frame == s_.long_frame)
-                    scandouble();
+                else if (s_.last_long_frame == s_.long_frame && render_)
+                    timed_call(timed, timing_.render, [this]() { scandouble(); });
                 s_.last_long_frame = s_.long_frame;
                 // XXX: FIXME: Shouldn't be done here
                 s_.intreq |= INTF_VERTB;
@@ -2725,6 +2867,7 @@ public:
         case DSKLEN: // $024
             s_.dsklen_act = s_.dsklen == val ? val : 0;
             s_.dsklen = val;
+            dsklen_from_rom_ = is_kickstart_pc(current_pc_);
             s_.dskwait = 0;
             s_.dskpos = 0;
             s_.dsksync_passed = false;
@@ -2934,11 +3077,10 @@ public:
             return;
         }
 
-        static uint8_t warned[0x100];
         if (!debug_flags && offset < 0x200) {
-            if (warned[offset >> 1] == 0xff)
+            if (warned_[offset >> 1] == 0xff)
                 return;
-            if (++warned[offset >> 1] == 0xff)
+            if (++warned_[offset >> 1] == 0xff)
                 std::cerr << "Disabling warnings for writes to " << custom_regname(offset) << "\n";
         }
         std::cerr << "Unhandled write to custom register $" << hexfmt(offset, 3) << " (" << custom_regname(offset) << ")"
@@ -2982,13 +3124,26 @@ private:
     memory_handler& mem_;
     cia_handler& cia_;
     serial_data_handler serial_data_handler_;
+    external_irq_handler external_irq_handler_;
 
     uint32_t gfx_buf_[graphics_width * graphics_height];
     int16_t audio_buf_[audio_buffer_size];
     custom_state s_;
     uint32_t chip_ram_mask_;
-    uint32_t current_pc_; // For debug output
+    uint32_t current_pc_; // For debug output and telling trackdisk.device (ROM) disk accesses from custom loaders
     uint32_t floppy_speed_;
+    std::vector<uint32_t> sync_index_; // Sorted bit positions of sync_index_word_ in s_.mfm_track
+    uint16_t sync_index_word_ = 0;
+    bool sync_index_valid_ = false;
+    bool turbo_transfer_ = false; // Current disk transfer is completed at once (not saved, it's just a speedup)
+    bool dsklen_from_rom_ = false; // Last DSKLEN write was made by ROM code (not saved, only affects turbo mode)
+    uint32_t cia_pending_ = 0; // E-clocks not yet applied to the CIAs (not saved, applied before the CIA state is)
+    uint32_t cia_next_event_ = 1; // Step the CIAs when cia_pending_ reaches this
+    uint8_t warned_[0x100] = {}; // Number of warnings shown for writes to unhandled registers
+    int num_bpl1_writes_ = 0; // Only used for debug output
+    bool render_ = true; // Skip pixel output (and scandoubling) when false, only affects the display (doesn't need to be saved)
+    bool timing_enabled_ = false;
+    timing_info timing_ {};
     decltype(&one_pixel<0>) one_pixel_;
     uint32_t col32_[32];
     struct sprite_state {
@@ -3340,6 +3495,11 @@ void custom_handler::set_serial_data_handler(const serial_data_handler& handler)
     impl_->set_serial_data_handler(handler);
 }
 
+void custom_handler::set_external_irq_handler(const external_irq_handler& handler)
+{
+    impl_->set_external_irq_handler(handler);
+}
+
 void custom_handler::set_rbutton_state(bool pressed)
 {
     impl_->set_rbutton_state(pressed);
@@ -3355,6 +3515,26 @@ void custom_handler::set_joystate(uint16_t dat, bool button_state)
     impl_->set_joystate(dat, button_state);
 }
 
+void custom_handler::set_rendering(bool enabled)
+{
+    impl_->set_rendering(enabled);
+}
+
+bool custom_handler::rendering() const
+{
+    return impl_->rendering();
+}
+
+void custom_handler::set_timing(bool enabled)
+{
+    impl_->set_timing(enabled);
+}
+
+const custom_handler::timing_info& custom_handler::timing() const
+{
+    return impl_->timing();
+}
+
 void custom_handler::show_debug_state(std::ostream& os)
 {
     impl_->show_debug_state(os);
@@ -46,6 +46,8 @@ public:
     ~custom_handler();
 
     using serial_data_handler = std::function<void(uint8_t numbits, uint8_t data)>;
+    // Level of external interrupt lines (e.g. from expansion boards), same format as cia_handler::active_irq_mask (1=INT2, 2=INT6)
+    using external_irq_handler = std::function<uint8_t ()>;
     struct step_result {
         const uint32_t* frame;
         const int16_t* audio;
@@ -62,10 +64,28 @@ public:
     uint8_t current_ipl();
 
     void set_serial_data_handler(const serial_data_handler& handler);
+    void set_external_irq_handler(const external_irq_handler& handler);
     void set_rbutton_state(bool pressed);
     void mouse_move(int dx, int dy);
     void set_joystate(uint16_t dat, bool button_state);
 
+    // When disabled no pixels are output (the frame buffer keeps its old contents), DMA etc. is unaffected
+    void set_rendering(bool enabled);
+    bool rendering() const;
+
+    // Sampled timing of the custom chip emulation (only a subset of steps are timed, scale by steps / sampled_steps)
+    struct timing_info {
+        uint64_t steps;
+        uint64_t sampled_steps;
+        double step; // Seconds spent in sampled steps, the parts below are sampled separately at the same rate
+        double copper_blitter;
+        double cia;
+        double disk;
+        double render;
+    };
+    void set_timing(bool enabled);
+    const timing_info& timing() const;
+
     void show_debug_state(std::ostream& os);
     void show_registers(std::ostream& os);
     uint32_t copper_ptr(uint8_t idx); // 0=current
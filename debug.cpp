@@ -1,5 +1,5 @@
 #include "debug.h"
 #include <iostream>
 
-uint32_t debug_flags = 0;
-std::ostream* debug_stream = &std::cout;
\ No newline at end of file
+thread_local uint32_t debug_flags = 0;
+thread_local std::ostream* debug_stream = &std::cout;
\ No newline at end of file
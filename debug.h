@@ -4,8 +4,9 @@
 #include <stdint.h>
 #include <ostream>
 
-extern uint32_t debug_flags;
-extern std::ostream* debug_stream;
+// Per thread so several machines can run in one process (each on its own thread)
+extern thread_local uint32_t debug_flags;
+extern thread_local std::ostream* debug_stream;
 
 constexpr uint32_t debug_flag_copper  = 1 << 0;
 constexpr uint32_t debug_flag_bpl     = 1 << 1;
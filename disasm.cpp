@@ -4,7 +4,6 @@
 #include <ostream>
 #include <cassert>
 #include <cstring>
-#include <iomanip>
 
 #include "instruction.h"
 #include "ioutil.h"
@@ -110,7 +109,7 @@ std::string reg_list_string(uint16_t list, bool reverse)
     return res;
 }
 
-uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t num_iwords)
+uint16_t disasm(format_buffer& fb, uint32_t pc, const uint16_t* iwords, size_t num_iwords)
 {
     uint16_t iwords_copy[max_instruction_words] = { 0 };
     if (iwords && num_iwords)
@@ -119,20 +118,24 @@ uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t nu
 
     const auto& inst = instructions[iwords[0]];
 
-    os << hexfmt(pc) << ' ';
+    fb << hexfmt(pc) << ' ';
     for (unsigned i = 0; i < max_instruction_words; ++i) {
-        os << ' ';
+        fb << ' ';
         if (i < inst.ilen)
-            os << hexfmt(iwords[i]);
+            fb << hexfmt(iwords[i]);
         else
-            os << "    ";
+            fb << "    ";
     }
-    os << "  ";
+    fb << "  ";
     // Only print "ILLEGAL" for the explicitly defined illegal instruction
     if (inst.type == inst_type::ILLEGAL && iwords[0] != illegal_instruction_num)
-        os << "DC.W\t$" << hexfmt(iwords[0]);
-    else
-        os << std::setw(inst.nea ? 4 : 0) << std::left << inst.name;
+        fb << "DC.W\t$" << hexfmt(iwords[0]);
+    else {
+        const auto name_pos = fb.size();
+        fb << instruction_name(iwords[0]);
+        if (inst.nea)
+            fb.pad_to(name_pos + 4);
+    }
 
     unsigned eaw = 1;
 
@@ -149,34 +152,34 @@ uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t nu
     uint32_t pc_addr = invalid_pc_addr;
 
     for (unsigned i = 0; i < inst.nea; ++i) {
-        os << (i == 0 ? "\t" : ",");
+        fb << (i == 0 ? "\t" : ",");
         const auto ea = inst.ea[i];
         switch (ea >> ea_m_shift) {
         case ea_m_Dn:
-            os << "D" << (ea & 7);
+            fb << "D" << (ea & 7);
             break;
         case ea_m_An:
-            os << "A" << (ea & 7);
+            fb << "A" << (ea & 7);
             break;
         case ea_m_A_ind:
-            os << "(A" << (ea & 7) << ")";
+            fb << "(A" << (ea & 7) << ")";
             break;
         case ea_m_A_ind_post:
-            os << "(A" << (ea & 7) << ")+";
+            fb << "(A" << (ea & 7) << ")+";
             break;
         case ea_m_A_ind_pre:
-            os << "-(A" << (ea & 7) << ")";
+            fb << "-(A" << (ea & 7) << ")";
             break;
         case ea_m_A_ind_disp16: {
             assert(eaw < inst.ilen);
             int16_t n = iwords[eaw++];
-            os << "$";
+            fb << "$";
             if (n < 0) {
-                os << "-";
+                fb << "-";
                 n = -n;
             }
-            os << hexfmt(static_cast<uint16_t>(n));
-            os << "(A" << (ea & 7) << ")";
+            fb << hexfmt(static_cast<uint16_t>(n));
+            fb << "(A" << (ea & 7) << ")";
             break;
         }
         case ea_m_A_ind_index: {
@@ -184,43 +187,43 @@ uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t nu
             const auto extw = iwords[eaw++];
             // Note: 68000 ignores scale in bits 9/10 and full extension word bit (8)
             auto disp = static_cast<int8_t>(extw & 255);
-            os << "$";
+            fb << "$";
             if (disp < 0) {
-                os << "-";
+                fb << "-";
                 disp = -disp;
             }
-            os << hexfmt(static_cast<uint8_t>(disp)) << "(A" << (ea & 7) << ",";
-            os << ((extw & (1 << 15)) ? "A" : "D") << ((extw >> 12) & 7) << "." << (((extw >> 11) & 1) ? "L" : "W");
-            os << ")";
+            fb << hexfmt(static_cast<uint8_t>(disp)) << "(A" << (ea & 7) << ",";
+            fb << ((extw & (1 << 15)) ? "A" : "D") << ((extw >> 12) & 7) << "." << (((extw >> 11) & 1) ? "L" : "W");
+            fb << ")";
             break;
         }
         case ea_m_Other:
             switch (ea & ea_xn_mask) {
             case ea_other_abs_w:
                 assert(eaw < inst.ilen);
-                os << "$";
-                os << hexfmt(iwords[eaw++]);
-                os << ".W";
+                fb << "$";
+                fb << hexfmt(iwords[eaw++]);
+                fb << ".W";
                 break;
             case ea_other_abs_l:
                 assert(eaw + 1 < inst.ilen);
-                os << "$";
-                os << hexfmt(iwords[eaw++]);
-                os << hexfmt(iwords[eaw++]);
-                os << ".L";
+                fb << "$";
+                fb << hexfmt(iwords[eaw++]);
+                fb << hexfmt(iwords[eaw++]);
+                fb << ".L";
                 break;
             case ea_other_pc_disp16: {
                 assert(eaw < inst.ilen);
                 int16_t n = iwords[eaw++];
                 assert(pc_addr == invalid_pc_addr);
                 pc_addr = pc + (eaw - 1) * 2 + n;
-                os << "$";
+                fb << "$";
                 if (n < 0) {
-                    os << "-";
+                    fb << "-";
                     n = -n;
                 }
-                os << hexfmt(static_cast<uint16_t>(n));
-                os << "(PC)";
+                fb << hexfmt(static_cast<uint16_t>(n));
+                fb << "(PC)";
                 break;
             }
             case ea_other_pc_index: {
@@ -228,49 +231,49 @@ uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t nu
                 const auto extw = iwords[eaw++];
                 // Note: 68000 ignores scale in bits 9/10 and full extension word bit (8)
                 auto disp = static_cast<int8_t>(extw & 255);
-                os << "$";
+                fb << "$";
                 if (disp < 0) {
-                    os << "-";
+                    fb << "-";
                     disp = -disp;
                 }
-                os << hexfmt(static_cast<uint8_t>(disp)) << "(PC,";
-                os << ((extw & (1 << 15)) ? "A" : "D") << ((extw >> 12) & 7) << "." << (((extw >> 11) & 1) ? "L" : "W");
-                os << ")";
+                fb << hexfmt(static_cast<uint8_t>(disp)) << "(PC,";
+                fb << ((extw & (1 << 15)) ? "A" : "D") << ((extw >> 12) & 7) << "." << (((extw >> 11) & 1) ? "L" : "W");
+                fb << ")";
                 break;
             }
             case ea_other_imm:
-                os << "#$";
+                fb << "#$";
                 if (inst.size == opsize::l) {
                     assert(eaw + 1 < inst.ilen);
-                    os << hexfmt(iwords[eaw++]);
-                    os << hexfmt(iwords[eaw++]);
+                    fb << hexfmt(iwords[eaw++]);
+                    fb << hexfmt(iwords[eaw++]);
                 } else {
                     assert(eaw < inst.ilen);
                     if (inst.size == opsize::b)
-                        os << hexfmt(static_cast<uint8_t>(iwords[eaw++]));
+                        fb << hexfmt(static_cast<uint8_t>(iwords[eaw++]));
                     else
-                        os << hexfmt(iwords[eaw++]);
+                        fb << hexfmt(iwords[eaw++]);
                 }
                 break;
             default:
-                os << "\nTODO: Handle EA other=0x" << hexfmt(ea & 3) << "\n";
+                fb << "\nTODO: Handle EA other=0x" << hexfmt(ea & 3) << "\n";
                 assert(0);
             }
             break;
         default:
             if (ea == ea_sr) {
-                os << "SR";
+                fb << "SR";
                 break;
             } else if (ea == ea_ccr) {
-                os << "CCR";
+                fb << "CCR";
                 break;
             } else if (ea == ea_usp) {
-                os << "USP";
+                fb << "USP";
                 break;
             } else if (ea == ea_reglist) {
                 assert(inst.nea == 2);
                 // Note: reversed for predecrement
-                os << reg_list_string(reglist, i == 0 && (inst.ea[1] >> 3) == ea_m_A_ind_pre);
+                fb << reg_list_string(reglist, i == 0 && (inst.ea[1] >> 3) == ea_m_A_ind_pre);
                 break;
             } else if (ea == ea_bitnum) {
                 assert(eaw < inst.ilen);
@@ -279,7 +282,7 @@ uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t nu
                     b &= 7;
                 else
                     b &= 31;
-                os << "#" << b;
+                fb << "#" << b;
                 break;
             }
 
@@ -287,18 +290,18 @@ uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t nu
                 assert(ea == ea_disp);
                 assert(eaw < inst.ilen);
                 int16_t n = iwords[eaw++];
-                os << "$" << hexfmt(pc + 2 + n);
+                fb << "$" << hexfmt(pc + 2 + n);
             } else if (ea == ea_disp) {
-                os << "$" << hexfmt(pc + 2 + static_cast<int8_t>(inst.data));
+                fb << "$" << hexfmt(pc + 2 + static_cast<int8_t>(inst.data));
             } else {
-                os << "#$" << hexfmt(inst.data);
+                fb << "#$" << hexfmt(inst.data);
             }
             break;
         }
     }
 
     if (pc_addr != invalid_pc_addr) {
-        os << "\t ; PC addr=$" << hexfmt(pc_addr);
+        fb << "\t ; PC addr=$" << hexfmt(pc_addr);
     }
 
     assert(eaw == inst.ilen);
@@ -306,3 +309,11 @@ uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t nu
 }
 
 
+
+uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t num_iwords)
+{
+    format_buffer fb;
+    const auto ilen = disasm(fb, pc, iwords, num_iwords);
+    os << fb;
+    return ilen;
+}
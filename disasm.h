@@ -8,6 +8,10 @@
 std::string ea_string(uint8_t ea);
 std::string reg_list_string(uint16_t list, bool reverse);
 
+class format_buffer;
+
+// Appends the disassembly of one instruction (without newline) and returns its length in words
+uint16_t disasm(format_buffer& fb, uint32_t pc, const uint16_t* iwords, size_t num_iwords);
 uint16_t disasm(std::ostream& os, uint32_t pc, const uint16_t* iwords, size_t num_iwords);
 
 #endif
@@ -2,8 +2,10 @@
 #include <stdexcept>
 #include <cassert>
 #include <ostream>
+#include <iostream>
 #include <cstring>
 #include <fstream>
+#include <algorithm>
 #include "ioutil.h"
 #include "memory.h"
 #include "debug.h"
@@ -43,24 +45,30 @@ public:
             *debug_stream << name_ << " Inserting disk " << (data_ ? data_->name() : "<empty file>") << "\n";
     }
 
-    bool step()
+    uint32_t step(uint32_t eclocks)
     {
         if (s_.motor_cnt) {
-            --s_.motor_cnt;
+            s_.motor_cnt -= std::min(s_.motor_cnt, eclocks);
             if (DEBUG_DISK && !s_.motor_cnt) {
                 *debug_stream << name_ << " Motor is now " << (s_.motor ? "running at full speed" : "off") << "\n";
             }
         }
         // TODO: If motor isn't spinning at full speed the count should probably be different...
-        if (s_.motor && s_.index_cnt) {
-            if (--s_.index_cnt == 0) {
-                // Disk completed a revolution
-                s_.index_cnt = DISK_INDEX_CNT;
-                return true;
-            }
+        if (!s_.motor || !s_.index_cnt)
+            return 0;
+        if (eclocks < s_.index_cnt) {
+            s_.index_cnt -= eclocks;
+            return 0;
         }
+        // Disk completed (at least) a revolution
+        eclocks -= s_.index_cnt;
+        s_.index_cnt = DISK_INDEX_CNT - eclocks % DISK_INDEX_CNT;
+        return 1 + eclocks / DISK_INDEX_CNT;
+    }
 
-        return false;
+    uint32_t eclocks_until_index() const
+    {
+        return s_.motor ? s_.index_cnt : 0;
     }
 
     uint8_t cia_state() const
@@ -68,8 +76,8 @@ public:
         uint8_t flags = DSKF_ALL;
         if (!data_) {
             flags &= ~DSKF_CHANGE;
-        } else {
-            //flags &= ~DSKF_PROT;
+        } else if (data_->write_protected()) {
+            flags &= ~DSKF_PROT;
         }
 
         // Even if no disk is inserted track0 sensor works (a1000 bootrom)
@@ -104,7 +112,9 @@ public:
             *debug_stream << name_ << " Motor turning " << (enabled ? "on" : "off") << " motor_cnt=" << s_.motor_cnt << "\n";
         if (s_.motor != enabled) {
             // If the motor is already spinning up/down, just reuse the count. Not accurate but oh well
-            if (!s_.motor_cnt)
+            if (turbo_active())
+                s_.motor_cnt = 0;
+            else if (!s_.motor_cnt)
                 s_.motor_cnt = MOTOR_ON_CNT; // Just use same speed for starting/stopping
         }
         s_.motor = enabled;
@@ -150,6 +160,7 @@ public:
             disk_activity_handler_(tracknum, false);
 
         data_->read_mfm_track(tracknum, dest);
+        turbo_index();
     }
 
     void write_mfm_track(const uint8_t* src)
@@ -162,6 +173,13 @@ public:
 
         const uint8_t tracknum = !s_.side + s_.cyl * 2;
 
+        // The drive doesn't write to a protected disk (the data is just lost)
+        if (data_->write_protected()) {
+            std::cerr << name_ << " Ignoring write to track $" << hexfmt(tracknum) << " of write protected disk " << data_->name() << "\n";
+            turbo_index();
+            return;
+        }
+
         if (disk_activity_handler_)
             disk_activity_handler_(tracknum, true);
 
@@ -169,6 +187,7 @@ public:
             *debug_stream << name_ << " writing track $" << hexfmt(tracknum) << "\n";
 
         data_->write_mfm_track(tracknum, src);
+        turbo_index();
     }
 
     void set_disk_activity_handler(const disk_activity_handler& handler)
@@ -193,6 +212,28 @@ public:
         return data_->ofs_bootable();
     }
 
+    void set_turbo(bool enabled)
+    {
+        turbo_ = enabled;
+    }
+
+    bool turbo() const
+    {
+        return turbo_;
+    }
+
+    void set_trackdisk_access(bool trackdisk)
+    {
+        if (DEBUG_DISK && turbo_ && trackdisk != trackdisk_access_)
+            *debug_stream << name_ << " Turbo mode " << (trackdisk ? "enabled (trackdisk access)" : "disabled (custom loader)") << "\n";
+        trackdisk_access_ = trackdisk;
+    }
+
+    bool turbo_active() const
+    {
+        return turbo_ && trackdisk_access_;
+    }
+
 private:
     std::string name_;
     std::unique_ptr<disk_file> data_;
@@ -205,6 +246,15 @@ private:
         uint32_t index_cnt = DISK_INDEX_CNT; // Countdown to next DSKINDEX event (once per revolution)
     } s_;
     disk_activity_handler disk_activity_handler_;
+    bool turbo_ = false;
+    bool trackdisk_access_ = false; // Not saved, redetected on the next transfer
+
+    void turbo_index()
+    {
+        // The whole track is transferred at once in turbo mode, so let the revolution end right away
+        if (turbo_active() && s_.motor)
+            s_.index_cnt = 1;
+    }
 };
 
 disk_drive::disk_drive(const std::string& name)
@@ -269,12 +319,37 @@ void disk_drive::handle_state(state_file& sf)
     impl_->handle_state(sf);
 }
 
-bool disk_drive::step()
+uint32_t disk_drive::step(uint32_t eclocks)
 {
-    return impl_->step();
+    return impl_->step(eclocks);
+}
+
+uint32_t disk_drive::eclocks_until_index() const
+{
+    return impl_->eclocks_until_index();
 }
 
 bool disk_drive::ofs_bootable_disk_inserted() const
 {
     return impl_->ofs_bootable_disk_inserted();
 }
+
+void disk_drive::set_turbo(bool enabled)
+{
+    impl_->set_turbo(enabled);
+}
+
+bool disk_drive::turbo() const
+{
+    return impl_->turbo();
+}
+
+void disk_drive::set_trackdisk_access(bool trackdisk)
+{
+    impl_->set_trackdisk_access(trackdisk);
+}
+
+bool disk_drive::turbo_active() const
+{
+    return impl_->turbo_active();
+}
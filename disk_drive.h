@@ -43,12 +43,23 @@ public:
 
     void handle_state(state_file& sf);
 
-    // Call with EClock frequency (CCKFreq / 5)
-    // returns true if the disk has completed a revolution
-    bool step();
+    // Advance by a number of EClocks (CCKFreq / 5)
+    // returns the number of times the disk completed a revolution (index pulses)
+    uint32_t step(uint32_t eclocks = 1);
+    // Number of EClocks until the next index pulse (0 if the motor is off)
+    uint32_t eclocks_until_index() const;
 
     bool ofs_bootable_disk_inserted() const;
 
+    // Turbo mode (opt-in): While the drive is being accessed like trackdisk.device does it, motor spin up
+    // is instant and an index pulse follows each track transfer. Custom loaders get the normal timing.
+    void set_turbo(bool enabled);
+    bool turbo() const;
+    // Called (by the DMA code) at the start of each transfer with whether it looks like a trackdisk.device one
+    void set_trackdisk_access(bool trackdisk);
+    // True if turbo mode is enabled and the last transfer was a trackdisk.device one
+    bool turbo_active() const;
+
 private:
     class impl;
     std::unique_ptr<impl> impl_;
@@ -56,4 +67,11 @@ private:
 
 constexpr uint8_t max_drives = 4;
 
+// trackdisk.device runs from the Kickstart ROM, turbo mode is only applied to disk accesses made from there
+constexpr bool is_kickstart_pc(uint32_t pc)
+{
+    pc &= 0xffffff;
+    return pc >= 0xf80000;
+}
+
 #endif
\ No newline at end of file
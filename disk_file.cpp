@@ -8,7 +8,17 @@
 
 #include <stdexcept>
 #include <fstream>
+#include <iostream>
 #include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MFM_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MFM_NEON
+#endif
 
 namespace {
 
@@ -39,6 +49,24 @@ void put_split_long_fill(uint8_t* dest, uint32_t l)
 uint32_t checksum(const uint8_t* data, uint32_t nlongs)
 {
     uint32_t csum = 0;
+#if defined(MFM_SSE2) || defined(MFM_NEON)
+    // XOR is independent of byte order, so combine 16 bytes at a time and fold at the end
+    if (nlongs >= 4) {
+        uint8_t folded[16];
+#ifdef MFM_SSE2
+        __m128i acc = _mm_setzero_si128();
+        for (; nlongs >= 4; nlongs -= 4, data += 16)
+            acc = _mm_xor_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(folded), acc);
+#else
+        uint8x16_t acc = vdupq_n_u8(0);
+        for (; nlongs >= 4; nlongs -= 4, data += 16)
+            acc = veorq_u8(acc, vld1q_u8(data));
+        vst1q_u8(folded, acc);
+#endif
+        csum = get_u32(&folded[0]) ^ get_u32(&folded[4]) ^ get_u32(&folded[8]) ^ get_u32(&folded[12]);
+    }
+#endif
     while (nlongs--) {
         csum ^= get_u32(data);
         data += 4;
@@ -46,6 +74,57 @@ uint32_t checksum(const uint8_t* data, uint32_t nlongs)
     return csum;
 }
 
+// Split data into odd and even bits (with clock bits set to fill)
+void mfm_encode_odd_even(uint8_t* odd, uint8_t* even, const uint8_t* src, uint32_t size)
+{
+    uint32_t i = 0;
+#if defined(MFM_SSE2)
+    const __m128i mask = _mm_set1_epi8(0x55);
+    const __m128i clock = _mm_set1_epi8(static_cast<char>(0xaa));
+    for (; i + 16 <= size; i += 16) {
+        // Bits shifted in from the neighbouring byte land in bit 7 which is masked out
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(odd + i), _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 1), mask), clock));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(even + i), _mm_or_si128(_mm_and_si128(v, mask), clock));
+    }
+#elif defined(MFM_NEON)
+    const uint8x16_t mask = vdupq_n_u8(0x55);
+    const uint8x16_t clock = vdupq_n_u8(0xaa);
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16_t v = vld1q_u8(src + i);
+        vst1q_u8(odd + i, vorrq_u8(vandq_u8(vshrq_n_u8(v, 1), mask), clock));
+        vst1q_u8(even + i, vorrq_u8(vandq_u8(v, mask), clock));
+    }
+#endif
+    for (; i < size; ++i) {
+        odd[i] = 0xaa | ((src[i] >> 1) & 0x55);
+        even[i] = 0xaa | (src[i] & 0x55);
+    }
+}
+
+// Combine odd and even bits (clock bits are ignored)
+void mfm_decode_odd_even(uint8_t* dest, const uint8_t* odd, const uint8_t* even, uint32_t size)
+{
+    uint32_t i = 0;
+#if defined(MFM_SSE2)
+    const __m128i mask = _mm_set1_epi8(0x55);
+    for (; i + 16 <= size; i += 16) {
+        const __m128i o = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(odd + i)), mask);
+        const __m128i e = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(even + i)), mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_or_si128(_mm_slli_epi16(o, 1), e));
+    }
+#elif defined(MFM_NEON)
+    const uint8x16_t mask = vdupq_n_u8(0x55);
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16_t o = vandq_u8(vld1q_u8(odd + i), mask);
+        const uint8x16_t e = vandq_u8(vld1q_u8(even + i), mask);
+        vst1q_u8(dest + i, vorrq_u8(vshlq_n_u8(o, 1), e));
+    }
+#endif
+    for (; i < size; ++i)
+        dest[i] = static_cast<uint8_t>((odd[i] & 0x55) << 1 | (even[i] & 0x55));
+}
+
 uint32_t decode_long(const uint8_t* src)
 {
     return (get_u32(src) & mfm_mask) << 1 | (get_u32(src + 4) & mfm_mask);
@@ -78,10 +157,7 @@ void format_std_track(uint8_t* dest, uint8_t tracknum, const uint8_t* raw_data)
         // header checksum
         put_split_long_fill(&dest[48], checksum(&dest[8], (48 - 8) / 4));
         // data
-        for (uint16_t i = 0; i < 512; ++i) {
-            dest[64 + i] = 0xaa | ((raw_data[i] >> 1) & 0x55);
-            dest[64 + 512 + i] = 0xaa | (raw_data[i] & 0x55);
-        }
+        mfm_encode_odd_even(&dest[64], &dest[64 + TD_SECTOR], raw_data, TD_SECTOR);
         // data checksum
         put_split_long_fill(&dest[56], checksum(&dest[64], (MFM_SECTOR_SIZE_WORDS * 2 - 64) / 4));
         dest += MFM_SECTOR_SIZE_WORDS * 2;
@@ -90,34 +166,78 @@ void format_std_track(uint8_t* dest, uint8_t tracknum, const uint8_t* raw_data)
     std::memset(dest, 0xaa, MFM_GAP_SIZE_WORDS * 2);
 }
 
+bool ofs_bootblock(const uint8_t* data)
+{
+    if (data[0] != 'D' || data[1] != 'O' || data[2] != 'S' || data[3] != 0)
+        return false;
+    uint32_t csum = 0;
+    for (uint32_t i = 0; i < 1024; i += 4) {
+        const auto before = csum;
+        csum += get_u32(&data[i]);
+        if (csum < before) // carry?
+            ++csum;
+    }
+    return csum == 0xffffffff;
+}
+
+// Encoded MFM tracks, filled on first read and invalidated when the track is written
+class mfm_track_cache {
+public:
+    explicit mfm_track_cache(size_t num_tracks)
+        : tracks_(num_tracks)
+    {
+    }
+
+    template <typename F>
+    void read(uint8_t tracknum, uint8_t* dest, F&& encode)
+    {
+        assert(tracknum < tracks_.size());
+        auto& t = tracks_[tracknum];
+        if (t.empty()) {
+            t.resize(MFM_TRACK_SIZE_WORDS * 2);
+            encode(t.data());
+        }
+        memcpy(dest, t.data(), t.size());
+    }
+
+    void invalidate(uint8_t tracknum)
+    {
+        assert(tracknum < tracks_.size());
+        tracks_[tracknum].clear();
+    }
+
+private:
+    std::vector<std::vector<uint8_t>> tracks_;
+};
+
 class adf_disk_file : public disk_file {
 public:
-    adf_disk_file(const std::string& name, std::vector<uint8_t>&& data)
-        : name_ { name }
-        , data_ { std::move(data) }
-        , dirty_ { false }
+    explicit adf_disk_file(std::unique_ptr<disk_image>&& image)
+        : image_ { std::move(image) }
+        , cache_ { NUM_CYLINDERS * 2 }
     {
-        if (data_.size() != DISK_SIZE)
-            throw std::runtime_error { name_ + " has unsupported size $" + hexstring(data_.size()) };
+        if (image_->size() != DISK_SIZE)
+            throw std::runtime_error { name() + " has unsupported size $" + hexstring(image_->size()) };
     }
 
     ~adf_disk_file()
     {
-        if (!dirty_)
+        // Copy-on-write images aren't written back, so save a modified copy instead
+        if (!image_->modified() || image_->mode() != disk_image_mode::copy_on_write)
             return;
-        auto filename = name_ + "_modified.adf"; // TODO: Fix me
+        auto filename = name() + "_modified.adf"; // TODO: Fix me
         if (debug_stream)
-            *debug_stream << name_ << " has been written. Saving as " << filename << "\n";
+            *debug_stream << name() << " has been written. Saving as " << filename << "\n";
         std::ofstream out { filename, std::ofstream::binary };
-        if (out && out.is_open() && out.write(reinterpret_cast<const char*>(&data_[0]), data_.size()))
+        if (out && out.is_open() && out.write(reinterpret_cast<const char*>(image_->data()), image_->size()))
             return;
         if (debug_stream)
-            *debug_stream << name_ << " error writing " << filename << "\n";
+            *debug_stream << name() << " error writing " << filename << "\n";
     }
 
     const std::string& name() const override
     {
-        return name_;
+        return image_->filename();
     }
 
     uint8_t num_cylinders() const override
@@ -127,21 +247,17 @@ public:
 
     bool ofs_bootable() const override
     {
-        if (data_.size() < 1024 || data_[0] != 'D' || data_[1] != 'O' || data_[2] != 'S' || data_[3] != 0)
-            return false;
-        uint32_t csum = 0;
-        for (uint32_t i = 0; i < 1024; i += 4) {
-            const auto before = csum;
-            csum += get_u32(&data_[i]);
-            if (csum < before) // carry?
-                ++csum;
-        }
-        return csum == 0xffffffff;
+        return ofs_bootblock(image_->data());
+    }
+
+    bool write_protected() const override
+    {
+        return image_->mode() == disk_image_mode::read_only;
     }
 
     void read_mfm_track(uint8_t tracknum, uint8_t* dest) const override
     {
-        format_std_track(dest, tracknum, &data_[tracknum * NUMSECS * TD_SECTOR]);
+        cache_.read(tracknum, dest, [&](uint8_t* mfm) { format_std_track(mfm, tracknum, &image_->data()[tracknum * NUMSECS * TD_SECTOR]); });
     }
 
     void write_mfm_track(uint8_t tracknum, const uint8_t* src) override
@@ -150,7 +266,7 @@ public:
         std::vector<uint8_t> data(2 * MFM_TRACK_SIZE_WORDS);
         for (uint32_t wpos = 0;; ++wpos) {
             if (wpos >= MFM_TRACK_SIZE_WORDS)
-                throw std::runtime_error { name_ + " no sync word found in written MFM data" };
+                throw std::runtime_error { name() + " no sync word found in written MFM data" };
             if (get_u16(&src[2 * wpos]) != MFM_SYNC)
                 continue;
             const auto byte_ofs = wpos * 2;
@@ -161,54 +277,110 @@ public:
         }
 
         uint16_t sector_mask = 0;
+        uint8_t track_data[TRACK_SIZE];
         for (int seccnt = 0; seccnt < NUMSECS; ++seccnt) {
             const auto ofs = seccnt * MFM_SECTOR_SIZE_WORDS * 2;
             if (get_u16(&data[ofs]) != MFM_SYNC || get_u16(&data[ofs + 2]) != MFM_SYNC)
-                throw std::runtime_error { name_ + " invalid MFM data" };
+                throw std::runtime_error { name() + " invalid MFM data" };
 
             const auto info = decode_long(&data[ofs + 4]);
             const auto sec = (info >> 8) & 0xff;
             if (info >> 24 != 0xff || ((info >> 16) & 0xff) != tracknum || sec > NUMSECS || (sec + (info & 0xff)) != NUMSECS)
-                throw std::runtime_error { name_ + " invalid MFM data (info long=$" + hexstring(info) + ")" };
+                throw std::runtime_error { name() + " invalid MFM data (info long=$" + hexstring(info) + ")" };
 
             if (sector_mask & (1 << sec))
-                throw std::runtime_error { name_ + " sector " + std::to_string(sec) + " found twice in MFM data" };
+                throw std::runtime_error { name() + " sector " + std::to_string(sec) + " found twice in MFM data" };
 
             sector_mask |= 1 << sec;
 
             // TODO: Verify checksums..
-            uint8_t* raw_data = &data_[(tracknum * NUMSECS + sec) * TD_SECTOR];
-            for (int i = 0; i < 512; ++i) {
-                const uint8_t odd = data[ofs + 60 + i] & 0x55;
-                const uint8_t even = data[ofs + 60 + 512 + i] & 0x55;
-                raw_data[i] = odd << 1 | even;
-            }
+            mfm_decode_odd_even(&track_data[sec * TD_SECTOR], &data[ofs + 60], &data[ofs + 60 + TD_SECTOR], TD_SECTOR);
         }
 
-        dirty_ = true;
+        image_->write(tracknum * TRACK_SIZE, track_data, TRACK_SIZE);
+        cache_.invalidate(tracknum);
+    }
+
+private:
+    std::unique_ptr<disk_image> image_;
+    mutable mfm_track_cache cache_;
+};
+
+// DMS archives are decrunched on demand (see dms_archive), and converted to an in-memory ADF on the first write
+class dms_disk_file : public disk_file {
+public:
+    explicit dms_disk_file(const std::string& filename, std::vector<uint8_t>&& data)
+        : name_ { filename }
+        , archive_ { std::move(data) }
+        , cache_ { NUM_CYLINDERS * 2 }
+    {
+        if (archive_.num_cylinders() != NUM_CYLINDERS)
+            throw std::runtime_error { name() + " has unsupported size $" + hexstring(archive_.num_cylinders() * 2 * TRACK_SIZE) };
+    }
+
+    const std::string& name() const override
+    {
+        return name_;
+    }
+
+    uint8_t num_cylinders() const override
+    {
+        return NUM_CYLINDERS;
+    }
+
+    bool ofs_bootable() const override
+    {
+        if (adf_)
+            return adf_->ofs_bootable();
+        const auto* cyl = archive_.cylinder(0);
+        return cyl && ofs_bootblock(cyl);
+    }
+
+    void read_mfm_track(uint8_t tracknum, uint8_t* dest) const override
+    {
+        if (adf_) {
+            adf_->read_mfm_track(tracknum, dest);
+            return;
+        }
+        cache_.read(tracknum, dest, [&](uint8_t* mfm) {
+            if (const auto* cyl = archive_.cylinder(tracknum / 2))
+                format_std_track(mfm, tracknum, cyl + (tracknum & 1) * TRACK_SIZE);
+            else
+                memset(mfm, 0xaa, MFM_TRACK_SIZE_WORDS * 2); // Failed to decrunch, present it as an unformatted track
+        });
+    }
+
+    void write_mfm_track(uint8_t tracknum, const uint8_t* src) override
+    {
+        if (!adf_)
+            adf_ = std::make_unique<adf_disk_file>(std::make_unique<disk_image>(name_, archive_.unpack()));
+        adf_->write_mfm_track(tracknum, src);
     }
 
 private:
     std::string name_;
-    std::vector<uint8_t> data_;
-    bool dirty_;
+    mutable dms_archive archive_;
+    mutable mfm_track_cache cache_;
+    std::unique_ptr<adf_disk_file> adf_;
 };
 
 class extended_adf_disk_file : public disk_file {
 public:
-    extended_adf_disk_file(const std::string& name, std::vector<uint8_t>&& data)
-        : name_ { name }
-        , data_ { std::move(data) }
+    explicit extended_adf_disk_file(std::unique_ptr<disk_image>&& image)
+        : image_ { std::move(image) }
+        , name_ { image_->filename() }
+        , data_ { image_->data() }
     {
-        if (!detect(data_))
+        if (!detect(data_, image_->size()))
             throw std::runtime_error { name_ + " is not a valid extended ADF file" };
         const auto num_tracks = get_u16(&data_[10]); 
         info_.resize(num_tracks);
+        cache_ = std::make_unique<mfm_track_cache>(num_tracks);
 
         if (debug_stream)
             *debug_stream << "Loading extended ADF file " << name_ << " " << info_.size() << " tracks\n";
         uint32_t pos = 12;
-        const auto end = static_cast<uint32_t>(data_.size());
+        const auto end = static_cast<uint32_t>(image_->size());
         uint32_t ofs = 12 + 12 * num_tracks;
         for (auto& ti: info_) {
             if (pos + 12 > end)
@@ -232,10 +404,10 @@ public:
 
     ~extended_adf_disk_file() = default;
 
-    static bool detect(const std::vector<uint8_t>& data)
+    static bool detect(const uint8_t* data, uint64_t size)
     {
         // Limit to 84 cylinders (probably 83 is the right number)
-        if (data.size() < 12 || memcmp(data.data(), magic, sizeof(magic)))
+        if (size < 12 || memcmp(data, magic, sizeof(magic)))
             return false;
         const auto num_tracks = get_u16(&data[10]);
         if (num_tracks % 2 || num_tracks > max_cylinders * 2)
@@ -260,13 +432,18 @@ public:
         return false;
     }
 
+    bool write_protected() const override
+    {
+        return image_->mode() == disk_image_mode::read_only;
+    }
+
     void read_mfm_track(uint8_t tracknum, uint8_t* dest) const override
     {
         assert(tracknum < info_.size());
         const auto& ti = info_[tracknum];
 
         if (!ti.type) {
-            format_std_track(dest, tracknum, &data_[ti.offset]);
+            cache_->read(tracknum, dest, [&](uint8_t* mfm) { format_std_track(mfm, tracknum, &data_[ti.offset]); });
             return;
         }
 
@@ -293,24 +470,43 @@ private:
     static constexpr uint8_t magic[8] = { 'U', 'A', 'E', '-', '1', 'A', 'D', 'F' };
     static constexpr uint8_t max_cylinders = 84; // Probably 83 is more correct
 
+    std::unique_ptr<disk_image> image_;
     std::string name_;
-    std::vector<uint8_t> data_;
+    const uint8_t* data_;
     std::vector<track_info> info_;
+    std::unique_ptr<mfm_track_cache> cache_; // Only used for normal AmigaDOS tracks
 };
 }
 
-std::unique_ptr<disk_file> load_disk_file(const std::string& filename)
+std::unique_ptr<disk_file> load_disk_file(const std::string& filename, const disk_image_options& options)
 {
-    auto data = read_file(filename);
-    if (data.size() < 32)
+    // Overlay deltas only work for images used directly from the file, so don't create one until the format is known
+    const bool overlay = options.mode == disk_image_mode::overlay;
+    auto image = std::make_unique<disk_image>(filename, overlay ? disk_image_options { disk_image_mode::read_only, options.sync_interval_ms, options.overlay_dir } : options);
+    auto file_image = [&]() {
+        return overlay ? std::make_unique<disk_image>(filename, options) : std::move(image);
+    };
+    const uint8_t* data = image->data();
+    const auto size = image->size();
+    if (size < 32)
         throw std::runtime_error { filename + " is not a disk image" };
-    if (dms_detect(data))
-        return std::make_unique<adf_disk_file>(filename, dms_unpack(data));
-    if (extended_adf_disk_file::detect(data))
-        return std::make_unique<extended_adf_disk_file>(filename, std::move(data));
-    if (get_u32(&data[0]) == 1011) // HUNK_HEADER
-        return std::make_unique<adf_disk_file>(filename, make_exe_disk(filename, data));
-    if (data.size() != DISK_SIZE)
-        throw std::runtime_error { filename + " is not a valid disk image (wrong size)" };
-    return std::make_unique<adf_disk_file>(filename, std::move(data));
+    if (extended_adf_disk_file::detect(data, size))
+        return std::make_unique<extended_adf_disk_file>(file_image());
+    if (size == DISK_SIZE)
+        return std::make_unique<adf_disk_file>(file_image());
+    // Other formats are converted in memory (and behave as copy-on-write)
+    auto check_mode = [&]() {
+        if (overlay)
+            std::cerr << "Warning: Overlay mode is not supported for " << filename << " (converted in memory), modifications will be saved as " << filename << "_modified.adf\n";
+    };
+    std::vector<uint8_t> contents(data, data + size);
+    if (dms_detect(contents)) {
+        check_mode();
+        return std::make_unique<dms_disk_file>(filename, std::move(contents));
+    }
+    if (get_u32(&data[0]) == 1011) { // HUNK_HEADER
+        check_mode();
+        return std::make_unique<adf_disk_file>(std::make_unique<disk_image>(filename, make_exe_disk(filename, contents)));
+    }
+    throw std::runtime_error { filename + " is not a valid disk image (wrong size)" };
 }
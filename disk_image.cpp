@@ -0,0 +1,572 @@
+#include "disk_image.h"
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include "memory.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+
+[[noreturn]] void throw_system_error(const std::string& what)
+{
+#ifdef _WIN32
+    throw std::system_error(GetLastError(), std::system_category(), what);
+#else
+    throw std::system_error(errno, std::system_category(), what);
+#endif
+}
+
+// Platform specific file mapping
+class file_mapping {
+public:
+    explicit file_mapping(const std::string& filename, disk_image_mode mode)
+    {
+#ifdef _WIN32
+        const bool writable = mode == disk_image_mode::write_through;
+        file_ = CreateFileW(std::filesystem::path(filename).wstring().c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ | (writable ? 0 : FILE_SHARE_WRITE), nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            throw_system_error("Error opening " + filename);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size)) {
+            CloseHandle(file_);
+            throw_system_error("Error getting size of " + filename);
+        }
+        size_ = static_cast<uint64_t>(size.QuadPart);
+        if (!size_) {
+            CloseHandle(file_);
+            throw std::runtime_error { filename + " is empty" };
+        }
+        const DWORD protect = mode == disk_image_mode::read_only ? PAGE_READONLY : writable ? PAGE_READWRITE : PAGE_WRITECOPY;
+        mapping_ = CreateFileMappingW(file_, nullptr, protect, 0, 0, nullptr);
+        if (!mapping_) {
+            CloseHandle(file_);
+            throw_system_error("Error mapping " + filename);
+        }
+        const DWORD access = mode == disk_image_mode::read_only ? FILE_MAP_READ : writable ? FILE_MAP_WRITE : FILE_MAP_COPY;
+        data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, access, 0, 0, 0));
+        if (!data_) {
+            CloseHandle(mapping_);
+            CloseHandle(file_);
+            throw_system_error("Error mapping " + filename);
+        }
+#else
+        fd_ = open(filename.c_str(), mode == disk_image_mode::write_through ? O_RDWR : O_RDONLY);
+        if (fd_ < 0)
+            throw_system_error("Error opening " + filename);
+        struct stat st;
+        if (fstat(fd_, &st)) {
+            close(fd_);
+            throw_system_error("Error getting size of " + filename);
+        }
+        size_ = static_cast<uint64_t>(st.st_size);
+        if (!size_) {
+            close(fd_);
+            throw std::runtime_error { filename + " is empty" };
+        }
+        const int prot = mode == disk_image_mode::read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+        const int flags = mode == disk_image_mode::copy_on_write ? MAP_PRIVATE : MAP_SHARED;
+        void* p = mmap(nullptr, size_, prot, flags, fd_, 0);
+        if (p == MAP_FAILED) {
+            close(fd_);
+            throw_system_error("Error mapping " + filename);
+        }
+        data_ = static_cast<uint8_t*>(p);
+#endif
+    }
+
+    ~file_mapping()
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+        CloseHandle(file_);
+#else
+        munmap(data_, size_);
+        close(fd_);
+#endif
+    }
+
+    file_mapping(const file_mapping&) = delete;
+    file_mapping& operator=(const file_mapping&) = delete;
+
+    uint8_t* data()
+    {
+        return data_;
+    }
+
+    uint64_t size() const
+    {
+        return size_;
+    }
+
+    void sync(uint64_t begin, uint64_t end, bool wait)
+    {
+        assert(begin < end && end <= size_);
+#ifdef _WIN32
+        FlushViewOfFile(data_ + begin, static_cast<SIZE_T>(end - begin));
+        if (wait)
+            FlushFileBuffers(file_);
+#else
+        const uint64_t page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        begin &= ~(page_size - 1);
+        msync(data_ + begin, static_cast<size_t>(end - begin), wait ? MS_SYNC : MS_ASYNC);
+#endif
+    }
+
+private:
+    uint8_t* data_ = nullptr;
+    uint64_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// Thrown by file_lock if another instance holds the lock
+class file_in_use_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Exclusive lock on a file (created if necessary) held for the lifetime of the object.
+// Keeps several emulator instances (e.g. parallel -batch scenarios) from sharing a delta file.
+class file_lock {
+public:
+    explicit file_lock(const std::string& filename)
+    {
+#ifdef _WIN32
+        file_ = CreateFileW(std::filesystem::path(filename).wstring().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            throw_system_error("Error opening " + filename);
+        // Lock a byte far beyond the end of the file so the data can still be accessed through other handles
+        OVERLAPPED ov {};
+        ov.Offset = ov.OffsetHigh = 0xffffffff;
+        if (!LockFileEx(file_, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &ov)) {
+            const auto err = GetLastError();
+            CloseHandle(file_);
+            if (err == ERROR_LOCK_VIOLATION || err == ERROR_IO_PENDING)
+                throw file_in_use_error { filename + " is in use by another instance" };
+            throw std::system_error(err, std::system_category(), "Error locking " + filename);
+        }
+#else
+        fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0666);
+        if (fd_ < 0)
+            throw_system_error("Error opening " + filename);
+        if (flock(fd_, LOCK_EX | LOCK_NB)) {
+            const int err = errno;
+            close(fd_);
+            if (err == EWOULDBLOCK)
+                throw file_in_use_error { filename + " is in use by another instance" };
+            throw std::system_error(err, std::system_category(), "Error locking " + filename);
+        }
+#endif
+    }
+
+    ~file_lock()
+    {
+#ifdef _WIN32
+        CloseHandle(file_);
+#else
+        close(fd_);
+#endif
+    }
+
+    file_lock(const file_lock&) = delete;
+    file_lock& operator=(const file_lock&) = delete;
+
+private:
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// Identifies the base image a delta file was made for, so it isn't applied to a different image of the same size
+struct base_image_id {
+    uint64_t size;
+    uint64_t mtime; // Raw last write time (only compared for equality)
+    uint64_t hash; // FNV-1a of the first and last sample_size bytes
+
+    static constexpr uint64_t sample_size = 64 << 10;
+
+    explicit base_image_id(const std::string& filename, const uint8_t* data, uint64_t size)
+        : size { size }
+        , mtime { static_cast<uint64_t>(std::filesystem::last_write_time(filename).time_since_epoch().count()) }
+        , hash { 0xcbf29ce484222325ULL }
+    {
+        const auto first = std::min(size, sample_size);
+        const auto last = std::max(first, size - std::min(size, sample_size));
+        for (uint64_t i = 0; i < first; ++i)
+            hash = (hash ^ data[i]) * 0x100000001b3ULL;
+        for (uint64_t i = last; i < size; ++i)
+            hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+};
+
+// Sparse delta file holding the blocks written to an image opened in overlay mode. Layout:
+//   Header (magic, version, block size, base image size, mtime and hash)
+//   Bitmap of written blocks
+//   Block data (at data_offset + block * block_size, unwritten blocks are left as holes)
+class overlay_file {
+public:
+    explicit overlay_file(const std::string& filename, const base_image_id& base)
+        : filename_ { filename }
+        , lock_ { filename }
+        , base_size_ { base.size }
+        , num_blocks_ { (base_size_ + block_size - 1) / block_size }
+        , bitmap_((num_blocks_ + 7) / 8)
+        , data_offset_ { (header_size + bitmap_.size() + data_align - 1) & ~(data_align - 1) }
+    {
+        // The lock created the file if it didn't exist
+        if (!std::filesystem::file_size(filename_)) {
+            std::ofstream create { filename_, std::ofstream::binary };
+            uint8_t header[header_size] {};
+            std::memcpy(header, magic, sizeof(magic));
+            put_u32(&header[8], version);
+            put_u32(&header[12], block_size);
+            put_u64(&header[16], base.size);
+            put_u64(&header[24], base.mtime);
+            put_u64(&header[32], base.hash);
+            if (!create.write(reinterpret_cast<const char*>(header), sizeof(header)) || !create.write(reinterpret_cast<const char*>(bitmap_.data()), bitmap_.size()))
+                throw std::runtime_error { "Error creating " + filename_ };
+        }
+
+        f_.open(filename_, std::fstream::binary | std::fstream::in | std::fstream::out);
+        uint8_t header[header_size];
+        if (!f_.is_open() || !f_.read(reinterpret_cast<char*>(header), sizeof(header)))
+            throw std::runtime_error { "Error opening " + filename_ };
+        if (std::memcmp(header, magic, sizeof(magic)) || get_u32(&header[12]) != block_size)
+            throw std::runtime_error { filename_ + " is not a valid delta file" };
+        if (get_u32(&header[8]) != version)
+            throw std::runtime_error { filename_ + " has unsupported version " + std::to_string(get_u32(&header[8])) };
+        if (get_u64(&header[16]) != base.size)
+            throw std::runtime_error { filename_ + " doesn't match the size of the base image" };
+        if (get_u64(&header[24]) != base.mtime || get_u64(&header[32]) != base.hash)
+            throw std::runtime_error { filename_ + " was made for a different (or modified) base image" };
+        if (!f_.read(reinterpret_cast<char*>(bitmap_.data()), bitmap_.size()))
+            throw std::runtime_error { "Error reading " + filename_ };
+    }
+
+    ~overlay_file()
+    {
+        f_.flush();
+    }
+
+    const std::string& filename() const
+    {
+        return filename_;
+    }
+
+    // Copy previously written blocks into the image data
+    bool apply(uint8_t* data)
+    {
+        bool any = false;
+        for (uint64_t block = 0; block < num_blocks_; ++block) {
+            if (!(bitmap_[block / 8] & (1 << (block % 8))))
+                continue;
+            const auto ofs = block * block_size;
+            f_.seekg(data_offset_ + ofs);
+            if (!f_.read(reinterpret_cast<char*>(data + ofs), block_len(block)))
+                throw std::runtime_error { "Error reading " + filename_ };
+            any = true;
+        }
+        return any;
+    }
+
+    // Store all blocks touched by [offset; offset+len) from the (already updated) image data
+    void write(const uint8_t* data, uint64_t offset, uint64_t len)
+    {
+        assert(len && offset + len <= base_size_);
+        const auto first = offset / block_size;
+        const auto last = (offset + len - 1) / block_size;
+        const auto start = first * block_size;
+        const auto end = std::min(base_size_, (last + 1) * block_size);
+        f_.seekp(data_offset_ + start);
+        if (!f_.write(reinterpret_cast<const char*>(data + start), end - start))
+            throw std::runtime_error { "Error writing to " + filename_ };
+
+        bool bitmap_changed = false;
+        for (auto block = first; block <= last; ++block) {
+            auto& b = bitmap_[block / 8];
+            const uint8_t mask = static_cast<uint8_t>(1 << (block % 8));
+            if (!(b & mask)) {
+                b |= mask;
+                bitmap_changed = true;
+            }
+        }
+        if (bitmap_changed) {
+            f_.seekp(header_size + first / 8);
+            if (!f_.write(reinterpret_cast<const char*>(&bitmap_[first / 8]), last / 8 - first / 8 + 1))
+                throw std::runtime_error { "Error writing to " + filename_ };
+        }
+    }
+
+    void flush()
+    {
+        if (!f_.flush())
+            throw std::runtime_error { "Error writing to " + filename_ };
+    }
+
+private:
+    static constexpr char magic[8] = { 'A', 'M', 'I', 'D', 'E', 'L', 'T', 'A' };
+    static constexpr uint32_t version = 2;
+    static constexpr uint32_t block_size = 512;
+    static constexpr uint64_t header_size = 64;
+    static constexpr uint64_t data_align = 4096;
+
+    std::string filename_;
+    file_lock lock_;
+    uint64_t base_size_;
+    uint64_t num_blocks_;
+    std::vector<uint8_t> bitmap_;
+    uint64_t data_offset_;
+    std::fstream f_;
+
+    uint32_t block_len(uint64_t block) const
+    {
+        return static_cast<uint32_t>(std::min<uint64_t>(block_size, base_size_ - block * block_size));
+    }
+};
+
+// <name>.delta for the first instance using the image, <name>.2.delta for the second and so on
+std::string overlay_filename(const std::string& filename, const std::string& overlay_dir, unsigned instance)
+{
+    const auto base = std::filesystem::path { filename };
+    const auto suffix = (instance > 1 ? "." + std::to_string(instance) : std::string {}) + ".delta";
+    if (overlay_dir.empty())
+        return filename + suffix;
+    return (std::filesystem::path { overlay_dir } / base.filename()).string() + suffix;
+}
+
+constexpr unsigned max_overlay_instances = 100;
+
+} // unnamed namespace
+
+class disk_image::impl {
+public:
+    explicit impl(const std::string& filename, const disk_image_options& options)
+        : filename_ { filename }
+        , mode_ { options.mode }
+        , sync_interval_ { options.sync_interval_ms }
+        , mapping_ { std::make_unique<file_mapping>(filename, options.mode == disk_image_mode::overlay ? disk_image_mode::copy_on_write : options.mode) }
+        , data_ { mapping_->data() }
+        , size_ { mapping_->size() }
+        , last_sync_ { clock::now() }
+    {
+        if (mode_ == disk_image_mode::overlay) {
+            if (!options.overlay_dir.empty())
+                std::filesystem::create_directories(options.overlay_dir);
+            // Every running instance gets its own delta file, so the same image can be used by several at once
+            const base_image_id base { filename, data_, size_ };
+            for (unsigned instance = 1; !overlay_; ++instance) {
+                try {
+                    overlay_ = std::make_unique<overlay_file>(overlay_filename(filename, options.overlay_dir, instance), base);
+                } catch (const file_in_use_error&) {
+                    if (instance == max_overlay_instances)
+                        throw;
+                }
+            }
+            if (overlay_->filename() != overlay_filename(filename, options.overlay_dir, 1))
+                std::cout << "Using " << overlay_->filename() << " for modifications (the default delta file is in use)\n";
+            if (overlay_->apply(data_))
+                std::cout << "Applied modifications from " << overlay_->filename() << "\n";
+        }
+    }
+
+    explicit impl(const std::string& name, std::vector<uint8_t>&& data)
+        : filename_ { name }
+        , mode_ { disk_image_mode::copy_on_write }
+        , sync_interval_ { 0 }
+        , memory_ { std::move(data) }
+        , data_ { memory_.data() }
+        , size_ { memory_.size() }
+        , last_sync_ { clock::now() }
+    {
+        if (memory_.empty())
+            throw std::runtime_error { name + " is empty" };
+    }
+
+    ~impl()
+    {
+        try {
+            flush();
+        } catch (...) {
+        }
+    }
+
+    const std::string& filename() const
+    {
+        return filename_;
+    }
+
+    disk_image_mode mode() const
+    {
+        return mode_;
+    }
+
+    uint64_t size() const
+    {
+        return size_;
+    }
+
+    bool modified() const
+    {
+        return modified_;
+    }
+
+    const uint8_t* data() const
+    {
+        return data_;
+    }
+
+    void write(uint64_t offset, const uint8_t* src, uint64_t len)
+    {
+        if (mode_ == disk_image_mode::read_only)
+            throw std::runtime_error { filename_ + " is read only" };
+        if (offset > size_ || len > size_ - offset)
+            throw std::runtime_error { filename_ + ": Write out of range" };
+        if (!len)
+            return;
+        std::memcpy(data_ + offset, src, static_cast<size_t>(len));
+        modified_ = true;
+
+        if (mode_ == disk_image_mode::overlay) {
+            overlay_->write(data_, offset, len);
+            if (const auto now = clock::now(); now - last_sync_ >= sync_interval_) {
+                overlay_->flush();
+                last_sync_ = now;
+            }
+            return;
+        }
+        if (mode_ != disk_image_mode::write_through)
+            return;
+        if (dirty_begin_ < dirty_end_) {
+            dirty_begin_ = std::min(dirty_begin_, offset);
+            dirty_end_ = std::max(dirty_end_, offset + len);
+        } else {
+            dirty_begin_ = offset;
+            dirty_end_ = offset + len;
+        }
+        if (const auto now = clock::now(); now - last_sync_ >= sync_interval_) {
+            // Don't wait for the data to reach the disk here, just get it going
+            mapping_->sync(dirty_begin_, dirty_end_, false);
+            dirty_begin_ = dirty_end_ = 0;
+            last_sync_ = now;
+        }
+    }
+
+    void flush()
+    {
+        if (overlay_) {
+            overlay_->flush();
+            last_sync_ = clock::now();
+            return;
+        }
+        if (mode_ != disk_image_mode::write_through || !modified_)
+            return;
+        mapping_->sync(0, size_, true);
+        dirty_begin_ = dirty_end_ = 0;
+        last_sync_ = clock::now();
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::string filename_;
+    disk_image_mode mode_;
+    std::chrono::milliseconds sync_interval_;
+    std::unique_ptr<file_mapping> mapping_;
+    std::unique_ptr<overlay_file> overlay_;
+    std::vector<uint8_t> memory_;
+    uint8_t* data_;
+    uint64_t size_;
+    bool modified_ = false;
+    uint64_t dirty_begin_ = 0; // Range not yet synced (write_through only)
+    uint64_t dirty_end_ = 0;
+    clock::time_point last_sync_;
+};
+
+disk_image::disk_image(const std::string& filename, const disk_image_options& options)
+    : impl_ { std::make_unique<impl>(filename, options) }
+{
+}
+
+disk_image::disk_image(const std::string& name, std::vector<uint8_t>&& data)
+    : impl_ { std::make_unique<impl>(name, std::move(data)) }
+{
+}
+
+disk_image::~disk_image() = default;
+
+const std::string& disk_image::filename() const
+{
+    return impl_->filename();
+}
+
+disk_image_mode disk_image::mode() const
+{
+    return impl_->mode();
+}
+
+uint64_t disk_image::size() const
+{
+    return impl_->size();
+}
+
+bool disk_image::modified() const
+{
+    return impl_->modified();
+}
+
+const uint8_t* disk_image::data() const
+{
+    return impl_->data();
+}
+
+void disk_image::write(uint64_t offset, const uint8_t* src, uint64_t len)
+{
+    impl_->write(offset, src, len);
+}
+
+void disk_image::flush()
+{
+    impl_->flush();
+}
+
+bool parse_disk_image_mode(const std::string& name, disk_image_mode& mode)
+{
+    if (name == "ro")
+        mode = disk_image_mode::read_only;
+    else if (name == "cow")
+        mode = disk_image_mode::copy_on_write;
+    else if (name == "rw")
+        mode = disk_image_mode::write_through;
+    else if (name == "overlay")
+        mode = disk_image_mode::overlay;
+    else
+        return false;
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef DISK_IMAGE_H_INCLUDED
+#define DISK_IMAGE_H_INCLUDED
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+enum class disk_image_mode {
+    read_only, // Writes are refused
+    copy_on_write, // Writes are kept in memory, the file is never modified
+    write_through, // Writes go to the file
+    overlay, // Writes go to a sparse delta file (<name>.delta, <name>.N.delta if already in use), the base file is never modified
+};
+
+struct disk_image_options {
+    disk_image_mode mode;
+    uint32_t sync_interval_ms; // How often modifications are synced to disk in write_through/overlay mode
+    std::string overlay_dir; // Where delta files are stored in overlay mode (default: next to the image)
+};
+
+constexpr uint32_t default_disk_image_sync_interval_ms = 1000;
+
+// Memory mapped disk image (ADF/HDF), shared by the floppy and harddisk code
+class disk_image {
+public:
+    explicit disk_image(const std::string& filename, const disk_image_options& options);
+    // Image that only exists in memory (e.g. unpacked DMS file), always copy_on_write
+    explicit disk_image(const std::string& name, std::vector<uint8_t>&& data);
+    ~disk_image();
+
+    disk_image(const disk_image&) = delete;
+    disk_image& operator=(const disk_image&) = delete;
+
+    const std::string& filename() const;
+    disk_image_mode mode() const;
+    uint64_t size() const;
+    bool modified() const;
+
+    // Direct access to the image data (reflects any writes)
+    const uint8_t* data() const;
+
+    // Throws if the image is read only
+    void write(uint64_t offset, const uint8_t* src, uint64_t len);
+    // Make sure all writes have reached the file (no-op unless write_through/overlay)
+    void flush();
+
+private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+};
+
+// Returns true if the mode name was valid
+bool parse_disk_image_mode(const std::string& name, disk_image_mode& mode);
+
+#endif
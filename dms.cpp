@@ -3,10 +3,16 @@
 #include "memory.h"
 #include <stdexcept>
 #include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <iostream>
 
 //#define DMS_TRACE
 #ifdef DMS_TRACE
-#include <iostream>
 #include <iomanip>
 #endif
 
@@ -566,20 +572,37 @@ const uint8_t decruncher::d_len[256] = {
     0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
 };
 
-} // unnamed namespace
+constexpr uint16_t track_size = 11 * 512 * 2; // One DMS "track" is a full cylinder
 
+struct dms_track_entry {
+    dms_track_header hdr;
+    uint32_t offset; // Offset of packed data
 
-bool dms_detect(const std::vector<uint8_t>& data)
-{
-    return data.size() >= dms_archive_header_offset + dms_archive_header_size && get_u32(&data[0]) == dms_header_id;
-}
+    bool banner() const
+    {
+        // Track 0 of size 1024 is also a banner track
+        return hdr.track == 0xffff || (hdr.unpack_size == 1024 && hdr.track == 0);
+    }
 
-std::vector<uint8_t> dms_unpack(const std::vector<uint8_t>& data)
+    bool uses_decruncher() const
+    {
+        return hdr.pack_mode == 3 || hdr.pack_mode == 5 || hdr.pack_mode == 6;
+    }
+};
+
+struct dms_archive_info {
+    dms_archive_header hdr;
+    std::vector<dms_track_entry> tracks;
+};
+
+// Validates the headers, but doesn't touch the packed data
+dms_archive_info read_archive_info(const std::vector<uint8_t>& data)
 {
     if (!dms_detect(data))
         throw invalid_dms_file{"Header invalid"};
 
-    const auto hdr = read_archive_header(&data[dms_archive_header_offset]);
+    dms_archive_info info;
+    const auto& hdr = info.hdr = read_archive_header(&data[dms_archive_header_offset]);
     if (crc16(&data[dms_archive_header_offset], dms_archive_header_size - 2) != hdr.header_sum) {
         throw invalid_dms_file{"Header CRC mismatch"};
     }
@@ -608,15 +631,7 @@ std::vector<uint8_t> dms_unpack(const std::vector<uint8_t>& data)
 #undef PR
     std::cout << "Track Flags Psize RSize USize PF  PM  USum  DSum\n";
 #endif
-    decruncher decrunch;
-    decrunch.reset();
 
-    constexpr uint16_t track_size = 11 * 512 * 2;
-
-    std::vector<uint8_t> res;
-    res.resize(track_size * std::max(80, hdr.hightrack + 1)); // Create full 80 track disk even if fewer tracks are available (Megablast-a.dms)
-
-    std::vector<uint8_t> track_data;
     for (uint32_t offset = dms_archive_header_size + dms_archive_header_offset; offset < data.size();) {
         if (offset + dms_track_header_size > data.size())
             throw invalid_dms_file{"End of file while reading track header"};
@@ -634,65 +649,290 @@ std::vector<uint8_t> dms_unpack(const std::vector<uint8_t>& data)
         if (offset + tr_hdr.pack_size > data.size())
             throw invalid_dms_file { "End of file while reading track packed data" };
 
-        if (crc16(&data[offset], tr_hdr.pack_size) != tr_hdr.data_sum)
-            throw invalid_dms_file { "CRC mismatch for packed data" };
-
-        track_data.resize(tr_hdr.unpack_size);
-
-        switch (tr_hdr.pack_mode) {
-        case 0: // Store
-            if (tr_hdr.unpack_size != tr_hdr.pack_size)
-                throw invalid_dms_file { "Invalid unpack size for store" };
-            memcpy(&track_data[0], &data[offset], tr_hdr.unpack_size);
-            break;
-        case 1: // Simple (= RLE only)
-            if (tr_hdr.pack_size != tr_hdr.rle_size)
-                throw invalid_dms_file { "Invalid rle/pack size for simple crunch mode" };
-            track_data = rle_decode(&data[offset], tr_hdr.rle_size);
-            break;
-        case 3: // Medium
-            track_data.resize(tr_hdr.rle_size);
-            decrunch.medium(&data[offset], tr_hdr.pack_size, &track_data[0], tr_hdr.rle_size);
-            track_data = rle_decode(track_data.data(), track_data.size());
-            break;
-        case 5: // Heavy1
-        case 6: // Heavy2
-            track_data.resize(tr_hdr.rle_size);
-            decrunch.heavy(&data[offset], tr_hdr.pack_size, &track_data[0], tr_hdr.rle_size, !!(tr_hdr.pack_flag & 2), tr_hdr.pack_mode == 6);
-            if (tr_hdr.pack_flag & 4)
-                track_data = rle_decode(track_data.data(), track_data.size());
-            break;
-        default:
-            throw invalid_dms_file { "Unsupported DMS packing method $" + hexstring(tr_hdr.pack_mode) };
+        const dms_track_entry entry { tr_hdr, offset };
+        if (!entry.banner()) {
+            if (tr_hdr.track > hdr.hightrack)
+                throw invalid_dms_file { "Track $" + hexstring(tr_hdr.track) + " is out range $" + hexstring(hdr.hightrack) };
+
+            if (tr_hdr.unpack_size != track_size)
+                throw invalid_dms_file { "Track $" + hexstring(tr_hdr.track) + " has invalid size $" + hexstring(tr_hdr.unpack_size) };
         }
+        info.tracks.push_back(entry);
 
-        if (track_data.size() != tr_hdr.unpack_size)
-            throw invalid_dms_file { "Track decrunch failed" };
+        offset += tr_hdr.pack_size;
+    }
 
-        if (sum16(track_data.data(), static_cast<uint32_t>(track_data.size())) != tr_hdr.unpack_sum)
-            throw invalid_dms_file { "Track checksum invalid" };
+    return info;
+}
 
-        if (!(tr_hdr.pack_flag & 1))
-            decrunch.reset();
+void decrunch_track(decruncher& decrunch, const uint8_t* src, const dms_track_header& tr_hdr, std::vector<uint8_t>& track_data)
+{
+    if (crc16(src, tr_hdr.pack_size) != tr_hdr.data_sum)
+        throw invalid_dms_file { "CRC mismatch for packed data" };
+
+    track_data.resize(tr_hdr.unpack_size);
+
+    switch (tr_hdr.pack_mode) {
+    case 0: // Store
+        if (tr_hdr.unpack_size != tr_hdr.pack_size)
+            throw invalid_dms_file { "Invalid unpack size for store" };
+        memcpy(&track_data[0], src, tr_hdr.unpack_size);
+        break;
+    case 1: // Simple (= RLE only)
+        if (tr_hdr.pack_size != tr_hdr.rle_size)
+            throw invalid_dms_file { "Invalid rle/pack size for simple crunch mode" };
+        track_data = rle_decode(src, tr_hdr.rle_size);
+        break;
+    case 3: // Medium
+        track_data.resize(tr_hdr.rle_size);
+        decrunch.medium(src, tr_hdr.pack_size, &track_data[0], tr_hdr.rle_size);
+        track_data = rle_decode(track_data.data(), track_data.size());
+        break;
+    case 5: // Heavy1
+    case 6: // Heavy2
+        track_data.resize(tr_hdr.rle_size);
+        decrunch.heavy(src, tr_hdr.pack_size, &track_data[0], tr_hdr.rle_size, !!(tr_hdr.pack_flag & 2), tr_hdr.pack_mode == 6);
+        if (tr_hdr.pack_flag & 4)
+            track_data = rle_decode(track_data.data(), track_data.size());
+        break;
+    default:
+        throw invalid_dms_file { "Unsupported DMS packing method $" + hexstring(tr_hdr.pack_mode) };
+    }
 
-        // Track 0 of size 1024 is also a banner track
-        if (tr_hdr.track == 0xffff || (tr_hdr.unpack_size == 1024 && tr_hdr.track == 0)) {
+    if (track_data.size() != tr_hdr.unpack_size)
+        throw invalid_dms_file { "Track decrunch failed" };
+
+    if (sum16(track_data.data(), static_cast<uint32_t>(track_data.size())) != tr_hdr.unpack_sum)
+        throw invalid_dms_file { "Track checksum invalid" };
+
+    if (!(tr_hdr.pack_flag & 1))
+        decrunch.reset();
+}
+
+// Decrunch tracks [first, last) into res (which holds all cylinders), starting with a fresh decruncher at track 'start'
+// 'done' (if given) is updated to one past the last track that was successfully decrunched
+void decrunch_tracks(const std::vector<uint8_t>& data, const std::vector<dms_track_entry>& tracks, size_t start, size_t first, size_t last, uint8_t* res, size_t* done = nullptr)
+{
+    assert(start <= first && first <= last && last <= tracks.size());
+    auto decrunch = std::make_unique<decruncher>();
+    decrunch->reset();
+    std::vector<uint8_t> track_data;
+    for (size_t i = start; i < last; ++i) {
+        const auto& t = tracks[i];
+        decrunch_track(*decrunch, &data[t.offset], t.hdr, track_data);
+        if (done)
+            *done = i + 1;
+        if (i < first || t.banner()) {
 #ifdef DMS_TRACE
-            std::cout << "Skipping track $" << hexfmt(tr_hdr.track) << " - Banner track\n";
-            hexdump(std::cout, track_data.data(), track_data.size());
+            if (t.banner()) {
+                std::cout << "Skipping track $" << hexfmt(t.hdr.track) << " - Banner track\n";
+                hexdump(std::cout, track_data.data(), track_data.size());
+            }
 #endif
-        } else {
-            if (tr_hdr.track > hdr.hightrack)
-                throw invalid_dms_file { "Track $" + hexstring(tr_hdr.track) + " is out range $" + hexstring(hdr.hightrack) };
+            continue;
+        }
+        memcpy(&res[t.hdr.track * track_size], track_data.data(), track_size);
+    }
+}
 
-            if (tr_hdr.unpack_size != track_size)
-                throw invalid_dms_file { "Track $" + hexstring(tr_hdr.track) + " has invalid size $" + hexstring(tr_hdr.unpack_size) };
+uint32_t dms_num_cylinders(const dms_archive_header& hdr)
+{
+    return std::max(80, hdr.hightrack + 1); // Create full 80 track disk even if fewer tracks are available (Megablast-a.dms)
+}
 
-            memcpy(&res[tr_hdr.track * track_size], track_data.data(), track_size);
+} // unnamed namespace
+
+
+bool dms_detect(const std::vector<uint8_t>& data)
+{
+    return data.size() >= dms_archive_header_offset + dms_archive_header_size && get_u32(&data[0]) == dms_header_id;
+}
+
+std::vector<uint8_t> dms_unpack(const std::vector<uint8_t>& data)
+{
+    const auto info = read_archive_info(data);
+    std::vector<uint8_t> res(track_size * dms_num_cylinders(info.hdr));
+    decrunch_tracks(data, info.tracks, 0, 0, info.tracks.size(), res.data());
+    return res;
+}
+
+class dms_archive::impl {
+public:
+    explicit impl(std::vector<uint8_t>&& data)
+        : data_ { std::move(data) }
+    {
+        auto info = read_archive_info(data_);
+        tracks_ = std::move(info.tracks);
+        res_.resize(track_size * dms_num_cylinders(info.hdr));
+        cylinder_chain_.resize(dms_num_cylinders(info.hdr), no_chain);
+        cylinder_track_.resize(cylinder_chain_.size());
+
+        // Split the tracks into chains that can be decrunched independently. A track depends on the
+        // previous ones unless the decruncher has been reset since the last track that used it.
+        // Heavy tracks that don't include their own huffman tables also depend on earlier tracks.
+        bool fresh = true;
+        for (size_t i = 0; i < tracks_.size(); ++i) {
+            const auto& t = tracks_[i];
+            const bool needs_tables = (t.hdr.pack_mode == 5 || t.hdr.pack_mode == 6) && !(t.hdr.pack_flag & 2);
+            if (chains_.empty() || (fresh && !needs_tables))
+                chains_.push_back(chain { i, i, chain_state::pending, 0, {}, false });
+            chains_.back().last = i + 1;
+            if (!t.banner()) {
+                cylinder_chain_[t.hdr.track] = static_cast<uint32_t>(chains_.size() - 1);
+                cylinder_track_[t.hdr.track] = i;
+            }
+            if (!(t.hdr.pack_flag & 1))
+                fresh = true;
+            else if (t.uses_decruncher())
+                fresh = false;
         }
 
-        offset += tr_hdr.pack_size;
+        // Leave one core for the emulator itself
+        const auto hw_threads = std::thread::hardware_concurrency();
+        const auto num_threads = std::min<size_t>(std::max(1U, hw_threads > 1 ? hw_threads - 1 : 1U), chains_.size());
+        for (size_t i = 0; i < num_threads; ++i)
+            threads_.emplace_back([this]() { prefetch(); });
     }
 
-    return res;
+    ~impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            stop_ = true;
+        }
+        for (auto& t : threads_)
+            t.join();
+    }
+
+    uint32_t num_cylinders() const
+    {
+        return static_cast<uint32_t>(cylinder_chain_.size());
+    }
+
+    const uint8_t* cylinder(uint32_t cyl)
+    {
+        assert(cyl < cylinder_chain_.size());
+        if (cylinder_chain_[cyl] != no_chain) {
+            std::unique_lock<std::mutex> lock { mutex_ };
+            auto& c = chains_[cylinder_chain_[cyl]];
+            if (c.state == chain_state::pending) {
+                // Not picked up by the prefetch threads yet, decrunch it here
+                c.state = chain_state::running;
+                lock.unlock();
+                run(c);
+                lock.lock();
+            } else {
+                cv_.wait(lock, [&c]() { return c.state != chain_state::running; });
+            }
+            if (!c.error.empty() && cylinder_track_[cyl] >= c.done) {
+                // Decrunching stopped at or before this track. Don't take the emulator down
+                // because of a damaged archive, the track just becomes unreadable.
+                if (!c.reported) {
+                    c.reported = true;
+                    std::cerr << "DMS: " << c.error << " (track $" << hexfmt(tracks_[std::max(c.done, c.first)].hdr.track) << "), treating the remaining tracks of the chain as unreadable\n";
+                }
+                return nullptr;
+            }
+        }
+        return &res_[cyl * track_size];
+    }
+
+    // Unreadable cylinders are left zeroed
+    std::vector<uint8_t> unpack()
+    {
+        for (uint32_t cyl = 0; cyl < num_cylinders(); ++cyl)
+            cylinder(cyl);
+        return res_;
+    }
+
+private:
+    static constexpr uint32_t no_chain = ~0U;
+    enum class chain_state { pending, running, done };
+    struct chain {
+        size_t first;
+        size_t last;
+        chain_state state = chain_state::pending;
+        size_t done = 0; // One past the last track decrunched successfully
+        std::string error; // Set if decrunching failed (tracks from 'done' on are unavailable)
+        bool reported = false;
+    };
+
+    const std::vector<uint8_t> data_;
+    std::vector<dms_track_entry> tracks_;
+    std::vector<chain> chains_;
+    std::vector<uint32_t> cylinder_chain_; // Index of chain containing the cylinder (or no_chain if not present in the archive)
+    std::vector<size_t> cylinder_track_; // Index of the track holding the cylinder (only valid if it's part of a chain)
+    std::vector<uint8_t> res_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::thread> threads_;
+    size_t next_chain_ = 0;
+    bool stop_ = false;
+
+    // Called with the chain marked running, and without holding the lock
+    void run(chain& c)
+    {
+        std::string error;
+        size_t done = c.first;
+        try {
+            try {
+                decrunch_tracks(data_, tracks_, c.first, c.first, c.last, res_.data(), &done);
+            } catch (const invalid_dms_file&) {
+                // Should not happen, but in case the chain wasn't really independent (decruncher
+                // state that isn't reset), restart from the first track like a sequential unpack.
+                if (!c.first)
+                    throw;
+                done = 0;
+                decrunch_tracks(data_, tracks_, 0, c.first, c.last, res_.data(), &done);
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            c.state = chain_state::done;
+            c.done = done;
+            c.error = error;
+        }
+        cv_.notify_all();
+    }
+
+    void prefetch()
+    {
+        for (;;) {
+            chain* c = nullptr;
+            {
+                std::lock_guard<std::mutex> lock { mutex_ };
+                while (!stop_ && next_chain_ < chains_.size() && chains_[next_chain_].state != chain_state::pending)
+                    ++next_chain_;
+                if (stop_ || next_chain_ == chains_.size())
+                    return;
+                c = &chains_[next_chain_++];
+                c->state = chain_state::running;
+            }
+            run(*c);
+        }
+    }
+};
+
+dms_archive::dms_archive(std::vector<uint8_t>&& data)
+    : impl_ { std::make_unique<impl>(std::move(data)) }
+{
+}
+
+dms_archive::~dms_archive() = default;
+
+uint32_t dms_archive::num_cylinders() const
+{
+    return impl_->num_cylinders();
+}
+
+const uint8_t* dms_archive::cylinder(uint32_t cyl)
+{
+    return impl_->cylinder(cyl);
+}
+
+std::vector<uint8_t> dms_archive::unpack()
+{
+    return impl_->unpack();
 }
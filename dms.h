@@ -2,9 +2,31 @@
 #define DMS_H_INCLUDED
 
 #include <stdint.h>
+#include <memory>
 #include <vector>
 
 bool dms_detect(const std::vector<uint8_t>& data);
 std::vector<uint8_t> dms_unpack(const std::vector<uint8_t>& data);
 
+// DMS archive that is decrunched lazily. The headers are validated up front, cylinders are
+// unpacked on first access while the rest are prefetched by background threads.
+class dms_archive {
+public:
+    explicit dms_archive(std::vector<uint8_t>&& data);
+    ~dms_archive();
+
+    uint32_t num_cylinders() const;
+
+    // Returns the unpacked data (2*11*512 bytes) for the cylinder, waiting for it to be decrunched if necessary.
+    // Returns nullptr if the cylinder couldn't be decrunched (the error is logged once).
+    const uint8_t* cylinder(uint32_t cyl);
+
+    // Unpack everything (same result as dms_unpack)
+    std::vector<uint8_t> unpack();
+
+private:
+    class impl;
+    std::unique_ptr<impl> impl_;
+};
+
 #endif
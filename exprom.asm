@@ -8,7 +8,7 @@
 RomStart=0
 
 VERSION=0
-REVISION=5
+REVISION=7
 
 DEBUG=0
 
@@ -20,6 +20,20 @@ OP_FSINITSEG=$fee2
 OP_VOLUME_GET_ID=$fee3
 OP_VOLUME_INIT=$fee4
 OP_VOLUME_PACKET=$fee5
+OP_LOADSEG_INIT=$fee6
+OP_LOADSEG_INFO=$fee7
+OP_LOADSEG_HUNK=$fee8
+OP_LOADSEG_RELOC=$fee9
+
+; Host registers (relative to RomCodeEnd) used for asynchronous requests
+REG_QUEUED=8            ; W: Non-zero if the last request was queued (replied from the interrupt server)
+REG_ASYNC=10            ; W: Non-zero if the host completes requests asynchronously
+REG_DONE_MSG=12         ; L: Next completed message (reading removes it), 0 if none
+REG_DONE_PORT=16        ; L: Reply port for REG_DONE_MSG (0 = ReplyMsg)
+
+; Host registers for accelerated LoadSeg from shared folders
+REG_OLD_LOADSEG=20      ; L: Original dos.library LoadSeg vector
+REG_LOADSEG_PATCH=24    ; W: Non-zero if the LoadSeg patch should be installed (enabled and not yet done)
 
 RT_MATCHWORD=$00		; UWORD word to match on (ILLEGAL)
 RT_MATCHTAG=$02			; APTR  pointer to the above (RT_MATCHWORD)
@@ -54,6 +68,7 @@ _LVOInitResident=-102
 _LVOAlert=-108
 _LVOForbid=-132
 _LVOPermit=-138
+_LVOAddIntServer=-168
 _LVOAllocMem=-198
 _LVOFreeMem=-210
 _LVOAllocEntry=-222
@@ -68,6 +83,7 @@ _LVOGetMsg=-372
 _LVOReplyMsg=-378
 _LVOWaitPort=-384
 _LVOOldOpenLibrary=-408
+_LVOSetFunction=-420
 _LVOCloseLibrary=-414
 _LVODoIO=-456
 _LVOAddResource=-486
@@ -89,7 +105,11 @@ _LVOAddDosNode=-150
 eb_MountList=74
 
 ; dos.library
+_LVOLock=-84
+_LVOUnLock=-90
 _LVOCreateProc=-138
+_LVOLoadSeg=-150
+_LVOUnLoadSeg=-156
 _LVODeviceProc=-174
 _LVODateStamp=-192
 _LVODelay=-198
@@ -108,6 +128,7 @@ rn_Info=$0018
 di_DevInfo=$0004
 
 pr_MsgPort=$5c
+pr_Result2=$94
 pr_FileSystemTask=$a8
 pr_WindowPtr=$b8
 
@@ -211,6 +232,12 @@ BootNode_SIZEOF=$14
 MEMF_PUBLIC=$1
 MEMF_CLEAR=$10000
 
+INTB_PORTS=3
+
+IS_DATA=$0E
+IS_CODE=$12
+IS_SIZE=$16
+
 ; struct MemEntry
 me_Addr=0
 me_Length=4
@@ -355,6 +382,9 @@ ACTION_LOCATE_OBJECT=8
 DOSTRUE=-1
 DOSFALSE=0
 
+ACCESS_READ=-2
+ERROR_NO_FREE_STORE=103
+
 ; struct DosList
 dol_Next=$0
 dol_Type=$4
@@ -876,6 +906,25 @@ initRoutine:
         beq     irError
         move.l  d0, a4    ; a4=expansion library
 
+        ; Install interrupt server for completing queued requests
+        lea     RomCodeEnd(pc), a0
+        tst.w   REG_ASYNC(a0)
+        beq.b   irIntOK
+        moveq   #IS_SIZE, d0
+        move.l  #MEMF_CLEAR+MEMF_PUBLIC, d1
+        jsr     _LVOAllocMem(a6)
+        tst.l   d0
+        beq     irError
+        move.l  d0, a1
+        move.b  #NT_INTERRUPT, LN_TYPE(a1)
+        lea     DevName(pc), a0
+        move.l  a0, LN_NAME(a1)
+        lea     IntServer(pc), a0
+        move.l  a0, IS_CODE(a1)
+        moveq   #INTB_PORTS, d0
+        jsr     _LVOAddIntServer(a6)
+irIntOK:
+
         ; Check if we need to install any filesystems
         lea     RomCodeEnd(pc), a0
         move.w  2(a0), d6       ; d6 = number of filesystems to install
@@ -1505,6 +1554,10 @@ BeginIO: ; ( iob: a1, device:a6 )
         move.l  a1, (a0)
         move.w  #OP_IOREQ, 4(a0)
 
+        ; Queued requests (IOF_QUICK cleared by host) are replied from IntServer
+        tst.w   REG_QUEUED(a0)
+        bne     BeginIO_End
+
         btst    #IOB_QUICK, IO_FLAGS(a1)
         bne     BeginIO_End
 
@@ -1522,6 +1575,27 @@ AbortIO:
         move.b  #0, IO_ERROR(a1)
         rts
 
+; PORTS interrupt server, replies to requests completed by the host
+; (the host has already filled in the results)
+IntServer:
+        move.l  $4.w, a6
+        lea     RomCodeEnd(pc), a5
+.loop:
+        move.l  REG_DONE_MSG(a5), d0
+        beq.b   .done
+        move.l  d0, a1
+        move.l  REG_DONE_PORT(a5), d0
+        beq.b   .reply
+        move.l  d0, a0
+        jsr     _LVOPutMsg(a6)
+        bra.b   .loop
+.reply:
+        jsr     _LVOReplyMsg(a6)
+        bra.b   .loop
+.done:
+        moveq   #0, d0 ; Let other servers run
+        rts
+
 ; In: a6=SysBase Out: d0=Filesystem resource
 CreateFileSysResource:
         move.l  #fsr_Sizeof, d0
@@ -1679,6 +1753,7 @@ FakeSegList:
         move.w  #OP_VOLUME_INIT, 4(a5)
 
         move.l  handler_SysBase(a4), a6
+        bsr     InstallLoadSeg
 .waitmsg:
         ; In this loop:
         ; a4 = handler data, a5 = comm area, a6 = ExecBase
@@ -1712,6 +1787,10 @@ FakeSegList:
         move.l  a2, (a5)
         move.w  #OP_VOLUME_PACKET, 4(a5)
 
+        ; Queued packets are replied from IntServer
+        tst.w   REG_QUEUED(a5)
+        bne     .msgloop
+
         bsr     .dosreply
 
         bra     .msgloop
@@ -1822,4 +1901,127 @@ GetDosList:
         lea.l   di_DevInfo(a0), a0
         rts
 
+; Patch dos.library LoadSeg (once) if the host wants to load executables from shared folders
+; a4 = handler data, a5 = comm area, a6 = ExecBase
+InstallLoadSeg:
+        move.l  handler_DosBase(a4), a1
+        ; Only V36+ (KS1.x uses the BCPL LoadSeg from the global vector)
+        cmp.w   #36, LIB_VERSION(a1)
+        bcs.b   .out
+        jsr     _LVOForbid(a6)
+        tst.w   REG_LOADSEG_PATCH(a5)
+        beq.b   .permit
+        move.w  #_LVOLoadSeg, a0
+        lea     NewLoadSeg(pc), a2
+        move.l  a2, d0
+        jsr     _LVOSetFunction(a6)
+        ; Tell host the old vector
+        move.l  d0, (a5)
+        move.w  #OP_LOADSEG_INIT, 4(a5)
+.permit:
+        jsr     _LVOPermit(a6)
+.out:
+        rts
+
+        ; Structure shared with emulator
+        ; Keep in sync
+        rsreset
+ls_Lock         rs.l 1 ; In: BPTR to lock on the file
+ls_Num          rs.l 1 ; INFO: Out=number of hunks (0 => not handled), HUNK: In=hunk number, RELOC: Out=0 on failure
+ls_Size         rs.l 1 ; HUNK: Out=allocation size
+ls_Flags        rs.l 1 ; HUNK: Out=AllocMem requirements
+ls_SegList      rs.l 1 ; RELOC: In=BPTR to segment list
+ls_Sizeof       rs.b 0
+
+; seglist = LoadSeg(name)
+; D0                D1
+; Executables on shared folders are loaded and relocated by the host, anything else
+; is passed on to the original LoadSeg
+NewLoadSeg:
+        movem.l d1-d7/a0-a6, -(sp)
+        sub.l   #ls_Sizeof, sp
+        move.l  sp, a3 ; a3 = request
+        lea     RomCodeEnd(pc), a4 ; a4 = comm area
+        move.l  a6, a5 ; a5 = DosBase
+
+        moveq   #ACCESS_READ, d2
+        jsr     _LVOLock(a6)
+        move.l  d0, ls_Lock(a3)
+        beq     .fallback
+
+        move.l  $4.w, a6
+        jsr     _LVOForbid(a6)
+
+        move.l  a3, (a4)
+        move.w  #OP_LOADSEG_INFO, 4(a4)
+        move.l  ls_Num(a3), d3 ; d3 = number of hunks
+        beq     .notours
+
+        ; Allocate and link hunks
+        clr.l   ls_SegList(a3)
+        lea     ls_SegList(a3), a2 ; a2 = link to update
+        moveq   #0, d2
+.alloc:
+        move.l  d2, ls_Num(a3)
+        move.l  a3, (a4)
+        move.w  #OP_LOADSEG_HUNK, 4(a4)
+        move.l  ls_Size(a3), d0
+        move.l  ls_Flags(a3), d1
+        jsr     _LVOAllocMem(a6)
+        tst.l   d0
+        beq.b   .nomem
+        move.l  d0, a0
+        move.l  ls_Size(a3), (a0)+
+        clr.l   (a0)
+        move.l  a0, d0
+        lsr.l   #2, d0 ; To BPTR
+        move.l  d0, (a2)
+        move.l  a0, a2
+        addq.l  #1, d2
+        cmp.l   d2, d3
+        bne.b   .alloc
+
+        ; Let the host fill in and relocate the hunks
+        move.l  a3, (a4)
+        move.w  #OP_LOADSEG_RELOC, 4(a4)
+        move.l  ls_SegList(a3), d7
+        tst.l   ls_Num(a3)
+        bne.b   .done
+        ; File changed in the mean time, let DOS handle it
+        bsr.b   .unload
+.notours:
+        jsr     _LVOPermit(a6)
+        move.l  ls_Lock(a3), d1
+        exg.l   a5, a6
+        jsr     _LVOUnLock(a6)
+.fallback:
+        add.l   #ls_Sizeof, sp
+        movem.l (sp)+, d1-d7/a0-a6
+        move.l  RomCodeEnd+REG_OLD_LOADSEG(pc), -(sp)
+        rts
+
+.nomem:
+        bsr.b   .unload
+        moveq   #0, d7
+        move.l  ThisTask(a6), a0
+        move.l  #ERROR_NO_FREE_STORE, pr_Result2(a0)
+.done:
+        jsr     _LVOPermit(a6)
+        move.l  ls_Lock(a3), d1
+        exg.l   a5, a6
+        jsr     _LVOUnLock(a6)
+        move.l  d7, d0
+        add.l   #ls_Sizeof, sp
+        movem.l (sp)+, d1-d7/a0-a6
+        rts
+
+; Free the (partial) segment list, a5 = DosBase
+.unload:
+        move.l  a6, -(sp)
+        move.l  a5, a6
+        move.l  ls_SegList(a3), d1
+        jsr     _LVOUnLoadSeg(a6)
+        move.l  (sp)+, a6
+        rts
+
 RomCodeEnd:
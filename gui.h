@@ -21,6 +21,7 @@ public:
         disk_inserted,
         debug_mode,
         joystick,
+        warp_mode,
     };
     struct keyboard_event {
         bool pressed;
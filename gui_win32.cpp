@@ -1685,7 +1685,7 @@ private:
             else if (!active_)
                 return 0;
             else if (wParam == VK_F11) {
-                // For now do nothing
+                events_.push_back({ event_type::warp_mode, {} });
             }
             else if (wParam == VK_F12) {
                 const bool was_captured = mouse_captured_;
@@ -3,6 +3,7 @@
 #include "ioutil.h"
 #include "autoconf.h"
 #include "state_file.h"
+#include "disk_image.h"
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
@@ -13,6 +14,18 @@
 #include <algorithm>
 #include <variant>
 #include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <tuple>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 //#define LOCAL_RAM_DEBUG
 //#define FS_HANDLER_DEBUG 3
@@ -24,6 +37,7 @@ namespace {
 #include "exprom.h"
 
 constexpr uint32_t EXPROM_BASE = 0x40; // Must match value in exprom.asm
+constexpr uint32_t fs_io_chunk_size = 64 * 1024; // Max bytes transferred per block copy for ACTION_READ/ACTION_WRITE
 
 // Shared with exprom
 // constexpr uint32_t handler_SysBase = 0x00;
@@ -32,6 +46,19 @@ constexpr uint32_t handler_MsgPort = 0x08;
 constexpr uint32_t handler_DosList = 0x0C;
 constexpr uint32_t handler_Id      = 0x10;
 
+// LoadSeg request, shared with exprom
+constexpr uint32_t ls_Lock    = 0x00;
+constexpr uint32_t ls_Num     = 0x04;
+constexpr uint32_t ls_Size    = 0x08;
+constexpr uint32_t ls_Flags   = 0x0C;
+constexpr uint32_t ls_SegList = 0x10;
+
+constexpr uint32_t MEMF_PUBLIC = 1 << 0;
+constexpr uint32_t MEMF_CHIP = 1 << 1;
+constexpr uint32_t MEMF_FAST = 1 << 2;
+
+constexpr uint64_t loadseg_cache_max_bytes = 64 << 20; // Cache is flushed when the executables in it exceed this size
+
 constexpr uint32_t IDNAME_RIGIDDISK = 0x5244534B; // 'RDSK'
 constexpr uint32_t IDNAME_PARTITION = 0x50415254; // 'PART'
 constexpr uint32_t IDNAME_FILESYSHEADER = 0x46534844; // 'FSHD'
@@ -40,6 +67,7 @@ constexpr uint32_t IDNAME_LOADSEG = 0x4C534547; // 'LSEG'
 constexpr int8_t IOERR_NOCMD = -3;
 // constexpr int8_t IOERR_BADLENGTH = -4;
 constexpr int8_t IOERR_BADADDRESS = -5;
+constexpr int8_t TDERR_WriteProt = 28;
 
 struct scsi_cmd {
     uint32_t scsi_Data; /* word aligned data for SCSI Data Phase */
@@ -339,28 +367,35 @@ std::string read_bcpl_string(memory_handler& mem, uint32_t ptr)
     return s;
 }
 
-bool ci_equal(const std::string_view l, const std::string_view r)
+// Key for case insensitive lookups
+std::string ci_key(const std::string_view s)
 {
-    if (l.length() != r.length())
-        return false;
-    auto case_convert = [](char ch) {
-        // TODO: "DOS\3" style INTL compare at some point
-        return ch >= 'a' && ch <= 'z' ? ch - ('a' - 'A') : ch;
-    };
-    for (size_t i = 0, len = l.length(); i < len; ++i)
-        if (case_convert(l[i]) != case_convert(r[i]))
-            return false;
-    return true;
+    // TODO: "DOS\3" style INTL compare at some point
+    std::string key { s };
+    for (auto& ch : key) {
+        if (ch >= 'a' && ch <= 'z')
+            ch -= 'a' - 'A';
+    }
+    return key;
 }
 
-constexpr uint32_t HUNK_HEADER = 1011;
+constexpr uint32_t HUNK_NAME = 1000;
 constexpr uint32_t HUNK_CODE = 1001;
 constexpr uint32_t HUNK_DATA = 1002;
 constexpr uint32_t HUNK_BSS = 1003;
 constexpr uint32_t HUNK_RELOC32 = 1004;
+constexpr uint32_t HUNK_SYMBOL = 1008;
+constexpr uint32_t HUNK_DEBUG = 1009;
 constexpr uint32_t HUNK_END = 1010;
+constexpr uint32_t HUNK_HEADER = 1011;
+constexpr uint32_t HUNK_DREL32 = 1015; // Treated as HUNK_RELOC32SHORT in executables (V37+)
+constexpr uint32_t HUNK_RELOC32SHORT = 1020;
+
+constexpr uint32_t HUNKF_CHIP = 1U << 30;
+constexpr uint32_t HUNKF_FAST = 1U << 31;
 
 constexpr uint32_t max_hunks = 3; // keep in check with expansion rom
+constexpr uint32_t max_loadseg_hunks = 4096; // For executables loaded from shared folders
 
 struct hunk_reloc {
     uint32_t dst_hunk;
@@ -370,11 +405,17 @@ struct hunk_reloc {
 struct hunk {
     uint32_t flags;
     uint32_t type;
+    uint32_t mem_attrs; // Explicit memory attributes (only when both HUNKF_CHIP and HUNKF_FAST are set)
     std::vector<uint8_t> data;
     std::vector<hunk_reloc> relocs;
+
+    uint32_t size_bytes() const
+    {
+        return (flags & 0x3FFFFFFF) * 4;
+    }
 };
 
-std::vector<hunk> parse_hunk_file(const std::vector<uint8_t>& code)
+std::vector<hunk> parse_hunk_file(const std::vector<uint8_t>& code, uint32_t hunk_limit = max_hunks)
 {
     uint32_t pos = 0;
 
@@ -386,23 +427,60 @@ std::vector<hunk> parse_hunk_file(const std::vector<uint8_t>& code)
         return val;
     };
 
+    auto skip = [&](uint32_t num_longs) {
+        if (num_longs > (code.size() - pos) / 4)
+            throw std::runtime_error { "Invalid HUNK file" };
+        pos += num_longs * 4;
+    };
+
     if (code.size() % 4 || code.size() < 32 || read() != HUNK_HEADER || read())
         throw std::runtime_error { "Invalid HUNK file" };
 
     const uint32_t table_size = read();
 
-    if (table_size == 0 || table_size > max_hunks || read() != 0 || read() != table_size - 1)
+    if (table_size == 0 || table_size > hunk_limit || read() != 0 || read() != table_size - 1)
         throw std::runtime_error { "Invalid HUNK file" };
 
     std::vector<hunk> hunks(table_size);
 
     for (uint32_t i = 0; i < table_size; ++i) {
         hunks[i].flags = read();
+        if ((hunks[i].flags & (HUNKF_CHIP | HUNKF_FAST)) == (HUNKF_CHIP | HUNKF_FAST))
+            hunks[i].mem_attrs = read();
     }
 
+    auto read_relocs = [&](hunk& h, bool short_relocs) {
+        if (h.type != HUNK_CODE && h.type != HUNK_DATA)
+            throw std::runtime_error { "Invalid HUNK file" };
+        uint32_t short_pos = pos / 2; // Position in words for short relocations
+        auto read_short = [&]() {
+            if (short_pos * 2 + 2 > code.size())
+                throw std::runtime_error { "Invalid HUNK file" };
+            return static_cast<uint32_t>(get_u16(&code[short_pos++ * 2]));
+        };
+        for (;;) {
+            hunk_reloc hr;
+            const uint32_t cnt = short_relocs ? read_short() : read();
+            if (cnt == 0)
+                break;
+            hr.dst_hunk = short_relocs ? read_short() : read();
+            if (hr.dst_hunk >= table_size)
+                throw std::runtime_error { "Invalid HUNK file" };
+            hr.offsets.resize(cnt);
+            for (uint32_t i = 0; i < cnt; ++i) {
+                hr.offsets[i] = short_relocs ? read_short() : read();
+                if ((hr.offsets[i] & 1) || hr.offsets[i] + 3 > h.size_bytes())
+                    throw std::runtime_error { "Invalid relocation in HUNK file" };
+            }
+            h.relocs.push_back(std::move(hr));
+        }
+        if (short_relocs)
+            pos = (short_pos * 2 + 3) & ~3; // Padded to long word
+    };
+
     uint32_t idx = 0;
     while (pos < code.size()) {
-        const auto hunk_type = read();
+        const auto hunk_type = read() & 0x3FFFFFFF; // Ignore memory flags
         switch (hunk_type) {
         case HUNK_BSS:
         case HUNK_CODE:
@@ -410,38 +488,33 @@ std::vector<hunk> parse_hunk_file(const std::vector<uint8_t>& code)
             if (idx >= table_size || hunks[idx].type)
                 throw std::runtime_error { "Invalid HUNK file" };
             const auto size = read() * 4;
-            if (size > (hunks[idx].flags & 0x3FFFFFFF) * 4)
+            if (size > hunks[idx].size_bytes())
                 throw std::runtime_error { "Invalid HUNK file" };
+            hunks[idx].type = hunk_type;
             if (hunk_type == HUNK_BSS)
                 break;
             if (pos + size > code.size())
                 throw std::runtime_error { "Invalid HUNK file" };
-            hunks[idx].type = hunk_type;
             hunks[idx].data = std::vector<uint8_t>(&code[pos], &code[pos + size]);
             pos += size;
             break;
         }
-        case HUNK_RELOC32: {
-            if (hunks[idx].type != HUNK_CODE && hunks[idx].type != HUNK_DATA)
+        case HUNK_RELOC32:
+        case HUNK_RELOC32SHORT:
+        case HUNK_DREL32:
+            if (idx >= table_size)
                 throw std::runtime_error { "Invalid HUNK file" };
-            for (;;) {
-                hunk_reloc hr;
-                const uint32_t cnt = read();
-                if (cnt == 0)
-                    break;
-                hr.dst_hunk = read();
-                if (hr.dst_hunk >= table_size)
-                    throw std::runtime_error { "Invalid HUNK file" };
-                hr.offsets.resize(cnt);
-                for (uint32_t i = 0; i < cnt; ++i) {
-                    hr.offsets[i] = read();
-                    if ((hr.offsets[i] & 1) || hr.offsets[i] + 3 > (hunks[idx].flags & 0x3FFFFFFF) * 4)
-                        throw std::runtime_error { "Invalid relocation in HUNK file" };
-                }
-                hunks[idx].relocs.push_back(std::move(hr));
-            }
+            read_relocs(hunks[idx], hunk_type != HUNK_RELOC32);
+            break;
+        case HUNK_NAME:
+        case HUNK_DEBUG:
+            skip(read());
+            break;
+        case HUNK_SYMBOL:
+            // Name (length in longs) + value until zero length
+            while (const auto len = read())
+                skip(len + 1);
             break;
-        }
         case HUNK_END:
             ++idx;
             break;
@@ -489,6 +562,15 @@ uint32_t translate_error(const std::error_code& ec)
 
 class filesystem_handler {
 public:
+    // Cached host metadata for a directory entry
+    struct dir_entry {
+        std::string key; // ci_key(name)
+        std::string name;
+        int32_t type; // ST_USERDIR or ST_FILE
+        uint64_t size;
+        fs::file_time_type mtime;
+    };
+
     class node {
     public:
         node(node&&) = default;
@@ -497,7 +579,8 @@ public:
 
         ~node()
         {
-            std::erase(parent_.children_, this);
+            if (auto it = parent_.children_.find({ key_, name_ }); it != parent_.children_.end() && it->second == this)
+                parent_.children_.erase(it);
         }
 
         uint32_t id() const
@@ -550,6 +633,8 @@ public:
             : id_ { id }
             , parent_ { parent ? *parent : *this }
             , path_ { path }
+            , name_ { path.filename().string() }
+            , key_ { ci_key(name_) }
             , type_ { type }
         {
             assert(id != 0);
@@ -557,16 +642,25 @@ public:
             assert((&parent_ == this) == (type == ST_ROOT));
             if (parent) {
                 assert(parent->type() == ST_USERDIR || parent->type() == ST_ROOT);
-                parent->children_.push_back(this);
+                parent->children_[{ key_, name_ }] = this;
             }
         }
 
         const uint32_t id_;
         node& parent_;
         const fs::path path_;
+        const std::string name_;
+        const std::string key_;
         const int32_t type_;
         int access_count_ = 0; // -1 -> exclusive access, 0 no access, > 0 number of shared accesses
-        std::vector<node*> children_;
+        std::map<std::pair<std::string, std::string>, node*> children_; // By key_ then name_ (host names may only differ in case)
+
+        // Directory listing cache (see filesystem_handler::dir_entries)
+        std::vector<dir_entry> entries_; // Sorted by key, then name
+        bool entries_valid_ = false;
+        int watch_ = -1; // inotify watch descriptor, -1 if changes aren't being watched
+        fs::file_time_type entries_dir_mtime_ {};
+        std::chrono::steady_clock::time_point entries_time_ {};
 
         friend filesystem_handler;
     };
@@ -615,9 +709,23 @@ public:
             throw std::runtime_error { base_dir_.string() + " is not a valid directory" };
 #if FS_HANDLER_DEBUG > 0
         std::cout << "[HD] File system handler starting with basedir=\"" << base_dir_ << "\"\n";
+#endif
+#ifdef __linux__
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 #endif
     }
 
+    ~filesystem_handler()
+    {
+#ifdef __linux__
+        if (inotify_fd_ >= 0)
+            close(inotify_fd_);
+#endif
+    }
+
+    filesystem_handler(const filesystem_handler&) = delete;
+    filesystem_handler& operator=(const filesystem_handler&) = delete;
+
     void init(uint32_t msg_port, uint32_t dos_list)
     {
         assert(msg_port_ == 0 && dos_list_ == 0);
@@ -626,6 +734,11 @@ public:
         dos_list_ = dos_list;
     }
 
+    bool initialized() const
+    {
+        return msg_port_ != 0;
+    }
+
     uint32_t msg_port_address() const
     {
         assert(msg_port_);
@@ -664,22 +777,71 @@ public:
     {
         assert(dir.type() == ST_USERDIR || dir.type() == ST_ROOT);
 
-        if (name.empty() || name == "." || name == ".." || name[0] == '\\')
+        if (!valid_name(name))
             return nullptr;
 
         // Already known?
-        for (auto child : dir.children_) {
-            if (ci_equal(child->path().filename().string(), name))
-                return child;
+        const auto key = ci_key(name);
+        if (auto it = dir.children_.find({ key, std::string { name } }); it != dir.children_.end())
+            return it->second;
+
+        if (const auto* e = find_entry(dir, key, name)) {
+            if (auto it = dir.children_.find({ e->key, e->name }); it != dir.children_.end())
+                return it->second;
+            return &make_node(&dir, dir.path() / e->name, e->type);
         }
 
-        auto child_path = dir.path() / name;
-        if (exists(child_path))
-            return &make_node(&dir, child_path, is_directory(child_path) ? ST_USERDIR : ST_FILE);
+        // Not (yet) in the listing
+        if (auto it = dir.children_.lower_bound({ key, "" }); it != dir.children_.end() && it->first.first == key)
+            return it->second;
 
         return nullptr;
     }
 
+    // Size and modification time of a node, from the parent's directory cache when possible
+    void get_metadata(node& n, uint64_t& size, fs::file_time_type& mtime)
+    {
+        if (n.type() != ST_ROOT) {
+            if (const auto* e = find_entry(n.parent(), n.key_, n.name_); e && e->name == n.name_) {
+                size = e->size;
+                mtime = e->mtime;
+                return;
+            }
+        }
+        size = n.type() == ST_FILE ? file_size(n.path()) : 0;
+        mtime = last_write_time(n.path());
+    }
+
+    // Refresh cached information about "name" in "dir" after it has been created/modified/deleted
+    void update_entry(node& dir, const std::string& name)
+    {
+        if (!dir.entries_valid_)
+            return;
+        auto& entries = dir.entries_;
+        const auto key = ci_key(name);
+        auto it = std::lower_bound(entries.begin(), entries.end(), std::pair<std::string_view, std::string_view> { key, name }, entry_less);
+        const bool found = it != entries.end() && it->name == name;
+        dir_entry e;
+        if (stat_entry(dir.path() / name, e)) {
+            if (found)
+                *it = std::move(e);
+            else
+                entries.insert(it, std::move(e));
+        } else if (found) {
+            entries.erase(it);
+        }
+        if (dir.watch_ < 0) {
+            std::error_code ec;
+            dir.entries_dir_mtime_ = last_write_time(dir.path(), ec);
+        }
+    }
+
+    void update_entry(node& n)
+    {
+        if (n.type() != ST_ROOT)
+            update_entry(n.parent(), n.path().filename().string());
+    }
+
     uint32_t make_file_handle(node& n, std::fstream&& file, int32_t access)
     {
         assert((access == EXCLUSIVE_LOCK && n.access_count_ == -1) || (access == SHARED_LOCK && n.access_count_ > 0));
@@ -709,34 +871,44 @@ public:
     {
         if (idx >= file_handles_.size() || !file_handles_[idx])
             return false;
+        auto& n = file_handles_[idx]->file_node();
+        const bool written = file_handles_[idx]->access_ == EXCLUSIVE_LOCK;
         file_handles_[idx].reset();
+        if (written)
+            update_entry(n);
         return true;
     }
 
     node* find_next_node(node& dir, uint32_t last)
     {
         assert(dir.type() == ST_ROOT || dir.type() == ST_USERDIR);
-        if (!last) {
-            // First in iteration, add children (probably slow in larger folders)
-            for (const auto& entry : fs::directory_iterator { dir.path() })
-                (void)find_in_node(dir, entry.path().filename().string());
-            return dir.children_.empty() ? nullptr : dir.children_.front();
-        }
-        auto last_node = node_from_key(last);
-        if (!last_node) {
+        const auto& entries = dir_entries(dir);
+        auto it = entries.begin();
+        if (last) {
+            auto last_node = node_from_key(last);
+            if (!last_node) {
 #if FS_HANDLER_DEBUG > 0
-            std::cout << "[HD] Invalid directory key used\n";
+                std::cout << "[HD] Invalid directory key used\n";
 #endif
-            return nullptr;
-        }
-        auto it = std::find(dir.children_.begin(), dir.children_.end(), last_node);
-        if (it == dir.children_.end()) {
+                return nullptr;
+            }
+            if (&last_node->parent() != &dir) {
 #if FS_HANDLER_DEBUG > 0
-            std::cout << "[HD] Invalid directory key used (not found in dir node)\n";
+                std::cout << "[HD] Invalid directory key used (not found in dir node)\n";
 #endif
-            return nullptr;
+                return nullptr;
+            }
+            // Continue after the last returned entry (even if the listing was refreshed in between)
+            it = std::upper_bound(entries.begin(), entries.end(), std::pair<std::string_view, std::string_view> { last_node->key_, last_node->name_ }, [](const std::pair<std::string_view, std::string_view>& key_name, const dir_entry& e) { return key_name < std::pair<std::string_view, std::string_view> { e.key, e.name }; });
+        }
+        for (; it != entries.end(); ++it) {
+            if (!valid_name(it->name))
+                continue;
+            if (auto c = dir.children_.find({ it->key, it->name }); c != dir.children_.end())
+                return c->second;
+            return &make_node(&dir, dir.path() / it->name, it->type);
         }
-        return ++it == dir.children_.end() ? nullptr : *it;
+        return nullptr;
     }
 
     uint32_t delete_node(node& obj)
@@ -750,7 +922,10 @@ public:
         if (!remove(obj.path(), ec))
             return translate_error(ec);
 
+        auto& parent = obj.parent();
+        const auto name = obj.path().filename().string();
         nodes_.erase(it);
+        update_entry(parent, name);
         return NO_ERROR;
     }
 
@@ -769,7 +944,11 @@ public:
             return translate_error(ec);
 
         const auto type = old_node.type();
+        auto& old_dir = old_node.parent();
+        const auto old_name = old_node.path().filename().string();
         nodes_.erase(it);
+        update_entry(old_dir, old_name);
+        update_entry(dir, name);
 
         (void)make_node(&dir, new_path, type);
 
@@ -784,6 +963,141 @@ private:
     node& root_node_;
     uint32_t msg_port_ = 0;
     uint32_t dos_list_ = 0;
+#ifdef __linux__
+    int inotify_fd_ = -1;
+    std::map<int, uint32_t> watches_; // inotify watch descriptor -> node id
+#endif
+
+    static constexpr std::chrono::seconds fallback_cache_ttl { 1 };
+
+    static bool valid_name(const std::string_view name)
+    {
+        return !name.empty() && name != "." && name != ".." && name[0] != '\\';
+    }
+
+    static bool entry_less(const dir_entry& e, const std::pair<std::string_view, std::string_view>& key_name)
+    {
+        return std::pair<std::string_view, std::string_view> { e.key, e.name } < key_name;
+    }
+
+    static bool stat_entry(const fs::path& p, dir_entry& e)
+    {
+        std::error_code ec;
+        const auto st = status(p, ec);
+        if (ec || !exists(st))
+            return false;
+        e.name = p.filename().string();
+        e.key = ci_key(e.name);
+        e.type = is_directory(st) ? ST_USERDIR : ST_FILE;
+        e.size = e.type == ST_FILE ? file_size(p, ec) : 0;
+        e.mtime = last_write_time(p, ec);
+        return true;
+    }
+
+    // Entry matching key, preferring the one named exactly "name" if several host names only differ in case
+    const dir_entry* find_entry(node& dir, const std::string& key, const std::string_view name)
+    {
+        const auto& entries = dir_entries(dir);
+        auto it = std::lower_bound(entries.begin(), entries.end(), key, [](const dir_entry& e, const std::string& k) { return e.key < k; });
+        if (it == entries.end() || it->key != key)
+            return nullptr;
+        for (auto e = it; e != entries.end() && e->key == key; ++e) {
+            if (e->name == name)
+                return &*e;
+        }
+        return &*it;
+    }
+
+    // Returns the (cached) listing of "dir". Without inotify the cache is refreshed when the directory's
+    // modification time changes (files added/removed) or it's older than fallback_cache_ttl (file sizes/dates)
+    const std::vector<dir_entry>& dir_entries(node& dir)
+    {
+        assert(dir.type() == ST_ROOT || dir.type() == ST_USERDIR);
+        poll_changes();
+
+        if (dir.entries_valid_ && dir.watch_ < 0) {
+            std::error_code ec;
+            if (std::chrono::steady_clock::now() - dir.entries_time_ > fallback_cache_ttl || last_write_time(dir.path(), ec) != dir.entries_dir_mtime_)
+                dir.entries_valid_ = false;
+        }
+        if (dir.entries_valid_)
+            return dir.entries_;
+
+        std::error_code ec;
+        dir.entries_.clear();
+        dir.entries_dir_mtime_ = last_write_time(dir.path(), ec);
+        dir.entries_time_ = std::chrono::steady_clock::now();
+#ifdef __linux__
+        if (inotify_fd_ >= 0 && dir.watch_ < 0) {
+            dir.watch_ = inotify_add_watch(inotify_fd_, dir.path().c_str(), IN_ONLYDIR | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+            if (dir.watch_ >= 0)
+                watches_[dir.watch_] = dir.id();
+        }
+#endif
+        for (const auto& de : fs::directory_iterator { dir.path(), ec }) {
+            dir_entry e;
+            e.name = de.path().filename().string();
+            e.key = ci_key(e.name);
+            e.type = de.is_directory(ec) ? ST_USERDIR : ST_FILE;
+            e.size = e.type == ST_FILE ? de.file_size(ec) : 0;
+            e.mtime = de.last_write_time(ec);
+            dir.entries_.push_back(std::move(e));
+        }
+        std::sort(dir.entries_.begin(), dir.entries_.end(), [](const dir_entry& l, const dir_entry& r) { return std::tie(l.key, l.name) < std::tie(r.key, r.name); });
+        dir.entries_valid_ = true;
+        return dir.entries_;
+    }
+
+    // Apply changes reported by inotify
+    void poll_changes()
+    {
+#ifdef __linux__
+        if (inotify_fd_ < 0)
+            return;
+        alignas(inotify_event) char buf[4096];
+        std::vector<std::pair<uint32_t, std::string>> changed;
+        for (;;) {
+            const auto len = read(inotify_fd_, buf, sizeof(buf));
+            if (len <= 0)
+                break;
+            for (const char* p = buf; p < buf + len;) {
+                const auto* ev = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + ev->len;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    for (auto& [id, n] : nodes_)
+                        n->entries_valid_ = false;
+                    continue;
+                }
+                auto it = watches_.find(ev->wd);
+                if (it == watches_.end())
+                    continue;
+                auto nit = nodes_.find(it->second);
+                node* dir = nit != nodes_.end() && nit->second->watch_ == ev->wd ? nit->second.get() : nullptr;
+                if (ev->mask & IN_IGNORED) {
+                    if (dir) {
+                        dir->watch_ = -1;
+                        dir->entries_valid_ = false;
+                    }
+                    watches_.erase(it);
+                } else if (!dir) {
+                    // Node no longer exists (deleted/renamed)
+                    inotify_rm_watch(inotify_fd_, ev->wd);
+                    watches_.erase(it);
+                } else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    dir->entries_valid_ = false;
+                } else if (ev->len) {
+                    changed.emplace_back(dir->id(), ev->name);
+                }
+            }
+        }
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        for (const auto& [id, name] : changed) {
+            if (auto it = nodes_.find(id); it != nodes_.end())
+                update_entry(*it->second, name);
+        }
+#endif
+    }
 
     node& make_node(node* parent, const fs::path& path, int32_t type)
     {
@@ -795,15 +1109,113 @@ private:
     }
 };
 
+// Asynchronous request whose host side I/O is done on the worker thread of async_io_queue
+struct async_io_job {
+    uint32_t msg; // Message to reply to when done (IORequest or dp_Link of DosPacket)
+    uint32_t reply_port; // 0 => ReplyMsg(msg), otherwise PutMsg(reply_port, msg)
+    std::vector<uint8_t> buffer;
+    uint32_t actual;
+    bool failed;
+    std::function<void (async_io_job&)> work; // Runs on the worker thread, must not access guest memory
+    std::function<void (async_io_job&)> complete; // Runs on the emulation thread
+    std::exception_ptr error;
+};
+
+// Runs jobs in submission order on a separate thread
+class async_io_queue {
+public:
+    async_io_queue()
+    {
+        thread_ = std::thread { [this]() { run(); } };
+    }
+
+    ~async_io_queue()
+    {
+        {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        thread_.join();
+    }
+
+    async_io_queue(const async_io_queue&) = delete;
+    async_io_queue& operator=(const async_io_queue&) = delete;
+
+    void submit(async_io_job&& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            pending_.push_back(std::move(job));
+        }
+        work_cv_.notify_all();
+    }
+
+    bool has_completed() const
+    {
+        return has_completed_.load(std::memory_order_acquire);
+    }
+
+    std::deque<async_io_job> take_completed()
+    {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        has_completed_.store(false, std::memory_order_relaxed);
+        return std::move(completed_);
+    }
+
+    // Wait until all submitted jobs have completed
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock { mutex_ };
+        idle_cv_.wait(lock, [this]() { return pending_.empty() && !busy_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<async_io_job> pending_;
+    std::deque<async_io_job> completed_;
+    std::atomic<bool> has_completed_ { false };
+    bool busy_ = false;
+    bool stop_ = false;
+    std::thread thread_;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock { mutex_ };
+        for (;;) {
+            work_cv_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+            if (pending_.empty())
+                return;
+            auto job = std::move(pending_.front());
+            pending_.pop_front();
+            busy_ = true;
+            lock.unlock();
+            try {
+                job.work(job);
+            } catch (...) {
+                job.error = std::current_exception();
+            }
+            lock.lock();
+            busy_ = false;
+            completed_.push_back(std::move(job));
+            has_completed_.store(true, std::memory_order_release);
+            idle_cv_.notify_all();
+        }
+    }
+};
+
 } // unnamed namespace
 
 class harddisk::impl final : public memory_area_handler, public autoconf_device {
 public:
-    explicit impl(memory_handler& mem, bool& cpu_active, const bool_func& should_disable_autoboot, const std::vector<std::string>& hdfilenames, const std::vector<std::string>& shared_folders)
+    explicit impl(memory_handler& mem, bool& cpu_active, const bool_func& should_disable_autoboot, const std::vector<std::string>& hdfilenames, const std::vector<std::string>& shared_folders, const disk_image_options& image_options, bool async_io, bool fast_loadseg)
         : autoconf_device { mem, *this, config }
         , mem_ { mem }
         , cpu_active_ { cpu_active }
         , should_disable_autoboot_ { should_disable_autoboot }
+        , fast_loadseg_ { fast_loadseg && !shared_folders.empty() }
     {
         if (hdfilenames.empty() && shared_folders.empty())
             throw std::runtime_error { "Harddisk initialized with no filenames / shared folders" };
@@ -818,7 +1230,20 @@ public:
             sfs.push_back(p);
         }
 
-        do_reset(hdfilenames, sfs);
+        std::vector<std::unique_ptr<disk_image>> images;
+        for (const auto& hdfilename : hdfilenames)
+            images.push_back(std::make_unique<disk_image>(hdfilename, image_options));
+
+        do_reset(std::move(images), sfs);
+
+        if (async_io)
+            async_io_ = std::make_unique<async_io_queue>();
+    }
+
+    uint8_t active_irq_mask()
+    {
+        process_async_completions();
+        return replies_.empty() ? 0 : 1;
     }
 
 private:
@@ -832,9 +1257,19 @@ private:
     };
     static constexpr uint32_t sector_size_bytes = 512;
 
+    static constexpr uint32_t IO_UNIT = 0x18;
+    static constexpr uint32_t IO_COMMAND = 0x1C;
+    static constexpr uint32_t IO_FLAGS = 0x1E;
+    static constexpr uint32_t IO_ERROR = 0x1F;
+    static constexpr uint32_t IO_ACTUAL = 0x20;
+    static constexpr uint32_t IO_LENGTH = 0x24;
+    static constexpr uint32_t IO_DATA = 0x28;
+    static constexpr uint32_t IO_OFFSET = 0x2C;
+    static constexpr uint8_t IOF_QUICK = 1;
+
     struct hd_info {
         std::string filename;
-        std::fstream f;
+        std::unique_ptr<disk_image> image;
         uint64_t size;
         uint32_t cylinders;
         uint8_t heads;
@@ -876,6 +1311,12 @@ private:
         std::unique_ptr<filesystem_handler> fs_handler;
     };
 
+    struct loadseg_cache_entry {
+        fs::file_time_type mtime;
+        uint64_t size;
+        std::shared_ptr<const std::vector<hunk>> hunks; // nullptr if not an executable that can be loaded by the host
+    };
+
     memory_handler& mem_;
     bool& cpu_active_;
     bool_func should_disable_autoboot_;
@@ -885,6 +1326,15 @@ private:
     std::vector<partition_info> partitions_;
     std::vector<fs_info> filesystems_;
     std::vector<shared_folder_info> shared_folders_;
+    std::unique_ptr<async_io_queue> async_io_; // Only in async mode, declared after the disks/folders it accesses
+    bool request_queued_ = false; // Was the last request queued to async_io_?
+    std::map<const std::fstream*, uint32_t> pending_file_io_; // Number of queued ACTION_READ/ACTION_WRITE jobs per open file
+    std::deque<std::pair<uint32_t, uint32_t>> replies_; // (message, reply port) of completed requests for IntServer
+    std::pair<uint32_t, uint32_t> current_reply_ {};
+    const bool fast_loadseg_;
+    uint32_t old_loadseg_ = 0; // Original LoadSeg vector once the patch has been installed
+    std::map<fs::path, loadseg_cache_entry> loadseg_cache_; // Kept across resets
+    uint64_t loadseg_cache_bytes_ = 0;
 
     static constexpr uint32_t local_ram_list_end = ~0U;
     static constexpr uint32_t local_ram_align = 8;
@@ -895,24 +1345,28 @@ private:
 
     void reset() override
     {
+        wait_async_io();
+        replies_.clear();
         // HACK to re-read RDB in case of format etc.
-        std::vector<std::string> disk_filenames;
+        // Note: The images are kept open so copy-on-write modifications survive
+        std::vector<std::unique_ptr<disk_image>> images;
         std::vector<fs::path> shared_folders;
-        for (const auto& hd : hds_)
-            disk_filenames.push_back(hd->filename);
+        for (auto& hd : hds_)
+            images.push_back(std::move(hd->image));
         for (const auto& sf : shared_folders_)
             shared_folders.push_back(sf.root_dir);
-        do_reset(disk_filenames, shared_folders);
+        do_reset(std::move(images), shared_folders);
     }
 
-    void do_reset(const std::vector<std::string>& disk_filenames, const std::vector<fs::path>& shared_folders)
+    void do_reset(std::vector<std::unique_ptr<disk_image>>&& images, const std::vector<fs::path>& shared_folders)
     {
         ptr_hold_ = 0;
+        old_loadseg_ = 0;
         local_ram_init();
-        hds_.clear();
         partitions_.clear();
+        hds_.clear();
         filesystems_.clear();
-        init_disks(disk_filenames);
+        init_disks(std::move(images));
         shared_folders_.clear();
         for (const auto& p : shared_folders) {
             auto name = p.filename().string();
@@ -1031,20 +1485,16 @@ private:
 #endif
     }
 
-    void init_disks(const std::vector<std::string>& hdfilenames)
+    void init_disks(std::vector<std::unique_ptr<disk_image>>&& images)
     {
-        for (const auto& hdfilename : hdfilenames) {
-            std::fstream hdfile { hdfilename, std::ios::binary | std::ios::in | std::ios::out };
-
-            if (!hdfile.is_open())
-                throw std::runtime_error { "Error opening " + hdfilename };
-            hdfile.seekg(0, std::fstream::end);
-            const uint64_t total_size = hdfile.tellg();
+        for (auto& image : images) {
+            const std::string hdfilename = image->filename();
+            const uint64_t total_size = image->size();
 
             if (total_size < 100 * 1024)
                 throw std::runtime_error { "Invalid size for " + hdfilename + " " + std::to_string(total_size) };
 
-            hds_.push_back(std::unique_ptr<hd_info>(new hd_info { hdfilename, std::move(hdfile), total_size, uint32_t(0), uint8_t(0), uint16_t(0) }));
+            hds_.push_back(std::unique_ptr<hd_info>(new hd_info { hdfilename, std::move(image), total_size, uint32_t(0), uint8_t(0), uint16_t(0) }));
             auto& hd = *hds_.back();
 
             const uint8_t* sector = disk_read(hd, 0, sector_size_bytes);
@@ -1236,8 +1686,56 @@ private:
 
     void handle_state(state_file& sf) override
     {
-        const state_file::scope scope { sf, "Harddisk", 1 };
+        const state_file::scope scope { sf, "Harddisk", 3 };
         sf.handle(ptr_hold_);
+        sf.handle(old_loadseg_);
+
+        // Completed requests not yet picked up by IntServer
+        wait_async_io();
+        uint32_t num_replies = static_cast<uint32_t>(replies_.size());
+        sf.handle(num_replies);
+        if (sf.loading())
+            replies_.resize(num_replies);
+        for (auto& r : replies_) {
+            sf.handle(r.first);
+            sf.handle(r.second);
+        }
+    }
+
+    // Apply results of completed asynchronous requests to guest memory and make them available to IntServer
+    void process_async_completions()
+    {
+        if (!async_io_ || !async_io_->has_completed())
+            return;
+        const bool was_active = cpu_active_;
+        cpu_active_ = false;
+        try {
+            for (auto& job : async_io_->take_completed()) {
+                if (job.error)
+                    std::rethrow_exception(job.error);
+                job.complete(job);
+                replies_.push_back({ job.msg, job.reply_port });
+            }
+        } catch (...) {
+            cpu_active_ = was_active;
+            throw;
+        }
+        cpu_active_ = was_active;
+    }
+
+    // Make sure all queued requests have finished (before handling a request synchronously)
+    void wait_async_io()
+    {
+        if (!async_io_)
+            return;
+        async_io_->wait_idle();
+        process_async_completions();
+    }
+
+    void queue_request(async_io_job&& job)
+    {
+        async_io_->submit(std::move(job));
+        request_queued_ = true;
     }
 
     bool partition_name_ok(const std::string& name)
@@ -1248,12 +1746,8 @@ private:
     const uint8_t* disk_read(hd_info& hd, uint64_t offset, uint32_t len)
     {
         assert(len && len % sector_size_bytes == 0 && offset % sector_size_bytes == 0 && offset < hd.size && len < hd.size && offset + len <= hd.size);
-        buffer_.resize(len);
-        hd.f.seekg(offset);
-        hd.f.read(reinterpret_cast<char*>(&buffer_[0]), len);
-        if (!hd.f)
-            throw std::runtime_error { "Error reading from " + hd.filename };
-        return &buffer_[0];
+        (void)len;
+        return hd.image->data() + offset;
     }
 
     uint8_t read_u8(uint32_t, uint32_t offset) override
@@ -1284,6 +1778,30 @@ private:
             return should_disable_autoboot_();
         } else if (offset == special_offset + 6) {
             return static_cast<uint16_t>(shared_folders_.size());
+        } else if (offset == special_offset + 8) {
+            return request_queued_;
+        } else if (offset == special_offset + 10) {
+            return async_io_ != nullptr;
+        } else if (offset == special_offset + 12) {
+            process_async_completions();
+            current_reply_ = {};
+            if (!replies_.empty()) {
+                current_reply_ = replies_.front();
+                replies_.pop_front();
+            }
+            return static_cast<uint16_t>(current_reply_.first >> 16);
+        } else if (offset == special_offset + 14) {
+            return static_cast<uint16_t>(current_reply_.first);
+        } else if (offset == special_offset + 16) {
+            return static_cast<uint16_t>(current_reply_.second >> 16);
+        } else if (offset == special_offset + 18) {
+            return static_cast<uint16_t>(current_reply_.second);
+        } else if (offset == special_offset + 20) {
+            return static_cast<uint16_t>(old_loadseg_ >> 16);
+        } else if (offset == special_offset + 22) {
+            return static_cast<uint16_t>(old_loadseg_);
+        } else if (offset == special_offset + 24) {
+            return fast_loadseg_ && !old_loadseg_;
         } else if (offset >= local_ram_offset) {
             return get_u16(&local_ram_[offset - local_ram_offset]);
         }
@@ -1315,8 +1833,11 @@ private:
                 return;
             }
             cpu_active_ = false;
+            request_queued_ = false;
 
             try {
+                if (val != 0xfede && val != 0xfee5)
+                    wait_async_io();
                 if (val == 0xfede)
                     handle_disk_cmd();
                 else if (val == 0xfedf)
@@ -1333,6 +1854,14 @@ private:
                     handle_volume_init();
                 else if (val == 0xfee5)
                     handle_volume_packet();
+                else if (val == 0xfee6)
+                    handle_loadseg_init();
+                else if (val == 0xfee7)
+                    handle_loadseg_info();
+                else if (val == 0xfee8)
+                    handle_loadseg_hunk();
+                else if (val == 0xfee9)
+                    handle_loadseg_reloc();
                 else
                     throw std::runtime_error { "Invalid HD command: $" + hexstring(val) };
             } catch (...) {
@@ -1439,8 +1968,7 @@ private:
 
         auto copy_data = [&](const uint8_t* data, size_t len) {
             const uint32_t actlen = std::min(sc.scsi_Length, static_cast<uint32_t>(len));
-            for (uint32_t i = 0; i < actlen; ++i)
-                mem_.write_u8(sc.scsi_Data + i, data[i]);
+            mem_.write_block(sc.scsi_Data, data, actlen);
 
             if constexpr (scsi_debug) {
                 std::cout << "[HD] Returning: ";
@@ -1558,14 +2086,14 @@ private:
                     std::cerr << "[HD] Invalid data length for write lba = " << lba << " len = " << len << " scis_Length = " << sc.scsi_Length  << "\n";
                     goto err;
                 }
+                if (hd.image->mode() == disk_image_mode::read_only) {
+                    std::cerr << "[HD] Write to read only image " << hd.filename << "\n";
+                    goto err;
+                }
 
                 buffer_.resize(len);
-                for (uint32_t i = 0; i < len; i += 4)
-                    put_u32(&buffer_[i], mem_.read_u32(sc.scsi_Data + i));
-                hd.f.seekp(lba);
-                hd.f.write(reinterpret_cast<const char*>(&buffer_[0]), len);
-                if (!hd.f)
-                    throw std::runtime_error { "Error writing to " + hd.filename };
+                mem_.read_block(sc.scsi_Data, &buffer_[0], len);
+                hd.image->write(lba, &buffer_[0], len);
                 
                 sc.scsi_Actual = sc.scsi_Length;
                 sc.scsi_CmdActual = sc.scsi_CmdLength;
@@ -1589,6 +2117,19 @@ err:
         sc.scsi_SenseActual = 0; // Not used
     }
 
+    void complete_io_request(uint32_t ioreq, uint32_t actual, uint8_t error)
+    {
+        mem_.write_u32(ioreq + IO_ACTUAL, actual);
+        mem_.write_u8(ioreq + IO_ERROR, error);
+    }
+
+    void queue_io_request(async_io_job&& job)
+    {
+        // Not a quick request anymore, IntServer replies when done
+        mem_.write_u8(job.msg + IO_FLAGS, mem_.read_u8(job.msg + IO_FLAGS) & ~IOF_QUICK);
+        queue_request(std::move(job));
+    }
+
     void handle_disk_cmd()
     {
         // Standard commands
@@ -1618,14 +2159,6 @@ err:
         //constexpr uint16_t TD_GETGEOMETRY = CMD_NONSTD + 13; // 16
         constexpr uint16_t HD_SCSICMD = 28;
 
-        constexpr uint32_t IO_UNIT = 0x18;
-        constexpr uint32_t IO_COMMAND = 0x1C;
-        constexpr uint32_t IO_ERROR = 0x1F;
-        constexpr uint32_t IO_ACTUAL = 0x20;
-        constexpr uint32_t IO_LENGTH = 0x24;
-        constexpr uint32_t IO_DATA = 0x28;
-        constexpr uint32_t IO_OFFSET = 0x2C;
-
         constexpr uint16_t devunit_UnitNum = 0x2A;
 
         const auto unit = mem_.read_u32(mem_.read_u32(ptr_hold_ + IO_UNIT) + devunit_UnitNum); // grab from private field
@@ -1639,6 +2172,9 @@ err:
         }
         auto& hd = partitions_[unit].hd;
 
+        if (cmd != CMD_READ && cmd != CMD_WRITE && cmd != TD_FORMAT && cmd != CMD_UPDATE)
+            wait_async_io();
+
         // std::cerr << "[HD]: Command=$" << hexfmt(cmd) << " Unit=" << unit << " Length=$" << hexfmt(len) << " Data=$" << hexfmt(data) << " Offset=$" << hexfmt(ofs) << "\n";
         switch (cmd) {
         case CMD_READ:
@@ -1651,26 +2187,63 @@ err:
             } else if (len % sector_size_bytes) {
                 std::cerr << "[HD] Invalid length $" << hexfmt(len) << "\n";
                 mem_.write_u8(ptr_hold_ + IO_ERROR, static_cast<uint8_t>(IOERR_BADADDRESS));
+            } else if (cmd != CMD_READ && hd.image->mode() == disk_image_mode::read_only) {
+                mem_.write_u32(ptr_hold_ + IO_ACTUAL, 0);
+                mem_.write_u8(ptr_hold_ + IO_ERROR, static_cast<uint8_t>(TDERR_WriteProt));
+            } else if (async_io_) {
+                async_io_job job {};
+                job.msg = ptr_hold_;
+                if (cmd == CMD_READ) {
+                    job.work = [&hd, ofs, len](async_io_job& j) {
+                        const uint8_t* diskdata = hd.image->data() + ofs;
+                        j.buffer.assign(diskdata, diskdata + len);
+                    };
+                    job.complete = [this, data](async_io_job& j) {
+                        mem_.write_block(data, j.buffer.data(), static_cast<uint32_t>(j.buffer.size()));
+                        complete_io_request(j.msg, static_cast<uint32_t>(j.buffer.size()), 0);
+                    };
+                } else {
+                    job.buffer.resize(len);
+                    mem_.read_block(data, job.buffer.data(), len);
+                    job.work = [&hd, ofs](async_io_job& j) {
+                        hd.image->write(ofs, j.buffer.data(), j.buffer.size());
+                    };
+                    job.complete = [this](async_io_job& j) {
+                        complete_io_request(j.msg, static_cast<uint32_t>(j.buffer.size()), 0);
+                    };
+                }
+                queue_io_request(std::move(job));
+                return;
             } else {
                 if (cmd == CMD_READ) {
-                    const uint8_t* diskdata = disk_read(hd, ofs, len);
-                    for (uint32_t i = 0; i < len; i += 4)
-                        mem_.write_u32(data + i, get_u32(&diskdata[i]));
+                    mem_.write_block(data, disk_read(hd, ofs, len), len);
                 } else {
                     buffer_.resize(len);
-                    for (uint32_t i = 0; i < len; i += 4)
-                        put_u32(&buffer_[i], mem_.read_u32(data + i));
-                    hd.f.seekp(ofs);
-                    hd.f.write(reinterpret_cast<const char*>(&buffer_[0]), len);
-                    if (!hd.f)
-                        throw std::runtime_error { "Error writing to " + hd.filename };
+                    mem_.read_block(data, &buffer_[0], len);
+                    hd.image->write(ofs, &buffer_[0], len);
                 }
                 mem_.write_u32(ptr_hold_ + IO_ACTUAL, len);
                 mem_.write_u8(ptr_hold_ + IO_ERROR, 0);
             }
             break;
-        case CMD_RESET:
         case CMD_UPDATE:
+            if (async_io_) {
+                async_io_job job {};
+                job.msg = ptr_hold_;
+                job.work = [&hd](async_io_job&) { hd.image->flush(); };
+                job.complete = [this](async_io_job& j) { complete_io_request(j.msg, 0, 0); };
+                queue_io_request(std::move(job));
+                return;
+            }
+            hd.image->flush();
+            mem_.write_u32(ptr_hold_ + IO_ACTUAL, 0);
+            mem_.write_u8(ptr_hold_ + IO_ERROR, 0);
+            break;
+        case TD_PROTSTATUS:
+            mem_.write_u32(ptr_hold_ + IO_ACTUAL, hd.image->mode() == disk_image_mode::read_only ? 1 : 0);
+            mem_.write_u8(ptr_hold_ + IO_ERROR, 0);
+            break;
+        case CMD_RESET:
         case CMD_CLEAR:
         case CMD_STOP:
         case CMD_START:
@@ -1680,7 +2253,6 @@ err:
         case TD_REMOVE:
         case TD_CHANGENUM:
         case TD_CHANGESTATE:
-        case TD_PROTSTATUS:
         case TD_ADDCHANGEINT:
         case TD_REMCHANGEINT:
             mem_.write_u32(ptr_hold_ + IO_ACTUAL, 0);
@@ -1849,11 +2421,132 @@ err:
 
     void handle_volume_packet();
 
+    void handle_loadseg_init()
+    {
+        if (!fast_loadseg_ || old_loadseg_)
+            throw std::runtime_error { "Unexpected LoadSeg patch" };
+        old_loadseg_ = ptr_hold_;
+        std::cout << "[HD] LoadSeg patched for shared folders (old vector $" << hexfmt(old_loadseg_) << ")\n";
+    }
+
+    void handle_loadseg_info()
+    {
+        const auto hunks = loadseg_hunks(mem_.read_u32(ptr_hold_ + ls_Lock));
+        mem_.write_u32(ptr_hold_ + ls_Num, hunks ? static_cast<uint32_t>(hunks->size()) : 0);
+    }
+
+    void handle_loadseg_hunk()
+    {
+        // Note: The file may have changed since handle_loadseg_info, in that case handle_loadseg_reloc fails and the original LoadSeg is used
+        const auto hunks = loadseg_hunks(mem_.read_u32(ptr_hold_ + ls_Lock));
+        const auto num = mem_.read_u32(ptr_hold_ + ls_Num);
+        uint32_t size = 0, flags = MEMF_PUBLIC;
+        if (hunks && num < hunks->size()) {
+            const auto& h = (*hunks)[num];
+            size = h.size_bytes();
+            if ((h.flags & (HUNKF_CHIP | HUNKF_FAST)) == (HUNKF_CHIP | HUNKF_FAST))
+                flags |= h.mem_attrs;
+            else if (h.flags & HUNKF_CHIP)
+                flags |= MEMF_CHIP;
+            else if (h.flags & HUNKF_FAST)
+                flags |= MEMF_FAST;
+        }
+        mem_.write_u32(ptr_hold_ + ls_Size, size + 8); // Room for size and link
+        mem_.write_u32(ptr_hold_ + ls_Flags, flags);
+    }
+
+    void handle_loadseg_reloc()
+    {
+        const auto hunks = loadseg_hunks(mem_.read_u32(ptr_hold_ + ls_Lock));
+        mem_.write_u32(ptr_hold_ + ls_Num, 0);
+        if (!hunks)
+            return;
+
+        // Hunks have been allocated and linked by the ROM
+        std::vector<uint32_t> hunk_addr;
+        for (uint32_t seg = mem_.read_u32(ptr_hold_ + ls_SegList); seg; seg = mem_.read_u32(BADDR(seg))) {
+            const uint32_t idx = static_cast<uint32_t>(hunk_addr.size());
+            if (idx == hunks->size() || mem_.read_u32(BADDR(seg) - 4) != (*hunks)[idx].size_bytes() + 8)
+                return;
+            hunk_addr.push_back(BADDR(seg) + 4);
+        }
+        if (hunk_addr.size() != hunks->size())
+            return;
+
+        std::vector<uint8_t> buf;
+        for (uint32_t i = 0; i < hunks->size(); ++i) {
+            const auto& h = (*hunks)[i];
+            buf.assign(h.size_bytes(), 0);
+            if (!h.data.empty())
+                memcpy(&buf[0], h.data.data(), h.data.size());
+            for (const auto& hr : h.relocs) {
+                for (const auto ofs : hr.offsets)
+                    put_u32(&buf[ofs], get_u32(&buf[ofs]) + hunk_addr[hr.dst_hunk]);
+            }
+            if (!buf.empty())
+                mem_.write_block(hunk_addr[i], buf.data(), static_cast<uint32_t>(buf.size()));
+        }
+        mem_.write_u32(ptr_hold_ + ls_Num, 1);
+    }
+
+    // Parsed executable for the file "bptr_to_lock" refers to, nullptr if it's not on a shared folder or can't be loaded by the host
+    std::shared_ptr<const std::vector<hunk>> loadseg_hunks(uint32_t bptr_to_lock)
+    {
+        if (!bptr_to_lock)
+            return nullptr;
+        const uint32_t lock_cptr = BADDR(bptr_to_lock);
+        const uint32_t task = mem_.read_u32(lock_cptr + fl_Task);
+        for (auto& sf : shared_folders_) {
+            auto& fs_handler = *sf.fs_handler;
+            if (!fs_handler.initialized() || fs_handler.msg_port_address() != task)
+                continue;
+            auto* node = fs_handler.node_from_key(mem_.read_u32(lock_cptr + fl_Key));
+            if (!node || node->type() != ST_FILE)
+                return nullptr;
+            return loadseg_hunks(node->path());
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<const std::vector<hunk>> loadseg_hunks(const fs::path& path)
+    {
+        std::error_code ec;
+        const auto mtime = last_write_time(path, ec);
+        const auto size = ec ? 0 : file_size(path, ec);
+        if (ec)
+            return nullptr;
+
+        if (auto it = loadseg_cache_.find(path); it != loadseg_cache_.end()) {
+            if (it->second.mtime == mtime && it->second.size == size)
+                return it->second.hunks;
+            loadseg_cache_bytes_ -= it->second.size;
+            loadseg_cache_.erase(it);
+        }
+
+        std::shared_ptr<const std::vector<hunk>> hunks;
+        try {
+            hunks = std::make_shared<const std::vector<hunk>>(parse_hunk_file(read_file(path.string()), max_loadseg_hunks));
+        } catch (const std::exception& e) {
+            // Not handled here (e.g. overlays or not an executable), dos.library gets to report any errors
+#if FS_HANDLER_DEBUG > 0
+            std::cout << "[HD] Not loading " << path << " on host: " << e.what() << "\n";
+#endif
+        }
+
+        if (loadseg_cache_bytes_ + size > loadseg_cache_max_bytes) {
+            loadseg_cache_.clear();
+            loadseg_cache_bytes_ = 0;
+        }
+        loadseg_cache_[path] = { mtime, size, hunks };
+        loadseg_cache_bytes_ += size;
+        return hunks;
+    }
+
     // 0 => root dir
     filesystem_handler::node* node_from_lock(filesystem_handler& fs_handler, uint32_t bptr_to_lock);    
     // Perform an operation on "name" releative to "lock" (operation = 0 => lock, ST_USERDIR/ST_FILE => create, node* => rename the node to the pointed to object)
     std::variant<uint32_t, filesystem_handler::node*> node_operation(filesystem_handler& fs_handler, uint32_t bptr_to_lock, uint32_t bptr_to_name, int32_t access, std::variant<int32_t, filesystem_handler::node*> operation = 0);
-    void fill_file_info(filesystem_handler::node& node, uint32_t fib_cptr);
+    void fill_file_info(filesystem_handler& fs_handler, filesystem_handler::node& node, uint32_t fib_cptr);
     void fill_info_data(filesystem_handler& fs_handler, uint32_t id_cptr);
 
     // Alloc FileLock for already locked node (returns BPTR to allocated memory, or 0 on error)
@@ -1875,6 +2568,8 @@ err:
     void action_find(filesystem_handler& fs_handler, DosPacket& dp);
     void action_end(filesystem_handler& fs_handler, DosPacket& dp);
     void action_seek(filesystem_handler& fs_handler, DosPacket& dp);
+    bool queue_file_io(filesystem_handler& fs_handler, const DosPacket& dp);
+    void file_io_done(const std::fstream* f);
     void action_read(filesystem_handler& fs_handler, DosPacket& dp);
     void action_write(filesystem_handler& fs_handler, DosPacket& dp);
 };
@@ -1936,12 +2631,14 @@ std::variant<uint32_t, filesystem_handler::node*> harddisk::impl::node_operation
                     if (!temp_file || !temp_file.is_open())
                         return ERROR_WRITE_PROTECTED; // FIXME
                 }
+                fs_handler.update_entry(parent, filename);
                 node = fs_handler.find_in_node(parent, filename);
                 assert(node);
             } else if (create_type == ST_USERDIR) {
                 if (node)
                     return ERROR_OBJECT_EXISTS;
                 create_directory(parent.path() / filename);
+                fs_handler.update_entry(parent, filename);
                 node = fs_handler.find_in_node(parent, filename);
                 assert(node);
             } else if (create_type) {
@@ -1968,7 +2665,7 @@ std::variant<uint32_t, filesystem_handler::node*> harddisk::impl::node_operation
     return node;
 }
 
-void harddisk::impl::fill_file_info(filesystem_handler::node& node, uint32_t fib_cptr)
+void harddisk::impl::fill_file_info(filesystem_handler& fs_handler, filesystem_handler::node& node, uint32_t fib_cptr)
 {
     const auto path = node.path();
     // NOTE: Filename and comment should be BSTR's when returned
@@ -1978,8 +2675,11 @@ void harddisk::impl::fill_file_info(filesystem_handler::node& node, uint32_t fib
     mem_.write_u32(fib_cptr + fib_EntryType, node.type()); // Must be same as fib_DirEntryType
     mem_.write_u32(fib_cptr + fib_Protection, 0); // Note: bit set means the action is NOT allowed
 
-    const auto size = static_cast<uint32_t>(node.type() == ST_FILE ? file_size(path) : 0);
-    const auto ticks = ticks_since_amiga_epoch(last_write_time(path));
+    uint64_t size64;
+    fs::file_time_type mtime;
+    fs_handler.get_metadata(node, size64, mtime);
+    const auto size = static_cast<uint32_t>(size64);
+    const auto ticks = ticks_since_amiga_epoch(mtime);
 
     mem_.write_u32(fib_cptr + fib_Size, size);
     mem_.write_u32(fib_cptr + fib_NumBlocks, (size + sector_size_bytes - 1) / sector_size_bytes);
@@ -2049,6 +2749,12 @@ void harddisk::impl::handle_volume_packet()
 
     auto& fs_handler = *shared_folders_[id].fs_handler;
 
+    if ((dp.dp_Type == ACTION_READ || dp.dp_Type == ACTION_WRITE) && queue_file_io(fs_handler, dp))
+        return;
+    // Everything else (including ACTION_SEEK/ACTION_END for a file with queued I/O) waits for the queued jobs
+    wait_async_io();
+    assert(pending_file_io_.empty());
+
     dp.dp_Res1 = DOSFALSE;
     dp.dp_Res2 = ERROR_ACTION_NOT_KNOWN;
     switch (dp.dp_Type) {
@@ -2356,7 +3062,7 @@ void harddisk::impl::action_examine_object(filesystem_handler& fs_handler, DosPa
 
     const auto fib_cptr = BADDR(dp.dp_Arg2);
     mem_.write_u32(fib_cptr + fib_DiskKey, 0);
-    fill_file_info(*node, fib_cptr);
+    fill_file_info(fs_handler, *node, fib_cptr);
 
     dp.dp_Res1 = DOSTRUE;
     dp.dp_Res2 = NO_ERROR;
@@ -2392,7 +3098,7 @@ void harddisk::impl::action_examine_next(filesystem_handler& fs_handler, DosPack
     }
 
     mem_.write_u32(fib_cptr + fib_DiskKey, next_node->id());
-    fill_file_info(*next_node, fib_cptr);
+    fill_file_info(fs_handler, *next_node, fib_cptr);
 
     dp.dp_Res1 = DOSTRUE;
     dp.dp_Res2 = NO_ERROR;
@@ -2557,6 +3263,80 @@ void harddisk::impl::action_end(filesystem_handler& fs_handler, DosPacket& dp)
 #endif
 }
 
+void harddisk::impl::file_io_done(const std::fstream* f)
+{
+    auto it = pending_file_io_.find(f);
+    assert(it != pending_file_io_.end() && it->second);
+    if (!--it->second)
+        pending_file_io_.erase(it);
+}
+
+// Queue ACTION_READ/ACTION_WRITE to the I/O thread, returns false if the packet should be handled synchronously
+bool harddisk::impl::queue_file_io(filesystem_handler& fs_handler, const DosPacket& dp)
+{
+    if (!async_io_)
+        return false;
+    auto fh = fs_handler.file_handle_from_idx(dp.dp_Arg1);
+    if (!fh || dp.dp_Arg3 > 0x1000000)
+        return false;
+
+    auto* f = &fh->file();
+    // The stream belongs to the I/O thread while jobs for it are queued. Later packets for the
+    // same file are queued behind them (and check the stream state there) to keep them in order.
+    if (auto it = pending_file_io_.find(f); it != pending_file_io_.end())
+        ++it->second;
+    else if (!*f)
+        return false;
+    else
+        pending_file_io_[f] = 1;
+
+    async_io_job job {};
+    job.msg = mem_.read_u32(ptr_hold_ + dp_Link);
+    job.reply_port = mem_.read_u32(ptr_hold_ + dp_Port);
+    mem_.write_u32(ptr_hold_ + dp_Port, fs_handler.msg_port_address()); // Like .dosreply
+    const uint32_t packet = ptr_hold_;
+
+    if (dp.dp_Type == ACTION_READ) {
+        const uint32_t len = dp.dp_Arg3;
+        job.work = [f, len](async_io_job& j) {
+            // Same results as action_read for a stream that's already failed
+            if (!*f) {
+                j.failed = !f->eof();
+                j.actual = j.failed ? static_cast<uint32_t>(-1) : 0;
+                return;
+            }
+            j.buffer.resize(len);
+            f->read(reinterpret_cast<char*>(j.buffer.data()), len);
+            j.actual = static_cast<uint32_t>(f->gcount());
+        };
+        job.complete = [this, packet, f, buf = dp.dp_Arg2](async_io_job& j) {
+            file_io_done(f);
+            if (!j.failed)
+                mem_.write_block(buf, j.buffer.data(), j.actual);
+            mem_.write_u32(packet + dp_Res1, j.actual);
+            mem_.write_u32(packet + dp_Res2, j.failed ? ERROR_SEEK_ERROR : NO_ERROR);
+        };
+    } else {
+        job.buffer.resize(dp.dp_Arg3);
+        mem_.read_block(dp.dp_Arg2, job.buffer.data(), dp.dp_Arg3);
+        job.work = [f](async_io_job& j) {
+            if (*f)
+                f->write(reinterpret_cast<const char*>(j.buffer.data()), j.buffer.size());
+            j.failed = !*f;
+            j.actual = j.failed ? 0 : static_cast<uint32_t>(j.buffer.size());
+        };
+        job.complete = [this, packet, f, &fs_handler, &file_node = fh->file_node()](async_io_job& j) {
+            file_io_done(f);
+            fs_handler.update_entry(file_node);
+            mem_.write_u32(packet + dp_Res1, j.actual);
+            mem_.write_u32(packet + dp_Res2, j.failed ? ERROR_DISK_FULL : NO_ERROR);
+        };
+    }
+
+    queue_request(std::move(job));
+    return true;
+}
+
 void harddisk::impl::action_read(filesystem_handler& fs_handler, DosPacket& dp)
 {
     // dp_Type - ACTION_READ (82 == 'R')
@@ -2572,13 +3352,14 @@ void harddisk::impl::action_read(filesystem_handler& fs_handler, DosPacket& dp)
         if (f) {
             dp.dp_Res1 = 0;
             dp.dp_Res2 = NO_ERROR;
-            // Not really efficient
-            for (uint32_t i = 0; i < dp.dp_Arg3; ++i) {
-                const int ch = f.get();
-                if (ch == EOF)
+            buffer_.resize(fs_io_chunk_size);
+            while (dp.dp_Res1 < dp.dp_Arg3) {
+                f.read(reinterpret_cast<char*>(&buffer_[0]), std::min(dp.dp_Arg3 - dp.dp_Res1, fs_io_chunk_size));
+                const auto n = static_cast<uint32_t>(f.gcount());
+                mem_.write_block(dp.dp_Arg2 + dp.dp_Res1, &buffer_[0], n);
+                dp.dp_Res1 += n;
+                if (!f)
                     break;
-                mem_.write_u8(dp.dp_Arg2 + i, static_cast<uint8_t>(ch));
-                ++dp.dp_Res1;
             }
         } else if (f.eof()) {
             dp.dp_Res1 = 0;
@@ -2610,11 +3391,15 @@ void harddisk::impl::action_write(filesystem_handler& fs_handler, DosPacket& dp)
         auto& f = fh->file();
         dp.dp_Res1 = 0;
         dp.dp_Res2 = NO_ERROR;
-        // Not really efficient
-        for (uint32_t i = 0; i < dp.dp_Arg3 && f; ++i) {
-            f.put(mem_.read_u8(dp.dp_Arg2 + i));
-            ++dp.dp_Res1;
+        buffer_.resize(fs_io_chunk_size);
+        while (dp.dp_Res1 < dp.dp_Arg3 && f) {
+            const uint32_t n = std::min(dp.dp_Arg3 - dp.dp_Res1, fs_io_chunk_size);
+            mem_.read_block(dp.dp_Arg2 + dp.dp_Res1, &buffer_[0], n);
+            f.write(reinterpret_cast<const char*>(&buffer_[0]), n);
+            if (f)
+                dp.dp_Res1 += n;
         }
+        fs_handler.update_entry(fh->file_node());
         if (!f) {
 #if FS_HANDLER_DEBUG > 0
             std::cout << "[HD] Write failed for " << dp.dp_Arg1 << " " << dp.dp_Arg3 << " bytes -> " << error_name(dp.dp_Res2) << " " << static_cast<int32_t>(dp.dp_Res1) << "\n";
@@ -2677,8 +3462,8 @@ bad_number:
 #endif
 }
 
-harddisk::harddisk(memory_handler& mem, bool& cpu_active, const bool_func& should_disable_autoboot, const std::vector<std::string>& hdfilenames, const std::vector<std::string>& shared_folders)
-    : impl_{ new impl(mem, cpu_active, should_disable_autoboot, hdfilenames, shared_folders) }
+harddisk::harddisk(memory_handler& mem, bool& cpu_active, const bool_func& should_disable_autoboot, const std::vector<std::string>& hdfilenames, const std::vector<std::string>& shared_folders, const disk_image_options& image_options, bool async_io, bool fast_loadseg)
+    : impl_{ new impl(mem, cpu_active, should_disable_autoboot, hdfilenames, shared_folders, image_options, async_io, fast_loadseg) }
 {
 }
 
@@ -2688,3 +3473,8 @@ autoconf_device& harddisk::autoconf_dev()
 {
     return *impl_;
 }
+
+uint8_t harddisk::active_irq_mask()
+{
+    return impl_->active_irq_mask();
+}
@@ -5,19 +5,24 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <stdint.h>
 
 class memory_handler;
 class autoconf_device;
+struct disk_image_options;
 
 class harddisk {
 public:
     using bool_func = std::function<bool ()>;
 
-    explicit harddisk(memory_handler& mem, bool& cpu_active, const bool_func& should_disable_autoboot, const std::vector<std::string>& hdfilenames, const std::vector<std::string>& shared_folders);
+    explicit harddisk(memory_handler& mem, bool& cpu_active, const bool_func& should_disable_autoboot, const std::vector<std::string>& hdfilenames, const std::vector<std::string>& shared_folders, const disk_image_options& image_options, bool async_io, bool fast_loadseg);
     ~harddisk();
 
     autoconf_device& autoconf_dev();
 
+    // In async mode requests are completed from a PORTS interrupt server, 1 (=INT2) while there are completed requests
+    uint8_t active_irq_mask();
+
 private:
     class impl;
     std::unique_ptr<impl> impl_;
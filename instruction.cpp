@@ -1,5 +1,3 @@
- #include "instruction.h"
+#include "instruction.h"
 
-const instruction instructions[65536] = {
 #include "instruction_table.h"
-};
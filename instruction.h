@@ -3,7 +3,7 @@
 
 #include <stdint.h>
 
-enum class opsize {
+enum class opsize : uint8_t {
     none,
     b,
     w,
@@ -37,7 +37,7 @@ constexpr int32_t sext(uint32_t val, opsize size)
     }
 }
 
-enum class inst_type {
+enum class inst_type : uint8_t {
     ILLEGAL,
 #ifdef DEBUG_BREAK_INST
     DBGBRK,
@@ -117,9 +117,9 @@ enum class inst_type {
     UNLK,
 };
 
+// Kept small (8 bytes) since an entry is looked up for every executed instruction
 struct instruction {
     inst_type type;
-    const char* const name;
     opsize size;
     uint8_t ilen;
     uint8_t nea;
@@ -127,6 +127,7 @@ struct instruction {
     uint8_t data;
     uint8_t extra;
 };
+static_assert(sizeof(instruction) == 8);
 
 enum ea_m {
     ea_m_Dn            = 0b000, // Dn
@@ -181,4 +182,13 @@ constexpr uint16_t debug_break_instruction_num = DEBUG_BREAK_INST;
 
 extern const instruction instructions[65536];
 
+// Mnemonics live in a side table so they don't take up space in the decode table
+extern const char* const instruction_names[];
+extern const uint8_t instruction_name_index[65536];
+
+inline const char* instruction_name(uint16_t opcode)
+{
+    return instruction_names[instruction_name_index[opcode]];
+}
+
 #endif
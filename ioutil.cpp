@@ -1,28 +1,86 @@
 #include "ioutil.h"
 #include <ostream>
 #include <cassert>
-#include <sstream>
+#include <stdexcept>
 #include <fstream>
+#include <charconv>
+#include <cstring>
+#include <algorithm>
 
-std::ostream& operator<<(std::ostream& os, const num_formatter& nf)
+char* num_formatter::format(char* dest) const
 {
-    assert(nf.base_ == 2 || nf.base_ == 16); // TODO: Binary at least
-    assert(nf.width_ > 0);
+    assert(base_ == 2 || base_ == 16);
+    assert(width_ > 0 && width_ <= max_width);
 
-    const uint8_t mask = static_cast<uint8_t>(nf.base_-1);
-    const uint8_t shift = nf.base_ == 16 ? 4 : 1;
+    const uint8_t mask = static_cast<uint8_t>(base_ - 1);
+    const uint8_t shift = base_ == 16 ? 4 : 1;
 
-    for (int w = nf.width_; w--;) {
-        os << ("0123456789abcdef"[(nf.num_ >> (w*shift)) & mask]);
-    }
-    return os;
+    for (int w = width_; w--;)
+        *dest++ = "0123456789abcdef"[(num_ >> (w * shift)) & mask];
+    return dest;
+}
+
+std::ostream& operator<<(std::ostream& os, const num_formatter& nf)
+{
+    char buf[num_formatter::max_width];
+    return os.write(buf, nf.format(buf) - buf);
 }
 
 std::string detail::do_format(const num_formatter& nf)
 {
-    std::ostringstream os;
-    os << nf;
-    return os.str();
+    char buf[num_formatter::max_width];
+    return std::string(buf, nf.format(buf));
+}
+
+void format_buffer::pad_to(size_t pos)
+{
+    pos = std::min(pos, capacity);
+    while (len_ < pos)
+        buf_[len_++] = ' ';
+}
+
+format_buffer& format_buffer::operator<<(std::string_view s)
+{
+    const size_t n = std::min(s.size(), capacity - len_);
+    std::memcpy(buf_ + len_, s.data(), n);
+    len_ += n;
+    return *this;
+}
+
+format_buffer& format_buffer::operator<<(const num_formatter& nf)
+{
+    if (capacity - len_ >= static_cast<size_t>(nf.width()))
+        len_ = nf.format(buf_ + len_) - buf_;
+    return *this;
+}
+
+template <typename T>
+format_buffer& format_buffer::append_integer(T n)
+{
+    const auto res = std::to_chars(buf_ + len_, buf_ + capacity, n);
+    if (res.ec == std::errc {})
+        len_ = res.ptr - buf_;
+    return *this;
+}
+
+format_buffer& format_buffer::operator<<(int n)
+{
+    return append_integer(n);
+}
+
+format_buffer& format_buffer::operator<<(unsigned n)
+{
+    return append_integer(n);
+}
+
+format_buffer& format_buffer::operator<<(uint64_t n)
+{
+    return append_integer(n);
+}
+
+std::ostream& operator<<(std::ostream& os, const format_buffer& fb)
+{
+    return os.write(fb.view().data(), fb.view().size());
 }
 
 std::vector<uint8_t> read_file(const std::string& path)
@@ -49,18 +107,21 @@ std::vector<uint8_t> read_file(const std::string& path)
 void hexdump(std::ostream& os, const uint8_t* data, size_t size)
 {
     constexpr size_t width = 16;
+    format_buffer line;
     for (size_t i = 0; i < size;) {
         const size_t here = std::min(size - i, width);
 
+        line.clear();
         for (size_t j = 0; j < here; ++j)
-            os << hexfmt(data[i + j]) << ' ';
+            line << hexfmt(data[i + j]) << ' ';
         for (size_t j = here; j < width; ++j)
-            os << "   ";
+            line << "   ";
         for (size_t j = 0; j < here; ++j) {
             const uint8_t d = data[i + j];
-            os << static_cast<char>(d >= 32 && d < 128 ? d : '.');
+            line << static_cast<char>(d >= 32 && d < 128 ? d : '.');
         }
-        os << "\n";
+        line << '\n';
+        os << line;
         i += here;
     }
 }
@@ -69,20 +130,23 @@ void hexdump16(std::ostream& os, uint32_t addr, const uint8_t* data, size_t size
 {
     constexpr size_t width = 16;
     assert(size % 2 == 0);
+    format_buffer line;
     for (size_t i = 0; i < size;) {
         const size_t here = std::min(size - i, width);
 
-        os << hexfmt(addr) << "  ";
+        line.clear();
+        line << hexfmt(addr) << "  ";
 
         for (size_t j = 0; j < here; ++j)
-            os << hexfmt(data[i + j]) << (j & 1 ? " " : "");
+            line << hexfmt(data[i + j]) << (j & 1 ? " " : "");
         for (size_t j = here; j < width; ++j)
-            os << (j & 1 ? "   " : "  ");
+            line << (j & 1 ? "   " : "  ");
         for (size_t j = 0; j < here; ++j) {
             const uint8_t d = data[i + j];
-            os << static_cast<char>(d >= 32 && d < 128 ? d : '.');
+            line << static_cast<char>(d >= 32 && d < 128 ? d : '.');
         }
-        os << "\n";
+        line << '\n';
+        os << line;
         i += here;
         addr += static_cast<uint32_t>(here);
     }
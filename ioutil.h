@@ -4,12 +4,24 @@
 #include <iosfwd>
 #include <stdint.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class num_formatter {
 public:
+    static constexpr int max_width = 64;
+
     explicit num_formatter(uint64_t num, int base, int width) : num_{num}, base_{base}, width_{width} {}
     friend std::ostream& operator<<(std::ostream& os, const num_formatter& hf);
+
+    int width() const
+    {
+        return width_;
+    }
+
+    // Writes exactly width() digits to dest and returns a pointer past the last one
+    char* format(char* dest) const;
+
 private:
     uint64_t num_;
     int base_;
@@ -45,6 +57,63 @@ std::string binstring(T n, int w = static_cast<int>(sizeof(T) * 8))
     return detail::do_format(binfmt(n, w));
 }
 
+// Fixed capacity character buffer for building output lines without going
+// through iostreams. Text that doesn't fit is dropped.
+class format_buffer {
+public:
+    static constexpr size_t capacity = 512;
+
+    format_buffer() = default;
+    format_buffer(const format_buffer&) = delete;
+    format_buffer& operator=(const format_buffer&) = delete;
+
+    size_t size() const
+    {
+        return len_;
+    }
+
+    std::string_view view() const
+    {
+        return { buf_, len_ };
+    }
+
+    void clear()
+    {
+        len_ = 0;
+    }
+
+    // Append spaces until the buffer holds at least pos characters
+    void pad_to(size_t pos);
+
+    format_buffer& operator<<(char c)
+    {
+        if (len_ < capacity)
+            buf_[len_++] = c;
+        return *this;
+    }
+
+    format_buffer& operator<<(std::string_view s);
+
+    format_buffer& operator<<(const char* s)
+    {
+        return *this << std::string_view { s };
+    }
+
+    format_buffer& operator<<(const num_formatter& nf);
+    format_buffer& operator<<(int n);
+    format_buffer& operator<<(unsigned n);
+    format_buffer& operator<<(uint64_t n);
+
+private:
+    template <typename T>
+    format_buffer& append_integer(T n);
+
+    char buf_[capacity];
+    size_t len_ = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const format_buffer& fb);
+
 std::vector<uint8_t> read_file(const std::string& path);
 void hexdump(std::ostream& os, const uint8_t* data, size_t size);
 void hexdump16(std::ostream& os, uint32_t addr, const uint8_t* data, size_t size);
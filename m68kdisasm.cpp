@@ -4,55 +4,56 @@
 #include <optional>
 #include <sstream>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <bitset>
 #include <iomanip>
 #include <algorithm>
 #include <cstring>
+#include <memory>
+#include <filesystem>
 
 #include "disasm.h"
 #include "ioutil.h"
 #include "instruction.h"
 #include "memory.h"
+#include "state_file.h"
 
 static bool verbose_disasm = false;
 static bool show_bytes = false;
 
 static constexpr int line_width = 40;
 
-class fixed_width_line {
+// Redirects everything written to os until flush() through a small fixed
+// buffer while keeping track of the column, so the line can be padded to
+// line_width without building it in a temporary string stream.
+class fixed_width_line : private std::streambuf {
 public:
     fixed_width_line(std::ostream& os)
         : os_ { os }
-        , old_streambuf_ { os_.rdbuf() }
+        , target_ { os_.rdbuf() }
     {
-        assert(old_streambuf_);
-        os_.rdbuf(oss_.rdbuf());
+        assert(target_);
+        setp(buf_, buf_ + sizeof(buf_));
+        os_.rdbuf(this);
     }
 
     ~fixed_width_line()
     {
-        if (old_streambuf_)
+        if (active_)
             flush(false);
     }
 
     void flush(bool enforce_width)
     {
-        assert(old_streambuf_);
-        os_.rdbuf(old_streambuf_);
-        old_streambuf_ = nullptr;
-        auto s = oss_.str();
-        os_.write(s.c_str(), s.length());
+        assert(active_);
+        os_.rdbuf(target_);
+        active_ = false;
+        drain();
         if (enforce_width) {
-            int col = 0;
-            const int tw = 8;
-            for (const auto ch : s) {
-                if (ch == '\t')
-                    col += tw - col % tw;
-                else
-                    ++col;
-            }
-            while (col < line_width) {
-                col += tw - col % tw;
-                os_.put('\t');
+            while (col_ < line_width) {
+                col_ += tab_width - col_ % tab_width;
+                target_->sputc('\t');
             }
         }
     }
@@ -60,9 +61,38 @@ public:
     fixed_width_line(const fixed_width_line&) = delete;
     fixed_width_line& operator=(const fixed_width_line&) = delete;
 private:
+    static constexpr int tab_width = 8;
     std::ostream& os_;
-    std::streambuf* old_streambuf_;
-    std::ostringstream oss_;
+    std::streambuf* target_;
+    bool active_ = true;
+    int col_ = 0;
+    char buf_[128];
+
+    void advance(char ch)
+    {
+        if (ch == '\t')
+            col_ += tab_width - col_ % tab_width;
+        else
+            ++col_;
+    }
+
+    void drain()
+    {
+        for (const char* p = pbase(); p != pptr(); ++p)
+            advance(*p);
+        target_->sputn(pbase(), pptr() - pbase());
+        setp(buf_, buf_ + sizeof(buf_));
+    }
+
+    int_type overflow(int_type ch) override
+    {
+        drain();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            advance(traits_type::to_char_type(ch));
+            target_->sputc(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
 };
 
 void disasm_stmts(const std::vector<uint8_t>& data, uint32_t offset, uint32_t end, uint32_t pcoffset = 0)
@@ -74,14 +104,17 @@ void disasm_stmts(const std::vector<uint8_t>& data, uint32_t offset, uint32_t en
         offset += 2;
         return w;
     };
+    format_buffer line;
     while (offset < end) {
         uint16_t iw[max_instruction_words];
         const auto pc = pcoffset + offset;
         iw[0] = get_word();
         for (uint16_t i = 1; i < instructions[iw[0]].ilen; ++i)
             iw[i] = get_word();
-        disasm(std::cout, pc, iw, max_instruction_words);
-        std::cout << "\n";
+        line.clear();
+        disasm(line, pc, iw, max_instruction_words);
+        line << '\n';
+        std::cout << line;
     }
 }
 
@@ -577,6 +610,12 @@ public:
         }
     }
 
+    // Raw value without checking (for saving state)
+    uint32_t raw_unchecked() const
+    {
+        return raw_;
+    }
+
     simval& operator+=(const simval& rhs)
     {
         if (known() && rhs.known())
@@ -1147,6 +1186,96 @@ const type* parse_type(const std::string& str)
 
 const type& libvec_code = make_array_type(code_type, 3);
 
+// Types that aren't created by the make_XXX_type functions, and so must be identified by address
+const std::pair<const type*, const char*> named_types[] = {
+    { &unknown_type, "unknown" },
+    { &char_type, "char" },
+    { &byte_type, "byte" },
+    { &word_type, "word" },
+    { &long_type, "long" },
+    { &code_type, "code" },
+    { &copper_code_type, "copper_code" },
+    { &jumptab_word_type, "jumptab_word" },
+    { &unknown_ptr, "unknown_ptr" },
+    { &char_ptr, "char_ptr" },
+    { &byte_ptr, "byte_ptr" },
+    { &word_ptr, "word_ptr" },
+    { &long_ptr, "long_ptr" },
+    { &code_ptr, "code_ptr" },
+    { &copper_code_ptr, "copper_code_ptr" },
+    { &bptr_type, "bptr" },
+    { &bstr_type, "bstr" },
+    { &bcpl_seglist_type, "bcpl_seglist" },
+    { &patchitem_type, "patchitem" },
+    { &hack_str_type, "hack_str" },
+};
+
+// Encode type so decode_type() gives back the same (identical) type
+std::string encode_type(const type& t)
+{
+    for (const auto& [nt, name] : named_types) {
+        if (nt == &t)
+            return std::string { "#" } + name + ";";
+    }
+    switch (t.base()) {
+    case base_data_type::ptr_:
+        if (t.len())
+            return "A" + std::to_string(t.len()) + ";" + encode_type(*t.ptr());
+        return "P" + encode_type(*t.ptr());
+    case base_data_type::bptr_:
+        return "B" + encode_type(*t.bptr());
+    case base_data_type::struct_:
+        return std::string { "S" } + t.struct_def()->name() + ";";
+    case base_data_type::rptrw_:
+        return "R" + std::to_string(t.rptr_base()) + ";";
+    default:
+        break;
+    }
+    std::ostringstream oss;
+    oss << "Can't encode type " << t;
+    throw std::runtime_error { oss.str() };
+}
+
+const type& decode_type(const std::string& str, size_t& pos)
+{
+    if (pos >= str.length())
+        throw std::runtime_error { "Invalid encoded type \"" + str + "\"" };
+    const char kind = str[pos++];
+    auto get_part = [&]() {
+        const auto end = str.find_first_of(';', pos);
+        if (end == std::string::npos)
+            throw std::runtime_error { "Invalid encoded type \"" + str + "\"" };
+        auto part = str.substr(pos, end - pos);
+        pos = end + 1;
+        return part;
+    };
+    switch (kind) {
+    case '#': {
+        const auto name = get_part();
+        for (const auto& [nt, n] : named_types) {
+            if (name == n)
+                return *nt;
+        }
+        break;
+    }
+    case 'A': {
+        const auto len = static_cast<uint32_t>(std::stoul(get_part()));
+        return make_array_type(decode_type(str, pos), len);
+    }
+    case 'P':
+        return make_pointer_type(decode_type(str, pos));
+    case 'B':
+        return make_bpointer_type(decode_type(str, pos));
+    case 'S':
+        if (auto it = typenames.find(get_part()); it != typenames.end() && it->second->struct_def())
+            return *it->second;
+        break;
+    case 'R':
+        return make_rptrw(static_cast<uint32_t>(std::stoul(get_part())));
+    }
+    throw std::runtime_error { "Invalid encoded type \"" + str + "\"" };
+}
+
 // nodes.h
 const structure_definition MinNode {
     "MinNode",
@@ -2989,13 +3118,155 @@ void maybe_add_custom_bit_info(std::ostream& extra, uint32_t addr, uint16_t val)
 
 constexpr uint16_t JMP_ABS_L_instruction = 0x4EF9;
 
+// 24-bit address space where storage is only allocated for pages that are actually used.
+// Unused memory reads as zero and is neither written nor handled.
+class sparse_memory {
+public:
+    static constexpr uint32_t size = 1 << 24;
+
+    uint8_t operator[](uint32_t addr) const
+    {
+        const auto p = find_page(addr);
+        return p ? p->data[addr & page_mask] : 0;
+    }
+
+    uint16_t u16(uint32_t addr) const
+    {
+        if ((addr & page_mask) <= page_size - 2) {
+            const auto p = find_page(addr);
+            return p ? get_u16(&p->data[addr & page_mask]) : 0;
+        }
+        return static_cast<uint16_t>((*this)[addr] << 8 | (*this)[addr + 1]);
+    }
+
+    uint32_t u32(uint32_t addr) const
+    {
+        if ((addr & page_mask) <= page_size - 4) {
+            const auto p = find_page(addr);
+            return p ? get_u32(&p->data[addr & page_mask]) : 0;
+        }
+        return u16(addr) << 16 | u16(addr + 2);
+    }
+
+    // Copy of the bytes in [addr, addr+len)
+    std::vector<uint8_t> read(uint32_t addr, uint32_t len) const
+    {
+        std::vector<uint8_t> res(len);
+        for (uint32_t i = 0; i < len; ++i)
+            res[i] = (*this)[addr + i];
+        return res;
+    }
+
+    bool equal(uint32_t addr1, uint32_t addr2, uint32_t len) const
+    {
+        for (uint32_t i = 0; i < len; ++i) {
+            if ((*this)[addr1 + i] != (*this)[addr2 + i])
+                return false;
+        }
+        return true;
+    }
+
+    // NUL terminated string starting at addr
+    std::string string_at(uint32_t addr) const
+    {
+        std::string res;
+        while (addr < size && (*this)[addr])
+            res.push_back((*this)[addr++]);
+        return res;
+    }
+
+    void write(uint32_t addr, const uint8_t* data, uint32_t len)
+    {
+        assert(static_cast<size_t>(addr) + len <= size);
+        while (len) {
+            auto& p = get_page(addr);
+            const auto ofs = addr & page_mask;
+            const auto here = std::min(len, page_size - ofs);
+            memcpy(&p.data[ofs], data, here);
+            for (uint32_t i = 0; i < here; ++i)
+                p.written[ofs + i] = true;
+            addr += here;
+            data += here;
+            len -= here;
+        }
+    }
+
+    bool written(uint32_t addr) const
+    {
+        const auto p = find_page(addr);
+        return p && p->written[addr & page_mask];
+    }
+
+    void mark_written(uint32_t addr, uint32_t len)
+    {
+        for (uint32_t i = 0; i < len; ++i)
+            get_page(addr + i).written[(addr + i) & page_mask] = true;
+    }
+
+    // [begin, end) ranges of written memory
+    std::vector<std::pair<uint32_t, uint32_t>> written_ranges() const
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        for (uint32_t pi = 0; pi < pages_.size(); ++pi) {
+            if (!pages_[pi])
+                continue;
+            for (uint32_t ofs = 0; ofs < page_size; ++ofs) {
+                if (!pages_[pi]->written[ofs])
+                    continue;
+                const uint32_t addr = pi << page_shift | ofs;
+                if (!ranges.empty() && ranges.back().second == addr)
+                    ++ranges.back().second;
+                else
+                    ranges.push_back({ addr, addr + 1 });
+            }
+        }
+        return ranges;
+    }
+
+    bool handled(uint32_t addr) const
+    {
+        const auto p = find_page(addr);
+        return p && p->handled[addr & page_mask];
+    }
+
+    void mark_handled(uint32_t addr, uint32_t len = 1)
+    {
+        for (uint32_t i = 0; i < len; ++i)
+            get_page(addr + i).handled[(addr + i) & page_mask] = true;
+    }
+
+private:
+    static constexpr uint32_t page_shift = 12;
+    static constexpr uint32_t page_size = 1 << page_shift;
+    static constexpr uint32_t page_mask = page_size - 1;
+
+    struct page {
+        uint8_t data[page_size];
+        std::bitset<page_size> written;
+        std::bitset<page_size> handled;
+    };
+    std::vector<std::unique_ptr<page>> pages_ = std::vector<std::unique_ptr<page>>(size >> page_shift);
+
+    const page* find_page(uint32_t addr) const
+    {
+        return addr < size ? pages_[addr >> page_shift].get() : nullptr;
+    }
+
+    page& get_page(uint32_t addr)
+    {
+        if (addr >= size)
+            throw std::runtime_error { "Address out of range: $" + hexstring(addr) };
+        auto& p = pages_[addr >> page_shift];
+        if (!p)
+            p = std::make_unique<page>(); // Value initialized (zero)
+        return *p;
+    }
+};
+
 class analyzer {
 public:
     explicit analyzer()
-        : written_(max_mem)
-        , data_handled_at_(max_mem)
-        , data_(max_mem)
-        , regs_ {}
+        : regs_ {}
     {
     }
 
@@ -3015,9 +3286,9 @@ public:
     uint32_t alloc_fake_mem(uint32_t size)
     {
         size = (size + 3) & -4; // align
-        if (size < alloc_top_ && !written_[alloc_top_ - size]) {
+        if (size < alloc_top_ && !data_.written(alloc_top_ - size)) {
             alloc_top_ -= size;
-            std::fill(written_.begin() + alloc_top_, written_.begin() + alloc_top_ + size, true); // So assignments will be tracked and pointers are deemed OK
+            data_.mark_written(alloc_top_, size); // So assignments will be tracked and pointers are deemed OK
             return alloc_top_;
         }
         return 0;
@@ -3069,9 +3340,15 @@ public:
 
             std::vector<std::string> parts = split(line.substr(start, end - start), ' ');
 
+            // Normalized definition, used to detect changes that prevent reusing a cached analysis
+            std::string def;
+            for (const auto& part : parts)
+                def += (def.empty() ? "" : " ") + part;
+
             if (parts.size() == 1 && parts[0] == "ESTRUCT") {
                 if (!in_struct)
                     throw std::runtime_error { "ESTRUCT outside structure in " + filename + " line " + std::to_string(linenum) + ": " + line };
+                info_other_.push_back(def);
                 in_struct = false;
                 struct_defs_.push_back(std::make_unique<structure_definition>(struct_name.c_str(), struct_fields));
                 struct_fields.clear();
@@ -3080,6 +3357,7 @@ public:
                 if (in_struct)
                     throw std::runtime_error { "Already in structure in " + filename + " line " + std::to_string(linenum) + ": " + line };
                 struct_name = parts[1];
+                info_other_.push_back(def);
                 in_struct = true;
                 continue;
             }
@@ -3090,6 +3368,7 @@ public:
                     const auto [ok, addr] = from_hex(parts[0]);
                     if (ok) {
                         alias_or_forced_mem_.push_back(std::make_pair(addr, parts[1]));
+                        info_other_.push_back(def);
                         continue;
                     }
                 }
@@ -3104,10 +3383,12 @@ public:
                     if (lab[0] >= '0' && lab[0] <= '9') {
                         if (const auto [ok2, val] = from_hex(lab); ok2) {
                             forced_values_.insert({ addr, { *rn, val } });
+                            info_other_.push_back(def);
                             continue;
                         }
                     } else {
                         delayed_forced_values_.push_back({ addr, *rn, lab });
+                        info_other_.push_back(def);
                         continue;
                     }
                 }
@@ -3128,6 +3409,7 @@ public:
                 continue;
             }
 
+            const auto type_name = parts[1];
             // quick hack for BCPL code
             if (parts[1] == "BCPLCODE") {
                 parts[1] = "CODE";
@@ -3142,6 +3424,7 @@ public:
             if (!t)
                 throw std::runtime_error { "Invalid type in " + filename + " line " + std::to_string(linenum) + ": " + line };
             auto lab = parts[2];
+            std::string args;
             if (lab == "?") {
                 if (t == &hack_str_type)
                     lab = ""; // Label added later for strings
@@ -3168,14 +3451,18 @@ public:
                     }
                     // TODO outputs..
                     functions_.insert({ addr, function_description { {}, input } });
+                    args = lab.substr(pos);
                     lab.erase(pos);
                 }
             }
 
-            if (in_struct)
+            if (in_struct) {
                 struct_fields.push_back({lab.c_str(), *t, static_cast<int32_t>(addr)});
-            else
+                info_other_.push_back(def);
+            } else {
                 predef_info_.push_back({ addr, { lab, t } });
+                predef_records_.push_back({ addr, type_name, lab, args, type_name != "BCPLCODE" && t != &hack_str_type && t != &bcpl_seglist_type });
+            }
         }
 
         if (in_struct)
@@ -3193,11 +3480,9 @@ public:
 
     void write_data(uint32_t addr, const uint8_t* data, uint32_t length)
     {
-        if (static_cast<size_t>(addr) + length > data_.size())
+        if (static_cast<size_t>(addr) + length > max_mem)
             throw std::runtime_error { "Out of range" };
-        memcpy(&data_[addr], data, length);
-        for (uint32_t i = 0; i < length; ++i)
-            written_[i + addr] = true;
+        data_.write(addr, data, length);
         insert_area(areas_, addr, addr + length);
     }
 
@@ -3217,9 +3502,9 @@ public:
     {
         // Add roots for all defined interrupt vectors up to and including traps
         for (uint8_t i = 2; i < 48; ++i) {
-            if (!written_[i * 4])
+            if (!data_.written(i * 4))
                 continue;
-            auto ptr = get_u32(&data_[i * 4]);
+            auto ptr = data_.u32(i * 4);
             if (!pointer_ok(ptr))
                 continue;
             // Only add if not supplied in info file
@@ -3240,7 +3525,7 @@ public:
             return;
 
         // Don't visit non-written areas
-        if (!force && (!written_[addr] || addr < 32*4))
+        if (!force && (!data_.written(addr) || addr < 32*4))
             return;
 
         if (addr >= alloc_top_ && addr <= alloc_start)
@@ -3302,6 +3587,7 @@ public:
             // Don't override symbol names
             if (!is_auto_label || li-> name.starts_with("dat"))
                 li->name = name;
+            label_extent_lost(addr - offset, *li);
             li->t = &t;
             return;
         }
@@ -3314,10 +3600,15 @@ public:
 
     std::pair<label_info*, int32_t> find_label(uint32_t addr)
     {
-        if (addr >= max_mem || labels_.empty())
+        return find_label(labels_, addr);
+    }
+
+    static std::pair<label_info*, int32_t> find_label(std::map<uint32_t, label_info>& labels, uint32_t addr)
+    {
+        if (addr >= max_mem || labels.empty())
             return { nullptr, 0 };
-        auto it = labels_.lower_bound(addr);
-        if (it != labels_.end()) {
+        auto it = labels.lower_bound(addr);
+        if (it != labels.end()) {
             const int32_t offset = addr - it->first;
             assert(offset <= 0);
             if (!offset)
@@ -3326,7 +3617,7 @@ public:
                 return { &it->second, offset };
         }
         // At this point it can't be an exact match, and can't be part of a structures negative area
-        if (it == labels_.begin())
+        if (it == labels.begin())
             return { nullptr, 0 }; // Before any labels
         --it;
         const int32_t offset = addr - it->first;
@@ -3338,6 +3629,19 @@ public:
         return { nullptr, 0 };
     }
 
+    // Remember what a label covered before it's erased or changes type, the old label
+    // may have affected the analysis so new code can't be added there to a cached analysis
+    void label_extent_lost(uint32_t addr, const label_info& li)
+    {
+        uint32_t beg = addr, end = addr + 1;
+        if (li.t != &unknown_type && li.t != &code_type) {
+            if (li.t->struct_def())
+                beg -= li.t->struct_def()->negsize();
+            end = std::max(end, addr + sizeof_type(*li.t));
+        }
+        lost_label_extents_.push_back({ beg, end });
+    }
+
     void add_auto_label(uint32_t addr, const type& t, const std::string& prefix = "dat")
     {
         if (addr < interrupts_end && (addr & 3) == 0 && &t != &code_type) {
@@ -3387,10 +3691,10 @@ public:
         assert(!regs_.d[1].known());
 
 
-        const uint32_t dSize = get_u32(&data_[addr]);
-        const uint32_t vectors = get_u32(&data_[addr + 4]);
-        const uint32_t structure = get_u32(&data_[addr + 8]);
-        const uint32_t initFunc = get_u32(&data_[addr + 12]);
+        const uint32_t dSize = data_.u32(addr);
+        const uint32_t vectors = data_.u32(addr + 4);
+        const uint32_t structure = data_.u32(addr + 8);
+        const uint32_t initFunc = data_.u32(addr + 12);
 
         regs_.a[0] = simval {vectors};
         regs_.a[1] = simval {structure};
@@ -3420,7 +3724,7 @@ public:
             library_bases_.insert({ "exec.library", exec_base_ });
         }
         const auto gfx_base = add_library("graphics.library", "GfxBase", GfxBase);
-        if (const auto a = exec_base_ + ExecBase.field_offset("IntVects") + 0x48; get_u32(&data_[a]) == 0) {
+        if (const auto a = exec_base_ + ExecBase.field_offset("IntVects") + 0x48; data_.u32(a) == 0) {
             // Stuff gfxbase into IntVects[6].iv_Data ...
             saved_pointers_.insert({ a, gfx_base });
         }
@@ -3550,86 +3854,36 @@ public:
     std::optional<uint32_t> label_adddress(const std::string& lab)
     {
         // TODO: This lookup is slow
+        looked_up_labels_.insert(lab);
         auto it = std::find_if(labels_.begin(), labels_.end(), [&lab = lab](const auto& l) { return l.second.name == lab; });
         if (it == labels_.end())
             return {};
         return it->first;
     }
 
-    void run()
+    // Use (and update) cached analysis results in filename, key identifies the input
+    void set_cache(const std::string& filename, const std::string& key)
     {
-        handle_predef_info();
-        if (!exec_base_)
-            add_fakes();
-
-        for (const auto& [addr, reg, lab] : delayed_forced_values_) {
-            auto la = label_adddress(lab);
-            if (!la)
-                throw std::runtime_error { "Invalid label \"" + lab + "\" used for forced value at address $" + hexstring(addr) };
-            forced_values_.insert({ addr, { reg, *la } });
-        }
-        for (const auto& [addr, expr] : alias_or_forced_mem_) {
-            if (addr + 3 >= max_mem)
-                throw std::runtime_error { "Invalid function alias/forced address $" + hexstring(addr) + " \"" + expr + "\"" };
-            auto base = expr;
-            int32_t ofs = 0;
-            auto pos = base.find_first_of("-");
-            if (pos != std::string::npos) {
-                auto [ok, val] = from_hex(base.substr(pos + 1));
-                if (!ok)
-                    throw std::runtime_error { "Invalid function alias/forced mem for expression address $" + hexstring(addr) + " \"" + expr + "\"" };
-                base = base.substr(0, pos);
-                ofs = -static_cast<int32_t>(val);
-            }
-            auto la = label_adddress(base);
-            if (!la)
-                throw std::runtime_error { "Invalid function alias/forced mem for expression address (label not found) $" + hexstring(addr) + " \"" + expr + "\"" };
-            const auto actual_address = *la + ofs;
-
-            auto fit = functions_.find(actual_address);
-            if (fit == functions_.end()) {
-                // Must be a forced memory value
-                //put_u32(&data_[addr], actual_address);
-                saved_pointers_.insert({ addr, actual_address});
-                std::fill(written_.begin() + actual_address, written_.begin() + actual_address + 4, true);
-                continue;
-            }
-
-            if (!functions_.insert({ addr, fit->second }).second)
-                throw std::runtime_error { "Invalid function alias/forced mem for expression address (function already defined there) $" + hexstring(addr) + " \"" + expr + "\"" };
-            add_root(addr, simregs{});
-        }
+        cache_filename_ = filename;
+        cache_key_ = key;
+    }
 
-        process_roots();
-        // Now add any predefined roots that were not automatically inferred
-        for (const auto& pi : predef_info_) {
-            if (pi.second.t == &code_type && visited_.find(pi.first) == visited_.end()) {
-                add_root(pi.first, simregs {}, true);
-                process_roots();
-            } else if (pi.second.t->base() == base_data_type::ptr_ && pi.second.t->ptr()->base() == base_data_type::jumptab_word_ && pi.second.t->len()) {
-                for (uint32_t i = 0; i < pi.second.t->len(); ++i) {
-                    int16_t offset = get_u16(&data_[pi.first + 2 * i]);
-                    if (!offset)
-                        continue;
-                    add_root(pi.first + offset, simregs {}, true);
-                }
-                process_roots();
-            }
+    void run()
+    {
+        const auto setup = setup_fingerprint();
+        if (cache_filename_.empty() || !load_analysis(setup)) {
+            do_analysis();
+            if (!cache_filename_.empty())
+                save_analysis(setup);
         }
+        prune_labels();
 
-        // Prune overlapping labels
-        for (auto it = labels_.begin(); it != labels_.end();) {
-            if (it->second.t == &unknown_type || it->second.t == &code_type) {
-                ++it;
-                continue;
-            }
-            const auto next = it->first + sizeof_type(*it->second.t);
-            ++it;
-            while (it != labels_.end() && it->first < next) {
-                //std::cerr << "Erasing " << it->second.name << " " << *it->second.t << "\n";
-                it = labels_.erase(it);
-            }
-        }
+        // Sorted visited addresses to find the extent of data areas
+        std::vector<uint32_t> visited_addrs;
+        visited_addrs.reserve(visited_.size());
+        for (const auto& v : visited_)
+            visited_addrs.push_back(v.first);
+        std::sort(visited_addrs.begin(), visited_addrs.end());
 
         for (const auto& area : areas_) {
             uint32_t pos = area.beg;
@@ -3642,8 +3896,8 @@ public:
 
                 auto it = visited_.find(pos);
                 if (it == visited_.end()) {
-                    const auto next_visited = visited_.upper_bound(pos);
-                    const auto next_visited_pos = std::min(area.end, next_visited == visited_.end() ? ~0U : next_visited->first);
+                    const auto next_visited = std::upper_bound(visited_addrs.begin(), visited_addrs.end(), pos);
+                    const auto next_visited_pos = std::min(area.end, next_visited == visited_addrs.end() ? ~0U : *next_visited);
                     handle_data_area(pos, next_visited_pos);
                     pos = next_visited_pos;
                     continue;
@@ -3664,7 +3918,7 @@ public:
                 if (inst.type == inst_type::ILLEGAL && iwords[0] != illegal_instruction_num) {
                     if (iwords[0] == movec_instruction_dr0_num || iwords[0] == movec_instruction_dr1_num) {
                         // MOVEC special case
-                        const auto op = get_u16(&data_[pos + 2]);
+                        const auto op = data_.u16(pos + 2);
                         const auto regname = (op & 0x8000 ? "A" : "D") + std::to_string((op >> 12) & 7);
                         std::string crname;                        
                         static const std::map<uint32_t, std::string> crnames = {
@@ -3689,7 +3943,8 @@ public:
                     continue;
                 }
 
-                std::ostringstream extra;
+                static std::ostringstream extra;
+                extra.str("");
                 fixed_width_line fwl { std::cout };
 
                 if (show_bytes) {
@@ -3700,7 +3955,7 @@ public:
                         extra << hexfmt(iwords[i], 4);
                 }
 
-                std::cout << "\t" << inst.name;
+                std::cout << "\t" << instruction_name(iwords[0]);
                 for (int i = 0; i < inst.nea; ++i) {
                     const auto ea = inst.ea[i];
                     std::cout << (i ? "," : "\t");
@@ -3931,9 +4186,9 @@ public:
                         break;
                     }
                 }
-                if (!extra.str().empty()) {
+                if (!extra.view().empty()) {
                     fwl.flush(true);
-                    std::cout << ";" << extra.str();
+                    std::cout << ";" << extra.view();
                 }
                 std::cout << "\n";
                 pos += inst.ilen * 2;
@@ -3947,12 +4202,95 @@ public:
 #endif
     }
 
+    void do_analysis()
+    {
+        handle_predef_info();
+        if (!exec_base_)
+            add_fakes();
+
+        for (const auto& [addr, reg, lab] : delayed_forced_values_) {
+            auto la = label_adddress(lab);
+            if (!la)
+                throw std::runtime_error { "Invalid label \"" + lab + "\" used for forced value at address $" + hexstring(addr) };
+            forced_values_.insert({ addr, { reg, *la } });
+        }
+        for (const auto& [addr, expr] : alias_or_forced_mem_) {
+            if (addr + 3 >= max_mem)
+                throw std::runtime_error { "Invalid function alias/forced address $" + hexstring(addr) + " \"" + expr + "\"" };
+            auto base = expr;
+            int32_t ofs = 0;
+            auto pos = base.find_first_of("-");
+            if (pos != std::string::npos) {
+                auto [ok, val] = from_hex(base.substr(pos + 1));
+                if (!ok)
+                    throw std::runtime_error { "Invalid function alias/forced mem for expression address $" + hexstring(addr) + " \"" + expr + "\"" };
+                base = base.substr(0, pos);
+                ofs = -static_cast<int32_t>(val);
+            }
+            auto la = label_adddress(base);
+            if (!la)
+                throw std::runtime_error { "Invalid function alias/forced mem for expression address (label not found) $" + hexstring(addr) + " \"" + expr + "\"" };
+            const auto actual_address = *la + ofs;
+
+            auto fit = functions_.find(actual_address);
+            if (fit == functions_.end()) {
+                // Must be a forced memory value
+                //put_u32(&data_[addr], actual_address);
+                saved_pointers_.insert({ addr, actual_address});
+                data_.mark_written(actual_address, 4);
+                continue;
+            }
+
+            if (!functions_.insert({ addr, fit->second }).second)
+                throw std::runtime_error { "Invalid function alias/forced mem for expression address (function already defined there) $" + hexstring(addr) + " \"" + expr + "\"" };
+            alias_functions_.push_back({ addr, actual_address });
+            add_root(addr, simregs{});
+        }
+
+        process_roots();
+        // Now add any predefined roots that were not automatically inferred
+        for (uint32_t idx = 0; idx < predef_info_.size(); ++idx) {
+            const auto& pi = predef_info_[idx];
+            if (pi.second.t == &code_type && visited_.find(pi.first) == visited_.end()) {
+                add_root(pi.first, simregs {}, true);
+                process_roots();
+                last_predef_root_ = idx;
+            } else if (pi.second.t->base() == base_data_type::ptr_ && pi.second.t->ptr()->base() == base_data_type::jumptab_word_ && pi.second.t->len()) {
+                for (uint32_t i = 0; i < pi.second.t->len(); ++i) {
+                    int16_t offset = data_.u16(pi.first + 2 * i);
+                    if (!offset)
+                        continue;
+                    add_root(pi.first + offset, simregs {}, true);
+                }
+                process_roots();
+                last_predef_root_ = idx;
+            }
+        }
+    }
+
+    void prune_labels()
+    {
+        // Prune overlapping labels
+        for (auto it = labels_.begin(); it != labels_.end();) {
+            if (it->second.t == &unknown_type || it->second.t == &code_type) {
+                ++it;
+                continue;
+            }
+            const auto next = it->first + sizeof_type(*it->second.t);
+            ++it;
+            while (it != labels_.end() && it->first < next) {
+                //std::cerr << "Erasing " << it->second.name << " " << *it->second.t << "\n";
+                it = labels_.erase(it);
+            }
+        }
+    }
+
     void add_rom_tag(const rom_tag& tag);
     void handle_whdload(uint32_t header_address);
     uint32_t handle_whd_patchlist(const uint32_t pl_start, bool analyze);
 
 private:
-    static constexpr uint32_t max_mem = 1 << 24;
+    static constexpr uint32_t max_mem = sparse_memory::size;
     struct area {
         uint32_t beg;
         uint32_t end;
@@ -3962,13 +4300,11 @@ private:
         regname reg;
         std::string label;
     };
-    std::vector<bool> written_;
-    std::vector<bool> data_handled_at_;
-    std::vector<uint8_t> data_;
+    sparse_memory data_;
     std::vector<std::pair<uint32_t, simregs>> roots_;
-    std::map<uint32_t, simregs> visited_;
-    std::map<uint32_t, label_info> labels_;
-    std::map<uint32_t, function_description> functions_;
+    std::unordered_map<uint32_t, simregs> visited_;
+    std::map<uint32_t, label_info> labels_; // Ordered since lookups need the closest preceding label
+    std::unordered_map<uint32_t, function_description> functions_;
     simregs regs_;
     std::vector<area> areas_;
     std::vector<std::pair<uint32_t, label_info>> predef_info_;
@@ -3981,6 +4317,25 @@ private:
     std::vector<std::unique_ptr<structure_definition>> struct_defs_;
 
     uint32_t fake_process_ = 0;
+    std::string cache_filename_;
+    std::string cache_key_;
+
+    // Info file definitions and what the analysis depended on, so a cached analysis can be
+    // updated when only labels are renamed or new code roots are added
+    struct predef_record {
+        uint32_t addr;
+        std::string type; // As written in the info file
+        std::string name;
+        std::string args; // Function arguments (if any)
+        bool plain; // Only adds a label
+    };
+    static constexpr uint32_t no_index = ~0U;
+    std::vector<predef_record> predef_records_; // Parallel to predef_info_
+    std::vector<std::string> info_other_; // Other definitions (except IGNORE which only affects the listing)
+    std::set<std::string> looked_up_labels_; // Names passed to label_adddress()
+    std::vector<area> lost_label_extents_;
+    std::vector<std::pair<uint32_t, uint32_t>> alias_functions_; // (alias, function address)
+    uint32_t last_predef_root_ = no_index; // Last entry in predef_info_ that added roots after the main analysis
 
     uint32_t ea_data_[2];
     simval ea_addr_[2];
@@ -3997,6 +4352,356 @@ private:
         return nullptr;
     }
 
+    // Analyzer state from before the analysis, a cached analysis is only valid if made from the same state
+    std::string setup_fingerprint() const
+    {
+        std::ostringstream ss;
+        ss << std::hex << exec_base_ << " " << fake_process_ << " " << alloc_top_ << "\n";
+        std::vector<uint32_t> funcs;
+        for (const auto& f : functions_)
+            funcs.push_back(f.first);
+        std::sort(funcs.begin(), funcs.end());
+        for (const auto addr : funcs)
+            ss << addr << " ";
+        ss << "\n";
+        for (const auto& r : roots_)
+            ss << r.first << " ";
+        ss << "\n";
+        for (const auto& [addr, li] : labels_)
+            ss << addr << " " << li.name << " " << encode_type(*li.t) << "\n";
+        for (const auto& [name, addr] : library_bases_)
+            ss << name << " " << addr << "\n";
+        return ss.str();
+    }
+
+    // Serialized analysis results and the info file definitions they were made with
+    struct cached_analysis {
+        std::string setup;
+        std::vector<uint8_t> predef_addrs;
+        std::vector<std::string> predef_types, predef_names, predef_args;
+        std::vector<uint8_t> predef_plain;
+        std::vector<std::string> info_other, looked_up;
+        std::vector<uint8_t> lost_label_extents, alias_functions;
+        uint32_t last_predef_root = no_index;
+        std::vector<uint8_t> label_addrs;
+        std::vector<std::string> label_names, label_types;
+        std::vector<uint8_t> visited, saved_pointers, forced_values, written;
+        std::vector<std::string> library_names;
+        std::vector<uint8_t> library_addrs;
+        uint32_t exec_base = 0, fake_process = 0, alloc_top = 0;
+    };
+
+    // Decoded cached analysis along with the changes needed to bring it up to date
+    struct reusable_analysis {
+        std::map<uint32_t, label_info> labels;
+        std::unordered_map<uint32_t, simregs> visited;
+        std::map<uint32_t, uint32_t> saved_pointers;
+        std::multimap<uint32_t, std::pair<regname, uint32_t>> forced_values;
+        std::vector<area> written;
+        std::map<std::string, uint32_t> library_bases;
+        uint32_t exec_base, fake_process, alloc_top;
+        std::vector<std::string> looked_up;
+        std::vector<area> lost_label_extents;
+        std::vector<std::pair<uint32_t, uint32_t>> alias_functions;
+        uint32_t last_predef_root;
+        std::vector<std::pair<uint32_t, std::string>> renames; // Index in predef_info_ and old name
+        std::vector<uint32_t> new_roots; // Indices in predef_info_
+    };
+
+    static constexpr size_t visited_size = 4 + 16 * 5;
+
+    static void append_u32(std::vector<uint8_t>& v, uint32_t val)
+    {
+        v.push_back(static_cast<uint8_t>(val >> 24));
+        v.push_back(static_cast<uint8_t>(val >> 16));
+        v.push_back(static_cast<uint8_t>(val >> 8));
+        v.push_back(static_cast<uint8_t>(val));
+    }
+
+    static void check_size(const std::vector<uint8_t>& v, size_t elem_size, size_t count = ~0ULL)
+    {
+        if (v.size() % elem_size || (count != ~0ULL && v.size() / elem_size != count))
+            throw std::runtime_error { "Invalid analysis state" };
+    }
+
+    void handle_analysis_state(state_file& sf, cached_analysis& c)
+    {
+        state_file::scope scope { sf, "m68kdisasm analysis", 2 };
+        auto key = cache_key_;
+        sf.handle(key);
+        if (key != cache_key_)
+            throw std::runtime_error { "Cache key mismatch" };
+
+        sf.handle(c.setup);
+        sf.handle(c.predef_addrs);
+        sf.handle(c.predef_types);
+        sf.handle(c.predef_names);
+        sf.handle(c.predef_args);
+        sf.handle(c.predef_plain);
+        sf.handle(c.info_other);
+        sf.handle(c.looked_up);
+        sf.handle(c.lost_label_extents);
+        sf.handle(c.alias_functions);
+        sf.handle(c.last_predef_root);
+        sf.handle(c.label_addrs);
+        sf.handle(c.label_names);
+        sf.handle(c.label_types);
+        sf.handle(c.visited);
+        sf.handle(c.saved_pointers);
+        sf.handle(c.forced_values);
+        sf.handle(c.written);
+        sf.handle(c.library_names);
+        sf.handle(c.library_addrs);
+        sf.handle(c.exec_base);
+        sf.handle(c.fake_process);
+        sf.handle(c.alloc_top);
+    }
+
+    cached_analysis make_cached_analysis(const std::string& setup) const
+    {
+        cached_analysis c;
+        c.setup = setup;
+        for (const auto& r : predef_records_) {
+            append_u32(c.predef_addrs, r.addr);
+            c.predef_types.push_back(r.type);
+            c.predef_names.push_back(r.name);
+            c.predef_args.push_back(r.args);
+            c.predef_plain.push_back(r.plain);
+        }
+        c.info_other = info_other_;
+        c.looked_up.assign(looked_up_labels_.begin(), looked_up_labels_.end());
+        for (const auto& [beg, end] : lost_label_extents_) {
+            append_u32(c.lost_label_extents, beg);
+            append_u32(c.lost_label_extents, end);
+        }
+        for (const auto& [addr, actual] : alias_functions_) {
+            append_u32(c.alias_functions, addr);
+            append_u32(c.alias_functions, actual);
+        }
+        c.last_predef_root = last_predef_root_;
+        for (const auto& [addr, li] : labels_) {
+            append_u32(c.label_addrs, addr);
+            c.label_names.push_back(li.name);
+            c.label_types.push_back(encode_type(*li.t));
+        }
+        for (const auto& [addr, regs] : visited_) {
+            append_u32(c.visited, addr);
+            for (const simval* r : { regs.d, regs.a }) {
+                for (int i = 0; i < 8; ++i) {
+                    c.visited.push_back(r[i].known());
+                    append_u32(c.visited, r[i].raw_unchecked());
+                }
+            }
+        }
+        for (const auto& [addr, val] : saved_pointers_) {
+            append_u32(c.saved_pointers, addr);
+            append_u32(c.saved_pointers, val);
+        }
+        for (const auto& [addr, rv] : forced_values_) {
+            append_u32(c.forced_values, addr);
+            c.forced_values.push_back(static_cast<uint8_t>(rv.first));
+            append_u32(c.forced_values, rv.second);
+        }
+        for (const auto& [beg, end] : data_.written_ranges()) {
+            append_u32(c.written, beg);
+            append_u32(c.written, end);
+        }
+        for (const auto& [name, addr] : library_bases_) {
+            c.library_names.push_back(name);
+            append_u32(c.library_addrs, addr);
+        }
+        c.exec_base = exec_base_;
+        c.fake_process = fake_process_;
+        c.alloc_top = alloc_top_;
+        return c;
+    }
+
+    // Decode c and check whether it can be used for the current info file definitions. Only renamed
+    // labels (not used for lookups) and new code labels that the analysis never reached are handled,
+    // anything else could have affected the analysis in ways that aren't tracked.
+    std::optional<reusable_analysis> check_cached_analysis(const cached_analysis& c, const std::string& setup)
+    {
+        auto not_reusable = [this](const std::string& reason) {
+            std::cerr << "Not using cached analysis in " << cache_filename_ << ": " << reason << "\n";
+            return std::optional<reusable_analysis> {};
+        };
+
+        const size_t num_predef = c.predef_types.size();
+        check_size(c.predef_addrs, 4, num_predef);
+        check_size(c.predef_plain, 1, num_predef);
+        if (c.predef_names.size() != num_predef || c.predef_args.size() != num_predef || (c.last_predef_root != no_index && c.last_predef_root >= num_predef))
+            throw std::runtime_error { "Invalid analysis state" };
+        check_size(c.lost_label_extents, 8);
+        check_size(c.alias_functions, 8);
+        check_size(c.label_addrs, 4, c.label_names.size());
+        check_size(c.label_addrs, 4, c.label_types.size());
+        check_size(c.visited, visited_size);
+        check_size(c.saved_pointers, 8);
+        check_size(c.forced_values, 9);
+        check_size(c.written, 8);
+        check_size(c.library_addrs, 4, c.library_names.size());
+
+        if (c.setup != setup)
+            return not_reusable("input was set up differently");
+        if (c.info_other != info_other_)
+            return not_reusable("structure, alias or forced value definitions changed");
+
+        reusable_analysis r;
+        r.looked_up = c.looked_up;
+        auto renamable = [&r](const std::string& name) {
+            return !name.starts_with("dat") && name.find("dat_") == std::string::npos && std::find(r.looked_up.begin(), r.looked_up.end(), name) == r.looked_up.end();
+        };
+
+        // Match up the old definitions (in order) with the current ones, those left over are new
+        std::vector<uint32_t> new_index(num_predef);
+        std::vector<bool> matched(predef_records_.size());
+        for (uint32_t i = 0, j = 0; i < num_predef; ++i, ++j) {
+            const auto addr = get_u32(&c.predef_addrs[i * 4]);
+            const bool plain = c.predef_plain[i] != 0;
+            for (; j < predef_records_.size(); ++j) {
+                const auto& pr = predef_records_[j];
+                if (pr.addr == addr && pr.type == c.predef_types[i] && pr.args == c.predef_args[i] && pr.plain == plain && (plain || pr.name == c.predef_names[i]))
+                    break;
+            }
+            if (j == predef_records_.size())
+                return not_reusable("definition of " + c.predef_names[i] + " at $" + hexstring(addr) + " changed or removed");
+            new_index[i] = j;
+            matched[j] = true;
+            if (predef_records_[j].name != c.predef_names[i]) {
+                if (!renamable(c.predef_names[i]) || !renamable(predef_records_[j].name))
+                    return not_reusable(c.predef_names[i] + " can't be renamed to " + predef_records_[j].name);
+                r.renames.push_back({ j, c.predef_names[i] });
+            }
+        }
+
+        r.last_predef_root = c.last_predef_root == no_index ? no_index : new_index[c.last_predef_root];
+        for (size_t i = 0; i < c.label_names.size(); ++i) {
+            size_t pos = 0;
+            const auto& t = decode_type(c.label_types[i], pos);
+            r.labels.insert({ get_u32(&c.label_addrs[i * 4]), { c.label_names[i], &t } });
+        }
+        for (size_t ofs = 0; ofs < c.visited.size(); ofs += visited_size) {
+            simregs regs;
+            const uint8_t* p = &c.visited[ofs + 4];
+            for (simval* rv : { regs.d, regs.a }) {
+                for (int i = 0; i < 8; ++i, p += 5)
+                    rv[i] = p[0] ? simval { get_u32(p + 1) } : simval {};
+            }
+            r.visited[get_u32(&c.visited[ofs])] = regs;
+        }
+        for (size_t ofs = 0; ofs < c.lost_label_extents.size(); ofs += 8)
+            r.lost_label_extents.push_back({ get_u32(&c.lost_label_extents[ofs]), get_u32(&c.lost_label_extents[ofs + 4]) });
+
+        // New code labels must be somewhere the analysis didn't reach (or label), and
+        // not be able to change anything traced after the main analysis
+        const uint32_t first_new = r.last_predef_root == no_index ? 0 : r.last_predef_root + 1;
+        for (uint32_t j = 0; j < predef_records_.size(); ++j) {
+            if (matched[j])
+                continue;
+            const auto& pr = predef_records_[j];
+            if (!pr.plain || pr.type != "CODE" || !pr.args.empty() || !renamable(pr.name) || j < first_new || pr.addr >= max_mem || (pr.addr & 1))
+                return not_reusable("new definition of " + pr.name + " at $" + hexstring(pr.addr));
+            if (r.visited.find(pr.addr) != r.visited.end() || find_label(r.labels, pr.addr).first || find_area(r.lost_label_extents, pr.addr))
+                return not_reusable("new code label " + pr.name + " at $" + hexstring(pr.addr) + " was already reached by the analysis");
+            r.new_roots.push_back(j);
+        }
+
+        for (size_t ofs = 0; ofs < c.saved_pointers.size(); ofs += 8)
+            r.saved_pointers[get_u32(&c.saved_pointers[ofs])] = get_u32(&c.saved_pointers[ofs + 4]);
+        for (size_t ofs = 0; ofs < c.forced_values.size(); ofs += 9) {
+            if (c.forced_values[ofs + 4] > static_cast<uint8_t>(regname::A7))
+                throw std::runtime_error { "Invalid analysis state" };
+            r.forced_values.insert({ get_u32(&c.forced_values[ofs]), { static_cast<regname>(c.forced_values[ofs + 4]), get_u32(&c.forced_values[ofs + 5]) } });
+        }
+        for (size_t ofs = 0; ofs < c.written.size(); ofs += 8) {
+            const auto beg = get_u32(&c.written[ofs]), end = get_u32(&c.written[ofs + 4]);
+            if (beg > end || end > max_mem)
+                throw std::runtime_error { "Invalid analysis state" };
+            r.written.push_back({ beg, end });
+        }
+        for (size_t ofs = 0; ofs < c.alias_functions.size(); ofs += 8)
+            r.alias_functions.push_back({ get_u32(&c.alias_functions[ofs]), get_u32(&c.alias_functions[ofs + 4]) });
+        for (size_t i = 0; i < c.library_names.size(); ++i)
+            r.library_bases[c.library_names[i]] = get_u32(&c.library_addrs[i * 4]);
+        r.exec_base = c.exec_base;
+        r.fake_process = c.fake_process;
+        r.alloc_top = c.alloc_top;
+        return r;
+    }
+
+    bool load_analysis(const std::string& setup)
+    {
+        if (!std::ifstream { cache_filename_ })
+            return false;
+        std::optional<reusable_analysis> r;
+        try {
+            cached_analysis c;
+            state_file sf { state_file::dir::load, cache_filename_ };
+            handle_analysis_state(sf, c);
+            r = check_cached_analysis(c, setup);
+        } catch (const std::exception& e) {
+            std::cerr << "Ignoring cached analysis in " << cache_filename_ << ": " << e.what() << "\n";
+        }
+        if (!r)
+            return false;
+
+        if (!exec_base_)
+            add_fakes(); // Same as do_analysis, needed for the function descriptions
+        labels_ = std::move(r->labels);
+        visited_ = std::move(r->visited);
+        saved_pointers_ = std::move(r->saved_pointers);
+        forced_values_ = std::move(r->forced_values);
+        for (const auto& [beg, end] : r->written)
+            data_.mark_written(beg, end - beg);
+        library_bases_ = std::move(r->library_bases);
+        exec_base_ = r->exec_base;
+        fake_process_ = r->fake_process;
+        alloc_top_ = r->alloc_top;
+        for (const auto& [addr, actual] : r->alias_functions)
+            functions_.insert({ addr, functions_.at(actual) });
+        looked_up_labels_.insert(r->looked_up.begin(), r->looked_up.end());
+        lost_label_extents_ = std::move(r->lost_label_extents);
+        alias_functions_ = std::move(r->alias_functions);
+        last_predef_root_ = r->last_predef_root;
+        roots_.clear();
+
+        if (r->renames.empty() && r->new_roots.empty()) {
+            std::cerr << "Using cached analysis from " << cache_filename_ << "\n";
+            return true;
+        }
+
+        // Only the new roots need to be traced, the same way do_analysis would have handled them
+        for (const auto& [idx, old_name] : r->renames) {
+            const auto& pi = predef_info_[idx];
+            if (auto it = labels_.find(pi.first); it != labels_.end() && it->second.name == old_name)
+                it->second.name = pi.second.name;
+        }
+        for (const auto idx : r->new_roots)
+            add_label(predef_info_[idx].first, predef_info_[idx].second.name, code_type, false);
+        for (const auto idx : r->new_roots) {
+            if (visited_.find(predef_info_[idx].first) == visited_.end()) {
+                add_root(predef_info_[idx].first, simregs {}, true);
+                process_roots();
+                last_predef_root_ = idx;
+            }
+        }
+        std::cerr << "Updated cached analysis from " << cache_filename_ << " (" << r->renames.size() << " renamed label(s), " << r->new_roots.size() << " new root(s))\n";
+        save_analysis(setup);
+        return true;
+    }
+
+    void save_analysis(const std::string& setup)
+    {
+        auto c = make_cached_analysis(setup);
+        // Write to a temporary file first so a partially written file is never used
+        const auto temp_filename = cache_filename_ + ".tmp";
+        {
+            state_file sf { state_file::dir::save, temp_filename };
+            handle_analysis_state(sf, c);
+        }
+        std::filesystem::rename(temp_filename, cache_filename_);
+    }
+
     static void insert_area(std::vector<area>& areas, uint32_t beg, uint32_t end)
     {
         auto it = areas.begin();
@@ -4050,14 +4755,14 @@ private:
             uint32_t runlen = 1;
             uint32_t runend = pos + elemsize;
             while (runend < end) {
-                if (memcmp(&data_[pos], &data_[runend], elemsize))
+                if (!data_.equal(pos, runend, elemsize))
                     break;
                 ++runlen;
                 runend += elemsize;
             }
 
             if (runlen > elem_per_line || (runlen > 1 && pos == startpos && runend == end)) {
-                const uint32_t val = elemsize == 1 ? data_[pos] : elemsize == 2 ? get_u16(&data_[pos]) : get_u32(&data_[pos]);
+                const uint32_t val = elemsize == 1 ? data_[pos] : elemsize == 2 ? data_.u16(pos) : data_.u32(pos);
                 std::cout << "\tDCB." << suffix << "\t$" << hexfmt(runlen, runlen < 256 ? 2 : runlen < 65536 ? 4 : 8) << ",";
                 if (is_ptr)
                     print_addr(val);
@@ -4075,11 +4780,11 @@ private:
                 if (elemsize == 1)
                     std::cout << "$" << hexfmt(data_[pos]);
                 else if (elemsize == 2)
-                    std::cout << "$" << hexfmt(get_u16(&data_[pos]));
+                    std::cout << "$" << hexfmt(data_.u16(pos));
                 else if (is_ptr)
-                    print_addr(get_u32(&data_[pos]));
+                    print_addr(data_.u32(pos));
                 else
-                    std::cout << "$" << hexfmt(get_u32(&data_[pos]));
+                    std::cout << "$" << hexfmt(data_.u32(pos));
                 pos += elemsize;
             }
             std::cout << "\n";
@@ -4141,7 +4846,7 @@ private:
     {
         const auto base = pos;
         for (; pos < next_pos && len; --len, pos += 2) {
-            int16_t offset = get_u16(&data_[pos]);
+            int16_t offset = data_.u16(pos);
             std::cout << "\tDC.W\t";
             if (offset == 0) {
                 std::cout << "0";
@@ -4159,8 +4864,8 @@ private:
         assert(len % 2 == 0);
         assert(pos + len * 2 <= next_pos);
         while (pos < next_pos && len) {
-            const auto ir1 = get_u16(&data_[pos]);
-            const auto ir2 = get_u16(&data_[pos + 2]);
+            const auto ir1 = data_.u16(pos);
+            const auto ir2 = data_.u16(pos + 2);
             pos += 4;
             len -= 2;
             if (ir1 & 1) {
@@ -4201,11 +4906,11 @@ private:
             ++pos;
             return true;
         case base_data_type::word_:
-            std::cout << "\tDC.W\t$" << hexfmt(get_u16(&data_[pos])) << "\n";
+            std::cout << "\tDC.W\t$" << hexfmt(data_.u16(pos)) << "\n";
             pos += 2;
             return true;
         case base_data_type::long_:
-            std::cout << "\tDC.L\t$" << hexfmt(get_u32(&data_[pos])) << "\n";
+            std::cout << "\tDC.L\t$" << hexfmt(data_.u32(pos)) << "\n";
             pos += 4;
             return true;
         case base_data_type::ptr_:
@@ -4237,8 +4942,8 @@ private:
                 }
             } else {
                 std::cout << "\tDC.L\t";
-                if (!print_addr_maybe(get_u32(&data_[pos])))
-                    std::cout << "$" << hexfmt(get_u32(&data_[pos]));
+                if (!print_addr_maybe(data_.u32(pos)))
+                    std::cout << "$" << hexfmt(data_.u32(pos));
                 std::cout << "\n";
                 pos += 4;
             }
@@ -4246,7 +4951,7 @@ private:
         case base_data_type::bptr_:
         case base_data_type::bstr_: {
             assert(!t.len());
-            const auto addr = get_u32(&data_[pos]) * 4;
+            const auto addr = data_.u32(pos) * 4;
             pos += 4;
             std::cout << "\tDC.L\t$" << hexfmt(addr/4);
             if (addr) {
@@ -4280,7 +4985,7 @@ private:
             return true;
         }
         case base_data_type::rptrw_: {
-            int16_t offset = get_u16(&data_[pos]);
+            int16_t offset = data_.u16(pos);
             std::cout << "\tDC.W\t";
             if (offset == 0) {
                 std::cout << "0";
@@ -4425,7 +5130,7 @@ private:
         // Darkman relocates to $8.w
         if ((addr & 1) || /*addr < 0x80 ||*/ addr > max_mem - 2)
             throw std::runtime_error { "Reading instruction word from invalid address $" + hexstring(addr) };
-        return get_u16(&data_[addr]);
+        return data_.u16(addr);
     }
 
     void read_instruction(uint16_t* iwords, const uint32_t addr)
@@ -4594,10 +5299,10 @@ private:
         if (!addr.known())
             return {};
         auto ptr = addr.raw();
-        if (ptr >= max_mem || !written_[ptr])
+        if (ptr >= max_mem || !data_.written(ptr))
             return {};
         std::string libname;
-        while (ptr < max_mem && written_[ptr] && data_[ptr]) {
+        while (ptr < max_mem && data_.written(ptr) && data_[ptr]) {
             auto c = data_[ptr++];
             if (c >= 'A' && c <= 'Z')
                 c += 'a' - 'A';
@@ -4651,7 +5356,7 @@ private:
         const auto table_start = init_table;
         // Note: seems to always be kept aligned despite description...
         for (;;) {
-            if (init_table + 3 >= max_mem || !written_[init_table])
+            if (init_table + 3 >= max_mem || !data_.written(init_table))
                 return;
             const auto cmd = data_[init_table++];
             if (!cmd) {
@@ -4700,14 +5405,14 @@ private:
             case 0b00:
                 if (init_table & 1)
                     ++init_table;
-                val = get_u32(&data_[init_table]);
+                val = data_.u32(init_table);
                 init_table += 4;
                 sz = opsize::l;
                 break;
             case 0b01:
                 if (init_table & 1)
                     ++init_table;
-                val = get_u16(&data_[init_table]);
+                val = data_.u16(init_table);
                 init_table += 2;
                 sz = opsize::w;
                 break;
@@ -4747,11 +5452,11 @@ private:
         std::vector<uint32_t> vectors;
         if (regs_.a[0].known() && pointer_ok(regs_.a[0].raw())) {
             const auto vecbase = regs_.a[0].raw();
-            if (get_u16(&data_[vecbase]) == 0xffff) {
+            if (data_.u16(vecbase) == 0xffff) {
                 for (uint32_t a = vecbase + 2;; a += 2) {
                     if (!pointer_ok(a))
                         break;
-                    const auto ofs = get_u16(&data_[a]);
+                    const auto ofs = data_.u16(a);
                     if (ofs == 0xffff)
                         break;
                     vectors.push_back(static_cast<int16_t>(ofs) + vecbase);
@@ -4759,7 +5464,7 @@ private:
                 add_auto_label(vecbase, make_array_type(word_type, 2 + static_cast<uint32_t>(vectors.size())), "libvecofs");
             } else {
                 for (uint32_t a = vecbase; pointer_ok(a); a += 4) {
-                    const auto v = get_u32(&data_[a]);
+                    const auto v = data_.u32(a);
                     if (v == 0xffffffff)
                         break;
                     vectors.push_back(v);
@@ -4842,7 +5547,7 @@ private:
         } else {
             // Word displacement
             for (;pointer_ok(array); array += 2, dest -= 6) { 
-                const int16_t disp = get_u16(&data_[array]);
+                const int16_t disp = data_.u16(array);
                 if (disp == -1)
                     break;
                 const uint32_t addr = funcDispBase + disp;
@@ -4912,6 +5617,7 @@ private:
                         if (auto lit = labels_.find(reg.raw()); lit != labels_.end()) {
                             if (!lit->second.t->ptr() && !lit->second.t->struct_def()) {
                                 std::cerr << "Warning: Overriding type of " << lit->second.name << " previous type " << *lit->second.t << " new type " << *pt << "\n";
+                                label_extent_lost(lit->first, lit->second);
                                 lit->second.t = pt;
                             } else if (lit->second.t != pt) {
                                 std::cerr << "Warning: Type conflict for " << lit->second.name << " previous type " << *lit->second.t << " new type " << *pt << "\n";
@@ -4940,8 +5646,8 @@ private:
     {
         for (uint32_t i = 0; i < len; ++i) {
             const uint32_t word_addr = addr + 2 * i;
-            if (word_addr + 1 < max_mem && written_[addr]) {
-                int16_t offset = get_u16(&data_[word_addr]);
+            if (word_addr + 1 < max_mem && data_.written(addr)) {
+                int16_t offset = data_.u16(word_addr);
                 if (!offset)
                     continue;
                 do_branch(addr + offset, true);
@@ -4951,7 +5657,7 @@ private:
 
     void check_jump_table(uint32_t addr)
     {
-        if (addr + 2 >= max_mem || !written_[addr])
+        if (addr + 2 >= max_mem || !data_.written(addr))
             return;
 
         auto it = labels_.find(addr);
@@ -4974,16 +5680,16 @@ private:
                 next_addr = next->first;            
 
             uint32_t a = addr;
-            for (; a < next_addr && written_[a]; a += 2) {
-                int16_t ofs = get_u16(&data_[a]);
+            for (; a < next_addr && data_.written(a); a += 2) {
+                int16_t ofs = data_.u16(a);
                 if (ofs & 1)
                     break;
                 if (ofs == 0)
                     continue; // Allow null entries
                 uint32_t dest = addr + ofs;
-                if (dest >= max_mem || !written_[dest])
+                if (dest >= max_mem || !data_.written(dest))
                     break;
-                if (instructions[get_u16(&data_[dest])].type == inst_type::ILLEGAL)
+                if (instructions[data_.u16(dest)].type == inst_type::ILLEGAL)
                     break;
                 // Heuristic end
                 if (abs(ofs) > 1040)
@@ -5004,7 +5710,7 @@ private:
         for (;;) {
             const auto start = addr;
 
-            if (start >= max_mem || !written_[start])
+            if (start >= max_mem || !data_.written(start))
                 return;
 
             uint16_t iwords[max_instruction_words];
@@ -5086,7 +5792,7 @@ private:
                     if (!ea_addr_[i].known())
                         continue;
                     const auto ea_addr = ea_addr_[i].raw() & 0xffffff;
-                    if (ea_addr >= written_.size() || !written_[ea_addr])
+                    if (!data_.written(ea_addr))
                         continue;
 
                     const auto& t = inst.type == inst_type::LEA ? unknown_type : type_from_size(inst.size);
@@ -5127,7 +5833,7 @@ private:
                         [[fallthrough]];
                     default:
                         if (inst.ea[i] == ea_disp)
-                            throw std::runtime_error { "Unexpected EA " + ea_string(inst.ea[i]) + " for " + inst.name };
+                            throw std::runtime_error { "Unexpected EA " + ea_string(inst.ea[i]) + " for " + instruction_name(iwords[0]) };
                     }
                 }
                 sim_inst(inst);
@@ -5144,7 +5850,7 @@ private:
             //std::cerr << "Tring to restore from $" << hexfmt(a) << "\n";
             if (auto it = saved_pointers_.find(a); it != saved_pointers_.end())
                 return simval { it->second };
-            return written_[a] ? simval { get_u32(&data_[a]) } : simval {};
+            return data_.written(a) ? simval { data_.u32(a) } : simval {};
         }
         return simval {};
     }
@@ -5274,7 +5980,7 @@ private:
             break;
         case inst_type::MOVEA: {
             auto val = ea_val_[0].known() ? simval { static_cast<uint32_t>(sext(ea_val_[0].raw(), inst.size)) } : simval {};
-            if (inst.ea[0] == ea_immediate && val.raw() < max_mem && written_[val.raw()])
+            if (inst.ea[0] == ea_immediate && val.raw() < max_mem && data_.written(val.raw()))
                 add_auto_label(ea_val_[0].raw(), unknown_type);
             update_ea(opsize::l, 1, inst.ea[1], val);
             break;
@@ -5305,14 +6011,14 @@ private:
 
     bool pointer_ok(uint32_t addr)
     {
-        return addr && !(addr & 1) && addr < max_mem - 3 && written_[addr];
+        return addr && !(addr & 1) && addr < max_mem - 3 && data_.written(addr);
     }
 
     uint32_t try_read_pointer(uint32_t addr)
     {
         if (!pointer_ok(addr))
             return 0;
-        const auto p = get_u32(&data_[addr]);
+        const auto p = data_.u32(addr);
         return pointer_ok(p) ? p : 0;
     }
 
@@ -5333,7 +6039,7 @@ std::string analyzer::make_str_label(uint32_t addr)
     std::string lab;
     uint32_t len = 0;
     for (;  len < 32; ++len, ++addr) {
-        if (addr >= max_mem || !written_[addr])
+        if (addr >= max_mem || !data_.written(addr))
             break;
         uint8_t ch = data_[addr];
         if (!ch)
@@ -5364,7 +6070,7 @@ void analyzer::add_rom_tag(const rom_tag& tag)
 
     auto slen = [&](uint32_t addr) {
         uint32_t l = 0;
-        while (addr + 1 < data_.size() && data_[addr++])
+        while (addr + 1 < max_mem && data_[addr++])
             ++l;
         return l + 1; // Include nul terminator
     };
@@ -5407,7 +6113,7 @@ void analyzer::handle_struct_at(uint32_t addr, const structure_definition& s)
     if (!pointer_ok(addr))
         return;
     
-    if (&s == &Node && !data_handled_at_[addr] && !find_label(addr).first) {
+    if (&s == &Node && !data_.handled(addr) && !find_label(addr).first) {
         switch (data_[addr + 0x08]) { // ln_Type
         case NT_UNKNOWN:
             break;
@@ -5421,7 +6127,7 @@ void analyzer::handle_struct_at(uint32_t addr, const structure_definition& s)
         case NT_RESOURCE:
         case NT_LIBRARY: {
             handle_struct_at(addr, Library);
-            const auto neg_size = get_u16(&data_[addr + 0x10]); // lib_NegSize
+            const auto neg_size = data_.u16(addr + 0x10); // lib_NegSize
             if (neg_size % 6)
                 return;
 
@@ -5431,8 +6137,8 @@ void analyzer::handle_struct_at(uint32_t addr, const structure_definition& s)
             for (int i = 0; i < neg_size / 6; ++i) {
                 const auto faddr = addr - (i + 1) * 6;
 
-                if (get_u16(&data_[faddr]) == JMP_ABS_L_instruction) {
-                    const auto impl_addr = get_u32(&data_[faddr + 2]);
+                if (data_.u16(faddr) == JMP_ABS_L_instruction) {
+                    const auto impl_addr = data_.u32(faddr + 2);
                     add_label(impl_addr, n + std::to_string(i), code_type);
                     add_root(impl_addr, r);
                 }
@@ -5469,8 +6175,8 @@ void analyzer::handle_struct_at(uint32_t addr, const structure_definition& s)
             if (fn.compare(0, 4, "_LVO") == 0)
                 fn.erase(1, 3);
 
-            if (get_u16(&data_[faddr]) == JMP_ABS_L_instruction) {
-                const auto impl_addr = get_u32(&data_[faddr + 2]);
+            if (data_.u16(faddr) == JMP_ABS_L_instruction) {
+                const auto impl_addr = data_.u32(faddr + 2);
                 add_label(impl_addr, std::string { s.name() } + fn, code_type);
                 add_root(impl_addr, r);
             }
@@ -5486,7 +6192,7 @@ void analyzer::handle_struct_at(uint32_t addr, const structure_definition& s)
 
 void analyzer::maybe_find_string_at(uint32_t addr, const std::string& label)
 {
-    if (addr >= max_mem || !written_[addr])
+    if (addr >= max_mem || !data_.written(addr))
         return;
 
     const auto start_addr = addr;
@@ -5494,7 +6200,7 @@ void analyzer::maybe_find_string_at(uint32_t addr, const std::string& label)
      // Arbitrary limits
     constexpr uint32_t max_len = 4096;
     uint32_t len = 0, nprint = 0;
-    while (addr < max_mem && written_[addr]) {
+    while (addr < max_mem && data_.written(addr)) {
         if (len > max_len)
             return;
         const auto c = data_[addr];
@@ -5502,7 +6208,7 @@ void analyzer::maybe_find_string_at(uint32_t addr, const std::string& label)
             ++addr;
             ++len;
             // Fold extra NUL into string if present (even after dc.b)
-            if (addr + 1 < max_mem && written_[addr + 1] && !data_[addr]) {
+            if (addr + 1 < max_mem && data_.written(addr + 1) && !data_[addr]) {
                 ++addr;
                 ++len;            
             }
@@ -5518,29 +6224,31 @@ void analyzer::maybe_find_string_at(uint32_t addr, const std::string& label)
     if (nprint * 10 > len)
         return;
 
-    std::fill(data_handled_at_.begin() + start_addr, data_handled_at_.begin() + start_addr + len, true);
+    data_.mark_handled(start_addr, len);
     add_label(start_addr, !label.empty() ? label : make_str_label(start_addr), make_array_type(char_type, len));
 }
 
 void analyzer::maybe_find_copper_list_at(uint32_t addr)
 {
     addr &= ~1;
-    if (addr >= max_mem || addr + 3 >= max_mem || !written_[addr])
+    if (addr >= max_mem || addr + 3 >= max_mem || !data_.written(addr))
         return;
 
     const auto start_addr = addr;
     // Arbitrary limits
     constexpr uint32_t max_len = 4096;
     uint32_t len = 0;
-    while (addr + 3 < max_mem && written_[addr] && written_[addr+2] && len < max_len) {
-        const auto ir1 = get_u16(&data_[addr]);
-        const auto ir2 = get_u16(&data_[addr + 2]);
+    while (addr + 3 < max_mem && data_.written(addr) && data_.written(addr+2) && len < max_len) {
+        const auto ir1 = data_.u16(addr);
+        const auto ir2 = data_.u16(addr + 2);
 
         // Delete any automatic word labels here
         if (auto it = labels_.find(addr); it != labels_.end() && it->second.name.find("dat_", 0) != std::string::npos) {
+            label_extent_lost(it->first, it->second);
             labels_.erase(it);
         }
         if (auto it = labels_.find(addr + 2); it != labels_.end() && it->second.name.find("dat_", 0) != std::string::npos) {
+            label_extent_lost(it->first, it->second);
             labels_.erase(it);
         }
 
@@ -5555,7 +6263,7 @@ void analyzer::maybe_find_copper_list_at(uint32_t addr)
         if (!(ir1 & 1) && ir1 >= 0x200)
             break;
     }
-    std::fill(data_handled_at_.begin() + start_addr, data_handled_at_.begin() + start_addr + len * 4, true);
+    data_.mark_handled(start_addr, len * 4);
     add_label(start_addr, "copperlist_" + hexstring(start_addr), make_array_type(copper_code_type, len * 2));
 }
 
@@ -5573,24 +6281,24 @@ void analyzer::handle_bseglist_at(uint32_t addr, const std::string& name)
     sr.a[0] = simval { 0 };
     sr.a[2] = simval { *globvec };
     sr.a[5] = simval { *supp };
-    for (uint32_t cnt = 0; addr + 3 <= max_mem && written_[addr] && !data_handled_at_[addr]; ++cnt) {
-        data_handled_at_[addr] = true;
+    for (uint32_t cnt = 0; addr + 3 <= max_mem && data_.written(addr) && !data_.handled(addr); ++cnt) {
+        data_.mark_handled(addr);
 
         add_label(addr, name + "_Link" + std::to_string(cnt), bptr_type, false);
         add_label(addr + 4, name + "_Size" + std::to_string(cnt), long_type, false);
         const auto code_addr = addr + 8;
         sr.a[4] = simval { code_addr };
         add_root(code_addr, sr);
-        addr = get_u32(&data_[addr]) << 2;
+        addr = data_.u32(addr) << 2;
     }
 }
 
 void analyzer::handle_data_at(uint32_t addr, const type& t)
 {
-    if (!addr || addr >= max_mem || !written_[addr])
+    if (!addr || addr >= max_mem || !data_.written(addr))
         return;
 
-    if (data_handled_at_[addr]) {
+    if (data_.handled(addr)) {
         //std::cerr << "ignoring $" << hexfmt(addr) << " of type " << t << " - already handled\n";
         return;
     }
@@ -5623,19 +6331,19 @@ void analyzer::handle_data_at(uint32_t addr, const type& t)
                 handle_data_at(addr + i * size, *t.ptr());
             break;
         }
-        data_handled_at_[addr] = true; // Prevent infinite recursion
+        data_.mark_handled(addr); // Prevent infinite recursion
         if (t.ptr() != &unknown_type)
-            handle_pointer_to(get_u32(&data_[addr]), *t.ptr());
+            handle_pointer_to(data_.u32(addr), *t.ptr());
         break;
     case base_data_type::bptr_:
         assert(t.len() == 0);
-        data_handled_at_[addr] = true; // Prevent infinite recursion
+        data_.mark_handled(addr); // Prevent infinite recursion
         if (t.bptr() != &unknown_type)
-            handle_pointer_to(get_u32(&data_[addr]) * 4, *t.bptr());
+            handle_pointer_to(data_.u32(addr) * 4, *t.bptr());
         break;
     case base_data_type::bstr_: {
-        const auto p = get_u32(&data_[addr]) * 4;
-        if (p && p + 256 < max_mem && written_[p]) {
+        const auto p = data_.u32(addr) * 4;
+        if (p && p + 256 < max_mem && data_.written(p)) {
             add_auto_label(p, byte_type, "bstr");
             if (data_[p])
                 add_auto_label(p + 1, make_array_type(char_type, data_[p]), "bstr_text");
@@ -5650,12 +6358,12 @@ void analyzer::handle_data_at(uint32_t addr, const type& t)
     //    break;
     }
 
-    data_handled_at_[addr] = true;
+    data_.mark_handled(addr);
 }
 
 void analyzer::handle_pointer_to(uint32_t addr, const type& t)
 {
-    if (!addr || addr == 0xffffffff || addr + 1 >= max_mem || !written_[addr] || &t == &unknown_type)
+    if (!addr || addr == 0xffffffff || addr + 1 >= max_mem || !data_.written(addr) || &t == &unknown_type)
         return;
 
     switch (t.base()) {
@@ -5687,17 +6395,17 @@ void analyzer::handle_pointer_to(uint32_t addr, const type& t)
 uint32_t analyzer::check_exec_base()
 {
     const uint32_t base = try_read_pointer(4);
-    if (!base || !written_[base] || !written_[base + 608] || ~base != get_u32(&data_[base + 0x26]))
+    if (!base || !data_.written(base) || !data_.written(base + 608) || ~base != data_.u32(base + 0x26))
         return 0;
     uint16_t csum = 0;
     for (uint32_t offset = 0x22; offset < 0x54; offset += 2)
-        csum += get_u16(&data_[base + offset]);
+        csum += data_.u16(base + offset);
     if (csum != 0xffff)
         return 0;
 
     // Check if Chip/fast mem matches loaded areas
-    uint32_t MaxLocMem = get_u32(&data_[base + 0x3e]);
-    uint32_t MaxExtMem = get_u32(&data_[base + 0x4e]);
+    uint32_t MaxLocMem = data_.u32(base + 0x3e);
+    uint32_t MaxExtMem = data_.u32(base + 0x4e);
     for (const auto& a : areas_) {
         if (MaxLocMem == a.end)
             MaxLocMem = 0;
@@ -5732,7 +6440,7 @@ void analyzer::handle_predef_info()
                 throw std::runtime_error { "Definition of " + i.second.name + " is outside valid memory" };
             }
             // Allow making fake types outside written area
-            std::fill(written_.begin() + i.first, written_.begin() + i.first + sz, true);
+            data_.mark_written(i.first, sz);
 
             handle_data_at(i.first, t);
         }
@@ -5747,15 +6455,15 @@ void analyzer::do_system_scan()
         return;
     }
 
-    const uint32_t this_task_ptr = get_u32(&data_[exec_base_ + 0x0114]);
+    const uint32_t this_task_ptr = data_.u32(exec_base_ + 0x0114);
 
     auto process_seg_list = [this](uint32_t seg_list_ptr) {
         if (!pointer_ok(seg_list_ptr))
             return;
         std::cerr << "SegList: $" << hexfmt(seg_list_ptr) << "\n";
-        hexdump16(std::cerr, seg_list_ptr, &data_[seg_list_ptr], 32);
-        for (uint32_t cnt = 0; pointer_ok(seg_list_ptr); seg_list_ptr = get_u32(&data_[seg_list_ptr]) * 4, ++cnt) {
-            std::cerr << "Segment at: $" << hexfmt(seg_list_ptr+4) << " size: $" << hexfmt(get_u32(&data_[seg_list_ptr-4])) << "\n";
+        hexdump16(std::cerr, seg_list_ptr, data_.read(seg_list_ptr, 32).data(), 32);
+        for (uint32_t cnt = 0; pointer_ok(seg_list_ptr); seg_list_ptr = data_.u32(seg_list_ptr) * 4, ++cnt) {
+            std::cerr << "Segment at: $" << hexfmt(seg_list_ptr+4) << " size: $" << hexfmt(data_.u32(seg_list_ptr-4)) << "\n";
             if (cnt == 0)
                 add_start_root(seg_list_ptr + 4);
         }
@@ -5771,30 +6479,30 @@ void analyzer::do_system_scan()
         goto finish;
     }
 
-    if (const auto pr_cli = get_u32(&data_[this_task_ptr + 0xac]); pointer_ok(pr_cli * 4)) {
-        if (const uint32_t cli_name_addr = get_u32(&data_[pr_cli * 4 + 0x10]) * 4; cli_name_addr + 256 < max_mem && written_[cli_name_addr]) {
-            const auto len = data_[cli_name_addr];
-            std::cerr << "Current task: \"" << std::string{ &data_[cli_name_addr + 1], &data_[cli_name_addr + 1 + len] } << "\"\n";
+    if (const auto pr_cli = data_.u32(this_task_ptr + 0xac); pointer_ok(pr_cli * 4)) {
+        if (const uint32_t cli_name_addr = data_.u32(pr_cli * 4 + 0x10) * 4; cli_name_addr + 256 < max_mem && data_.written(cli_name_addr)) {
+            const auto name = data_.read(cli_name_addr + 1, data_[cli_name_addr]);
+            std::cerr << "Current task: \"" << std::string{ name.begin(), name.end() } << "\"\n";
         }
         add_label(this_task_ptr, "ThisProcess", make_struct_type(Process));
         add_label(pr_cli * 4, "ThisCli", make_struct_type(CommandLineInterface));
         handle_data_at(this_task_ptr, make_struct_type(Process));
-        process_seg_list(get_u32(&data_[pr_cli * 4 + 0x3c]) * 4); // BADDR(BADDR(proc->pr_CLI)->cli_Module)
+        process_seg_list(data_.u32(pr_cli * 4 + 0x3c) * 4); // BADDR(BADDR(proc->pr_CLI)->cli_Module)
     } else {
-        if (const uint32_t task_name_addr = get_u32(&data_[this_task_ptr + 0x0a]); task_name_addr < max_mem && written_[task_name_addr])
-            std::cerr << "Current task: \"" << reinterpret_cast<const char*>(&data_[task_name_addr]) << "\"\n";
+        if (const uint32_t task_name_addr = data_.u32(this_task_ptr + 0x0a); task_name_addr < max_mem && data_.written(task_name_addr))
+            std::cerr << "Current task: \"" << data_.string_at(task_name_addr) << "\"\n";
 
         add_label(this_task_ptr, "ThisProcess", make_struct_type(Process));
 
-        const auto seg_list_array = get_u32(&data_[this_task_ptr + 0x80]) * 4; // BADDR(proc->pr_SegList)
+        const auto seg_list_array = data_.u32(this_task_ptr + 0x80) * 4; // BADDR(proc->pr_SegList)
         // Array of seg lists used by this process
-        if (!pointer_ok(seg_list_array) || get_u32(&data_[seg_list_array]) > 4)
+        if (!pointer_ok(seg_list_array) || data_.u32(seg_list_array) > 4)
             return;
 
-        hexdump16(std::cerr, seg_list_array, &data_[seg_list_array], 32);
+        hexdump16(std::cerr, seg_list_array, data_.read(seg_list_array, 32).data(), 32);
         // Ignore array size (first element)
-        process_seg_list(get_u32(&data_[seg_list_array + 3 * 4]) * 4);
-        process_seg_list(get_u32(&data_[seg_list_array + 4 * 4]) * 4);
+        process_seg_list(data_.u32(seg_list_array + 3 * 4) * 4);
+        process_seg_list(data_.u32(seg_list_array + 4 * 4) * 4);
     }
 
 finish:
@@ -5893,16 +6601,16 @@ struct patch_list_item {
 uint32_t analyzer::handle_whd_patchlist(const uint32_t pl_start, bool analyze)
 {
     if (analyze) {
-        if (data_handled_at_[pl_start])
+        if (data_.handled(pl_start))
             return 0;
-        data_handled_at_[pl_start] = true;
+        data_.mark_handled(pl_start);
     } else {
         std::cout << "\tPL_START\n";
     }
     int nest = 0;
     uint32_t addr = pl_start;
     for (;;) {
-        uint16_t type = get_u16(&data_[addr]);
+        uint16_t type = data_.u16(addr);
         addr += 2;
         if (type == 0) {
             if (!analyze)
@@ -5915,10 +6623,10 @@ uint32_t analyzer::handle_whd_patchlist(const uint32_t pl_start, bool analyze)
         // Bit14: No args, Bit15: word arg
         if (has_cmd_arg) {
             if (!(type & (1 << 15))) {
-                cmd_addr = get_u32(&data_[addr]);
+                cmd_addr = data_.u32(addr);
                 addr += 4;
             } else {
-                cmd_addr = get_u16(&data_[addr]);
+                cmd_addr = data_.u16(addr);
                 addr += 2;
             }
         }
@@ -5928,7 +6636,7 @@ uint32_t analyzer::handle_whd_patchlist(const uint32_t pl_start, bool analyze)
 
         if (type == 17) {
             // PL_NEXT
-            const auto taddr = pl_start + static_cast<int16_t>(get_u16(&data_[addr]));
+            const auto taddr = pl_start + static_cast<int16_t>(data_.u16(addr));
             addr += 2;
             if (!analyze) {
                 std::cout << "\tPL_NEXT\t";
@@ -5971,12 +6679,12 @@ uint32_t analyzer::handle_whd_patchlist(const uint32_t pl_start, bool analyze)
             switch (t) {
             case base_data_type::byte_:
                 if (!analyze)
-                    std::cout << "$" << hexstring((uint8_t)get_u16(&data_[addr]));
+                    std::cout << "$" << hexstring((uint8_t)data_.u16(addr));
                 addr += 2;
                 break;
             case base_data_type::word_:
                 if (!analyze) {
-                    uint16_t v = get_u16(&data_[addr]);
+                    uint16_t v = data_.u16(addr);
                     if (type == 4) // PL_S
                         v += 2; // Offset is stored -2
                     if (is_signed)
@@ -5988,11 +6696,11 @@ uint32_t analyzer::handle_whd_patchlist(const uint32_t pl_start, bool analyze)
                 break;
             case base_data_type::long_:
                 if (!analyze)
-                    std::cout << "$" << hexstring(get_u32(&data_[addr]));
+                    std::cout << "$" << hexstring(data_.u32(addr));
                 addr += 4;
                 break;
             case base_data_type::code_: {
-                const auto code_addr = pl_start + static_cast<int16_t>(get_u16(&data_[addr]));
+                const auto code_addr = pl_start + static_cast<int16_t>(data_.u16(addr));
                 if (!analyze)
                     print_addr(code_addr);
                 else
@@ -6001,7 +6709,7 @@ uint32_t analyzer::handle_whd_patchlist(const uint32_t pl_start, bool analyze)
             } break;
             case base_data_type::rptrw_:
                 if (analyze) {
-                    const auto taddr = pl_start + static_cast<int16_t>(get_u16(&data_[addr]));
+                    const auto taddr = pl_start + static_cast<int16_t>(data_.u16(addr));
                     print_addr(taddr);
                 }
                 addr += 2;
@@ -6023,7 +6731,7 @@ void analyzer::handle_whdload(uint32_t header_address)
 {
     const auto& hdr_rptr = make_rptrw(header_address);
     auto resolve_rptr = [&](int16_t offset) -> uint32_t {
-        int16_t offset2 = get_u16(&data_[header_address + offset]);
+        int16_t offset2 = data_.u16(header_address + offset);
         if (offset2 == 0)
             return 0;
         else
@@ -6077,7 +6785,7 @@ void analyzer::handle_whdload(uint32_t header_address)
     add_string_rptr(26, "_CurrentDir");
     add_string_rptr(28, "_DontCache");
 
-    const uint16_t version = get_u16(&data_[header_address + 12]);
+    const uint16_t version = data_.u16(header_address + 12);
     if (version >= 4) {
         add_label(header_address + 30, "_keydebug", byte_type);
         add_label(header_address + 31, "_keyexit", byte_type);
@@ -6763,6 +7471,7 @@ void usage()
     std::cerr << "   -cut    cut out part of file\n";
     std::cerr << "   -rom    force rom mode\n";
     std::cerr << "   -bytes  show bytes and address for all instructions\n";
+    std::cerr << "   -cache dir  reuse (and update) analysis results for the input stored in dir\n";
     std::cerr << "\n";
     std::cerr << "Options for non-hunk files:";
     std::cerr << "   Normal (non-analysis mode) options: [base]\n";
@@ -6775,6 +7484,7 @@ int main(int argc, char* argv[])
         bool force_rom = false;
         std::unique_ptr<analyzer> a;
         int cut_offset = -1, cut_length = -1;
+        std::string cache_dir;
         while (argc >= 2) {
             if (!strcmp(argv[1], "-a")) {
                 if (!a)
@@ -6801,6 +7511,16 @@ int main(int argc, char* argv[])
                 a->read_info_file(argv[1]);
                 ++argv;
                 --argc;
+            } else if (!strcmp(argv[1], "-cache")) {
+                ++argv;
+                --argc;
+                if (argc < 2) {
+                    usage();
+                    return 1;
+                }
+                cache_dir = argv[1];
+                ++argv;
+                --argc;
             } else if (!strcmp(argv[1], "-cut")) {
                 ++argv;
                 --argc;
@@ -6833,6 +7553,31 @@ int main(int argc, char* argv[])
             data.erase(data.begin() + cut_length, data.end());
         }
 
+        if (a && !cache_dir.empty()) {
+            // Key is a hash of the input, info file definitions are stored in the cache since
+            // it can be updated when they change
+            uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+            auto update_hash = [&hash](const void* d, size_t size) {
+                const auto* p = static_cast<const uint8_t*>(d);
+                for (size_t i = 0; i < size; ++i) {
+                    hash ^= p[i];
+                    hash *= 0x100000001b3ULL;
+                }
+                // Also include the size, so concatenated items can't collide
+                for (int i = 0; i < 8; ++i) {
+                    hash ^= static_cast<uint8_t>(size >> (8 * i));
+                    hash *= 0x100000001b3ULL;
+                }
+            };
+            update_hash(data.data(), data.size());
+            update_hash(&force_rom, sizeof(force_rom));
+            for (int i = 2; i < argc; ++i)
+                update_hash(argv[i], strlen(argv[i]));
+            const auto key = hexstring(hash);
+            std::filesystem::create_directories(cache_dir);
+            a->set_cache((std::filesystem::path { cache_dir } / (key + ".m68kdb")).string(), key);
+        }
+
         if (force_rom || is_rom(data)) {
             if (argc > 2)
                 throw std::runtime_error { "Too many arguments" };
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <string>
+
+#include "cpu_trace.h"
+#include "disasm.h"
+#include "ioutil.h"
+
+namespace {
+
+constexpr const char* const regnames[cpu_trace_num_regs] = {
+    "D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
+    "A0", "A1", "A2", "A3", "A4", "A5", "A6", "SSP", "USP"
+};
+
+uint32_t reg_value(const cpu_state& s, uint32_t idx)
+{
+    if (idx < 8)
+        return s.d[idx];
+    else if (idx < 15)
+        return s.a[idx - 8];
+    return idx == cpu_trace_reg_ssp ? s.ssp : s.usp;
+}
+
+uint32_t number_or_die(const char* s, uint8_t base)
+{
+    auto [valid, val] = number_from_string(s, base);
+    if (!valid)
+        throw std::runtime_error { "Invalid number: " + std::string { s } };
+    return val;
+}
+
+void usage()
+{
+    std::cerr << "Usage: m68ktrace [options] file\n";
+    std::cerr << "   file           binary trace file (from the \"trace_bin\" debugger command)\n";
+    std::cerr << "   -from n        start at instruction count n (decimal)\n";
+    std::cerr << "   -count n       show at most n instructions (decimal)\n";
+    std::cerr << "   -pc start end  only show instructions in the range [start, end) (hex)\n";
+    std::cerr << "   -regs          show full register state after each instruction\n";
+    std::cerr << "   -mem           show memory accesses\n";
+}
+
+} // unnamed namespace
+
+int main(int argc, char* argv[])
+{
+    try {
+        uint64_t from = 0, count = ~0ULL;
+        uint32_t pc_start = 0, pc_end = ~0U;
+        bool show_regs = false, show_mem = false;
+        while (argc >= 2 && argv[1][0] == '-') {
+            if (!strcmp(argv[1], "-from") && argc > 2) {
+                from = number_or_die(argv[2], 10);
+                argv += 2;
+                argc -= 2;
+            } else if (!strcmp(argv[1], "-count") && argc > 2) {
+                count = number_or_die(argv[2], 10);
+                argv += 2;
+                argc -= 2;
+            } else if (!strcmp(argv[1], "-pc") && argc > 3) {
+                pc_start = number_or_die(argv[2], 16);
+                pc_end = number_or_die(argv[3], 16);
+                argv += 3;
+                argc -= 3;
+            } else if (!strcmp(argv[1], "-regs")) {
+                show_regs = true;
+                ++argv;
+                --argc;
+            } else if (!strcmp(argv[1], "-mem")) {
+                show_mem = true;
+                ++argv;
+                --argc;
+            } else {
+                usage();
+                return 1;
+            }
+        }
+        if (argc != 2) {
+            usage();
+            return 1;
+        }
+
+        cpu_trace_reader reader { argv[1] };
+        cpu_trace_entry e {};
+        format_buffer line;
+        while (count && reader.next(e)) {
+            if (e.instruction_count < from || e.pc < pc_start || e.pc >= pc_end)
+                continue;
+            --count;
+
+            line.clear();
+            line << e.instruction_count << '\t' << hexfmt(e.vpos, 3) << '/' << hexfmt(e.hpos, 3) << '\t';
+            if (e.ilen)
+                disasm(line, e.pc, e.iwords, e.ilen);
+            else
+                line << "(interrupt)";
+            if (e.exception)
+                line << "\tException $" << hexfmt(e.exception);
+            line << '\n';
+            std::cout << line;
+
+            if (show_mem) {
+                for (const auto& ma : e.mem_accesses) {
+                    line.clear();
+                    line << "\t\t" << (ma.write ? 'W' : 'R') << (ma.size == 1 ? ".B" : ".W") << " $" << hexfmt(ma.addr);
+                    if (ma.write)
+                        line << " = $" << hexfmt(ma.data, ma.size * 2);
+                    line << '\n';
+                    std::cout << line;
+                }
+            }
+
+            line.clear();
+            if (show_regs) {
+                print_cpu_state(line, e.state);
+            } else if (e.changed & (((1 << cpu_trace_num_regs) - 1) | cpu_trace_sr_changed)) {
+                line << "\t\t";
+                for (uint32_t r = 0; r < cpu_trace_num_regs; ++r) {
+                    if (e.changed & (1 << r))
+                        line << regnames[r] << '=' << hexfmt(reg_value(e.state, r)) << ' ';
+                }
+                if (e.changed & cpu_trace_sr_changed)
+                    line << "SR=" << hexfmt(e.state.sr);
+                line << '\n';
+            }
+            std::cout << line;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -11,6 +11,11 @@
 #include <iomanip>
 #include <variant>
 #include <map>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <filesystem>
 
 #include "ioutil.h"
 #include "instruction.h"
@@ -30,24 +35,46 @@
 #include "state_file.h"
 #include "disk_file.h"
 #include "debug_board.h"
+#include "profiler.h"
+#include "cpu_trace.h"
 
 namespace {
 
-volatile bool ctrl_c;
-
-cpu_state debugger_cpu_state;
-uint32_t debugger_ans; // Last result
-uint32_t debugger_reg[100];
+// Number of SIGINTs received. Each machine compares it against the count it
+// has already seen and sets its own break request (amiga::ctrl_c).
+std::atomic<unsigned> sigint_count;
+static_assert(std::atomic<unsigned>::is_always_lock_free);
 
 struct debugger_function {
     std::string name;
     std::variant<std::function<uint32_t()>, std::function<uint32_t(uint32_t)>, std::function<uint32_t(uint32_t, uint32_t)>> func;
 };
-std::vector<debugger_function> debugger_functions;
+
+// Expression evaluation for the debugger (one per machine)
+class debugger_context {
+public:
+    cpu_state state; // Registers used in expressions
+    uint32_t ans = 0; // Last result
+    uint32_t internal_reg[100] = {};
+    std::vector<debugger_function> functions;
+
+    std::pair<uint32_t, const void*> get_register_address(const char* s, const cpu_state& st);
+    std::pair<bool, uint32_t> get_register(const char* s);
+    std::pair<bool, uint32_t> get_number(const std::string& s);
+    std::pair<bool, uint32_t> get_simple_expr(const std::string& arg);
+    std::tuple<bool, uint32_t, uint32_t> get_addr_and_lines(const std::vector<std::string>& args, uint32_t def_addr, uint32_t def_lines);
+};
 
 void ctrl_c_handler(int)
 {
-    ctrl_c = true;
+    ++sigint_count;
+}
+
+// In batch mode the first Ctrl+C stops the running scenarios, a second one kills the process
+void batch_ctrl_c_handler(int)
+{
+    ++sigint_count;
+    signal(SIGINT, SIG_DFL);
 }
 
 std::vector<std::string> split_line(const std::string& line)
@@ -163,7 +190,7 @@ std::optional<std::vector<uint8_t>> unhex_bytes(const std::string& s)
     return res;
 }
 
-std::pair<uint32_t, const void*> get_register_address(const char* s, const cpu_state& st)
+std::pair<uint32_t, const void*> debugger_context::get_register_address(const char* s, const cpu_state& st)
 {
     std::string reg { s };
     if (reg.empty()) {
@@ -174,8 +201,8 @@ std::pair<uint32_t, const void*> get_register_address(const char* s, const cpu_s
         // Internal register
         const auto [ok, idx] = number_from_string(reg.c_str(), 10);
         if (ok) {
-            if (idx < std::size(debugger_reg))
-                return { 4, &debugger_reg[idx] };
+            if (idx < std::size(internal_reg))
+                return { 4, &internal_reg[idx] };
             std::cerr << "Out of range for internal register \"" << reg << "\"\n";
         } else {
             std::cerr << "Invalid register \"" << reg << "\"\n";
@@ -196,7 +223,7 @@ std::pair<uint32_t, const void*> get_register_address(const char* s, const cpu_s
     else if (reg == "SR")
         return { 2, &st.sr };
     else if (reg == "ANS")
-        return { 4, &debugger_ans };
+        return { 4, &ans };
 
     if (reg.size() == 2 && reg[1] >= '0' && reg[1] <= '7') {
         const auto idx = reg[1] - '0';
@@ -210,9 +237,9 @@ std::pair<uint32_t, const void*> get_register_address(const char* s, const cpu_s
     return { 0, nullptr };
 }
 
-std::pair<bool, uint32_t> get_register(const char* s)
+std::pair<bool, uint32_t> debugger_context::get_register(const char* s)
 {
-    const auto [size, ptr] = get_register_address(s, debugger_cpu_state);
+    const auto [size, ptr] = get_register_address(s, state);
     if (!size)
         return { false, 0 };
     assert(ptr);
@@ -222,7 +249,7 @@ std::pair<bool, uint32_t> get_register(const char* s)
     return { true, *reinterpret_cast<const uint32_t*>(ptr) };
 }
 
-std::pair<bool, uint32_t> get_number(const std::string& s)
+std::pair<bool, uint32_t> debugger_context::get_number(const std::string& s)
 {
     if (s.empty())
         return { false, 0 };
@@ -241,7 +268,7 @@ std::pair<bool, uint32_t> get_number(const std::string& s)
     return number_from_string(s.c_str(), 16);
 }
 
-std::pair<bool, uint32_t> get_simple_expr(const std::string& arg)
+std::pair<bool, uint32_t> debugger_context::get_simple_expr(const std::string& arg)
 {
     if (arg.empty())
         return { false, 0 };
@@ -254,7 +281,7 @@ std::pair<bool, uint32_t> get_simple_expr(const std::string& arg)
     constexpr unsigned char op_neq = 0x85;
     constexpr unsigned char op_func_base = 0x90;
 
-    assert(debugger_functions.size() < 0x100 - op_func_base);
+    assert(functions.size() < 0x100 - op_func_base);
 
     auto prec = [](unsigned char c) {
         switch (c) {
@@ -405,8 +432,8 @@ std::pair<bool, uint32_t> get_simple_expr(const std::string& arg)
             const auto tok = arg.substr(i, j - i);
             i = j;
             uint8_t func_index = 0xFF;
-            for (size_t cnt = 0; cnt < debugger_functions.size(); ++cnt) {
-                if (tok == debugger_functions[cnt].name) {
+            for (size_t cnt = 0; cnt < functions.size(); ++cnt) {
+                if (tok == functions[cnt].name) {
                     func_index = static_cast<uint8_t>(cnt);
                     break;
                 }
@@ -440,8 +467,8 @@ std::pair<bool, uint32_t> get_simple_expr(const std::string& arg)
             assert(se.val < 0x100);
             vals.push_back(doop(static_cast<unsigned char>(se.val), a, b));
         } else if (se.type == elem_type::func) {
-            assert(se.val < debugger_functions.size());
-            const auto& func = debugger_functions[se.val];
+            assert(se.val < functions.size());
+            const auto& func = functions[se.val];
             if (vals.size() < func.func.index())
                 return { false, 0 };
             std::vector<uint32_t> args;
@@ -476,7 +503,7 @@ std::pair<bool, uint32_t> get_simple_expr(const std::string& arg)
     return { true, vals[0] };
 }
 
-std::tuple<bool, uint32_t, uint32_t> get_addr_and_lines(const std::vector<std::string>& args, uint32_t def_addr, uint32_t def_lines)
+std::tuple<bool, uint32_t, uint32_t> debugger_context::get_addr_and_lines(const std::vector<std::string>& args, uint32_t def_addr, uint32_t def_lines)
 {
     uint32_t addr = def_addr, lines = def_lines;
 
@@ -509,6 +536,7 @@ uint32_t disasm_stmts(memory_handler& mem, uint32_t start, uint32_t count)
         return 0;
     }
     uint32_t addr = start;
+    format_buffer line;
     while (count--) {
         uint16_t iw[max_instruction_words];
         const auto pc = addr;
@@ -518,8 +546,10 @@ uint32_t disasm_stmts(memory_handler& mem, uint32_t start, uint32_t count)
             iw[i] = mem.read_u16(addr);
             addr += 2;
         }
-        disasm(std::cout, pc, iw, max_instruction_words);
-        std::cout << "\n";
+        line.clear();
+        disasm(line, pc, iw, max_instruction_words);
+        line << '\n';
+        std::cout << line;
     }
     return addr - start;
 }
@@ -612,7 +642,7 @@ void write_bmp(const std::string& filename, const uint32_t* data, uint32_t w, ui
         throw std::runtime_error { "Error writing to " + filename };
 }
 
-void mem_search(const std::vector<uint8_t>& ram, uint32_t base_address, const std::vector<uint8_t>& needle, uint32_t start_address, uint32_t end_address, unsigned& match_count)
+void mem_search(const std::vector<uint8_t>& ram, uint32_t base_address, const std::vector<uint8_t>& needle, uint32_t start_address, uint32_t end_address, unsigned& match_count, uint32_t& first_match)
 {
     constexpr unsigned max_matches = 20;
     if (needle.size() > ram.size() || needle.empty() || match_count)
@@ -625,7 +655,7 @@ void mem_search(const std::vector<uint8_t>& ram, uint32_t base_address, const st
             const auto addr = base_address + static_cast<uint32_t>(i);
             std::cout << "Found at $" << hexfmt(addr) << "\n";
             if (!match_count)
-                debugger_ans = addr; // Save first match
+                first_match = addr;
             if (++match_count > max_matches) {
                 std::cout << "maximum number of matches reached\n";
                 return;
@@ -675,7 +705,58 @@ struct disable_bool {
     const bool orig_val_;
 };
 
-constexpr int default_disk_insertion_delay = 2 * 50;
+// Set of breakpoint addresses. One bit per word in the 24-bit address space (1MB in total), allocated in pages as needed.
+class breakpoint_set {
+public:
+    bool empty() const
+    {
+        return count_ == 0;
+    }
+
+    bool contains(uint32_t addr) const
+    {
+        const auto& page = pages_[(addr >> page_shift) & (num_pages - 1)];
+        if (!page)
+            return false;
+        const uint32_t bit = (addr & page_mask) >> 1;
+        return (page[bit >> 6] >> (bit & 63)) & 1;
+    }
+
+    // Returns true if the breakpoint was added, false if it was removed
+    bool toggle(uint32_t addr)
+    {
+        auto& page = pages_[(addr >> page_shift) & (num_pages - 1)];
+        if (!page)
+            page = std::make_unique<uint64_t[]>(page_words);
+        const uint32_t bit = (addr & page_mask) >> 1;
+        const uint64_t mask = 1ULL << (bit & 63);
+        page[bit >> 6] ^= mask;
+        if (page[bit >> 6] & mask) {
+            ++count_;
+            return true;
+        }
+        --count_;
+        return false;
+    }
+
+    void clear()
+    {
+        for (auto& p : pages_)
+            p.reset();
+        count_ = 0;
+    }
+
+private:
+    static constexpr uint32_t page_shift = 16;
+    static constexpr uint32_t page_mask = (1 << page_shift) - 1;
+    static constexpr uint32_t page_words = (1 << (page_shift - 1)) / 64;
+    static constexpr uint32_t num_pages = 1 << (24 - page_shift);
+    std::unique_ptr<uint64_t[]> pages_[num_pages];
+    uint32_t count_ = 0;
+};
+
+constexpr uint32_t vertical_frequency = 50; // PAL
+constexpr int default_disk_insertion_delay = 2 * vertical_frequency;
 
 } // unnamed namespace
 
@@ -703,15 +784,36 @@ struct command_line_arguments {
     std::vector<std::string> hds;
     std::vector<std::string> shared_folders;
     std::string debug_script;
+    std::string overlay_dir;
     uint32_t chip_size;
     uint32_t slow_size;
     uint32_t fast_size;
     uint8_t cpu_scale;
     uint32_t floppy_speed;
+    uint32_t warp_interval;
+    uint32_t benchmark_frames;
+    uint32_t image_sync_interval;
+    disk_image_mode floppy_mode = disk_image_mode::copy_on_write;
+    disk_image_mode hd_mode = disk_image_mode::write_through;
     bool test_mode;
     bool nosound;
     bool debug;
     bool debug_board;
+    bool warp;
+    bool hd_async;
+    bool fast_loadseg;
+    bool floppy_turbo;
+    bool batch; // Running as part of a batch (see run_batch): no console input
+
+    disk_image_options floppy_image_options() const
+    {
+        return { floppy_mode, image_sync_interval, overlay_dir };
+    }
+
+    disk_image_options hd_image_options() const
+    {
+        return { hd_mode, image_sync_interval, overlay_dir };
+    }
 
     void handle_state(state_file& sf)
     {
@@ -736,18 +838,29 @@ void usage(const std::string& msg)
         "[-df0/-df1 disk/exe]"
         "[-hd file]\n"
         "[-share path]\n"
+        "[-floppymode ro/cow/rw/overlay]\n"
+        "[-hdmode ro/cow/rw/overlay]\n"
+        "[-overlaydir path]\n"
+        "[-syncinterval ms]\n"
+        "[-hdasync]\n"
+        "[-shareloadseg]\n"
         "[-chip size]\n"
         "[-slow size]\n"
         "[-fast size]\n"
         "[-nosound]\n"
         "[-floppyspeed X]\n"
+        "[-turbofloppy]\n"
         "[-cpuscale X]\n"
+        "[-warp]\n"
+        "[-warpinterval X]\n"
         "[-state statefile]\n"
         "[-debug]\n"
         "[-debugscript file]\n"
         "[-testmode]\n"
+        "[-benchmark frames=N]\n"
         "[-debugboard]\n"
-        "[-help]\n";
+        "[-help]\n"
+        "or: -batch file [-j threads]\n";
     throw std::runtime_error { msg };
 }
 
@@ -811,7 +924,17 @@ command_line_arguments parse_command_line_arguments(int argc, char* argv[])
             } else if (std::string share; get_string_arg("share", share)) {
                 args.shared_folders.push_back(share);
                 continue;
-            } else if (get_string_arg("rom", args.rom))
+            } else if (std::string mode; get_string_arg("floppymode", mode)) {
+                if (!parse_disk_image_mode(mode, args.floppy_mode))
+                    usage("Invalid floppy mode \"" + mode + "\" (expected ro, cow, rw or overlay)");
+                continue;
+            } else if (std::string mode; get_string_arg("hdmode", mode)) {
+                if (!parse_disk_image_mode(mode, args.hd_mode))
+                    usage("Invalid harddisk mode \"" + mode + "\" (expected ro, cow, rw or overlay)");
+                continue;
+            } else if (get_string_arg("overlaydir", args.overlay_dir))
+                continue;
+            else if (get_string_arg("rom", args.rom))
                 continue;
             else if (get_size_arg("chip", args.chip_size, max_chip_size))
                 continue;
@@ -825,12 +948,27 @@ command_line_arguments parse_command_line_arguments(int argc, char* argv[])
                 continue;
             else if (get_number_arg("cpuscale", args.cpu_scale, 255))
                 continue;
+            else if (get_number_arg("warpinterval", args.warp_interval, 1000))
+                continue;
+            else if (get_number_arg("syncinterval", args.image_sync_interval, 3600 * 1000))
+                continue;
             else if (!std::strcmp(&argv[i][1], "help"))
                 usage("");
             else if (!std::strcmp(&argv[i][1], "testmode")) {
                 args.test_mode = true;
                 args.nosound = true;
                 continue;
+            } else if (std::string bench; get_string_arg("benchmark", bench)) {
+                if (bench.compare(0, 7, "frames=") == 0)
+                    bench.erase(0, 7);
+                char* ep = nullptr;
+                const auto num = strtoul(bench.c_str(), &ep, 10);
+                if (*ep || !num || num > UINT32_MAX)
+                    usage("Invalid argument for benchmark (expected frames=N)");
+                args.benchmark_frames = static_cast<uint32_t>(num);
+                args.test_mode = true;
+                args.nosound = true;
+                continue;
             } else if (!std::strcmp(&argv[i][1], "nosound")) {
                 args.nosound = true;
                 continue;
@@ -840,6 +978,18 @@ command_line_arguments parse_command_line_arguments(int argc, char* argv[])
             } else if (!std::strcmp(&argv[i][1], "debugboard")) {
                 args.debug_board = true;
                 continue;
+            } else if (!std::strcmp(&argv[i][1], "hdasync")) {
+                args.hd_async = true;
+                continue;
+            } else if (!std::strcmp(&argv[i][1], "shareloadseg")) {
+                args.fast_loadseg = true;
+                continue;
+            } else if (!std::strcmp(&argv[i][1], "turbofloppy")) {
+                args.floppy_turbo = true;
+                continue;
+            } else if (!std::strcmp(&argv[i][1], "warp")) {
+                args.warp = true;
+                continue;
             } else if (get_string_arg("debugscript", args.debug_script)) {
                 args.debug = true; // debugscript implies -debug
                 continue;
@@ -863,6 +1013,10 @@ command_line_arguments parse_command_line_arguments(int argc, char* argv[])
         args.cpu_scale = 1;
     if (!args.floppy_speed)
         args.floppy_speed = 16;
+    if (!args.warp_interval)
+        args.warp_interval = 10;
+    if (!args.image_sync_interval)
+        args.image_sync_interval = default_disk_image_sync_interval_ms;
     return args;
 }
 
@@ -879,7 +1033,7 @@ std::vector<uint8_t> patch(std::vector<uint8_t>&& rom)
 
 class amiga {
 public:
-    explicit amiga(const command_line_arguments& cmdline_args);
+    explicit amiga(const command_line_arguments& cmdline_args, const std::shared_ptr<const std::vector<uint8_t>>& rom_data);
     ~amiga();
 
     void run();
@@ -927,6 +1081,9 @@ private:
     uint32_t disk_chosen_countdown = 0;
     bool new_frame = false;
     bool quit = false;
+    bool interrupted = false; // Stopped by Ctrl+C in batch mode
+    unsigned sigint_seen = sigint_count;
+    bool ctrl_c = false;
     void process_event(const gui::event& evt);
 
     //
@@ -946,13 +1103,14 @@ private:
     uint32_t wait_arg = 0;
     std::string wait_process_name;
     uint32_t exception_break_mask = 0;
-    uint32_t chip_cycles_count = 0, cpu_cycles_count = 0;
+    uint64_t chip_cycles_count = 0, cpu_cycles_count = 0;
     uint32_t last_vhpos = 0;
-    std::vector<uint32_t> breakpoints;
+    breakpoint_set breakpoints;
     int illegal_access_debug_mode = -1; // 0 = print, 1 = break
     std::vector<cpu_state> cpu_history = std::vector<cpu_state>(1024); // XXX
     uint32_t cpu_history_pos = 0;
     std::unique_ptr<std::ifstream> debug_script;
+    debugger_context dbg_;
 
     struct mem_use {
         bus_use use;
@@ -964,10 +1122,21 @@ private:
     std::vector<memwatch> memwatches;
     std::vector<uint32_t> tasks;
     std::unique_ptr<std::ofstream> trace_file;
+    std::unique_ptr<cpu_trace_writer> bin_trace;
     bool profiling_ = false;
-    std::map<uint32_t, uint64_t> profiling_data_;
+    profiler profiler_;
     
     void activate_debugger();
+    void write_bin_trace();
+    bool debug_break_armed() const
+    {
+#ifdef DEBUG_BREAK_INST
+        return true;
+#else
+        // Combined without short-circuiting so normal runs only pay for a single (not taken) branch
+        return (wait_mode != wait_none) | (exception_break_mask != 0) | !breakpoints.empty();
+#endif
+    }
     void check_debug_break();
     bool check_wait_process_name(const std::string& process_name) const;
     void check_wait_process(uint32_t process_ptr, const std::string& process_name);
@@ -988,9 +1157,29 @@ private:
     bool audio_buffer_ready[2] = { false, false };
     int audio_next_to_play = 0;
     int audio_next_to_fill = 0;
+    std::chrono::steady_clock::time_point audio_last_warning;
+    unsigned audio_num_warnings = 0;
 
     void audio_callback(int16_t* buf, size_t sz);
 
+    //
+    // Warp mode (no audio pacing, only every warp_interval'th field is rendered)
+    //
+    bool warp_mode = false;
+    bool field_rendered = true; // Was the last field rendered (i.e. should it be presented)?
+    uint32_t warp_fields = 0;
+    uint32_t warp_report_fields = 0;
+    std::chrono::steady_clock::time_point warp_report_time;
+
+    void set_warp_mode(bool enabled);
+    void warp_report(bool force);
+
+    //
+    // Benchmark mode (run a fixed number of frames and report timing)
+    //
+    uint32_t benchmark_frames_done = 0;
+    void benchmark_report(double wall_time, uint64_t cpu_cycles, uint64_t chip_cycles);
+
     //
     // Main stuff
     //
@@ -1018,10 +1207,10 @@ private:
     void insert_disk(uint8_t drive, const char* filename, int delay = default_disk_insertion_delay);
 };
 
-amiga::amiga(const command_line_arguments& args)
+amiga::amiga(const command_line_arguments& args, const std::shared_ptr<const std::vector<uint8_t>>& rom_data)
     : cmdline_args { args }
     , mem { cmdline_args.chip_size }
-    , rom { mem, patch(read_file(cmdline_args.rom)) }
+    , rom { mem, rom_data }
     , custom { mem, cias, slow_base + cmdline_args.slow_size, cmdline_args.floppy_speed }
 {
     if (cmdline_args.slow_size) {
@@ -1042,10 +1231,12 @@ amiga::amiga(const command_line_arguments& args)
         fast_ram = std::make_unique<fastmem_handler>(mem, cmdline_args.fast_size);
         autoconf.add_device(*fast_ram);
     }
+    df0.set_turbo(cmdline_args.floppy_turbo);
+    df1.set_turbo(cmdline_args.floppy_turbo);
     if (!cmdline_args.df0.empty())
-        df0.insert_disk(load_disk_file(cmdline_args.df0));
+        df0.insert_disk(load_disk_file(cmdline_args.df0, cmdline_args.floppy_image_options()));
     if (!cmdline_args.df1.empty())
-        df1.insert_disk(load_disk_file(cmdline_args.df1));
+        df1.insert_disk(load_disk_file(cmdline_args.df1, cmdline_args.floppy_image_options()));
 
     custom.set_serial_data_handler([this](uint8_t numbits, uint8_t data) { serial_data_handler(numbits, data); });
 
@@ -1059,7 +1250,7 @@ amiga::amiga(const command_line_arguments& args)
         });
         g->set_on_pause_callback([&](bool pause) {
             if (audio) {
-                audio->set_paused(pause);
+                audio->set_paused(pause || warp_mode);
             }
         });
     }
@@ -1089,8 +1280,10 @@ amiga::amiga(const command_line_arguments& args)
         auto should_disable_autoboot = [&]() {
             return df0.ofs_bootable_disk_inserted();
         };
-        hd = std::make_unique<harddisk>(mem, cpu_active, should_disable_autoboot, cmdline_args.hds, cmdline_args.shared_folders);
+        hd = std::make_unique<harddisk>(mem, cpu_active, should_disable_autoboot, cmdline_args.hds, cmdline_args.shared_folders, cmdline_args.hd_image_options(), cmdline_args.hd_async, cmdline_args.fast_loadseg);
         autoconf.add_device(hd->autoconf_dev());
+        if (cmdline_args.hd_async)
+            custom.set_external_irq_handler([this]() { return hd->active_irq_mask(); });
     }
 
     if (cmdline_args.debug_board) {
@@ -1110,6 +1303,15 @@ amiga::amiga(const command_line_arguments& args)
         });
     }
 
+    if (cmdline_args.warp)
+        set_warp_mode(true);
+
+    dbg_.functions.push_back({ "get_u8", [this](uint32_t addr) -> uint32_t { return mem.read_u8(addr); } });
+    dbg_.functions.push_back({ "get_u16", [this](uint32_t addr) -> uint32_t { return mem.read_u16(addr); } });
+    dbg_.functions.push_back({ "get_u32", [this](uint32_t addr) -> uint32_t { return mem.read_u32(addr); } });
+    dbg_.functions.push_back({ "extb", [](uint32_t val) { return sext(val, opsize::b); } });
+    dbg_.functions.push_back({ "extw", [](uint32_t val) { return sext(val, opsize::w); } });
+
     if (cmdline_args.debug)
         activate_debugger();
 }
@@ -1153,7 +1355,7 @@ void amiga::cstep(bool cpu_waiting)
     if (!(custom_step.hpos & 1)) {
         dma_usage[custom_step.vpos * (hpos_per_line / 2) + custom_step.hpos / 2] = { custom_step.bus, custom_step.dma_addr, custom_step.dma_val };
         if (profiling_)
-            ++profiling_data_[cpu_step.current_pc];
+            profiler_.sample(cpu_step.current_pc);
     }
 
     ++chip_cycles_count;
@@ -1170,7 +1372,12 @@ void amiga::cstep(bool cpu_waiting)
             wait_mode = wait_none;
         }
 
-        if (audio) {
+        if (warp_mode) {
+            field_rendered = custom.rendering();
+            custom.set_rendering(++warp_fields % cmdline_args.warp_interval == 0);
+            if (!(warp_fields % vertical_frequency))
+                warp_report(false);
+        } else if (audio) {
             std::unique_lock<std::mutex> lock { audio_mutex_ };
             if (audio_buffer_ready[audio_next_to_fill]) {
                 audio_buffer_played_cv.wait(lock, [&]() { return !audio_buffer_ready[audio_next_to_fill]; });
@@ -1257,6 +1464,9 @@ void amiga::on_memory_access(uint32_t addr, uint32_t data, uint8_t size, bool wr
     if (!cpu_active)
         return;
 
+    if (bin_trace)
+        bin_trace->memory_access(addr, data, size, write);
+
     const auto scale = cmdline_args.cpu_scale;
 
     assert(size == 1 || size == 2);
@@ -1333,14 +1543,12 @@ void amiga::audio_callback(int16_t* buf, size_t sz)
 {
     static_assert(2 * audio_samples_per_frame == audio_buffer_size);
     constexpr auto warn_interval = std::chrono::seconds(2);
-    static auto last_warning = std::chrono::steady_clock::now() - warn_interval;
     const auto now = std::chrono::steady_clock::now();
-    static unsigned num_warnings = 0;
     assert(sz == audio_samples_per_frame);
     {
         std::unique_lock<std::mutex> lock { audio_mutex_ };
         if (!audio_buffer_ready[audio_next_to_play]) {
-            ++num_warnings;
+            ++audio_num_warnings;
             memset(buf, 0, sz * 2 * sizeof(int16_t));
             // Deadlocks with SDL
             // audio_buffer_ready_cv.wait(lock, [&]() { return audio_buffer_ready[audio_next_to_play]; });
@@ -1351,13 +1559,81 @@ void amiga::audio_callback(int16_t* buf, size_t sz)
         audio_next_to_play = !audio_next_to_play;
     }
     audio_buffer_played_cv.notify_one();
-    if (num_warnings && now - last_warning > warn_interval) {
-        std::cerr << "Audio buffer not ready! (" << num_warnings << ")\n";
-        last_warning = now;
-        num_warnings = 0;
+    if (audio_num_warnings && now - audio_last_warning > warn_interval) {
+        std::cerr << "Audio buffer not ready! (" << audio_num_warnings << ")\n";
+        audio_last_warning = now;
+        audio_num_warnings = 0;
     }
 }
 
+void amiga::set_warp_mode(bool enabled)
+{
+    if (enabled == warp_mode)
+        return;
+    if (warp_mode)
+        warp_report(true);
+    warp_mode = enabled;
+    warp_fields = warp_report_fields = 0;
+    warp_report_time = std::chrono::steady_clock::now();
+    field_rendered = true;
+    custom.set_rendering(true);
+    if (audio)
+        audio->set_paused(warp_mode);
+    std::cout << "Warp mode " << (warp_mode ? "enabled" : "disabled") << "\n";
+}
+
+void amiga::warp_report(bool force)
+{
+    constexpr auto report_interval = std::chrono::seconds(2);
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = now - warp_report_time;
+    if (!force && elapsed < report_interval)
+        return;
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    if (us > 0) {
+        const double speed = (warp_fields - warp_report_fields) * 1e6 / (static_cast<double>(us) * vertical_frequency);
+        std::ostringstream oss;
+        oss << "Warp speed: " << std::fixed << std::setprecision(1) << speed << "x\n";
+        std::cout << oss.str();
+    }
+    warp_report_time = now;
+    warp_report_fields = warp_fields;
+}
+
+void amiga::benchmark_report(double wall_time, uint64_t cpu_cycles, uint64_t chip_cycles)
+{
+    // Only a sample of custom chip steps are timed, so scale up the measurements
+    const auto& t = custom.timing();
+    const double scale = t.sampled_steps ? static_cast<double>(t.steps) / t.sampled_steps : 0.0;
+    const double custom_time = t.step * scale;
+    const double custom_parts = (t.copper_blitter + t.cia + t.disk + t.render) * scale;
+
+    // Formatted separately so the stream flags of std::cout aren't changed (it may be shared with other machines)
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(6);
+    oss << "{\n";
+    oss << "  \"frames\": " << benchmark_frames_done << ",\n";
+    oss << "  \"wall_time\": " << wall_time << ",\n";
+    oss << "  \"fps\": " << benchmark_frames_done / wall_time << ",\n";
+    oss << "  \"speed\": " << benchmark_frames_done / (wall_time * vertical_frequency) << ",\n";
+    oss << "  \"cpu_cycles\": " << cpu_cycles << ",\n";
+    oss << "  \"chip_cycles\": " << chip_cycles << ",\n";
+    oss << "  \"cpu_cycles_per_second\": " << cpu_cycles / wall_time << ",\n";
+    oss << "  \"chip_cycles_per_second\": " << chip_cycles / wall_time << ",\n";
+    oss << "  \"emulated_cpu_mhz\": " << cpu_cycles / wall_time / 1e6 << ",\n";
+    oss << "  \"time\": {\n";
+    oss << "    \"cpu\": " << std::max(0.0, wall_time - custom_time) << ",\n";
+    oss << "    \"custom\": " << std::max(0.0, custom_time - custom_parts) << ",\n";
+    oss << "    \"copper_blitter\": " << t.copper_blitter * scale << ",\n";
+    oss << "    \"cia\": " << t.cia * scale << ",\n";
+    oss << "    \"disk\": " << t.disk * scale << ",\n";
+    oss << "    \"render\": " << t.render * scale << "\n";
+    oss << "  }\n";
+    oss << "}\n";
+    serial_data_flush();
+    std::cout << oss.str();
+}
+
 void amiga::serial_data_handler([[maybe_unused]] uint8_t numbits, uint8_t data)
 {
     assert(numbits == 8);
@@ -1439,6 +1715,21 @@ void amiga::activate_debugger()
     debug_mode = true;
 }
 
+void amiga::write_bin_trace()
+{
+    // No instruction was executed if an interrupt was taken
+    const bool interrupt = cpu_step.exception >= 24 && cpu_step.exception < 32;
+    uint16_t iwords[max_instruction_words];
+    uint8_t ilen = 0;
+    if (!interrupt) {
+        iwords[0] = mem.hack_peek_u16(cpu_step.last_pc);
+        ilen = instructions[iwords[0]].ilen;
+        for (uint8_t i = 1; i < ilen; ++i)
+            iwords[i] = mem.hack_peek_u16(cpu_step.last_pc + i * 2);
+    }
+    bin_trace->instruction(cpu_step.last_pc, iwords, ilen, cpu.state(), cpu_step.exception, custom_step.vpos, custom_step.hpos);
+}
+
 void amiga::check_debug_break()
 {
 
@@ -1531,7 +1822,7 @@ activate:
     return;
 
 check_breakpoint:
-    if (auto it = std::find(breakpoints.begin(), breakpoints.end(), cpu_step.current_pc); it != breakpoints.end()) {
+    if (breakpoints.contains(cpu_step.current_pc)) {
         std::cout << "Breakpoint hit\n";
         goto activate;
     }
@@ -1630,6 +1921,14 @@ void amiga::on_load_seg(uint32_t name_ptr, const uint32_t seg_list_bptr)
     }
     std::cout << "LoadSeg \"" << name << "\" seglist=$" << hexfmt(seg_list_bptr) << "\n";
 
+    // Add symbols for the profiler (segment: size (including header) at -4, next segment BPTR at 0, code at +4)
+    unsigned hunk = 0;
+    for (uint32_t seg = seg_list_bptr << 2; seg && hunk < 1000; seg = mem.read_u32(seg) << 2, ++hunk) {
+        const auto size = mem.read_u32(seg - 4);
+        if (size >= 8)
+            profiler_.add_symbol(seg + 4, size - 8, name + ":" + std::to_string(hunk));
+    }
+
     if (wait_mode != wait_process)
         return;
     if (check_wait_process_name(name)) {
@@ -1660,7 +1959,7 @@ void amiga::debugger_loop()
     cpu.show_state(std::cout);
     disasm_stmts(mem, cpu_step.current_pc, 1);
 
-    debugger_cpu_state = s;
+    dbg_.state = s;
 
     uint32_t disasm_pc = s.pc, hexdump_addr = 0, cop_addr = custom.copper_ptr(0);
     for (;;) {
@@ -1687,6 +1986,12 @@ void amiga::debugger_loop()
                     break;
                 }
             } else {
+                if (cmdline_args.batch) {
+                    // Nothing more to do when the debug script ends
+                    debug_mode = false;
+                    quit = true;
+                    break;
+                }
                 std::cout << "> " << std::flush;
                 if (!std::getline(std::cin, line)) {
                     debug_mode = false;
@@ -1701,7 +2006,7 @@ void amiga::debugger_loop()
         if (args[0] == "c") {
             custom.show_debug_state(std::cout);
         } else if (args[0] == "d") {
-            auto [valid, pc, lines] = get_addr_and_lines(args, disasm_pc, 10);
+            auto [valid, pc, lines] = dbg_.get_addr_and_lines(args, disasm_pc, 10);
             if (valid) {
                 disasm_pc = pc;
                 disasm_pc += disasm_stmts(mem, disasm_pc, lines);
@@ -1710,14 +2015,10 @@ void amiga::debugger_loop()
             custom.show_registers(std::cout);
         } else if (args[0] == "f") {
             if (args.size() > 1) {
-                auto [valid, pc] = get_simple_expr(args[1]);
+                auto [valid, pc] = dbg_.get_simple_expr(args[1]);
                 if (valid && !(pc & 1)) {
-                    if (auto it = std::find(breakpoints.begin(), breakpoints.end(), pc); it != breakpoints.end()) {
-                        breakpoints.erase(it);
+                    if (!breakpoints.toggle(pc))
                         std::cout << "Breakpoint removed\n";
-                    } else {
-                        breakpoints.push_back(pc);
-                    }
                 } else {
                     std::cerr << "Invalid address\n";
                 }
@@ -1730,7 +2031,7 @@ void amiga::debugger_loop()
             std::cout << "All breakpoints deleted\n";
         } else if (args[0] == "fi") {
             if (args.size() > 1) {
-                auto [valid, inst] = get_simple_expr(args[1]);
+                auto [valid, inst] = dbg_.get_simple_expr(args[1]);
                 if (valid && inst < 0x10000) {
                     wait_mode = wait_exact_inst;
                     wait_arg = inst;
@@ -1744,7 +2045,7 @@ void amiga::debugger_loop()
             }
         } else if (args[0] == "g") {
             if (args.size() == 2) {
-                if (const auto [ok, addr] = get_simple_expr(args[1]); ok) {
+                if (const auto [ok, addr] = dbg_.get_simple_expr(args[1]); ok) {
                     const_cast<cpu_state&>(s).pc = addr;
                     break;
                 } else {
@@ -1758,7 +2059,7 @@ void amiga::debugger_loop()
         } else if (args[0] == "H" || args[0] == "HH") {
             uint32_t cnt = 10;
             if (args.size() > 1) {
-                if (auto [valid, cntr] = get_simple_expr(args[1]); valid) {
+                if (auto [valid, cntr] = dbg_.get_simple_expr(args[1]); valid) {
                     cnt = cntr;
                 } else {
                     cnt = 0;
@@ -1776,7 +2077,7 @@ void amiga::debugger_loop()
             }
         } else if (args[0] == "il") {
             if (args.size() > 1) {
-                if (auto [valid, mask] = get_simple_expr(args[1]); valid)
+                if (auto [valid, mask] = dbg_.get_simple_expr(args[1]); valid)
                     exception_break_mask = mask;
                 else
                     std::cerr << "Invalid mask\n";
@@ -1790,7 +2091,7 @@ void amiga::debugger_loop()
                 if (drive >= 0 && drive < max_drives && drives[drive]) {
                     int delay = default_disk_insertion_delay;
                     if (args.size() >= 4) {
-                        auto d = get_simple_expr(args[3]);
+                        auto d = dbg_.get_simple_expr(args[3]);
                         if (d.first)
                             delay = d.second;
                         else
@@ -1807,7 +2108,7 @@ void amiga::debugger_loop()
                 std::cerr << "Drive missing\n";
             }
         } else if (args[0] == "m") {
-            auto [valid, addr, lines] = get_addr_and_lines(args, hexdump_addr, 20);
+            auto [valid, addr, lines] = dbg_.get_addr_and_lines(args, hexdump_addr, 20);
             addr &= ~1;
             if (valid) {
                 std::vector<uint8_t> data(lines * 16);
@@ -1818,7 +2119,7 @@ void amiga::debugger_loop()
             }
         } else if (args[0][0] == 'o') {
             if (args[0] == "o") {
-                auto [valid, addr, lines] = get_addr_and_lines(args, cop_addr, 20);
+                auto [valid, addr, lines] = dbg_.get_addr_and_lines(args, cop_addr, 20);
                 if (valid) {
                     cop_addr = addr & ~1;
                     cop_addr += copper_disasm(mem, cop_addr, lines);
@@ -1837,42 +2138,29 @@ void amiga::debugger_loop()
                 if (args[1] == "1") {
                     if (!profiling_) {
                         profiling_ = true;
-                        profiling_data_.clear();
+                        profiler_.reset();
                     } else {
                         std::cerr << "Profiling already enabled\n";
                     }
                 } else if (args[1] == "0") {
                     profiling_ = false;
+                } else if (args[1] == "flame") {
+                    if (args.size() > 2) {
+                        std::ofstream f { unquote(args[2]) };
+                        if (f) {
+                            profiler_.write_collapsed_stacks(f);
+                            std::cout << "Collapsed stacks written to \"" << unquote(args[2]) << "\"\n";
+                        } else {
+                            std::cerr << "Error creating \"" << unquote(args[2]) << "\"\n";
+                        }
+                    } else {
+                        std::cerr << "Missing argument (file)\n";
+                    }
+                } else {
+                    std::cerr << "Invalid argument to prof\n";
                 }
-            } else if (!profiling_) {
-                std::cerr << "Profiling is not enabled\n";
             } else {
-                // Slow and ugly, but show some data
-                std::map<uint64_t, uint32_t> data;
-                std::map<std::string, uint64_t> insts;
-                std::map<uint64_t, std::string> reverse_insts;
-                uint64_t total = 0;
-                for (const auto [addr, cycles] : profiling_data_) {
-                    data[cycles] = addr;
-                    total += cycles;
-                    insts[instructions[mem.hack_peek_u16(addr)].name] += cycles;
-                }
-                for (const auto& i: insts)
-                    reverse_insts[i.second] = i.first;
-                auto it = data.crbegin();
-                for (unsigned i = 0; i < 200 && it != data.crend(); ++i, ++it) {
-                    std::cout << hexfmt(it->second) << " " << std::setw(10) << static_cast<double>(it->first) * 100 / total << "\t";
-                    uint16_t iwords[max_instruction_words];
-                    iwords[0] = mem.hack_peek_u16(it->second);
-                    for (int j = 1; j < instructions[iwords[0]].ilen; ++j)
-                    iwords[j] = mem.hack_peek_u16(it->second + j * 2);
-                    disasm(std::cout, it->second, iwords, max_instruction_words);
-                    std::cout << "\n";
-                }
-                auto it2 = reverse_insts.crbegin();
-                for (unsigned i = 0; i < 200 && it2 != reverse_insts.crend(); ++i, ++it2) {
-                    std::cout << it2->second << "\t" << std::setw(10) << static_cast<double>(it2->first) * 100 / total << "\n";
-                }
+                profiler_.show_report(std::cout, mem);
             }
         } else if (args[0] == "q") {
             quit = true;
@@ -1881,10 +2169,10 @@ void amiga::debugger_loop()
             if (args.size() == 1) {
                 cpu.show_state(std::cout);
             } else if (args.size() == 3) {
-                const auto [size, ptr] = get_register_address(args[1].c_str(), s);
+                const auto [size, ptr] = dbg_.get_register_address(args[1].c_str(), s);
                 if (size) {
                     assert((size == 2 || size == 4) && ptr);
-                    if (const auto [ok, val] = get_simple_expr(args[2]); ok) {
+                    if (const auto [ok, val] = dbg_.get_simple_expr(args[2]); ok) {
                         if (size == 2) {
                             if (val < 65536)
                                 *reinterpret_cast<uint16_t*>(const_cast<void*>(ptr)) = static_cast<uint16_t>(val);
@@ -1921,26 +2209,26 @@ void amiga::debugger_loop()
                 uint32_t start_address = 0;
                 uint32_t end_address = 1 << 24;
                 if (ok && args.size() > 2) {
-                    std::tie(ok, start_address) = get_simple_expr(args[2]);
+                    std::tie(ok, start_address) = dbg_.get_simple_expr(args[2]);
                     if (!ok)
                         std::cerr << "Invalid start address\n";
                 }
                 if (ok && args.size() > 3) {
-                    std::tie(ok, end_address) = get_simple_expr(args[3]);
+                    std::tie(ok, end_address) = dbg_.get_simple_expr(args[3]);
                     if (!ok)
                         std::cerr << "Invalid length\n";
                     end_address += start_address;
                 }
                 if (ok) {
                     unsigned match_count = 0;
-                    mem_search(mem.ram(), 0, needle, start_address, end_address, match_count);
+                    mem_search(mem.ram(), 0, needle, start_address, end_address, match_count, dbg_.ans);
                     if (slow_ram)
-                        mem_search(slow_ram->ram(), slow_base, needle, start_address, end_address, match_count);
+                        mem_search(slow_ram->ram(), slow_base, needle, start_address, end_address, match_count, dbg_.ans);
                     if (fast_ram)
-                        mem_search(fast_ram->ram(), fast_ram->base_address(), needle, start_address, end_address, match_count);
-                    mem_search(rom.rom(), 0xf80000, needle, start_address, end_address, match_count); // Meh, not correct but w/e
+                        mem_search(fast_ram->ram(), fast_ram->base_address(), needle, start_address, end_address, match_count, dbg_.ans);
+                    mem_search(rom.rom(), 0xf80000, needle, start_address, end_address, match_count, dbg_.ans); // Meh, not correct but w/e
                     if (!match_count)
-                        debugger_ans = 0xffffffff;
+                        dbg_.ans = 0xffffffff;
                 }
             } else {
                 std::cerr << "Missing arguments\n";
@@ -1948,7 +2236,7 @@ void amiga::debugger_loop()
         } else if (args[0] == "t") {
             wait_arg = ~0U;
             if (args.size() > 1) {
-                auto fh = get_simple_expr(args[1]);
+                auto fh = dbg_.get_simple_expr(args[1]);
                 if (fh.first && fh.second > 0) {
                     wait_arg = fh.second - 1;
                 } else {
@@ -1978,9 +2266,22 @@ void amiga::debugger_loop()
                 trace_file.reset();
                 debug_stream = &std::cout;
             }
+        } else if (args[0] == "trace_bin") {
+            if (bin_trace) {
+                std::cout << "Stopped binary trace (" << bin_trace->bytes_written() << " bytes)\n";
+                bin_trace.reset();
+            }
+            if (args.size() > 1) {
+                try {
+                    bin_trace = std::make_unique<cpu_trace_writer>(args[1]);
+                    std::cout << "Writing binary trace to \"" << args[1] << "\"\n";
+                } catch (const std::exception& e) {
+                    std::cout << e.what() << "\n";
+                }
+            }
         } else if (args[0] == "trace_flags") {
             if (args.size() > 1) {
-                auto fh = get_simple_expr(args[1]);
+                auto fh = dbg_.get_simple_expr(args[1]);
                 if (fh.first) {
                     debug_flags = fh.second;
                 } else {
@@ -2011,12 +2312,12 @@ void amiga::debugger_loop()
         } else if (args[0] == "v") {
             uint32_t v = 0, h = 0;
             if (args.size() > 1) {
-                auto vh = get_simple_expr(args[1]);
+                auto vh = dbg_.get_simple_expr(args[1]);
                 if (!vh.first || vh.second >= vpos_per_field)
                     goto vcmdinvalidargs;
                 v = vh.second;
                 if (args.size() > 2) {
-                    auto hh = get_simple_expr(args[2]);
+                    auto hh = dbg_.get_simple_expr(args[2]);
                     if (!hh.first || hh.second >= hpos_per_line / 2)
                         goto vcmdinvalidargs;
                     h = hh.second;
@@ -2093,7 +2394,7 @@ void amiga::debugger_loop()
             }
         } else if (args[0] == "w") {
             if (args.size() > 1) {
-                auto [nvalid, num] = get_simple_expr(args[1]);
+                auto [nvalid, num] = dbg_.get_simple_expr(args[1]);
                 if (!nvalid)
                     goto memwatch_invalid_args;
                 if (args.size() == 2) {
@@ -2108,8 +2409,8 @@ void amiga::debugger_loop()
                         std::cerr << "Too few arguments\n";
                         goto memwatch_invalid_args;
                     }
-                    auto [avalid, address] = get_simple_expr(args[2]);
-                    auto [svalid, size] = get_simple_expr(args[3]);
+                    auto [avalid, address] = dbg_.get_simple_expr(args[2]);
+                    auto [svalid, size] = dbg_.get_simple_expr(args[3]);
                     uint8_t flags = 0;
                     for (const char c : args[4]) {
                         if (c == 'r' || c == 'R')
@@ -2142,7 +2443,7 @@ void amiga::debugger_loop()
             }
         } else if (args[0] == "W") {
             if (args.size() > 2) {
-                auto [avalid, address] = get_simple_expr(args[1]);
+                auto [avalid, address] = dbg_.get_simple_expr(args[1]);
                 if (avalid) {
                     for (uint32_t i = 2; i < args.size(); ++i) {
                         const auto& a = args[i];
@@ -2157,7 +2458,7 @@ void amiga::debugger_loop()
                             std::cerr << "Invalid length for value \"" << a << "\n";
                             break;
                         }
-                        auto [dvalid, data] = get_simple_expr(args[i]);
+                        auto [dvalid, data] = dbg_.get_simple_expr(args[i]);
                         if (!dvalid) {
                             std::cerr << "Invalid value \"" << a << "\n";
                             break;
@@ -2188,7 +2489,7 @@ void amiga::debugger_loop()
             }
         } else if (args[0] == "wd") {
             if (args.size() > 1) {
-                if (auto [valid, arg] = get_simple_expr(args[1]); valid && ((arg == 0) || (arg == 1) || (arg == ~0U))) {
+                if (auto [valid, arg] = dbg_.get_simple_expr(args[1]); valid && ((arg == 0) || (arg == 1) || (arg == ~0U))) {
                     illegal_access_debug_mode = static_cast<int>(arg);
                 } else {
                     std::cerr << "Invalid argument to wd\n";
@@ -2208,6 +2509,25 @@ void amiga::debugger_loop()
                 std::cout << "break\n";
                 break;
             }
+        } else if (args[0] == "warp") {
+            bool enable = !warp_mode;
+            if (args.size() > 1) {
+                auto [valid, arg] = dbg_.get_simple_expr(args[1]);
+                if (!valid || arg > 1) {
+                    std::cerr << "Invalid argument to warp\n";
+                    continue;
+                }
+                enable = !!arg;
+            }
+            if (args.size() > 2) {
+                auto [valid, interval] = dbg_.get_simple_expr(args[2]);
+                if (!valid || !interval) {
+                    std::cerr << "Invalid interval\n";
+                    continue;
+                }
+                cmdline_args.warp_interval = interval;
+            }
+            set_warp_mode(enable);
         } else if (args[0] == "write_mem") {
             if (args.size() > 1) {
                 std::ofstream f(args[1], std::ofstream::binary);
@@ -2271,7 +2591,7 @@ void amiga::debugger_loop()
         } else if (args[0] == "zf") {
             // Wait for next frame(s)
             if (args.size() > 1) {
-                auto [valid, count] = get_simple_expr(args[1]);
+                auto [valid, count] = dbg_.get_simple_expr(args[1]);
                 if (valid) {
                     wait_mode = wait_frames;
                     wait_arg = count;
@@ -2300,11 +2620,11 @@ void amiga::debugger_loop()
             // Wait for video position
             if (args.size() > 1) {
                 uint32_t waitpos = 0;
-                auto vpos = get_simple_expr(args[1]);
+                auto vpos = dbg_.get_simple_expr(args[1]);
                 if (vpos.first && vpos.second <= 313) {
                     waitpos = vpos.second << 9;
                     if (args.size() > 2) {
-                        auto hpos = get_simple_expr(args[2]);
+                        auto hpos = dbg_.get_simple_expr(args[2]);
                         if (hpos.first && hpos.second < 455) {
                             waitpos |= hpos.second;
                         } else {
@@ -2327,10 +2647,10 @@ void amiga::debugger_loop()
             std::string expr = args[0].substr(1);
             for (size_t i = 1; i < args.size(); ++i)
                 expr += args[i];
-            const auto [valid, num] = get_simple_expr(expr);
+            const auto [valid, num] = dbg_.get_simple_expr(expr);
             if (valid) {
                 std::cout << "$" << hexfmt(num) << " = %" << binfmt(num) << " = " << num << "\n";
-                debugger_ans = num;
+                dbg_.ans = num;
             } else {
                 std::cout << "Invalid expression\n";
             }
@@ -2374,6 +2694,9 @@ void amiga::process_event(const gui::event& evt)
     case gui::event_type::debug_mode:
         activate_debugger();
         break;
+    case gui::event_type::warp_mode:
+        set_warp_mode(!warp_mode);
+        break;
     case gui::event_type::joystick: {
         cias.set_button_state(1, evt.joystick.button1);
         uint16_t dat = 0;
@@ -2401,7 +2724,7 @@ void amiga::insert_disk(uint8_t drive, const char* filename, int delay)
     if (*filename) {
         std::cout << "Reading " << filename << "\n";
         try {
-            disk = load_disk_file(filename);
+            disk = load_disk_file(filename, cmdline_args.floppy_image_options());
         } catch (const std::exception& e) {
             std::cerr << "Failed to read " << filename << ": " << e.what() << "\n";
             return;
@@ -2434,6 +2757,13 @@ void amiga::run()
     // If not loading from state ensure that custom chips have been "stepped" once
     if (!cpu.state().instruction_count)
         cstep(false);
+
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto start_cpu_cycles = cpu_cycles_count;
+    const auto start_chip_cycles = chip_cycles_count;
+    if (cmdline_args.benchmark_frames)
+        custom.set_timing(true);
+
     while (!quit) {
         try {
             step();
@@ -2447,6 +2777,14 @@ void amiga::run()
             activate_debugger();
         }
     }
+
+    if (interrupted)
+        throw std::runtime_error { "Interrupted" };
+
+    if (cmdline_args.benchmark_frames) {
+        const auto wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        benchmark_report(wall_time, cpu_cycles_count - start_cpu_cycles, chip_cycles_count - start_chip_cycles);
+    }
 }
 
 void amiga::step()
@@ -2467,12 +2805,19 @@ void amiga::step()
     cpu_step = cpu.step();
     cpu_active = false;
 
+    if (profiling_ && !cpu_step.stopped)
+        profiler_.on_instruction(cpu_step, cpu.state());
+
+    if (bin_trace && !cpu_step.stopped)
+        write_bin_trace();
+
     if (cpu_step.stopped) {
         do {
             cstep(false);
         } while (!custom.current_ipl() && !new_frame && !debug_mode);
     } else {
-        check_debug_break();
+        if (debug_break_armed()) [[unlikely]]
+            check_debug_break();
 
         if (cpu_step.instruction == reset_instruction_num)
             reset = cpu_reset;
@@ -2491,6 +2836,8 @@ void amiga::step()
     }
 
     if (new_frame) {
+        if (cmdline_args.benchmark_frames && ++benchmark_frames_done == cmdline_args.benchmark_frames)
+            quit = true;
         if (disk_chosen_countdown) {
             if (--disk_chosen_countdown == 0) {
                 std::cout << drives[pending_disk_drive]->name() << " Inserting disk\n";
@@ -2505,13 +2852,23 @@ void amiga::step()
     update:
         serial_data_flush();
         steps_to_update = steps_per_update;
+        if (const unsigned n = sigint_count; n != sigint_seen) {
+            sigint_seen = n;
+            ctrl_c = true;
+        }
         if (ctrl_c) {
             ctrl_c = false;
-            signal(SIGINT, &ctrl_c_handler);
-            activate_debugger();
+            if (cmdline_args.batch) {
+                interrupted = true;
+                quit = true;
+            } else {
+                signal(SIGINT, &ctrl_c_handler);
+                activate_debugger();
+            }
         }
         if (g) {
-            g->update_image(custom_step.frame);
+            if (field_rendered)
+                g->update_image(custom_step.frame);
             g->led_state(cias.power_led_on());
             auto new_events = g->update();
             events.insert(events.end(), new_events.begin(), new_events.end());
@@ -2519,29 +2876,191 @@ void amiga::step()
     }
 }
 
+// Patched ROM images shared by all machines in the process
+class rom_cache {
+public:
+    std::shared_ptr<const std::vector<uint8_t>> get(const std::string& filename)
+    {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        auto& r = roms_[filename];
+        if (!r)
+            r = std::make_shared<const std::vector<uint8_t>>(patch(read_file(filename)));
+        return r;
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<const std::vector<uint8_t>>> roms_;
+};
+
+void run_machine(command_line_arguments cmdline_args, rom_cache& roms)
+{
+    std::unique_ptr<state_file> state;
+    if (!cmdline_args.state_filename.empty()) {
+        state = std::make_unique<state_file>(state_file::dir::load, cmdline_args.state_filename);
+        cmdline_args.handle_state(*state);
+    }
+
+    amiga amiga_ { cmdline_args, roms.get(cmdline_args.rom) };
+    if (state)
+        amiga_.handle_machine_state(*state);
+
+    amiga_.run();
+}
+
+// Forwards output to the stream buffer selected by the current thread
+class thread_streambuf : public std::streambuf {
+public:
+    explicit thread_streambuf(std::streambuf* fallback)
+        : fallback_ { fallback }
+    {
+    }
+
+    static inline thread_local std::streambuf* target;
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+        return buf()->sputc(traits_type::to_char_type(ch));
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize count) override
+    {
+        return buf()->sputn(s, count);
+    }
+
+    int sync() override
+    {
+        return buf()->pubsync();
+    }
+
+private:
+    std::streambuf* fallback_;
+
+    std::streambuf* buf()
+    {
+        return target ? target : fallback_;
+    }
+};
+
+// Run each scenario (line of command line arguments) in the batch file as an independent machine
+int run_batch(const std::string& filename, unsigned num_threads)
+{
+    std::vector<std::string> scenarios;
+    {
+        std::ifstream in { filename };
+        if (!in)
+            throw std::runtime_error { "Could not open batch file " + filename };
+        for (std::string line; std::getline(in, line);) {
+            line = trim(line);
+            if (!line.empty() && line[0] != '#')
+                scenarios.push_back(line);
+        }
+    }
+
+    struct result {
+        bool ok = false;
+        bool run = false;
+        double seconds = 0;
+        std::string output;
+    };
+    std::vector<result> results(scenarios.size());
+    rom_cache roms;
+    std::atomic<size_t> next_scenario { 0 };
+
+    thread_streambuf cout_buf { std::cout.rdbuf() }, cerr_buf { std::cerr.rdbuf() };
+    auto old_cout = std::cout.rdbuf(&cout_buf);
+    auto old_cerr = std::cerr.rdbuf(&cerr_buf);
+
+    // Ctrl+C stops the running machines (see amiga::ctrl_c) and no new scenarios are started
+    const unsigned start_sigint_count = sigint_count;
+    signal(SIGINT, &batch_ctrl_c_handler);
+
+    auto worker = [&]() {
+        for (size_t idx; (idx = next_scenario++) < scenarios.size();) {
+            if (sigint_count != start_sigint_count)
+                break;
+            results[idx].run = true;
+            std::ostringstream out;
+            thread_streambuf::target = out.rdbuf();
+            const auto start = std::chrono::steady_clock::now();
+            try {
+                std::vector<std::string> args { "amiemu" };
+                for (const auto& a : split_line(scenarios[idx]))
+                    args.push_back(unquote(a));
+                std::vector<char*> argv;
+                for (auto& a : args)
+                    argv.push_back(a.data());
+                argv.push_back(nullptr);
+                auto cmdline_args = parse_command_line_arguments(static_cast<int>(args.size()), argv.data());
+                cmdline_args.test_mode = true;
+                cmdline_args.nosound = true;
+                cmdline_args.batch = true;
+                // Each scenario gets its own overlay deltas (<batch file>.overlay/N unless -overlaydir is given),
+                // so scenarios sharing a base image neither block nor see each other's modifications
+                cmdline_args.overlay_dir = (std::filesystem::path { cmdline_args.overlay_dir.empty() ? filename + ".overlay" : cmdline_args.overlay_dir } / std::to_string(idx + 1)).string();
+                run_machine(cmdline_args, roms);
+                results[idx].ok = true;
+            } catch (const std::exception& e) {
+                out << e.what() << "\n";
+            }
+            results[idx].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            thread_streambuf::target = nullptr;
+            results[idx].output = out.str();
+        }
+    };
+
+    num_threads = std::max(1U, std::min(num_threads, static_cast<unsigned>(scenarios.size())));
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+
+    std::cout.rdbuf(old_cout);
+    std::cerr.rdbuf(old_cerr);
+    signal(SIGINT, SIG_DFL);
+
+    unsigned num_failed = 0;
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        const auto& r = results[i];
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(3);
+        oss << "=== Scenario " << i + 1 << ": " << scenarios[i] << "\n";
+        oss << r.output;
+        if (r.run)
+            oss << (r.ok ? "OK" : "FAILED") << " (" << r.seconds << " s)\n";
+        else
+            oss << "SKIPPED (interrupted)\n";
+        std::cout << oss.str();
+        if (!r.ok)
+            ++num_failed;
+    }
+    std::cout << scenarios.size() - num_failed << "/" << scenarios.size() << " scenarios succeeded\n";
+    return num_failed ? 1 : 0;
+}
+
 int main(int argc, char* argv[])
 {
     try {
-        auto cmdline_args = parse_command_line_arguments(argc, argv);
-        std::unique_ptr<state_file> state;
-        if (!cmdline_args.state_filename.empty()) {
-            state = std::make_unique<state_file>(state_file::dir::load, cmdline_args.state_filename);
-            cmdline_args.handle_state(*state);
+        if (argc > 2 && !strcmp(argv[1], "-batch")) {
+            unsigned num_threads = std::thread::hardware_concurrency();
+            if (argc == 5 && !strcmp(argv[3], "-j"))
+                num_threads = static_cast<unsigned>(std::stoul(argv[4]));
+            else if (argc != 3)
+                usage("Invalid arguments for -batch");
+            return run_batch(argv[2], num_threads);
         }
 
-        signal(SIGINT, &ctrl_c_handler);
-
-        amiga amiga_ { cmdline_args };
-        if (state)
-            amiga_.handle_machine_state(*state);
+        auto cmdline_args = parse_command_line_arguments(argc, argv);
 
-        debugger_functions.push_back({ "get_u8", [&mem = amiga_.mem_handler()](uint32_t addr) -> uint32_t { return mem.read_u8(addr); } });
-        debugger_functions.push_back({ "get_u16", [&mem = amiga_.mem_handler()](uint32_t addr) -> uint32_t { return mem.read_u16(addr); } });
-        debugger_functions.push_back({ "get_u32", [&mem = amiga_.mem_handler()](uint32_t addr) -> uint32_t { return mem.read_u32(addr); } });
-        debugger_functions.push_back({ "extb", [](uint32_t val) { return sext(val, opsize::b); } });
-        debugger_functions.push_back({ "extw", [](uint32_t val) { return sext(val, opsize::w); } });
+        signal(SIGINT, &ctrl_c_handler);
 
-        amiga_.run();
+        rom_cache roms;
+        run_machine(cmdline_args, roms);
 
     } catch (const std::exception& e) {
         std::cerr << e.what() << "\n";
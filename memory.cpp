@@ -4,13 +4,14 @@
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
 
-static uint32_t warncnt;
-static bool memwarn()
+bool memory_handler::memwarn()
 {
     constexpr uint32_t maxwarn = 50;
-    if (warncnt < 50) {
-        if (++warncnt == maxwarn)
+    if (warncnt_ < 50) {
+        if (++warncnt_ == maxwarn)
             std::cerr << "[MEM] Maximum warnings reached.\n";
         return true;
     }
@@ -20,7 +21,7 @@ static bool memwarn()
 uint8_t default_handler::read_u8(uint32_t addr, uint32_t)
 {
     // Don't warn a bunch when scanning for ROM tags / I/O space
-    if (addr < 0xf00000 && memwarn())
+    if (addr < 0xf00000 && mem_handler_.memwarn())
         std::cerr << "[MEM] Unhandled byte read from $" << hexfmt(addr) << "\n";
     mem_handler_.signal_illegal_access(addr, 0, 1, false);
     //return 0xff;
@@ -29,7 +30,7 @@ uint8_t default_handler::read_u8(uint32_t addr, uint32_t)
 uint16_t default_handler::read_u16(uint32_t addr, uint32_t)
 {
     // Don't warn a bunch when scanning for ROM tags / I/O space
-    if (addr < 0xf00000 && memwarn())
+    if (addr < 0xf00000 && mem_handler_.memwarn())
         std::cerr << "[MEM] Unhandled word read from $" << hexfmt(addr) << "\n";
     mem_handler_.signal_illegal_access(addr, 0, 2, false);
     //return 0xffff;
@@ -37,13 +38,13 @@ uint16_t default_handler::read_u16(uint32_t addr, uint32_t)
 }
 void default_handler::write_u8(uint32_t addr, uint32_t, uint8_t val)
 {
-    if (memwarn())
+    if (mem_handler_.memwarn())
         std::cerr << "[MEM] Unhandled write to $" << hexfmt(addr) << " val $" << hexfmt(val) << "\n";
     mem_handler_.signal_illegal_access(addr, val, 1, false);
 }
 void default_handler::write_u16(uint32_t addr, uint32_t, uint16_t val)
 {
-    if (memwarn())
+    if (mem_handler_.memwarn())
         std::cerr << "[MEM] Unhandled write to $" << hexfmt(addr) << " val $" << hexfmt(val) << "\n";
     mem_handler_.signal_illegal_access(addr, val, 2, false);
 }
@@ -114,8 +115,14 @@ memory_handler::memory_handler(uint32_t ram_size)
 }
 
 rom_area_handler::rom_area_handler(memory_handler& mem_handler, std::vector<uint8_t>&& data)
+    : rom_area_handler { mem_handler, std::make_shared<const std::vector<uint8_t>>(std::move(data)) }
+{
+}
+
+rom_area_handler::rom_area_handler(memory_handler& mem_handler, const std::shared_ptr<const std::vector<uint8_t>>& data)
     : mem_handler_ { mem_handler }
-    , rom_data_ { std::move(data) }
+    , rom_ptr_ { data }
+    , rom_data_ { *rom_ptr_ }
 {
     const auto size = static_cast<uint32_t>(rom_data_.size());
     if (size != 64 * 1024 && size != 256 * 1024 && size != 512 * 1024 && size != 1024 * 1024) {
@@ -174,7 +181,7 @@ void rom_area_handler::write_u8(uint32_t addr, uint32_t offset, uint8_t val)
         wom_[offset] = val;
         return;
     }
-    if (memwarn())
+    if (mem_handler_.memwarn())
         std::cerr << "[MEM] Write to rom area: " << hexfmt(addr) << " offset " << hexfmt(offset) << " val = $" << hexfmt(val) << "\n";
     mem_handler_.signal_illegal_access(addr, val, 1, false);
     //throw std::runtime_error { "Write to ROM" };
@@ -186,7 +193,7 @@ void rom_area_handler::write_u16(uint32_t addr, uint32_t offset, uint16_t val)
         put_u16(&wom_[offset], val);
         return;
     }
-    if (memwarn())
+    if (mem_handler_.memwarn())
         std::cerr << "[MEM] Write to rom area: " << hexfmt(addr) << " offset " << hexfmt(offset) << " val = $" << hexfmt(val) << "\n";
     mem_handler_.signal_illegal_access(addr, val, 2, false);
     //throw std::runtime_error { "Write to ROM" };
@@ -268,6 +275,58 @@ void memory_handler::write_u32(uint32_t addr, uint32_t val)
     write_u16(addr  + 2, static_cast<uint16_t>(val));
 }
 
+// Returns pointer to as much as possible (up to len bytes) of directly accessible memory at addr, and updates len
+uint8_t* memory_handler::direct_access(uint32_t addr, uint32_t& len)
+{
+    assert(addr < 0x1000000 && len);
+    uint32_t end = 0x1000000;
+    for (const auto& a : areas_) {
+        if (a.base > addr)
+            end = std::min(end, a.base);
+    }
+    const uint32_t orig_addr = addr;
+    auto& a = find_area(addr);
+    if (&a == &def_area_)
+        return nullptr;
+    end = std::min(end, orig_addr + (a.base + a.len - addr));
+    len = std::min(len, end - orig_addr);
+    return a.handler->direct_access(addr - a.base, len);
+}
+
+void memory_handler::read_block(uint32_t addr, uint8_t* dest, uint32_t len)
+{
+    while (len) {
+        addr &= 0xffffff;
+        uint32_t chunk = len;
+        if (const uint8_t* p = direct_access(addr, chunk)) {
+            std::memcpy(dest, p, chunk);
+        } else {
+            chunk = 1;
+            *dest = read_u8(addr);
+        }
+        addr += chunk;
+        dest += chunk;
+        len -= chunk;
+    }
+}
+
+void memory_handler::write_block(uint32_t addr, const uint8_t* src, uint32_t len)
+{
+    while (len) {
+        addr &= 0xffffff;
+        uint32_t chunk = len;
+        if (uint8_t* p = direct_access(addr, chunk)) {
+            std::memcpy(p, src, chunk);
+        } else {
+            chunk = 1;
+            write_u8(addr, *src);
+        }
+        addr += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+}
+
 memory_handler::area& memory_handler::find_area(uint32_t& addr)
 {
     assert(addr < 0x1000000);
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <vector>
+#include <memory>
 #include <functional>
 #include <cassert>
 
@@ -25,6 +26,11 @@ constexpr uint32_t get_u32(const uint8_t* d)
     return static_cast<uint32_t>(d[0]) << 24 | d[1] << 16 | d[2] << 8 | d[3];
 }
 
+constexpr uint64_t get_u64(const uint8_t* d)
+{
+    return static_cast<uint64_t>(get_u32(d)) << 32 | get_u32(d + 4);
+}
+
 constexpr void put_u16(uint8_t* d, uint16_t val)
 {
     d[0] = static_cast<uint8_t>(val >> 8);
@@ -39,6 +45,12 @@ constexpr void put_u32(uint8_t* d, uint32_t val)
     d[3] = static_cast<uint8_t>(val);
 }
 
+constexpr void put_u64(uint8_t* d, uint64_t val)
+{
+    put_u32(d, static_cast<uint32_t>(val >> 32));
+    put_u32(d + 4, static_cast<uint32_t>(val));
+}
+
 class memory_area_handler {
 public:
     virtual uint8_t read_u8(uint32_t addr, uint32_t offset) = 0;
@@ -46,6 +58,14 @@ public:
     virtual void write_u8(uint32_t addr, uint32_t offset, uint8_t val) = 0;
     virtual void write_u16(uint32_t addr, uint32_t offset, uint16_t val) = 0;
 
+    // Pointer to len bytes of plain memory starting at offset (for block transfers), nullptr if not possible
+    virtual uint8_t* direct_access(uint32_t offset, uint32_t len)
+    {
+        (void)offset;
+        (void)len;
+        return nullptr;
+    }
+
     virtual void reset() = 0;
 };
 
@@ -79,6 +99,10 @@ public:
     uint16_t read_u16(uint32_t, uint32_t offset) override;
     void write_u8(uint32_t, uint32_t offset, uint8_t val) override;
     void write_u16(uint32_t, uint32_t offset, uint16_t val) override;
+    uint8_t* direct_access(uint32_t offset, uint32_t len) override
+    {
+        return offset <= ram_.size() && len <= ram_.size() - offset ? &ram_[offset] : nullptr;
+    }
     void reset() override { }
     void handle_state(state_file& sf);
 
@@ -89,6 +113,8 @@ private:
 class rom_area_handler : public memory_area_handler {
 public:
     explicit rom_area_handler(memory_handler& mem_handler, std::vector<uint8_t>&& data);
+    // The ROM data is never modified, so it can be shared between several machines
+    explicit rom_area_handler(memory_handler& mem_handler, const std::shared_ptr<const std::vector<uint8_t>>& data);
 
     const std::vector<uint8_t>& rom() const
     {
@@ -107,7 +133,8 @@ public:
 
 private:
     memory_handler& mem_handler_;
-    std::vector<uint8_t> rom_data_;
+    std::shared_ptr<const std::vector<uint8_t>> rom_ptr_;
+    const std::vector<uint8_t>& rom_data_;
     std::vector<uint8_t> wom_;
     bool ovl_ = false;
     bool write_protect_ = false;
@@ -152,6 +179,11 @@ public:
     void write_u16(uint32_t addr, uint16_t val);
     void write_u32(uint32_t addr, uint32_t val);
 
+    // Block transfers (e.g. for harddisk DMA). RAM is accessed directly without going through the memory interceptor,
+    // other areas fall back to byte accesses.
+    void read_block(uint32_t addr, uint8_t* dest, uint32_t len);
+    void write_block(uint32_t addr, const uint8_t* src, uint32_t len);
+
     void reset();
     void handle_state(state_file& sf);
 
@@ -161,6 +193,9 @@ public:
             illegal_access_handler_(addr, data, size, write);
     }
 
+    // Returns true if a warning about an unhandled access should be shown (limits the number of warnings)
+    bool memwarn();
+
 private:
     struct area {
         uint32_t base;
@@ -174,8 +209,10 @@ private:
     area ram_area_;
     memory_interceptor memory_interceptor_;
     memory_interceptor illegal_access_handler_;
+    uint32_t warncnt_ = 0;
 
     area& find_area(uint32_t& addr);
+    uint8_t* direct_access(uint32_t addr, uint32_t& len);
     void track(uint32_t addr, uint32_t data, uint8_t size, bool write)
     {
         if (memory_interceptor_)
@@ -8,6 +8,7 @@
 #include <iomanip>
 #include <fstream>
 #include <memory>
+#include <map>
 #include <cstring>
 #include "ioutil.h"
 
@@ -1169,18 +1170,8 @@ int main(int argc, char* argv[])
         #endif
     }
 
-    std::unique_ptr<std::ofstream> of;
-    if (argc > 1) {
-        of = std::make_unique<std::ofstream>(argv[1]);
-        if (!*of || !of->is_open()) {
-            std::cerr << "Error creating " << argv[1] << "\n";
-            return 1;
-        }
-    }
-
-
-    std::ostream& out = of ? *of : std::cout;
-
+    std::vector<std::string> names;
+    std::map<std::string, unsigned> name_index;
     for (unsigned i = 0; i < 65536; ++i) {
         auto& ai = all_instructions[i];
 #ifdef DEBUG_BREAK_INST
@@ -1199,14 +1190,51 @@ int main(int argc, char* argv[])
             ai.memory_accesses = 1 + ai.ea_words;
             ai.base_cycles = 4 * ai.memory_accesses;
         }
+        if (name_index.insert({ ai.name, static_cast<unsigned>(names.size()) }).second)
+            names.push_back(ai.name);
+    }
+    // Indices must fit in instruction_name_index
+    if (names.size() > 256) {
+        std::cerr << "Too many instruction names (" << names.size() << ") for 8-bit name index\n";
+        return 1;
+    }
 
-        auto n = "\"" + ai.name + "\"";
+    std::unique_ptr<std::ofstream> of;
+    if (argc > 1) {
+        of = std::make_unique<std::ofstream>(argv[1]);
+        if (!*of || !of->is_open()) {
+            std::cerr << "Error creating " << argv[1] << "\n";
+            return 1;
+        }
+    }
+
+
+    std::ostream& out = of ? *of : std::cout;
+
+    out << "const char* const instruction_names[" << names.size() << "] = {\n";
+    for (const auto& n : names)
+        out << "    \"" << n << "\",\n";
+    out << "};\n\n";
+
+    out << "const uint8_t instruction_name_index[65536] = {\n";
+    for (unsigned i = 0; i < 65536; i += 16) {
+        out << "/* " << hexfmt(static_cast<uint16_t>(i)) << " */";
+        for (unsigned j = 0; j < 16; ++j)
+            out << " " << std::right << std::setw(3) << name_index[all_instructions[i + j].name] << ",";
+        out << "\n";
+    }
+    out << "};\n\n";
+
+    out << "const instruction instructions[65536] = {\n";
+    for (unsigned i = 0; i < 65536; ++i) {
+        const auto& ai = all_instructions[i];
         out << "/* " << hexfmt(static_cast<uint16_t>(i)) << " */ { ";
-        out << "inst_type::" << std::left << std::setw(10) << ai.type << ", " << std::left << std::setw(12) << n << ", opsize::" << std::left << std::setw(5) << ai.osize << ", ";
+        out << "inst_type::" << std::left << std::setw(10) << ai.type << ", opsize::" << std::left << std::setw(5) << ai.osize << ", ";
         out << (1+ai.ea_words) << ", " << static_cast<int>(ai.nea);
         out << ", { 0x" << hexfmt(ai.ea[0]) << ", 0x" << hexfmt(ai.ea[1]) << "}, ";
         out << "0x" << hexfmt(ai.data) << ", 0x" << hexfmt(ai.extra);
         //out << ", 0x" << hexfmt(ai.base_cycles) << ", 0x" << hexfmt(ai.memory_accesses);
-        out << " },\n";
+        out << " }, // " << ai.name << "\n";
     }
+    out << "};\n";
 }
@@ -0,0 +1,215 @@
+#include "profiler.h"
+#include "instruction.h"
+#include "disasm.h"
+#include "memory.h"
+#include "ioutil.h"
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <map>
+
+namespace {
+
+constexpr unsigned report_lines = 200;
+
+} // unnamed namespace
+
+profiler::profiler()
+    : pages_ { std::make_unique<std::unique_ptr<uint32_t[]>[]>(num_pages) }
+{
+    reset();
+}
+
+profiler::~profiler() = default;
+
+void profiler::reset()
+{
+    for (uint32_t i = 0; i < num_pages; ++i)
+        pages_[i].reset();
+    nodes_.clear();
+    nodes_.push_back({ 0, 0, 0 });
+    children_.clear();
+    stack_.clear();
+    overflow_ = 0;
+    total_samples_ = 0;
+}
+
+void profiler::push(uint32_t func, uint32_t sp, bool exception)
+{
+    if (stack_.size() >= max_depth) {
+        ++overflow_;
+        return;
+    }
+    const auto parent = current_node();
+    const auto key = static_cast<uint64_t>(parent) << 32 | func;
+    auto it = children_.find(key);
+    if (it == children_.end()) {
+        it = children_.insert({ key, static_cast<uint32_t>(nodes_.size()) }).first;
+        nodes_.push_back({ parent, func, 0 });
+    }
+    stack_.push_back({ it->second, sp, exception });
+}
+
+void profiler::on_instruction(const m68000::step_result& res, const cpu_state& state)
+{
+    const uint32_t sp = state.A(7);
+
+    // Note: check exception first, the instruction isn't valid if an interrupt was taken before it executed
+    if (res.exception) {
+        push(res.current_pc, sp, true);
+        return;
+    }
+
+    switch (instructions[res.instruction].type) {
+    case inst_type::BSR:
+    case inst_type::JSR:
+        push(res.current_pc, sp, false);
+        break;
+    case inst_type::RTS:
+    case inst_type::RTR:
+        if (overflow_) {
+            --overflow_;
+            break;
+        }
+        // Unwind all call frames whose return address is now above the stack pointer (normally just one)
+        while (!stack_.empty() && !stack_.back().exception && stack_.back().sp < sp)
+            stack_.pop_back();
+        break;
+    case inst_type::RTE:
+        if (overflow_) {
+            --overflow_;
+            break;
+        }
+        // Unwind up to and including the most recent exception frame
+        while (!stack_.empty()) {
+            const bool exception = stack_.back().exception;
+            stack_.pop_back();
+            if (exception)
+                break;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void profiler::add_symbol(uint32_t start, uint32_t size, const std::string& name)
+{
+    if (!size)
+        return;
+    // Memory may be reused (e.g. after UnLoadSeg), so drop any overlapping symbols
+    symbols_.erase(std::remove_if(symbols_.begin(), symbols_.end(), [&](const symbol& s) {
+        return s.start < start + size && start < s.start + s.size;
+    }), symbols_.end());
+    auto it = std::upper_bound(symbols_.begin(), symbols_.end(), start, [](uint32_t addr, const symbol& s) { return addr < s.start; });
+    symbols_.insert(it, symbol { start, size, name });
+}
+
+std::string profiler::symbol_name(uint32_t addr) const
+{
+    auto it = std::upper_bound(symbols_.begin(), symbols_.end(), addr, [](uint32_t a, const symbol& s) { return a < s.start; });
+    if (it != symbols_.begin()) {
+        --it;
+        if (addr - it->start < it->size)
+            return addr == it->start ? it->name : it->name + "+$" + hexstring(addr - it->start);
+    }
+    return "$" + hexstring(addr);
+}
+
+std::string profiler::path_string(uint32_t n) const
+{
+    if (!n)
+        return "[root]";
+    std::vector<uint32_t> path;
+    for (; n; n = nodes_[n].parent)
+        path.push_back(n);
+    std::string res;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        if (!res.empty())
+            res += ';';
+        res += symbol_name(nodes_[*it].func);
+    }
+    return res;
+}
+
+void profiler::show_report(std::ostream& os, memory_handler& mem) const
+{
+    if (!total_samples_) {
+        os << "No samples\n";
+        return;
+    }
+
+    const double total = static_cast<double>(total_samples_);
+
+    // Flat profile by address
+    std::vector<std::pair<uint32_t, uint32_t>> addrs; // count, address
+    std::map<std::string, uint64_t> insts;
+    for (uint32_t p = 0; p < num_pages; ++p) {
+        if (!pages_[p])
+            continue;
+        for (uint32_t i = 0; i < page_entries; ++i) {
+            if (const auto cnt = pages_[p][i]; cnt) {
+                const uint32_t addr = p << page_shift | i << 1;
+                addrs.push_back({ cnt, addr });
+                insts[instruction_name(mem.hack_peek_u16(addr))] += cnt;
+            }
+        }
+    }
+    const auto naddrs = std::min<size_t>(report_lines, addrs.size());
+    std::partial_sort(addrs.begin(), addrs.begin() + naddrs, addrs.end(), std::greater<> {});
+    for (size_t i = 0; i < naddrs; ++i) {
+        const auto [cnt, addr] = addrs[i];
+        os << hexfmt(addr) << " " << std::setw(10) << cnt * 100 / total << "\t";
+        uint16_t iwords[max_instruction_words];
+        iwords[0] = mem.hack_peek_u16(addr);
+        for (int j = 1; j < instructions[iwords[0]].ilen; ++j)
+            iwords[j] = mem.hack_peek_u16(addr + j * 2);
+        disasm(os, addr, iwords, max_instruction_words);
+        os << "\t; " << symbol_name(addr) << "\n";
+    }
+
+    // By instruction
+    std::vector<std::pair<uint64_t, std::string>> inst_list;
+    for (const auto& [name, cnt] : insts)
+        inst_list.push_back({ cnt, name });
+    std::sort(inst_list.begin(), inst_list.end(), std::greater<> {});
+    for (size_t i = 0; i < inst_list.size() && i < report_lines; ++i)
+        os << inst_list[i].second << "\t" << std::setw(10) << inst_list[i].first * 100 / total << "\n";
+
+    // By function (self = samples where it's the innermost function, inclusive = samples where it's on the call stack)
+    std::map<uint32_t, std::pair<uint64_t, uint64_t>> funcs;
+    std::vector<uint32_t> seen;
+    for (uint32_t n = 1; n < nodes_.size(); ++n) {
+        const auto samples = nodes_[n].samples;
+        if (!samples)
+            continue;
+        funcs[nodes_[n].func].first += samples;
+        seen.clear();
+        for (uint32_t a = n; a; a = nodes_[a].parent) {
+            if (std::find(seen.begin(), seen.end(), nodes_[a].func) != seen.end())
+                continue; // Recursion
+            seen.push_back(nodes_[a].func);
+            funcs[nodes_[a].func].second += samples;
+        }
+    }
+    std::vector<std::pair<std::pair<uint64_t, uint64_t>, uint32_t>> func_list;
+    for (const auto& [func, cnt] : funcs)
+        func_list.push_back({ cnt, func });
+    std::sort(func_list.begin(), func_list.end(), std::greater<> {});
+    os << "Self       Inclusive  Function\n";
+    for (size_t i = 0; i < func_list.size() && i < report_lines; ++i) {
+        const auto& [cnt, func] = func_list[i];
+        os << std::setw(10) << cnt.first * 100 / total << " " << std::setw(10) << cnt.second * 100 / total << " " << symbol_name(func) << "\n";
+    }
+    if (nodes_[0].samples)
+        os << std::setw(10) << nodes_[0].samples * 100 / total << " (outside any known function)\n";
+}
+
+void profiler::write_collapsed_stacks(std::ostream& os) const
+{
+    for (uint32_t n = 0; n < nodes_.size(); ++n) {
+        if (nodes_[n].samples)
+            os << path_string(n) << " " << nodes_[n].samples << "\n";
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <iosfwd>
+#include "cpu.h"
+
+class memory_handler;
+
+// Sampling profiler. Samples are recorded per (word) address in a sparse flat array covering the 24-bit
+// address space, and per call path in a call tree maintained from a shadow call stack (JSR/BSR/RTS/RTR/RTE
+// and exceptions). The shadow stack is a heuristic: frames are unwound based on the stack pointer, so
+// non-local exits are handled, but task switches in user mode aren't tracked.
+class profiler {
+public:
+    profiler();
+    ~profiler();
+
+    // Clear all samples (known symbols are kept)
+    void reset();
+
+    void sample(uint32_t pc)
+    {
+        auto& page = pages_[(pc >> page_shift) & (num_pages - 1)];
+        if (!page)
+            page = std::make_unique<uint32_t[]>(page_entries);
+        ++page[(pc & page_mask) >> 1];
+        ++nodes_[current_node()].samples;
+        ++total_samples_;
+    }
+
+    // Update shadow call stack (call after each CPU step)
+    void on_instruction(const m68000::step_result& res, const cpu_state& state);
+
+    // Add symbol for address range (e.g. a hunk from LoadSeg), replaces any overlapping symbols
+    void add_symbol(uint32_t start, uint32_t size, const std::string& name);
+
+    void show_report(std::ostream& os, memory_handler& mem) const;
+    // Write call stacks in "collapsed" format (suitable for flamegraph.pl)
+    void write_collapsed_stacks(std::ostream& os) const;
+
+private:
+    static constexpr uint32_t page_shift = 12;
+    static constexpr uint32_t page_mask = (1 << page_shift) - 1;
+    static constexpr uint32_t page_entries = 1 << (page_shift - 1); // One counter per word
+    static constexpr uint32_t num_pages = 1 << (24 - page_shift);
+    static constexpr uint32_t max_depth = 256;
+
+    struct node {
+        uint32_t parent;
+        uint32_t func;
+        uint64_t samples;
+    };
+    struct frame {
+        uint32_t node;
+        uint32_t sp;
+        bool exception;
+    };
+    struct symbol {
+        uint32_t start;
+        uint32_t size;
+        std::string name;
+    };
+
+    std::unique_ptr<std::unique_ptr<uint32_t[]>[]> pages_;
+    std::vector<node> nodes_; // Call tree, node 0 is the root
+    std::unordered_map<uint64_t, uint32_t> children_; // (parent << 32 | func) -> node
+    std::vector<frame> stack_;
+    uint32_t overflow_ = 0; // Calls not pushed because the maximum depth was reached
+    uint64_t total_samples_ = 0;
+    std::vector<symbol> symbols_; // Sorted by start address
+
+    uint32_t current_node() const
+    {
+        return stack_.empty() ? 0 : stack_.back().node;
+    }
+    void push(uint32_t func, uint32_t sp, bool exception);
+    std::string symbol_name(uint32_t addr) const;
+    std::string path_string(uint32_t node) const;
+};
+
+#endif
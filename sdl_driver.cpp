@@ -159,6 +159,10 @@ public:
             case SDL_QUIT:
                 return { event { event_type::quit, {} } };
             case SDL_KEYDOWN:
+                if (e.key.keysym.sym == SDLK_F11) {
+                    events.push_back(event { event_type::warp_mode, {} });
+                    break;
+                }
                 if (e.key.keysym.sym == SDLK_F12) {
                     const uint8_t* keystate = SDL_GetKeyboardState(nullptr);
                     if (keystate[SDL_SCANCODE_LSHIFT] || keystate[SDL_SCANCODE_RSHIFT]) {
@@ -91,10 +91,17 @@ public:
 
     void handle(std::vector<std::string>& vec)
     {
-        if (dir_ == dir::save)
-            put_vector(marker_vec_string, vec);
-        else
-            get_vector(marker_vec_string, vec);
+        if (dir_ == dir::save) {
+            put_u32(marker_vec_string);
+            put_u32(static_cast<uint32_t>(vec.size()));
+            for (const auto& s : vec)
+                put_string(s);
+        } else {
+            expect_marker(marker_vec_string);
+            vec.resize(get_u32());
+            for (auto& s : vec)
+                s = get_string();
+        }
     }
 
     void handle(std::vector<uint8_t>& vec)
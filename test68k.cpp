@@ -1,7 +1,12 @@
 #include "test68k.h"
 #include <iostream>
+#include <sstream>
 #include <filesystem>
 #include <cstring>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include "ioutil.h"
 #include "cpu.h"
 #include "memory.h"
@@ -474,11 +479,12 @@ struct memwrite_info {
 constexpr uint32_t low_memory = 0x00000000;
 constexpr uint32_t high_memory = 0xffff8000;
 
-winuae_test_header test_header;
+// Mnemonic directories are tested concurrently, so the state of the current test is per thread
+thread_local winuae_test_header test_header;
+thread_local std::vector<uint8_t>* testram;
+thread_local std::vector<memwrite_info> memwrite_restore_list;
 std::vector<uint8_t> test_lowmem;
 std::vector<uint8_t> test_testmem;
-std::vector<uint8_t>* testram;
-std::vector<memwrite_info> memwrite_restore_list;
 bool debug_winuae_tests = false;
 
 void sized_write(uint32_t addr, uint32_t val, int size)
@@ -800,7 +806,7 @@ void validate_test(winuae_test_file& tf, const cpu_state& after, winuae_test_sta
     // TODO: Check cycles
 }
 
-bool run_winuae_mnemonic_test(const fs::path& dir)
+bool run_winuae_mnemonic_test(const fs::path& dir, std::ostream& out)
 {
     test_header = read_winuae_test_header(dir);
     assert(test_header.test_low_memory_end < test_header.test_memory_addr);
@@ -808,7 +814,7 @@ bool run_winuae_mnemonic_test(const fs::path& dir)
     assert(test_header.test_memory_size == test_testmem.size());
     assert(test_header.opcode_memory_addr >= test_header.test_memory_addr && test_header.opcode_memory_addr < test_header.test_memory_addr + test_header.test_memory_size);
 
-    std::cout << "Testing " << test_header.inst_name << " from dir " << dir.filename() << "\n";
+    out << "Testing " << test_header.inst_name << " from dir " << dir.filename() << "\n";
 
     memory_handler mem { test_header.test_memory_addr + test_header.test_memory_size };
     auto& ram = mem.ram();
@@ -901,19 +907,19 @@ bool run_winuae_mnemonic_test(const fs::path& dir)
                         cpu.step();
                         validate_test(test_file, cpu.state(), check_state);
                     } catch (const std::exception& e) {
-                        std::cerr << "Test failed after " << test_count << " tests\n";
-                        std::cerr << "\n\nInput state:\n";
-                        print_cpu_state(std::cerr, input_state);
+                        out << "Test failed after " << test_count << " tests\n";
+                        out << "\n\nInput state:\n";
+                        print_cpu_state(out, input_state);
                         std::vector<uint16_t> iwords;
                         for (uint32_t addr = cur_state.pc; addr < cur_state.endpc + 4 /*HACK*/; addr += 2) {
                             iwords.push_back(get_u16(&ram[addr]));
                         }
 
-                        disasm(std::cerr, cur_state.pc, &iwords[0], iwords.size());
-                        std::cerr << "\n";
-                        std::cerr << "\n\nActual state:\n";
-                        print_cpu_state(std::cerr, cpu.state());
-                        std::cerr << "\n\n" << e.what() << "\n\n";
+                        disasm(out, cur_state.pc, &iwords[0], iwords.size());
+                        out << "\n";
+                        out << "\n\nActual state:\n";
+                        print_cpu_state(out, cpu.state());
+                        out << "\n\n" << e.what() << "\n\n";
                         return false;
                     }
                     ++test_count;
@@ -936,15 +942,13 @@ bool run_winuae_mnemonic_test(const fs::path& dir)
     return true;
 }
 
-bool run_winuae_tests()
+bool run_winuae_tests(const fs::path& basedir, unsigned num_threads)
 {
-    const fs::path basedir = R"(c:\dev\WinUAE\od-win32\winuae_msvc15\Release\data\68000_Basic\)";
-
-    test_lowmem = read_file((basedir/"lmem.dat").string());
+    test_lowmem = read_file((basedir / "lmem.dat").string());
     test_testmem = read_file((basedir / "tmem.dat").string());
 
     //debug_winuae_tests = true;
-    //run_winuae_mnemonic_test(basedir / "ABCD.B");
+    //run_winuae_mnemonic_test(basedir / "ABCD.B", std::cout);
     //assert(0);
 
     const std::vector<const char*> skip = {
@@ -953,17 +957,68 @@ bool run_winuae_tests()
         // Not implemented
         "RESET",
     };
-    std::vector<std::string> failed;
-    int errors = 0;
+
+    struct mnemonic_test {
+        fs::path dir;
+        uintmax_t size;
+        std::ostringstream output;
+        std::exception_ptr error;
+        bool ok;
+    };
+    std::vector<mnemonic_test> tests;
+    std::vector<std::string> skipped;
     for (auto& p : fs::directory_iterator(basedir)) {
         if (!p.is_directory())
             continue;
         if (auto it = std::find(skip.begin(), skip.end(), p.path().stem().string()); it != skip.end()) {
-            std::cout << "SKIPPING " << p.path().stem().string() << "\n";
+            skipped.push_back(p.path().stem().string());
             continue;
         }
-        if (!run_winuae_mnemonic_test(basedir / p)) {
-            failed.push_back(p.path().filename().string());
+        uintmax_t size = 0;
+        for (auto& f : fs::directory_iterator(p.path()))
+            size += f.is_regular_file() ? f.file_size() : 0;
+        tests.push_back(mnemonic_test { p.path(), size, {}, nullptr, false });
+    }
+    // Report in a fixed order regardless of directory iteration order and scheduling
+    std::sort(skipped.begin(), skipped.end());
+    std::sort(tests.begin(), tests.end(), [](const auto& l, const auto& r) { return l.dir.filename() < r.dir.filename(); });
+    for (const auto& s : skipped)
+        std::cout << "SKIPPING " << s << "\n";
+
+    // Hand out the largest directories first so a long test isn't started last
+    std::vector<size_t> order(tests.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&tests](size_t l, size_t r) { return tests[l].size > tests[r].size; });
+
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1)) < order.size();) {
+            auto& t = tests[order[i]];
+            try {
+                t.ok = run_winuae_mnemonic_test(t.dir, t.output);
+            } catch (...) {
+                t.error = std::current_exception();
+            }
+        }
+    };
+
+    num_threads = std::max(1U, std::min<unsigned>(num_threads, static_cast<unsigned>(tests.size())));
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+
+    std::vector<std::string> failed;
+    int errors = 0;
+    for (const auto& t : tests) {
+        std::cout << t.output.str();
+        if (t.error)
+            std::rethrow_exception(t.error);
+        if (!t.ok) {
+            failed.push_back(t.dir.filename().string());
             ++errors;
         }
     }
@@ -1153,8 +1208,29 @@ bool run_simple_tests()
     return true;
 }
 
-int main()
+void usage(const char* progname)
+{
+    std::cerr << "Usage: " << progname << " [-winuae data-dir] [-j threads]\n";
+    std::cerr << "  -winuae data-dir  Run the WinUAE cputester tests in data-dir (e.g. data/68000_Basic)\n";
+    std::cerr << "  -j threads        Number of threads for the WinUAE tests (default: number of cores)\n";
+}
+
+int main(int argc, char* argv[])
 {
+    fs::path winuae_dir;
+    unsigned num_threads = std::max(1U, std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-winuae") && i + 1 < argc) {
+            winuae_dir = argv[++i];
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            num_threads = static_cast<unsigned>(std::max(1, atoi(argv[++i])));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
     try {
         if (!test_state_file())
             return 1;
@@ -1165,7 +1241,9 @@ int main()
         if (!test_timing())
             return 1;
 
-        if (!run_winuae_tests())
+        if (winuae_dir.empty())
+            std::cout << "No WinUAE test data directory given, skipping WinUAE tests\n";
+        else if (!run_winuae_tests(winuae_dir, num_threads))
             return 1;
 
         if (!run_tests())
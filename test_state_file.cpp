@@ -11,7 +11,7 @@ struct test_state1 {
         uint32_t y;
     } blob;
     uint32_t num;
-
+    std::vector<std::string> strs;
 
     void handle_state(state_file& sf)
     {
@@ -20,12 +20,13 @@ struct test_state1 {
         sf.handle(data);
         sf.handle_blob(&blob, sizeof(blob));
         sf.handle(num);
+        sf.handle(strs);
     }
 };
 
 bool test_state_file()
 {
-    test_state1 src_state1 { "test string", { 1, 2, 4, 5, 6, 7 }, { 0x12345678, 0x9abcdef }, 0x42424141 };
+    test_state1 src_state1 { "test string", { 1, 2, 4, 5, 6, 7 }, { 0x12345678, 0x9abcdef }, 0x42424141, { "first", "", "third string" } };
     {
         state_file sf { state_file::dir::save, "test.state" };
         src_state1.handle_state(sf);
@@ -35,7 +36,7 @@ bool test_state_file()
         test_state1 dst;
         dst.handle_state(sf);
 
-        if (dst.str != src_state1.str || dst.data != src_state1.data || std::memcmp(&src_state1.blob, &dst.blob, sizeof(dst.blob)) || dst.num != src_state1.num)
+        if (dst.str != src_state1.str || dst.data != src_state1.data || std::memcmp(&src_state1.blob, &dst.blob, sizeof(dst.blob)) || dst.num != src_state1.num || dst.strs != src_state1.strs)
             throw std::runtime_error { "Test state 1 failed" };
     }
 
@@ -5,6 +5,8 @@
 #include <vector>
 #include <string>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include "ioutil.h"
 #include "disasm.h"
 #include "asm.h"
@@ -517,6 +519,37 @@ Foo:
     return true;
 }
 
+// Sources that must be rejected, checked by a substring of the error message
+bool asm_error_tests()
+{
+    const struct {
+        const char* text;
+        const char* error;
+    } test_cases[] = {
+        { "\tmove.l x, d0\n", "X referenced but not defined" },
+        { "\tbra.s x\nx:\n", "of out 8-bit range" },
+        { "\tbeq.s x\n\torg $2000\nx:\n", "of out 8-bit range" },
+        { "\tbra.w x\n\torg $100000\nx:\n", "of out 16-bit range" },
+        { "\tdbf d0, x\n\torg $100000\nx:\n", "of out 16-bit range" },
+    };
+
+    for (const auto& tc : test_cases) {
+        std::string error;
+        try {
+            assemble(0x1000, tc.text);
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        if (error.find(tc.error) == std::string::npos) {
+            std::cerr << "Error test failed for:\n" << tc.text << "\n";
+            std::cerr << "Expected error containing: \"" << tc.error << "\"\n";
+            std::cerr << "Got: \"" << error << "\"\n";
+            return false;
+        }
+    }
+    return true;
+}
+
 bool test_reglist_string()
 {
     const struct {
@@ -554,14 +587,86 @@ bool test_reglist_string()
     return true;
 }
 
-int main()
+// Generate a source with num_funcs functions using global and local labels,
+// forward and backward references, constants and data
+std::string make_bench_source(uint32_t num_funcs)
+{
+    std::string src;
+    src.reserve(num_funcs * 400);
+    for (uint32_t i = 0; i < num_funcs; ++i) {
+        const auto n = std::to_string(i);
+        const auto next = std::to_string((i + 1) % num_funcs);
+        const auto far = std::to_string((i * 7919) % num_funcs);
+        src += "CONST" + n + "\tEQU\t" + std::to_string(i & 0x7fff) + "\n";
+        src += "func" + n + ":\n";
+        src += "\tmovem.l\td2-d7/a2-a6,-(sp)\n";
+        src += "\tmove.w\t#CONST" + n + ",d0\n";
+        src += "\tmoveq\t#15,d1\n";
+        src += ".loop\n";
+        src += "\tadd.l\td0,d2\n";
+        src += "\tmove.l\t4(a0,d1.w),(a1)+\n";
+        src += "\tdbf\td1,.loop\n";
+        src += "\tlea\tdata" + n + "(pc),a0\n";
+        src += "\tcmp.l\t#func" + far + ",d2\n";
+        src += "\tbne.s\t.skip\n";
+        src += "\tjsr\tfunc" + next + "\n";
+        src += ".skip\tmovem.l\t(sp)+,d2-d7/a2-a6\n";
+        src += "\trts\n";
+        src += "data" + n + "\tdc.l\tfunc" + far + ",data" + next + "-func" + n + "\n";
+        src += "\tdc.w\t$1234,CONST" + n + "\n";
+    }
+    return src;
+}
+
+// Assemble generated sources of increasing size to check that the
+// assembler runs in time linear in the input size
+bool asm_benchmark(uint32_t megabytes)
+{
+    constexpr uint32_t start_pc = 0x10000;
+    // Start at roughly 1/4 of the requested size and double twice
+    const uint32_t base_funcs = std::max(1U, megabytes * (1 << 20) / 4 / static_cast<uint32_t>(make_bench_source(1).size()));
+    double last_rate = 0;
+    for (uint32_t num_funcs = base_funcs; num_funcs <= base_funcs * 4; num_funcs *= 2) {
+        const auto src = make_bench_source(num_funcs);
+        const auto start = std::chrono::steady_clock::now();
+        const auto code = assemble(start_pc, src.c_str());
+        const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double rate = src.size() / secs / (1 << 20);
+        std::cout << num_funcs << " functions: " << src.size() / 1024 << " KB source, " << code.size() / 1024 << " KB code in " << secs << " s (" << rate << " MB/s)";
+        if (last_rate)
+            std::cout << " " << rate / last_rate << "x previous rate";
+        std::cout << "\n";
+        last_rate = rate;
+
+        // Sanity check the result: the first function starts with the MOVEM
+        if (code.size() < 4 || get_u16(&code[0]) != 0x48e7) {
+            std::cerr << "Unexpected benchmark output\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
 {
     try {
+        if (argc > 1) {
+            if (!strcmp(argv[1], "-bench") && argc <= 3) {
+                const auto megabytes = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 4U;
+                return asm_benchmark(std::max(1U, megabytes)) ? 0 : 1;
+            }
+            std::cerr << "Usage: " << argv[0] << " [-bench [megabytes]]\n";
+            return 1;
+        }
+
         if (!test_reglist_string())
             return 1;
 
         if (!simple_asm_tests())
             return 1;
+
+        if (!asm_error_tests())
+            return 1;
         //const uint32_t start_pc = 0x1000;
         //auto code = assemble(start_pc, "\tMOVEQ #123, d3\nlabel MOVE #$42, 32766.W\n\tMOVE.B #42, d0\nMOVE.L d7, a2\n\tBRA.W label\nRTS\n");
         //disasm_code(std::cout, start_pc, code);